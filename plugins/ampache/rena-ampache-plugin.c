@@ -118,6 +118,9 @@ RENA_PLUGIN_REGISTER (RENA_TYPE_AMPACHE_PLUGIN,
 #define KEY_AMPACHE_USER   "username"
 #define KEY_AMPACHE_PASS   "password"
 
+/* Tracks saved between two refreshes of the interface. */
+#define AMPACHE_TRACKS_PER_BATCH 1024
+
 /*
  * Propotypes
  */
@@ -212,16 +215,28 @@ rena_ampache_raw_url_get_clean_url (const gchar *raw_uri)
 }
 
 static void
-rena_ampache_plugin_add_track_db (gpointer key,
-                                    gpointer value,
-                                    gpointer user_data)
+rena_ampache_plugin_add_tracks_db (GHashTable   *tracks_table,
+                                    RenaDatabase *database)
 {
-	RenaMusicobject *mobj = value;
-	RenaDatabase *database = user_data;
+	GHashTableIter iter;
+	GPtrArray *tracks;
+	gpointer value;
 
-	rena_database_add_new_musicobject (database, mobj);
+	tracks = g_ptr_array_sized_new (AMPACHE_TRACKS_PER_BATCH);
+	g_hash_table_iter_init (&iter, tracks_table);
+	while (g_hash_table_iter_next (&iter, NULL, &value)) {
+		g_ptr_array_add (tracks, value);
+		if (tracks->len < AMPACHE_TRACKS_PER_BATCH)
+			continue;
 
-	rena_process_gtk_events ();
+		rena_database_add_new_musicobjects (database, tracks);
+		g_ptr_array_set_size (tracks, 0);
+
+		rena_process_gtk_events ();
+	}
+
+	rena_database_add_new_musicobjects (database, tracks);
+	g_ptr_array_free (tracks, TRUE);
 }
 
 static void
@@ -495,7 +510,7 @@ rena_ampache_plugin_import_finished (RenaAmpachePlugin *plugin)
 
 	database = rena_database_get ();
 	provider = rena_database_provider_get ();
-	if (rena_database_find_provider (database, priv->server))
+	if (rena_provider_exist (provider, priv->server))
 	{
 		rena_provider_forget_songs (provider, priv->server);
 	}
@@ -511,9 +526,7 @@ rena_ampache_plugin_import_finished (RenaAmpachePlugin *plugin)
 
 	/* Insert songs and favorites */
 
-	g_hash_table_foreach (priv->tracks_table,
-	                      rena_ampache_plugin_add_track_db,
-	                      database);
+	rena_ampache_plugin_add_tracks_db (priv->tracks_table, database);
 
 	g_hash_table_foreach (priv->favorites_table,
 	                      rena_ampache_plugin_add_favorites,
@@ -777,7 +790,6 @@ rena_ampache_preferences_dialog_response (GtkDialog           *dialog,
                                             gint                 response_id,
                                             RenaAmpachePlugin *plugin)
 {
-	RenaDatabase *database;
 	RenaDatabaseProvider *provider;
 	RenaPreferences *preferences;
 	const gchar *entry_server = NULL, *entry_user = NULL, *entry_pass = NULL;
@@ -828,14 +840,12 @@ rena_ampache_preferences_dialog_response (GtkDialog           *dialog,
 
 				if (changed_server)
 				{
-					database = rena_database_get ();
-					if (rena_database_find_provider (database, test_server)) {
-						provider = rena_database_provider_get ();
+					provider = rena_database_provider_get ();
+					if (rena_provider_exist (provider, test_server)) {
 						rena_provider_remove (provider, test_server);
 						rena_provider_update_done (provider);
-						g_object_unref (provider);
 					}
-					g_object_unref (database);
+					g_object_unref (provider);
 				}
 
 				/* With all mandatory fields updates the collection.*/
@@ -332,7 +332,7 @@ rena_application_append_audio_cd (RenaCdromPlugin *plugin)
 	RenaDatabase *database;
 	RenaPlaylist *playlist;
 	RenaPreferences *preferences;
-	RenaMusicobject *mobj;
+	GPtrArray *tracks;
 	lba_t lba;
 	gint matches;
 	cdrom_drive_t *cdda_drive = NULL;
@@ -413,10 +413,11 @@ add:
 			rena_provider_set_visible (provider, priv->disc_id, TRUE);
 
 			database = rena_application_get_database (priv->rena);
-			for (l = list; l != NULL; l = l->next) {
-				mobj = l->data;
-				rena_database_add_new_musicobject (database, mobj);
-			}
+			tracks = g_ptr_array_new ();
+			for (l = list; l != NULL; l = l->next)
+				g_ptr_array_add (tracks, l->data);
+			rena_database_add_new_musicobjects (database, tracks);
+			g_ptr_array_free (tracks, TRUE);
 			rena_provider_update_done (provider);
 			g_object_unref (provider);
 		}
@@ -47,6 +47,7 @@
 #include "src/rena-musicobject-mgmt.h"
 #include "src/rena-playlist.h"
 #include "src/rena-database-provider.h"
+#include "src/rena-query-result.h"
 
 #include "plugins/rena-plugin-macros.h"
 
@@ -116,8 +117,12 @@ rena_dlna_plugin_share_library (RenaDlnaPlugin *plugin)
 {
 	RenaDatabase *cdbase;
 	RenaPreparedStatement *statement;
+	RenaQueryResult *result;
 	RenaMusicobject *mobj;
+	GPtrArray *mobjs;
+	GArray *loc_arr;
 	gint i = 0;
+	guint j, n_rows;
 
 	const gchar *sql = NULL;
 
@@ -135,17 +140,26 @@ rena_dlna_plugin_share_library (RenaDlnaPlugin *plugin)
 	cdbase = rena_application_get_database (priv->rena);
 	statement = rena_database_create_statement (cdbase, sql);
 	rena_prepared_statement_bind_string (statement, 1, "local");
+	result = rena_query_result_new (statement, "i");
+	rena_prepared_statement_free (statement);
+
+	n_rows = rena_query_result_get_n_rows (result);
+	loc_arr = g_array_sized_new (FALSE, FALSE, sizeof(gint), n_rows);
+	g_array_append_vals (loc_arr, rena_query_result_get_ints (result, 0), n_rows);
+	rena_query_result_free (result);
 
-	while (rena_prepared_statement_step (statement)) {
-		mobj = new_musicobject_from_db (cdbase,
-			rena_prepared_statement_get_int (statement, 0));
+	mobjs = new_musicobjects_from_db (cdbase, loc_arr);
+	for (j = 0; j < mobjs->len; j++) {
+		mobj = g_ptr_array_index (mobjs, j);
 		if (G_LIKELY(mobj)) {
 			rena_dlna_plugin_append_track (plugin, mobj, i++);
 			g_object_unref (mobj);
 		}
-		rena_process_gtk_events ();
+		if (j % 100 == 0)
+			rena_process_gtk_events ();
 	}
-	rena_prepared_statement_free (statement);
+	g_ptr_array_free (mobjs, TRUE);
+	g_array_free (loc_arr, TRUE);
 
 	remove_watch_cursor (rena_application_get_window(priv->rena));
 }
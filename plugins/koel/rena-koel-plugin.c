@@ -102,6 +102,9 @@ RENA_PLUGIN_REGISTER (RENA_TYPE_KOEL_PLUGIN,
 #define KEY_KOEL_USER   "username"
 #define KEY_KOEL_PASS   "password"
 
+/* Tracks saved between two refreshes of the interface. */
+#define KOEL_TRACKS_PER_BATCH 1024
+
 /*
  * Propotypes
  */
@@ -180,16 +183,28 @@ rena_koel_plugin_get_song_id (const gchar *server, const gchar *raw_uri)
 }
 
 static void
-rena_koel_plugin_add_track_db (gpointer key,
-                                    gpointer value,
-                                    gpointer user_data)
+rena_koel_plugin_add_tracks_db (GHashTable   *tracks_table,
+                                    RenaDatabase *database)
 {
-	RenaMusicobject *mobj = value;
-	RenaDatabase *database = user_data;
+	GHashTableIter iter;
+	GPtrArray *tracks;
+	gpointer value;
+
+	tracks = g_ptr_array_sized_new (KOEL_TRACKS_PER_BATCH);
+	g_hash_table_iter_init (&iter, tracks_table);
+	while (g_hash_table_iter_next (&iter, NULL, &value)) {
+		g_ptr_array_add (tracks, value);
+		if (tracks->len < KOEL_TRACKS_PER_BATCH)
+			continue;
+
+		rena_database_add_new_musicobjects (database, tracks);
+		g_ptr_array_set_size (tracks, 0);
 
-	rena_database_add_new_musicobject (database, mobj);
+		rena_process_gtk_events ();
+	}
 
-	rena_process_gtk_events ();
+	rena_database_add_new_musicobjects (database, tracks);
+	g_ptr_array_free (tracks, TRUE);
 }
 
 /*
@@ -211,9 +226,7 @@ rena_koel_save_cache (RenaKoelPlugin *plugin)
 	RenaKoelPluginPrivate *priv = plugin->priv;
 
 	database = rena_database_get ();
-	g_hash_table_foreach (priv->tracks_table,
-	                      rena_koel_plugin_add_track_db,
-	                      database);
+	rena_koel_plugin_add_tracks_db (priv->tracks_table, database);
 	g_object_unref (database);
 }
 
@@ -516,7 +529,7 @@ rena_koel_plugin_cache_provider_done (SoupSession *session,
 
 	database = rena_database_get ();
 	provider = rena_database_provider_get ();
-	if (rena_database_find_provider (database, priv->server))
+	if (rena_provider_exist (provider, priv->server))
 	{
 		rena_provider_forget_songs (provider, priv->server);
 	}
@@ -808,7 +821,6 @@ rena_koel_preferences_dialog_response (GtkDialog        *dialog,
                                          gint              response_id,
                                          RenaKoelPlugin *plugin)
 {
-	RenaDatabase *database;
 	RenaDatabaseProvider *provider;
 	RenaPreferences *preferences;
 	const gchar *entry_server = NULL, *entry_user = NULL, *entry_pass = NULL;
@@ -859,14 +871,12 @@ rena_koel_preferences_dialog_response (GtkDialog        *dialog,
 
 				if (changed_server)
 				{
-					database = rena_database_get ();
-					if (rena_database_find_provider (database, test_server)) {
-						provider = rena_database_provider_get ();
+					provider = rena_database_provider_get ();
+					if (rena_provider_exist (provider, test_server)) {
 						rena_provider_remove (provider, test_server);
 						rena_provider_update_done (provider);
-						g_object_unref (provider);
 					}
-					g_object_unref (database);
+					g_object_unref (provider);
 				}
 
 				/* With all mandatory fields updates the collection.*/
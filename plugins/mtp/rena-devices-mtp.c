@@ -333,6 +333,7 @@ rena_mtp_plugin_tracklist_loaded_idle (RenaMtpThreadTracklistData *data)
 	RenaDatabaseProvider *provider;
 	RenaAppNotification *notification;
 	RenaMusicobject *mobj;
+	GPtrArray *tracks;
 	GList *list, *l;
 
 	CDEBUG(DBG_PLUGIN, "Mtp plugin %s", G_STRFUNC);
@@ -350,7 +351,7 @@ rena_mtp_plugin_tracklist_loaded_idle (RenaMtpThreadTracklistData *data)
 
 	database = rena_database_get ();
 	provider = rena_database_provider_get ();
-	if (rena_database_find_provider (database, priv->device_id)) {
+	if (rena_provider_exist (provider, priv->device_id)) {
 		rena_provider_forget_songs (provider, priv->device_id);
 	}
 	else {
@@ -361,11 +362,14 @@ rena_mtp_plugin_tracklist_loaded_idle (RenaMtpThreadTracklistData *data)
 		                         "multimedia-player");
 	}
 
+	tracks = g_ptr_array_new ();
 	for (l = list; l != NULL; l = l->next) {
 		mobj = RENA_MUSICOBJECT(l->data);
 		if (G_LIKELY(mobj))
-			rena_database_add_new_musicobject (database, mobj);
+			g_ptr_array_add (tracks, mobj);
 	}
+	rena_database_add_new_musicobjects (database, tracks);
+	g_ptr_array_free (tracks, TRUE);
 
 	/* Inform to user */
 
@@ -0,0 +1,587 @@
+/*
+ * Copyright (C) 2024 Santelmo Technologies <santelmotechnologies@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "rena-database-maintenance.h"
+
+#include <sqlite3.h>
+
+#include "rena-preferences.h"
+#include "rena-simple-async.h"
+#include "rena-debug.h"
+
+/*
+ * Database maintenance.
+ *
+ * While the player is idle, the jobs run in low priority slices of the main
+ * loop. Each slice runs short steps until its time budget is spent, and the
+ * work left continues in the next slice, or the next time the player is idle.
+ * They also wait for the library scans, whose writes would keep the steps
+ * waiting on the busy timeout.
+ *
+ * The jobs that can't be split run in a thread. The integrity check uses a
+ * reader connection, which WAL keeps away from the writer, and the VACUUM
+ * that converts old databases a writer connection of its own. That one
+ * holds the write lock until it is done, so only small databases take it.
+ *
+ * Every job done is kept in MAINTENANCE_LOG, with its time and steps, and
+ * is not repeated before its interval.
+ */
+
+#define RENA_DATABASE_MAINTENANCE_DELAY        60  /* Seconds idle before the first slice */
+#define RENA_DATABASE_MAINTENANCE_SLICE_BUDGET (20 * G_TIME_SPAN_MILLISECOND)
+#define RENA_DATABASE_MAINTENANCE_VACUUM_PAGES 64
+#define RENA_DATABASE_MAINTENANCE_CONVERT_PAGES 4096 /* Copied well within the busy timeout */
+#define RENA_DATABASE_MAINTENANCE_ANALYSIS_LIMIT 1000
+#define RENA_DATABASE_MAINTENANCE_ANALYSIS_LIMIT_VERSION 3032000 /* SQLite 3.32 */
+#define RENA_DATABASE_MAINTENANCE_LOG_SIZE     256
+
+#define RENA_DATABASE_MAINTENANCE_DAY  (24 * 60 * 60)
+#define RENA_DATABASE_MAINTENANCE_WEEK (7 * RENA_DATABASE_MAINTENANCE_DAY)
+
+typedef enum {
+	MAINTENANCE_ANALYZE,
+	MAINTENANCE_VACUUM,
+	MAINTENANCE_INTEGRITY,
+	MAINTENANCE_DONE
+} RenaDatabaseMaintenanceJob;
+
+/* Tables analyzed one per step. */
+
+static const gchar *maintenance_tables[] = {
+	"TRACK",
+	"LOCATION",
+	"DIRECTORY",
+	"ARTIST",
+	"ALBUM",
+	"GENRE",
+	"YEAR",
+	"COMMENT",
+	"PLAYLIST_ENTRIES",
+	"PROVIDER"
+};
+
+struct _RenaDatabaseMaintenance {
+	RenaDatabase               *database;
+	RenaPreferences            *preferences;
+	gboolean                    idle;
+	gboolean                    running;
+	guint                       delay_id;
+	guint                       slice_id;
+
+	/* Current job, resumed on each slice. */
+	RenaDatabaseMaintenanceJob  job;
+	const gchar                *job_name;
+	guint                       steps;
+	gint64                      duration;
+	gint64                      longest;
+
+	/* Job running in a thread. */
+	gboolean                    threaded;
+	gboolean                    disposed;
+};
+
+typedef struct {
+	RenaDatabaseMaintenance *maintenance;
+	gchar                   *result;
+	gint64                   duration;
+} RenaDatabaseMaintenanceTask;
+
+static void
+rena_database_maintenance_schedule_slice (RenaDatabaseMaintenance *maintenance);
+
+
+/*
+ * Helpers.
+ */
+
+static gint
+rena_database_maintenance_get_int (RenaDatabaseMaintenance *maintenance, const gchar *sql)
+{
+	RenaPreparedStatement *statement;
+	gint value = 0;
+
+	statement = rena_database_create_statement (maintenance->database, sql);
+	if (rena_prepared_statement_step (statement))
+		value = rena_prepared_statement_get_int (statement, 0);
+	rena_prepared_statement_free (statement);
+
+	return value;
+}
+
+/* Seconds since the last time that the job was logged. */
+
+static gint64
+rena_database_maintenance_get_elapsed (RenaDatabaseMaintenance *maintenance, const gchar *job_name)
+{
+	RenaPreparedStatement *statement;
+	gint64 last = 0;
+
+	const gchar *sql = "SELECT MAX(time) FROM MAINTENANCE_LOG WHERE job = ?";
+	statement = rena_database_create_statement (maintenance->database, sql);
+	rena_prepared_statement_bind_string (statement, 1, job_name);
+	if (rena_prepared_statement_step (statement))
+		last = rena_prepared_statement_get_int64 (statement, 0);
+	rena_prepared_statement_free (statement);
+
+	return g_get_real_time () / G_USEC_PER_SEC - last;
+}
+
+static void
+rena_database_maintenance_log (RenaDatabaseMaintenance *maintenance,
+                               const gchar             *job_name,
+                               guint                    steps,
+                               gint64                   duration,
+                               gint64                   longest,
+                               const gchar             *result)
+{
+	RenaPreparedStatement *statement;
+
+	CDEBUG(DBG_DB, "Maintenance %s: %s, %u steps in %.1f ms, longest %.1f ms",
+	       job_name, result, steps, duration / 1000.0, longest / 1000.0);
+
+	const gchar *sql = "INSERT INTO MAINTENANCE_LOG (time, job, steps, duration, longest, result) VALUES (?, ?, ?, ?, ?, ?)";
+	statement = rena_database_create_statement (maintenance->database, sql);
+	rena_prepared_statement_bind_int64 (statement, 1, g_get_real_time () / G_USEC_PER_SEC);
+	rena_prepared_statement_bind_string (statement, 2, job_name);
+	rena_prepared_statement_bind_int (statement, 3, steps);
+	rena_prepared_statement_bind_int (statement, 4, MIN (duration, G_MAXINT));
+	rena_prepared_statement_bind_int (statement, 5, MIN (longest, G_MAXINT));
+	rena_prepared_statement_bind_string (statement, 6, result);
+	rena_prepared_statement_step (statement);
+	rena_prepared_statement_free (statement);
+
+	/* Keep only the last entries. */
+	rena_database_exec_query (maintenance->database,
+		"DELETE FROM MAINTENANCE_LOG WHERE rowid <= (SELECT MAX(rowid) FROM MAINTENANCE_LOG) - "
+		G_STRINGIFY (RENA_DATABASE_MAINTENANCE_LOG_SIZE));
+}
+
+static void
+rena_database_maintenance_next_job (RenaDatabaseMaintenance *maintenance, const gchar *result)
+{
+	if (maintenance->job_name && result)
+		rena_database_maintenance_log (maintenance, maintenance->job_name,
+		                               maintenance->steps, maintenance->duration,
+		                               maintenance->longest, result);
+
+	maintenance->job++;
+	maintenance->job_name = NULL;
+	maintenance->steps = 0;
+	maintenance->duration = 0;
+	maintenance->longest = 0;
+}
+
+
+/*
+ * Jobs in a thread.
+ */
+
+static gpointer
+rena_database_maintenance_check_worker (gpointer data)
+{
+	RenaDatabaseMaintenanceTask *check = data;
+	RenaDatabaseReader *reader;
+	RenaPreparedStatement *statement;
+	GString *result;
+	gint64 begin_time;
+
+	begin_time = g_get_monotonic_time ();
+
+	reader = rena_database_reader_acquire (check->maintenance->database);
+	if (reader == NULL) {
+		check->result = g_strdup ("failed");
+		return check;
+	}
+
+	/* Returns a single "ok", or the list of errors found. */
+	result = g_string_new (NULL);
+	statement = rena_database_reader_create_statement (reader, "PRAGMA quick_check");
+	while (statement && rena_prepared_statement_step (statement)) {
+		if (result->len)
+			g_string_append (result, "; ");
+		g_string_append (result, rena_prepared_statement_get_string (statement, 0));
+	}
+	if (statement)
+		rena_prepared_statement_free (statement);
+
+	rena_database_reader_release (check->maintenance->database, reader);
+
+	if (result->len == 0)
+		g_string_append (result, "failed");
+
+	check->result = g_string_free (result, FALSE);
+	check->duration = g_get_monotonic_time () - begin_time;
+
+	return check;
+}
+
+static gpointer
+rena_database_maintenance_convert_worker (gpointer data)
+{
+	RenaDatabaseMaintenanceTask *task = data;
+	RenaDatabase *writer;
+	gboolean success = FALSE;
+	gint64 begin_time;
+
+	begin_time = g_get_monotonic_time ();
+
+	/* The new page layout only applies with a VACUUM of the same
+	 * connection. The writes of the main one wait on the busy timeout
+	 * meanwhile, which the size limit of the job keeps it under. */
+	writer = rena_database_new_writer ();
+	if (rena_database_start_successfully (writer)) {
+		success = rena_database_exec_query (writer, "PRAGMA auto_vacuum=INCREMENTAL") &&
+		          rena_database_exec_query (writer, "VACUUM");
+	}
+	g_object_unref (writer);
+
+	task->result = g_strdup (success ? "ok" : "failed");
+	task->duration = g_get_monotonic_time () - begin_time;
+
+	return task;
+}
+
+static gboolean
+rena_database_maintenance_task_finished (gpointer data)
+{
+	RenaDatabaseMaintenanceTask *task = data;
+	RenaDatabaseMaintenance *maintenance = task->maintenance;
+
+	maintenance->threaded = FALSE;
+
+	if (maintenance->disposed) {
+		rena_database_maintenance_free (maintenance);
+	}
+	else {
+		if (maintenance->job == MAINTENANCE_INTEGRITY && g_strcmp0 (task->result, "ok") != 0)
+			g_critical ("Database integrity check failed: %s", task->result);
+
+		maintenance->steps = 1;
+		maintenance->duration = task->duration;
+		maintenance->longest = task->duration;
+		rena_database_maintenance_next_job (maintenance, task->result);
+
+		rena_database_maintenance_schedule_slice (maintenance);
+	}
+
+	g_free (task->result);
+	g_slice_free (RenaDatabaseMaintenanceTask, task);
+
+	return FALSE;
+}
+
+/* Runs the current job in a thread, and logs it when the thread returns. */
+
+static void
+rena_database_maintenance_launch (RenaDatabaseMaintenance *maintenance, GThreadFunc worker)
+{
+	RenaDatabaseMaintenanceTask *task;
+
+	maintenance->threaded = TRUE;
+
+	task = g_slice_new0 (RenaDatabaseMaintenanceTask);
+	task->maintenance = maintenance;
+
+	rena_async_launch (worker, rena_database_maintenance_task_finished, task);
+}
+
+
+/*
+ * Jobs.
+ *
+ * Each call runs one step of the job, and returns the result to log once
+ * it is done, or NULL while it has more steps. Jobs not due return without
+ * naming the job, and are not logged.
+ */
+
+#define MAINTENANCE_SKIPPED "skipped"
+
+static const gchar *
+rena_database_maintenance_analyze (RenaDatabaseMaintenance *maintenance)
+{
+	gboolean has_stats, success;
+	gchar *query;
+
+	if (maintenance->job_name == NULL) {
+		has_stats = rena_database_maintenance_get_int (maintenance,
+			"SELECT COUNT() FROM sqlite_master WHERE name = 'sqlite_stat1'") > 0;
+
+		/* Sampled, so every table takes a short step. The SQLite versions
+		 * before analysis_limit can't sample, and keep to the optimize. */
+		if (sqlite3_libversion_number () >= RENA_DATABASE_MAINTENANCE_ANALYSIS_LIMIT_VERSION &&
+		    (!has_stats ||
+		     rena_database_maintenance_get_elapsed (maintenance, "analyze") > RENA_DATABASE_MAINTENANCE_WEEK)) {
+			rena_database_exec_query (maintenance->database,
+				"PRAGMA analysis_limit=" G_STRINGIFY (RENA_DATABASE_MAINTENANCE_ANALYSIS_LIMIT));
+			maintenance->job_name = "analyze";
+		}
+		else if (rena_database_maintenance_get_elapsed (maintenance, "optimize") > RENA_DATABASE_MAINTENANCE_DAY) {
+			maintenance->job_name = "optimize";
+		}
+		else {
+			return MAINTENANCE_SKIPPED;
+		}
+	}
+
+	/* Only analyzes the tables whose stats are out of date. */
+	if (g_strcmp0 (maintenance->job_name, "optimize") == 0)
+		return rena_database_exec_query (maintenance->database, "PRAGMA optimize") ? "ok" : "failed";
+
+	query = g_strdup_printf ("ANALYZE %s", maintenance_tables[maintenance->steps]);
+	success = rena_database_exec_query (maintenance->database, query);
+	g_free (query);
+
+	if (!success)
+		return "failed";
+	if (maintenance->steps + 1 == G_N_ELEMENTS(maintenance_tables))
+		return "ok";
+
+	return NULL;
+}
+
+static const gchar *
+rena_database_maintenance_vacuum (RenaDatabaseMaintenance *maintenance)
+{
+	gint auto_vacuum, free_pages, pages;
+
+	free_pages = rena_database_maintenance_get_int (maintenance, "PRAGMA freelist_count");
+
+	if (maintenance->job_name == NULL) {
+		auto_vacuum = rena_database_maintenance_get_int (maintenance, "PRAGMA auto_vacuum");
+		pages = rena_database_maintenance_get_int (maintenance, "PRAGMA page_count");
+
+		if (auto_vacuum == 2 && free_pages > 0) {
+			maintenance->job_name = "vacuum";
+		}
+		else if (auto_vacuum == 0 && free_pages > 0 && free_pages >= pages / 4 &&
+		         pages <= RENA_DATABASE_MAINTENANCE_CONVERT_PAGES) {
+			/* Databases created before incremental vacuum need a full one
+			 * to switch to it. Only once, and only when worth it. Larger
+			 * ones would block the writes of the player for too long, and
+			 * keep their layout. */
+			maintenance->job_name = "convert";
+			rena_database_maintenance_launch (maintenance,
+			                                  rena_database_maintenance_convert_worker);
+			return NULL;
+		}
+		else {
+			return MAINTENANCE_SKIPPED;
+		}
+	}
+
+	if (free_pages == 0)
+		return "ok";
+
+	if (!rena_database_exec_query (maintenance->database,
+		"PRAGMA incremental_vacuum(" G_STRINGIFY (RENA_DATABASE_MAINTENANCE_VACUUM_PAGES) ")"))
+		return "failed";
+
+	return NULL;
+}
+
+static const gchar *
+rena_database_maintenance_integrity (RenaDatabaseMaintenance *maintenance)
+{
+	if (rena_database_maintenance_get_elapsed (maintenance, "integrity") < RENA_DATABASE_MAINTENANCE_WEEK)
+		return MAINTENANCE_SKIPPED;
+
+	maintenance->job_name = "integrity";
+	rena_database_maintenance_launch (maintenance,
+	                                  rena_database_maintenance_check_worker);
+
+	return NULL;
+}
+
+
+/*
+ * Scheduling.
+ */
+
+static gboolean
+rena_database_maintenance_slice (gpointer user_data)
+{
+	RenaDatabaseMaintenance *maintenance = user_data;
+	const gchar *result = NULL;
+	gint64 step_time, deadline;
+
+	deadline = g_get_monotonic_time () + RENA_DATABASE_MAINTENANCE_SLICE_BUDGET;
+
+	do {
+		step_time = g_get_monotonic_time ();
+
+		switch (maintenance->job) {
+			case MAINTENANCE_ANALYZE:
+				result = rena_database_maintenance_analyze (maintenance);
+				break;
+			case MAINTENANCE_VACUUM:
+				result = rena_database_maintenance_vacuum (maintenance);
+				break;
+			case MAINTENANCE_INTEGRITY:
+				result = rena_database_maintenance_integrity (maintenance);
+				break;
+			case MAINTENANCE_DONE:
+			default:
+				break;
+		}
+
+		if (maintenance->threaded)
+			break;
+
+		if (maintenance->job_name) {
+			step_time = g_get_monotonic_time () - step_time;
+			maintenance->steps++;
+			maintenance->duration += step_time;
+			maintenance->longest = MAX (maintenance->longest, step_time);
+		}
+
+		if (result)
+			rena_database_maintenance_next_job (maintenance, result);
+	} while (maintenance->job != MAINTENANCE_DONE &&
+	         !maintenance->threaded &&
+	         g_get_monotonic_time () < deadline);
+
+	if (maintenance->job != MAINTENANCE_DONE && !maintenance->threaded)
+		return G_SOURCE_CONTINUE;
+
+	maintenance->slice_id = 0;
+
+	return G_SOURCE_REMOVE;
+}
+
+static void
+rena_database_maintenance_schedule_slice (RenaDatabaseMaintenance *maintenance)
+{
+	if (!maintenance->running || maintenance->threaded || maintenance->slice_id)
+		return;
+	if (maintenance->job == MAINTENANCE_DONE)
+		return;
+
+	maintenance->slice_id = g_idle_add_full (G_PRIORITY_LOW,
+	                                         rena_database_maintenance_slice,
+	                                         maintenance,
+	                                         NULL);
+}
+
+static gboolean
+rena_database_maintenance_delay_done (gpointer user_data)
+{
+	RenaDatabaseMaintenance *maintenance = user_data;
+
+	maintenance->delay_id = 0;
+
+	/* A new pass, the jobs skip what is not due. */
+	if (maintenance->job == MAINTENANCE_DONE)
+		maintenance->job = MAINTENANCE_ANALYZE;
+
+	rena_database_maintenance_schedule_slice (maintenance);
+
+	return G_SOURCE_REMOVE;
+}
+
+static void
+rena_database_maintenance_pause (RenaDatabaseMaintenance *maintenance)
+{
+	if (maintenance->delay_id) {
+		g_source_remove (maintenance->delay_id);
+		maintenance->delay_id = 0;
+	}
+	if (maintenance->slice_id) {
+		g_source_remove (maintenance->slice_id);
+		maintenance->slice_id = 0;
+	}
+}
+
+static void
+rena_database_maintenance_update (RenaDatabaseMaintenance *maintenance)
+{
+	gboolean running;
+
+	running = maintenance->idle &&
+	          !rena_preferences_get_lock_library (maintenance->preferences);
+	if (maintenance->running == running)
+		return;
+
+	maintenance->running = running;
+
+	rena_database_maintenance_pause (maintenance);
+
+	if (running) {
+		maintenance->delay_id = g_timeout_add_seconds (RENA_DATABASE_MAINTENANCE_DELAY,
+		                                               rena_database_maintenance_delay_done,
+		                                               maintenance);
+	}
+}
+
+static void
+rena_database_maintenance_lock_library_changed (RenaPreferences         *preferences,
+                                                GParamSpec              *pspec,
+                                                RenaDatabaseMaintenance *maintenance)
+{
+	rena_database_maintenance_update (maintenance);
+}
+
+/**
+ * rena_database_maintenance_set_idle:
+ *
+ * Tells if the player is idle. The jobs start a while after it becomes
+ * idle and no scan is running, and stop, keeping their progress, as soon
+ * as it is not.
+ */
+void
+rena_database_maintenance_set_idle (RenaDatabaseMaintenance *maintenance, gboolean idle)
+{
+	maintenance->idle = idle;
+
+	rena_database_maintenance_update (maintenance);
+}
+
+RenaDatabaseMaintenance *
+rena_database_maintenance_new (RenaDatabase *database)
+{
+	RenaDatabaseMaintenance *maintenance;
+
+	maintenance = g_slice_new0 (RenaDatabaseMaintenance);
+	maintenance->database = g_object_ref (database);
+	maintenance->preferences = rena_preferences_get ();
+	maintenance->job = MAINTENANCE_DONE;
+
+	g_signal_connect (maintenance->preferences, "notify::lock-library",
+	                  G_CALLBACK (rena_database_maintenance_lock_library_changed), maintenance);
+
+	return maintenance;
+}
+
+void
+rena_database_maintenance_free (RenaDatabaseMaintenance *maintenance)
+{
+	rena_database_maintenance_pause (maintenance);
+
+	if (maintenance->preferences) {
+		g_signal_handlers_disconnect_by_data (maintenance->preferences, maintenance);
+		g_object_unref (maintenance->preferences);
+		maintenance->preferences = NULL;
+	}
+
+	/* Freed when the thread returns. */
+	if (maintenance->threaded) {
+		maintenance->disposed = TRUE;
+		return;
+	}
+
+	g_object_unref (maintenance->database);
+	g_slice_free (RenaDatabaseMaintenance, maintenance);
+}
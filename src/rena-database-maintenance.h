@@ -0,0 +1,40 @@
+/*
+ * Copyright (C) 2024 Santelmo Technologies <santelmotechnologies@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef RENA_DATABASE_MAINTENANCE_H
+#define RENA_DATABASE_MAINTENANCE_H
+
+#include <glib.h>
+
+#include "rena-database.h"
+
+G_BEGIN_DECLS
+
+typedef struct _RenaDatabaseMaintenance RenaDatabaseMaintenance;
+
+RenaDatabaseMaintenance *
+rena_database_maintenance_new      (RenaDatabase *database);
+
+void
+rena_database_maintenance_set_idle (RenaDatabaseMaintenance *maintenance, gboolean idle);
+
+void
+rena_database_maintenance_free     (RenaDatabaseMaintenance *maintenance);
+
+G_END_DECLS
+
+#endif /* RENA_DATABASE_MAINTENANCE_H */
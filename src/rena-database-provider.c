@@ -21,9 +21,28 @@
 
 #include "rena-database-provider.h"
 
+/* Cached row of the PROVIDER table. */
+
+typedef struct {
+	gint      id;
+	gchar    *name;
+	gchar    *kind;
+	gchar    *friendly_name;
+	gchar    *icon_name;
+	gboolean  visible;
+	gboolean  ignore;
+} RenaDatabaseProviderEntry;
+
 struct _RenaDatabaseProviderPrivate
 {
 	RenaDatabase *database;
+
+	/* Registry of providers, loaded once and kept in sync with every write. */
+	GPtrArray    *entries;
+	GHashTable   *entries_by_name;
+
+	/* Set when a write of the current savepoint fails. */
+	gboolean      failed;
 };
 
 G_DEFINE_TYPE_WITH_PRIVATE(RenaDatabaseProvider, rena_database_provider, G_TYPE_OBJECT)
@@ -33,14 +52,142 @@ enum {
 	SIGNAL_WANT_UPGRADE,
 	SIGNAL_WANT_REMOVE,
 	SIGNAL_UPDATE_DONE,
+	SIGNAL_PROVIDER_ADDED,
+	SIGNAL_PROVIDER_REMOVED,
+	SIGNAL_PROVIDER_TOGGLED,
 	LAST_SIGNAL
 };
 
 static int signals[LAST_SIGNAL] = { 0 };
 
-gchar *
-rena_database_provider_get_kind_from_id (RenaDatabaseProvider *database_provider,
-                                           gint                    kind_id);
+
+/*
+ * Registry.
+ */
+
+static void
+rena_database_provider_entry_free (RenaDatabaseProviderEntry *entry)
+{
+	g_free (entry->name);
+	g_free (entry->kind);
+	g_free (entry->friendly_name);
+	g_free (entry->icon_name);
+	g_slice_free (RenaDatabaseProviderEntry, entry);
+}
+
+static void
+rena_database_provider_load_registry (RenaDatabaseProvider *provider)
+{
+	RenaPreparedStatement *statement;
+	RenaDatabaseProviderEntry *entry;
+
+	RenaDatabaseProviderPrivate *priv = provider->priv;
+
+	const gchar *sql = "SELECT PROVIDER.id, PROVIDER.name, PROVIDER_TYPE.name, PROVIDER.friendly_name, PROVIDER.icon_name, PROVIDER.visible, PROVIDER.ignore "
+	                   "FROM PROVIDER LEFT JOIN PROVIDER_TYPE ON PROVIDER_TYPE.id = PROVIDER.type "
+	                   "ORDER BY PROVIDER.id";
+
+	g_hash_table_remove_all (priv->entries_by_name);
+	g_ptr_array_set_size (priv->entries, 0);
+
+	statement = rena_database_create_statement (priv->database, sql);
+	while (rena_prepared_statement_step (statement)) {
+		entry = g_slice_new0 (RenaDatabaseProviderEntry);
+		entry->id            = rena_prepared_statement_get_int (statement, 0);
+		entry->name          = g_strdup (rena_prepared_statement_get_string (statement, 1));
+		entry->kind          = g_strdup (rena_prepared_statement_get_string (statement, 2));
+		entry->friendly_name = g_strdup (rena_prepared_statement_get_string (statement, 3));
+		entry->icon_name     = g_strdup (rena_prepared_statement_get_string (statement, 4));
+		entry->visible       = rena_prepared_statement_get_int (statement, 5) != 0;
+		entry->ignore        = rena_prepared_statement_get_int (statement, 6) != 0;
+
+		g_ptr_array_add (priv->entries, entry);
+		g_hash_table_insert (priv->entries_by_name, entry->name, entry);
+	}
+	rena_prepared_statement_free (statement);
+}
+
+static RenaDatabaseProviderEntry *
+rena_database_provider_lookup (RenaDatabaseProvider *provider, const gchar *name)
+{
+	if (name == NULL)
+		return NULL;
+
+	return g_hash_table_lookup (provider->priv->entries_by_name, name);
+}
+
+/*
+ * Writes run in a savepoint, so they also work within the transactions of
+ * the callers. The registry only changes once the savepoint is released;
+ * if any statement of the savepoint failed, it is rolled back instead and
+ * the registry reloaded from the tables.
+ */
+
+static void
+rena_database_provider_begin (RenaDatabaseProvider *provider)
+{
+	RenaDatabaseProviderPrivate *priv = provider->priv;
+
+	priv->failed = !rena_database_exec_query (priv->database, "SAVEPOINT provider_registry");
+}
+
+static void
+rena_database_provider_run (RenaDatabaseProvider *provider, RenaPreparedStatement *statement)
+{
+	if (!rena_prepared_statement_run (statement))
+		provider->priv->failed = TRUE;
+	rena_prepared_statement_free (statement);
+}
+
+static gboolean
+rena_database_provider_commit (RenaDatabaseProvider *provider)
+{
+	RenaDatabaseProviderPrivate *priv = provider->priv;
+
+	if (!priv->failed &&
+	    rena_database_exec_query (priv->database, "RELEASE provider_registry"))
+		return TRUE;
+
+	rena_database_exec_query (priv->database, "ROLLBACK TO provider_registry");
+	rena_database_exec_query (priv->database, "RELEASE provider_registry");
+
+	rena_database_provider_load_registry (provider);
+
+	return FALSE;
+}
+
+static GSList *
+rena_database_provider_get_names (RenaDatabaseProvider *provider,
+                                  gboolean (*filter) (RenaDatabaseProviderEntry *entry, gconstpointer data),
+                                  gconstpointer data)
+{
+	RenaDatabaseProviderEntry *entry;
+	GSList *list = NULL;
+	guint i;
+
+	RenaDatabaseProviderPrivate *priv = provider->priv;
+
+	for (i = 0; i < priv->entries->len; i++) {
+		entry = g_ptr_array_index (priv->entries, i);
+		if (filter && !filter (entry, data))
+			continue;
+		list = g_slist_prepend (list, g_strdup(entry->name));
+	}
+
+	return g_slist_reverse (list);
+}
+
+static gboolean
+rena_database_provider_filter_visible (RenaDatabaseProviderEntry *entry, gconstpointer data)
+{
+	return entry->visible == GPOINTER_TO_INT(data);
+}
+
+static gboolean
+rena_database_provider_filter_kind (RenaDatabaseProviderEntry *entry, gconstpointer data)
+{
+	return !entry->ignore && g_strcmp0 (entry->kind, data) == 0;
+}
 
 
 /* Provider */
@@ -52,15 +199,23 @@ rena_provider_add_new (RenaDatabaseProvider *provider,
                          const gchar            *friendly_name,
                          const gchar            *icon_name)
 {
-	gint provider_type_id = 0;
+	gint provider_type_id = 0, provider_id = 0;
 	RenaPreparedStatement *statement;
+	RenaDatabaseProviderEntry *entry;
 
 	RenaDatabaseProviderPrivate *priv = provider->priv;
 
 	const gchar *sql = "INSERT INTO PROVIDER (name, type, friendly_name, icon_name, visible, ignore) VALUES (?, ?, ?, ?, ?, ?)";
 
+	if (rena_database_provider_lookup (provider, name))
+		return;
+
+	rena_database_provider_begin (provider);
+
 	if ((provider_type_id = rena_database_find_provider_type (priv->database, type)) == 0)
 		provider_type_id = rena_database_add_new_provider_type (priv->database, type);
+	if (provider_type_id == 0)
+		priv->failed = TRUE;
 
 	statement = rena_database_create_statement (priv->database, sql);
 	rena_prepared_statement_bind_string (statement, 1, name);
@@ -69,8 +224,26 @@ rena_provider_add_new (RenaDatabaseProvider *provider,
 	rena_prepared_statement_bind_string (statement, 4, icon_name);
 	rena_prepared_statement_bind_int    (statement, 5, 0);  // No visible by default.
 	rena_prepared_statement_bind_int    (statement, 6, 0);  // No ignore by default.
-	rena_prepared_statement_step (statement);
+	if (rena_prepared_statement_run (statement))
+		provider_id = (gint) rena_prepared_statement_get_last_insert_id (statement);
+	else
+		priv->failed = TRUE;
 	rena_prepared_statement_free (statement);
+
+	if (!rena_database_provider_commit (provider))
+		return;
+
+	entry = g_slice_new0 (RenaDatabaseProviderEntry);
+	entry->id            = provider_id;
+	entry->name          = g_strdup (name);
+	entry->kind          = g_strdup (type);
+	entry->friendly_name = g_strdup (friendly_name);
+	entry->icon_name     = g_strdup (icon_name);
+
+	g_ptr_array_add (priv->entries, entry);
+	g_hash_table_insert (priv->entries_by_name, entry->name, entry);
+
+	g_signal_emit (provider, signals[SIGNAL_PROVIDER_ADDED], 0, name);
 }
 
 void
@@ -81,58 +254,66 @@ rena_provider_remove (RenaDatabaseProvider *provider,
 	gint provider_id = 0;
 	const gchar *sql;
 
+	RenaDatabaseProviderEntry *entry;
+	gchar *provider_name;
+
 	RenaDatabaseProviderPrivate *priv = provider->priv;
 
-	if ((provider_id = rena_database_find_provider (priv->database, name)) == 0)
+	if ((entry = rena_database_provider_lookup (provider, name)) == NULL)
 		return;
 
-	/* Delete all entries from PLAYLIST_TRACKS which match provider */
+	provider_id = entry->id;
+
+	rena_database_provider_begin (provider);
 
-	sql = "DELETE FROM PLAYLIST_TRACKS WHERE file IN (SELECT name FROM location WHERE id IN (SELECT location FROM TRACK WHERE provider = ?))";
+	/* Delete all playlist entries which match provider */
+
+	sql = "DELETE FROM PLAYLIST_ENTRIES WHERE location IN (SELECT location FROM TRACK WHERE provider = ?)";
 	statement = rena_database_create_statement (priv->database, sql);
 	rena_prepared_statement_bind_int (statement, 1, provider_id);
-	rena_prepared_statement_step (statement);
-	rena_prepared_statement_free (statement);
+	rena_database_provider_run (provider, statement);
 
 	/* Delete all tracks of provider */
 
 	sql = "DELETE FROM TRACK WHERE provider = ?";
 	statement = rena_database_create_statement (priv->database, sql);
 	rena_prepared_statement_bind_int (statement, 1, provider_id);
-	rena_prepared_statement_step (statement);
-	rena_prepared_statement_free (statement);
+	rena_database_provider_run (provider, statement);
 
 	/* Delete the location entries */
 
-	sql = "DELETE FROM LOCATION WHERE id NOT IN (SELECT location FROM TRACK)";
+	sql = "DELETE FROM LOCATION WHERE refs = 0";
 	statement = rena_database_create_statement (priv->database, sql);
-	rena_prepared_statement_step (statement);
-	rena_prepared_statement_free (statement);
+	rena_database_provider_run (provider, statement);
 
 	/* Delete Provider */
 
 	sql = "DELETE FROM PROVIDER WHERE id = ?";
 	statement = rena_database_create_statement (priv->database, sql);
 	rena_prepared_statement_bind_int (statement, 1, provider_id);
-	rena_prepared_statement_step (statement);
-	rena_prepared_statement_free (statement);
+	rena_database_provider_run (provider, statement);
 
 	/* Now flush unused artists, albums, genres, years */
 
 	rena_database_flush_stale_entries (priv->database);
+
+	if (!rena_database_provider_commit (provider))
+		return;
+
+	provider_name = g_strdup (name);
+
+	g_hash_table_remove (priv->entries_by_name, entry->name);
+	g_ptr_array_remove (priv->entries, entry);
+
+	g_signal_emit (provider, signals[SIGNAL_PROVIDER_REMOVED], 0, provider_name);
+	g_free (provider_name);
 }
 
 gboolean
 rena_provider_exist (RenaDatabaseProvider *provider,
                        const gchar            *name)
 {
-	gint provider_id = 0;
-
-	RenaDatabaseProviderPrivate *priv = provider->priv;
-
-	provider_id = rena_database_find_provider (priv->database, name);
-
-	return (provider_id != 0);
+	return rena_database_provider_lookup (provider, name) != NULL;
 }
 
 void
@@ -143,80 +324,50 @@ rena_provider_forget_songs (RenaDatabaseProvider *provider,
 	gint provider_id = 0;
 	const gchar *sql;
 
+	RenaDatabaseProviderEntry *entry;
+
 	RenaDatabaseProviderPrivate *priv = provider->priv;
 
-	if ((provider_id = rena_database_find_provider (priv->database, name)) == 0)
+	if ((entry = rena_database_provider_lookup (provider, name)) == NULL)
 		return;
 
+	provider_id = entry->id;
+
+	rena_database_provider_begin (provider);
+
 	/* Delete all tracks of provider */
 
 	sql = "DELETE FROM TRACK WHERE provider = ?";
 	statement = rena_database_create_statement (priv->database, sql);
 	rena_prepared_statement_bind_int (statement, 1, provider_id);
-	rena_prepared_statement_step (statement);
-	rena_prepared_statement_free (statement);
-
-	/* Delete the location entries */
+	rena_database_provider_run (provider, statement);
 
-	sql = "DELETE FROM LOCATION WHERE id NOT IN (SELECT location FROM TRACK)";
-	statement = rena_database_create_statement (priv->database, sql);
-	rena_prepared_statement_step (statement);
-	rena_prepared_statement_free (statement);
+	/* Delete the location entries. Their playlist entries keep the uri,
+	 * so playlists survive the songs being imported again. */
 
-	/* Delete all entries from PLAYLIST_TRACKS which match given dir */
-
-	sql = "DELETE FROM PLAYLIST_TRACKS WHERE file NOT IN (SELECT name FROM LOCATION)";
+	sql = "DELETE FROM LOCATION WHERE refs = 0";
 	statement = rena_database_create_statement (priv->database, sql);
-	rena_prepared_statement_step (statement);
-	rena_prepared_statement_free (statement);
+	rena_database_provider_run (provider, statement);
 
 	/* Now flush unused artists, albums, genres, years */
 
 	rena_database_flush_stale_entries (priv->database);
+
+	rena_database_provider_commit (provider);
 }
 
 GSList *
 rena_provider_get_list (RenaDatabaseProvider *provider)
 {
-	RenaPreparedStatement *statement;
-	GSList *list = NULL;
-
-	RenaDatabaseProviderPrivate *priv = provider->priv;
-
-	const gchar *sql = "SELECT name FROM PROVIDER";
-
-	statement = rena_database_create_statement (priv->database, sql);
-	while (rena_prepared_statement_step (statement)) {
-		const gchar *name = rena_prepared_statement_get_string (statement, 0);
-		list = g_slist_append (list, g_strdup(name));
-	}
-
-	rena_prepared_statement_free (statement);
-
-	return list;
+	return rena_database_provider_get_names (provider, NULL, NULL);
 }
 
 GSList *
 rena_provider_get_visible_list (RenaDatabaseProvider *provider, gboolean visibles)
 {
-	RenaPreparedStatement *statement;
-	GSList *list = NULL;
-
-	RenaDatabaseProviderPrivate *priv = provider->priv;
-
-	const gchar *sql = "SELECT name FROM PROVIDER WHERE visible = ?";
-
-	statement = rena_database_create_statement (priv->database, sql);
-	rena_prepared_statement_bind_int (statement, 1,
-	                                    visibles ? 1 : 0);
-	while (rena_prepared_statement_step (statement)) {
-		const gchar *name = rena_prepared_statement_get_string (statement, 0);
-		list = g_slist_append (list, g_strdup(name));
-	}
-
-	rena_prepared_statement_free (statement);
-
-	return list;
+	return rena_database_provider_get_names (provider,
+	                                         rena_database_provider_filter_visible,
+	                                         GINT_TO_POINTER(visibles ? TRUE : FALSE));
 }
 
 GSList *
@@ -244,26 +395,9 @@ GSList *
 rena_database_provider_get_list_by_type (RenaDatabaseProvider *provider,
                                            const gchar            *provider_type)
 {
-	RenaPreparedStatement *statement;
-	GSList *list = NULL;
-
-	RenaDatabaseProviderPrivate *priv = provider->priv;
-
-	const gchar *sql = "SELECT name FROM PROVIDER WHERE type = ? AND ignore = ?";
-
-	statement = rena_database_create_statement (priv->database, sql);
-
-	rena_prepared_statement_bind_int (statement, 1,
-		rena_database_find_provider_type (priv->database, provider_type));
-	rena_prepared_statement_bind_int (statement, 2, 0);
-
-	while (rena_prepared_statement_step (statement)) {
-		const gchar *name = rena_prepared_statement_get_string (statement, 0);
-		list = g_slist_append (list, g_strdup(name));
-	}
-	rena_prepared_statement_free (statement);
-
-	return list;
+	return rena_database_provider_get_names (provider,
+	                                         rena_database_provider_filter_kind,
+	                                         provider_type);
 }
 
 GSList *
@@ -293,128 +427,132 @@ rena_provider_get_handled_list_by_type (RenaDatabaseProvider *provider,
 	return list;
 }
 
+static RenaProvider *
+rena_database_provider_entry_new_provider (RenaDatabaseProviderEntry *entry)
+{
+	return rena_provider_new (entry->name, entry->kind,
+	                          entry->friendly_name, entry->icon_name,
+	                          entry->visible,
+	                          entry->ignore);
+}
+
 GSList *
 rena_database_provider_get_list (RenaDatabaseProvider *database_provider)
 {
-	RenaPreparedStatement *statement;
-	RenaProvider *provider;
+	RenaDatabaseProviderEntry *entry;
 	GSList *list = NULL;
+	guint i;
 
 	RenaDatabaseProviderPrivate *priv = database_provider->priv;
 
-	const gchar *sql = "SELECT name, type, friendly_name, icon_name, visible, ignore FROM PROVIDER";
-
-	statement = rena_database_create_statement (priv->database, sql);
-	while (rena_prepared_statement_step (statement)) {
-		const gchar *name = rena_prepared_statement_get_string (statement, 0);
-		gchar *kind = rena_database_provider_get_kind_from_id (database_provider,
-			rena_prepared_statement_get_int (statement, 1));
-		const gchar *friendly_name = rena_prepared_statement_get_string (statement, 2);
-		const gchar *icon_name = rena_prepared_statement_get_string (statement, 3);
-		gint visible = rena_prepared_statement_get_int (statement, 4);
-		gint ignore = rena_prepared_statement_get_int (statement, 5);
-
-		provider = rena_provider_new (name, kind, friendly_name, icon_name,
-		                                visible,
-		                                ignore);
-		list = g_slist_append (list, provider);
-		g_free(kind);
+	for (i = 0; i < priv->entries->len; i++) {
+		entry = g_ptr_array_index (priv->entries, i);
+		list = g_slist_prepend (list, rena_database_provider_entry_new_provider (entry));
 	}
-	rena_prepared_statement_free (statement);
 
-	return list;
+	return g_slist_reverse (list);
 }
 
-
-void
-rena_provider_set_visible (RenaDatabaseProvider *provider,
-                             const gchar            *name,
-                             gboolean                visible)
+RenaProvider *
+rena_database_provider_get_provider (RenaDatabaseProvider *database_provider, const gchar *name)
 {
-	RenaPreparedStatement *statement;
-	RenaDatabaseProviderPrivate *priv = provider->priv;
+	RenaDatabaseProviderEntry *entry;
 
-	const gchar *sql = "UPDATE PROVIDER SET visible = ? WHERE name = ?";
+	if ((entry = rena_database_provider_lookup (database_provider, name)) == NULL)
+		return NULL;
 
-	statement = rena_database_create_statement (priv->database, sql);
-	rena_prepared_statement_bind_int (statement, 1, visible ? 1 : 0);
-	rena_prepared_statement_bind_string (statement, 2, name);
-	rena_prepared_statement_step (statement);
-	rena_prepared_statement_free (statement);
+	return rena_database_provider_entry_new_provider (entry);
 }
 
-void
-rena_provider_set_ignore (RenaDatabaseProvider *provider,
-                            const gchar            *name,
-                            gboolean                ignore)
+gint
+rena_database_provider_get_id (RenaDatabaseProvider *provider, const gchar *name)
 {
-	RenaPreparedStatement *statement;
-	RenaDatabaseProviderPrivate *priv = provider->priv;
+	RenaDatabaseProviderEntry *entry;
 
-	const gchar *sql = "UPDATE PROVIDER SET ignore = ? WHERE name = ?";
+	if ((entry = rena_database_provider_lookup (provider, name)) == NULL)
+		return 0;
 
-	statement = rena_database_create_statement (priv->database, sql);
-	rena_prepared_statement_bind_int (statement, 1, ignore ? 1 : 0);
-	rena_prepared_statement_bind_string (statement, 2, name);
-	rena_prepared_statement_step (statement);
-	rena_prepared_statement_free (statement);
+	return entry->id;
 }
 
-gchar *
-rena_database_provider_get_friendly_name (RenaDatabaseProvider *provider, const gchar *name)
+static void
+rena_database_provider_set_flag (RenaDatabaseProvider *provider,
+                                 const gchar          *name,
+                                 const gchar          *sql,
+                                 gboolean             *flag,
+                                 gboolean              value)
 {
 	RenaPreparedStatement *statement;
 	RenaDatabaseProviderPrivate *priv = provider->priv;
-	gchar *friendly_name = NULL;
 
-	const gchar *sql = "SELECT friendly_name FROM PROVIDER WHERE name = ?";
+	if (*flag == value)
+		return;
+
+	rena_database_provider_begin (provider);
 
 	statement = rena_database_create_statement (priv->database, sql);
-	rena_prepared_statement_bind_string (statement, 1, name);
-	rena_prepared_statement_step (statement);
-	friendly_name = g_strdup(rena_prepared_statement_get_string (statement, 0));
-	rena_prepared_statement_free (statement);
+	rena_prepared_statement_bind_int (statement, 1, value ? 1 : 0);
+	rena_prepared_statement_bind_string (statement, 2, name);
+	rena_database_provider_run (provider, statement);
+
+	if (!rena_database_provider_commit (provider))
+		return;
+
+	*flag = value;
 
-	return friendly_name;
+	g_signal_emit (provider, signals[SIGNAL_PROVIDER_TOGGLED], 0, name);
 }
 
-gchar *
-rena_database_provider_get_icon_name (RenaDatabaseProvider *provider, const gchar *name)
+void
+rena_provider_set_visible (RenaDatabaseProvider *provider,
+                             const gchar            *name,
+                             gboolean                visible)
 {
-	RenaPreparedStatement *statement;
-	RenaDatabaseProviderPrivate *priv = provider->priv;
-	gchar *icon_name = NULL;
+	RenaDatabaseProviderEntry *entry;
 
-	const gchar *sql = "SELECT icon_name FROM PROVIDER WHERE name = ?";
+	if ((entry = rena_database_provider_lookup (provider, name)) == NULL)
+		return;
 
-	statement = rena_database_create_statement (priv->database, sql);
-	rena_prepared_statement_bind_string (statement, 1, name);
-	rena_prepared_statement_step (statement);
-	icon_name = g_strdup(rena_prepared_statement_get_string (statement, 0));
-	rena_prepared_statement_free (statement);
+	rena_database_provider_set_flag (provider, name,
+	                                 "UPDATE PROVIDER SET visible = ? WHERE name = ?",
+	                                 &entry->visible, visible ? TRUE : FALSE);
+}
 
-	return icon_name;
+void
+rena_provider_set_ignore (RenaDatabaseProvider *provider,
+                            const gchar            *name,
+                            gboolean                ignore)
+{
+	RenaDatabaseProviderEntry *entry;
+
+	if ((entry = rena_database_provider_lookup (provider, name)) == NULL)
+		return;
+
+	rena_database_provider_set_flag (provider, name,
+	                                 "UPDATE PROVIDER SET ignore = ? WHERE name = ?",
+	                                 &entry->ignore, ignore ? TRUE : FALSE);
 }
 
 gchar *
-rena_database_provider_get_kind_from_id (RenaDatabaseProvider *database_provider,
-                                           gint                    kind_id)
+rena_database_provider_get_friendly_name (RenaDatabaseProvider *provider, const gchar *name)
 {
-	RenaPreparedStatement *statement;
-	gchar *kind = NULL;
+	RenaDatabaseProviderEntry *entry;
 
-	RenaDatabaseProviderPrivate *priv = database_provider->priv;
+	if ((entry = rena_database_provider_lookup (provider, name)) == NULL)
+		return NULL;
 
-	const gchar *sql = "SELECT name FROM PROVIDER_TYPE WHERE id = ?";
-	statement = rena_database_create_statement (priv->database, sql);
-	rena_prepared_statement_bind_int (statement, 1, kind_id);
+	return g_strdup (entry->friendly_name);
+}
 
-	rena_prepared_statement_step (statement);
-	kind = g_strdup(rena_prepared_statement_get_string (statement, 0));
+gchar *
+rena_database_provider_get_icon_name (RenaDatabaseProvider *provider, const gchar *name)
+{
+	RenaDatabaseProviderEntry *entry;
 
-	rena_prepared_statement_free (statement);
+	if ((entry = rena_database_provider_lookup (provider, name)) == NULL)
+		return NULL;
 
-	return kind;
+	return g_strdup (entry->icon_name);
 }
 
 /*
@@ -472,6 +610,18 @@ rena_database_provider_dispose (GObject *object)
 	G_OBJECT_CLASS(rena_database_provider_parent_class)->dispose(object);
 }
 
+static void
+rena_database_provider_finalize (GObject *object)
+{
+	RenaDatabaseProvider *provider = RENA_DATABASE_PROVIDER(object);
+	RenaDatabaseProviderPrivate *priv = provider->priv;
+
+	g_hash_table_destroy (priv->entries_by_name);
+	g_ptr_array_free (priv->entries, TRUE);
+
+	G_OBJECT_CLASS(rena_database_provider_parent_class)->finalize(object);
+}
+
 static void
 rena_database_provider_class_init (RenaDatabaseProviderClass *klass)
 {
@@ -479,6 +629,7 @@ rena_database_provider_class_init (RenaDatabaseProviderClass *klass)
 
 	object_class = G_OBJECT_CLASS(klass);
 	object_class->dispose = rena_database_provider_dispose;
+	object_class->finalize = rena_database_provider_finalize;
 
 	signals[SIGNAL_WANT_UPGRADE] =
 		g_signal_new ("want-upgrade",
@@ -515,6 +666,33 @@ rena_database_provider_class_init (RenaDatabaseProviderClass *klass)
 		              NULL, NULL,
 		              g_cclosure_marshal_VOID__VOID,
 		              G_TYPE_NONE, 0);
+
+	signals[SIGNAL_PROVIDER_ADDED] =
+		g_signal_new ("provider-added",
+		              G_TYPE_FROM_CLASS (object_class),
+		              G_SIGNAL_RUN_LAST,
+		              G_STRUCT_OFFSET (RenaDatabaseProviderClass, provider_added),
+		              NULL, NULL,
+		              g_cclosure_marshal_VOID__STRING,
+		              G_TYPE_NONE, 1, G_TYPE_STRING);
+
+	signals[SIGNAL_PROVIDER_REMOVED] =
+		g_signal_new ("provider-removed",
+		              G_TYPE_FROM_CLASS (object_class),
+		              G_SIGNAL_RUN_LAST,
+		              G_STRUCT_OFFSET (RenaDatabaseProviderClass, provider_removed),
+		              NULL, NULL,
+		              g_cclosure_marshal_VOID__STRING,
+		              G_TYPE_NONE, 1, G_TYPE_STRING);
+
+	signals[SIGNAL_PROVIDER_TOGGLED] =
+		g_signal_new ("provider-toggled",
+		              G_TYPE_FROM_CLASS (object_class),
+		              G_SIGNAL_RUN_LAST,
+		              G_STRUCT_OFFSET (RenaDatabaseProviderClass, provider_toggled),
+		              NULL, NULL,
+		              g_cclosure_marshal_VOID__STRING,
+		              G_TYPE_NONE, 1, G_TYPE_STRING);
 }
 
 static void
@@ -529,6 +707,13 @@ rena_database_provider_init (RenaDatabaseProvider *provider)
 	/* Database instance */
 
 	priv->database = rena_database_get ();
+
+	/* Providers registry */
+
+	priv->entries = g_ptr_array_new_with_free_func ((GDestroyNotify) rena_database_provider_entry_free);
+	priv->entries_by_name = g_hash_table_new (g_str_hash, g_str_equal);
+
+	rena_database_provider_load_registry (provider);
 }
 
 /**
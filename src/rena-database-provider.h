@@ -20,6 +20,8 @@
 
 #include <glib-object.h>
 
+#include "rena-provider.h"
+
 G_BEGIN_DECLS
 
 #define RENA_TYPE_DATABASE_PROVIDER            (rena_database_provider_get_type())
@@ -50,6 +52,9 @@ struct _RenaDatabaseProviderClass
 	void (*want_update)        (RenaDatabaseProvider *provider, gint provider_id);
 	void (*want_remove)        (RenaDatabaseProvider *provider, gint provider_id);
 	void (*update_done)        (RenaDatabaseProvider *provider);
+	void (*provider_added)     (RenaDatabaseProvider *provider, const gchar *name);
+	void (*provider_removed)   (RenaDatabaseProvider *provider, const gchar *name);
+	void (*provider_toggled)   (RenaDatabaseProvider *provider, const gchar *name);
 };
 
 /*
@@ -95,6 +100,12 @@ rena_provider_get_handled_list_by_type (RenaDatabaseProvider *provider,
 GSList *
 rena_database_provider_get_list (RenaDatabaseProvider *database_provider);
 
+RenaProvider *
+rena_database_provider_get_provider (RenaDatabaseProvider *database_provider, const gchar *name);
+
+gint
+rena_database_provider_get_id (RenaDatabaseProvider *provider, const gchar *name);
+
 void
 rena_provider_set_visible (RenaDatabaseProvider *provider,
                              const gchar            *name,
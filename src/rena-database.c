@@ -22,6 +22,7 @@
 #include "rena-database.h"
 #include "rena-prepared-statement-private.h"
 
+#include <string.h>
 #include <sqlite3.h>
 
 #include "rena-musicobject-mgmt.h"
@@ -29,10 +30,110 @@
 #include "rena-utils.h"
 #include "rena-debug.h"
 
+/* The schema created by rena_database_init_schema() is always this version,
+ * and rena_database_upgrade_schema() walks it up to the last migration. */
+
+#define RENA_DATABASE_BASE_VERSION 140
+
+typedef struct {
+	gint           version;
+	const gchar  **queries;
+	gint           n_queries;
+	gboolean     (*upgrade) (RenaDatabase *database);
+} RenaDatabaseMigration;
+
+/* Bounded name -> id caches of the tables interned by add_new_musicobject.
+ * The least recently used names are evicted once one is full. */
+
+#define RENA_DATABASE_INTERN_MAX 4096
+
+typedef struct {
+	gpointer key;
+	gint     id;
+} RenaDatabaseInternEntry;
+
+typedef struct {
+	GHashTable *entries;
+	GQueue      lru;
+	gboolean    by_value;
+} RenaDatabaseIntern;
+
+enum {
+	INTERN_LOCATION,
+	INTERN_PROVIDER,
+	INTERN_MIME_TYPE,
+	INTERN_ARTIST,
+	INTERN_ALBUM,
+	INTERN_GENRE,
+	INTERN_YEAR,
+	INTERN_COMMENT,
+	INTERN_DIRECTORY,
+	INTERN_LAST
+};
+
+/* Statement stats, collected while the DBG_DB debug level is enabled. */
+
+#define RENA_DATABASE_SLOW_QUERY_TIME (20 * G_TIME_SPAN_MILLISECOND)
+#define RENA_DATABASE_SLOW_QUERY_LOG  64
+
+typedef struct {
+	gchar   *sql;
+	guint    executions;
+	guint    rows;
+	gint64   total_time;
+	gint64   max_time;
+	guint    cache_hits;
+	guint    cache_misses;
+} RenaDatabaseStatementStats;
+
+typedef struct {
+	gchar   *sql;
+	gint64   time;
+	guint    rows;
+} RenaDatabaseSlowQuery;
+
+/* Bounded cache of the prepared statements of a connection. Statements
+ * are taken out while in use, and the least recently released ones are
+ * finalized once it is full. */
+
+#define RENA_DATABASE_STATEMENTS_CACHE_SIZE 256
+#define RENA_DATABASE_READER_STATEMENTS_CACHE_SIZE 64
+
+typedef struct {
+	GHashTable *statements;
+	GQueue      lru;
+	guint       max_size;
+	guint       hits;
+	guint       misses;
+	guint       evictions;
+	GMutex      mutex;
+} RenaDatabaseStatementCache;
+
+/* Read-only connections lent to background threads. With WAL they never
+ * wait for the writer connection, which stays on the main loop. */
+
+#define RENA_DATABASE_MAX_READERS 4
+
+struct _RenaDatabaseReader
+{
+	RenaDatabase *database;
+	sqlite3 *sqlitedb;
+	RenaDatabaseStatementCache *statements_cache;
+};
+
 struct _RenaDatabasePrivate
 {
 	sqlite3 *sqlitedb;
-	GHashTable *statements_cache;
+	RenaDatabaseStatementCache *statements_cache;
+	RenaDatabaseIntern intern[INTERN_LAST];
+	gchar *database_file;
+	GAsyncQueue *readers;
+	guint n_readers;
+	GMutex readers_mutex;
+	GHashTable *statement_stats;
+	GQueue *slow_queries;
+	GMutex stats_mutex;
+	gboolean has_search_index;
 	gboolean successfully;
 };
 
@@ -40,6 +141,7 @@ G_DEFINE_TYPE_WITH_PRIVATE (RenaDatabase, rena_database, G_TYPE_OBJECT)
 
 enum {
 	SIGNAL_PLAYLISTS_CHANGED,
+	SIGNAL_TRACKS_CHANGED,
 	LAST_SIGNAL
 };
 
@@ -74,83 +176,570 @@ rena_database_exec_query (RenaDatabase *database,
 	return ret;
 }
 
-static RenaPreparedStatement *
-new_statement (RenaDatabase *database, const gchar *sql)
+/*
+ * Statement stats.
+ */
+
+static void
+rena_database_statement_stats_free (RenaDatabaseStatementStats *stats)
+{
+	g_free (stats->sql);
+	g_slice_free (RenaDatabaseStatementStats, stats);
+}
+
+static void
+rena_database_slow_query_free (RenaDatabaseSlowQuery *query)
+{
+	g_free (query->sql);
+	g_slice_free (RenaDatabaseSlowQuery, query);
+}
+
+static RenaDatabaseStatementStats *
+rena_database_lookup_statement_stats (RenaDatabase *database, const gchar *sql)
 {
 	RenaDatabasePrivate *priv = database->priv;
+	RenaDatabaseStatementStats *stats;
+
+	stats = g_hash_table_lookup (priv->statement_stats, sql);
+	if (stats == NULL) {
+		stats = g_slice_new0 (RenaDatabaseStatementStats);
+		stats->sql = g_strdup (sql);
+		g_hash_table_insert (priv->statement_stats, stats->sql, stats);
+	}
+
+	return stats;
+}
+
+static void
+rena_database_stats_cache_lookup (RenaDatabase *database, const gchar *sql, gboolean hit)
+{
+	RenaDatabasePrivate *priv = database->priv;
+	RenaDatabaseStatementStats *stats;
+
+	if (G_LIKELY(DBG_DB > debug_level))
+		return;
+
+	g_mutex_lock (&priv->stats_mutex);
+	stats = rena_database_lookup_statement_stats (database, sql);
+	if (hit)
+		stats->cache_hits++;
+	else
+		stats->cache_misses++;
+	g_mutex_unlock (&priv->stats_mutex);
+}
+
+static void
+rena_database_stats_execution (RenaDatabase *database, RenaPreparedStatement *statement)
+{
+	RenaDatabasePrivate *priv = database->priv;
+	RenaDatabaseStatementStats *stats;
+	RenaDatabaseSlowQuery *query;
+	const gchar *sql;
+	gint64 step_time;
+	guint n_rows;
+
+	if (!rena_prepared_statement_take_stats (statement, &step_time, &n_rows))
+		return;
+	if (G_LIKELY(DBG_DB > debug_level))
+		return;
+
+	sql = rena_prepared_statement_get_sql (statement);
+
+	g_mutex_lock (&priv->stats_mutex);
+	stats = rena_database_lookup_statement_stats (database, sql);
+	stats->executions++;
+	stats->rows += n_rows;
+	stats->total_time += step_time;
+	stats->max_time = MAX (stats->max_time, step_time);
+
+	if (step_time >= RENA_DATABASE_SLOW_QUERY_TIME) {
+		query = g_slice_new (RenaDatabaseSlowQuery);
+		query->sql = g_strdup (sql);
+		query->time = step_time;
+		query->rows = n_rows;
+		g_queue_push_tail (priv->slow_queries, query);
+		if (g_queue_get_length (priv->slow_queries) > RENA_DATABASE_SLOW_QUERY_LOG)
+			rena_database_slow_query_free (g_queue_pop_head (priv->slow_queries));
+	}
+	g_mutex_unlock (&priv->stats_mutex);
+
+	if (step_time >= RENA_DATABASE_SLOW_QUERY_TIME)
+		CDEBUG (DBG_DB, "Slow query: %.1f ms, %u rows: %s",
+		        step_time / 1000.0, n_rows, sql);
+}
+
+static gint
+rena_database_compare_statement_stats (gconstpointer a, gconstpointer b)
+{
+	const RenaDatabaseStatementStats *stats_a = *(RenaDatabaseStatementStats **) a;
+	const RenaDatabaseStatementStats *stats_b = *(RenaDatabaseStatementStats **) b;
+
+	if (stats_a->total_time == stats_b->total_time)
+		return 0;
+
+	return stats_a->total_time > stats_b->total_time ? -1 : 1;
+}
+
+/*
+ * Statements cache.
+ */
+
+static RenaDatabaseStatementCache *
+rena_database_statement_cache_new (guint max_size)
+{
+	RenaDatabaseStatementCache *cache;
+
+	cache = g_slice_new0 (RenaDatabaseStatementCache);
+	cache->statements = g_hash_table_new (g_str_hash, g_str_equal);
+	g_queue_init (&cache->lru);
+	cache->max_size = max_size;
+	g_mutex_init (&cache->mutex);
+
+	return cache;
+}
+
+static void
+rena_database_statement_cache_free (RenaDatabaseStatementCache *cache)
+{
+	g_hash_table_destroy (cache->statements);
+	g_queue_foreach (&cache->lru, (GFunc) rena_prepared_statement_finalize, NULL);
+	g_queue_clear (&cache->lru);
+	g_mutex_clear (&cache->mutex);
+	g_slice_free (RenaDatabaseStatementCache, cache);
+}
+
+static RenaPreparedStatement *
+rena_database_statement_cache_take (RenaDatabaseStatementCache *cache, const gchar *sql)
+{
+	RenaPreparedStatement *statement = NULL;
+	GList *link;
+
+	g_mutex_lock (&cache->mutex);
+	link = g_hash_table_lookup (cache->statements, sql);
+	if (link) {
+		statement = link->data;
+		g_hash_table_remove (cache->statements, sql);
+		g_queue_delete_link (&cache->lru, link);
+		cache->hits++;
+	}
+	else {
+		cache->misses++;
+	}
+	g_mutex_unlock (&cache->mutex);
+
+	return statement;
+}
+
+static void
+rena_database_statement_cache_put (RenaDatabaseStatementCache *cache, RenaPreparedStatement *statement)
+{
+	RenaPreparedStatement *evicted = NULL;
+	const gchar *sql;
+
+	sql = rena_prepared_statement_get_sql (statement);
+
+	g_mutex_lock (&cache->mutex);
+	if (g_hash_table_contains (cache->statements, sql)) {
+		/* Another copy of the same SQL was used at the same time. */
+		evicted = statement;
+	}
+	else {
+		g_queue_push_head (&cache->lru, statement);
+		g_hash_table_insert (cache->statements, (gpointer) sql, cache->lru.head);
+
+		if (cache->lru.length > cache->max_size) {
+			evicted = g_queue_pop_tail (&cache->lru);
+			g_hash_table_remove (cache->statements, rena_prepared_statement_get_sql (evicted));
+			cache->evictions++;
+		}
+	}
+	g_mutex_unlock (&cache->mutex);
+
+	if (evicted)
+		rena_prepared_statement_finalize (evicted);
+}
+
+static sqlite3_stmt *
+rena_database_prepare (sqlite3 *sqlitedb, const gchar *sql, gboolean persistent)
+{
 	sqlite3_stmt *stmt;
 
-	if (sqlite3_prepare_v2 (priv->sqlitedb, sql, -1, &stmt, NULL) != SQLITE_OK) {
-		g_critical ("db: %s", rena_database_get_last_error (database));
+	/* Persistent statements are allocated apart from the lookaside memory,
+	 * what suits the static SQL that lives in the cache. */
+	if (sqlite3_prepare_v3 (sqlitedb, sql, -1, persistent ? SQLITE_PREPARE_PERSISTENT : 0,
+	                        &stmt, NULL) != SQLITE_OK) {
+		g_critical ("db: %s", sqlite3_errmsg (sqlitedb));
 		return NULL;
 	}
 
+	return stmt;
+}
+
+static RenaPreparedStatement *
+rena_database_create_statement_full (RenaDatabase *database, const gchar *sql, gboolean persistent)
+{
+	RenaDatabasePrivate *priv = database->priv;
+	RenaPreparedStatement *cached;
+	sqlite3_stmt *stmt;
+
+	cached = rena_database_statement_cache_take (priv->statements_cache, sql);
+	rena_database_stats_cache_lookup (database, sql, cached != NULL);
+	if (cached)
+		return cached;
+
+	stmt = rena_database_prepare (priv->sqlitedb, sql, persistent);
+	if (stmt == NULL)
+		return NULL;
+
 	return rena_prepared_statement_new (stmt, database);
 }
 
+/**
+ * rena_database_create_statement:
+ *
+ * Prepares a statement for static SQL, or takes it from the cache.
+ * Free it with rena_prepared_statement_free() to give it back.
+ */
 RenaPreparedStatement *
 rena_database_create_statement (RenaDatabase *database, const gchar *sql)
+{
+	return rena_database_create_statement_full (database, sql, TRUE);
+}
+
+/**
+ * rena_database_create_dynamic_statement:
+ *
+ * Same as rena_database_create_statement() for SQL built at runtime,
+ * that may be used once and is not worth a persistent statement.
+ */
+RenaPreparedStatement *
+rena_database_create_dynamic_statement (RenaDatabase *database, const gchar *sql)
+{
+	return rena_database_create_statement_full (database, sql, FALSE);
+}
+
+void
+rena_database_release_statement (RenaDatabase *database, RenaPreparedStatement *statement)
+{
+	rena_database_stats_execution (database, statement);
+
+	rena_prepared_statement_reset (statement);
+	rena_database_statement_cache_put (database->priv->statements_cache, statement);
+}
+
+/*
+ * Reader connections.
+ */
+
+static RenaDatabaseReader *
+rena_database_reader_new (RenaDatabase *database, const gchar *database_file)
+{
+	RenaDatabaseReader *reader;
+	sqlite3 *sqlitedb = NULL;
+
+	if (sqlite3_open_v2 (database_file, &sqlitedb,
+	                     SQLITE_OPEN_READONLY | SQLITE_OPEN_NOMUTEX, NULL) != SQLITE_OK) {
+		g_critical ("Unable to open a reader connection: %s", sqlite3_errmsg (sqlitedb));
+		sqlite3_close (sqlitedb);
+		return NULL;
+	}
+	sqlite3_busy_timeout (sqlitedb, 5000);
+
+	reader = g_slice_new (RenaDatabaseReader);
+	reader->database = database;
+	reader->sqlitedb = sqlitedb;
+	reader->statements_cache = rena_database_statement_cache_new (RENA_DATABASE_READER_STATEMENTS_CACHE_SIZE);
+
+	return reader;
+}
+
+static void
+rena_database_reader_free (RenaDatabaseReader *reader)
+{
+	rena_database_statement_cache_free (reader->statements_cache);
+	sqlite3_close (reader->sqlitedb);
+	g_slice_free (RenaDatabaseReader, reader);
+}
+
+/**
+ * rena_database_reader_acquire:
+ *
+ * Borrows a read-only connection to the library, that can be used from
+ * any thread until it is given back with rena_database_reader_release().
+ * Blocks while all of them are in use.
+ *
+ * Return value: a #RenaDatabaseReader or %NULL if it can't be opened.
+ */
+RenaDatabaseReader *
+rena_database_reader_acquire (RenaDatabase *database)
 {
 	RenaDatabasePrivate *priv = database->priv;
-	RenaPreparedStatement *cached = g_hash_table_lookup (priv->statements_cache, sql);
+	RenaDatabaseReader *reader;
+	gboolean open_new = FALSE;
 
-	if (cached) {
-		g_hash_table_steal (priv->statements_cache, sql);
-		return cached;
+	reader = g_async_queue_try_pop (priv->readers);
+	if (reader)
+		return reader;
+
+	g_mutex_lock (&priv->readers_mutex);
+	if (priv->n_readers < RENA_DATABASE_MAX_READERS) {
+		priv->n_readers++;
+		open_new = TRUE;
 	}
+	g_mutex_unlock (&priv->readers_mutex);
 
-	return new_statement (database, sql);
+	if (!open_new)
+		return g_async_queue_pop (priv->readers);
+
+	reader = rena_database_reader_new (database, priv->database_file);
+	if (reader == NULL) {
+		g_mutex_lock (&priv->readers_mutex);
+		priv->n_readers--;
+		g_mutex_unlock (&priv->readers_mutex);
+	}
+
+	return reader;
 }
 
 void
-rena_database_release_statement (RenaDatabase *database, RenaPreparedStatement *statement)
+rena_database_reader_release (RenaDatabase *database, RenaDatabaseReader *reader)
 {
-	RenaDatabasePrivate *priv = database->priv;
-	gpointer sql = (gpointer) rena_prepared_statement_get_sql (statement);
+	g_async_queue_push (database->priv->readers, reader);
+}
 
-	rena_prepared_statement_reset (statement);
-	g_hash_table_replace (priv->statements_cache, sql, statement);
+RenaPreparedStatement *
+rena_database_reader_create_statement (RenaDatabaseReader *reader, const gchar *sql)
+{
+	RenaPreparedStatement *cached;
+	sqlite3_stmt *stmt;
+
+	cached = rena_database_statement_cache_take (reader->statements_cache, sql);
+	rena_database_stats_cache_lookup (reader->database, sql, cached != NULL);
+	if (cached)
+		return cached;
+
+	stmt = rena_database_prepare (reader->sqlitedb, sql, TRUE);
+	if (stmt == NULL)
+		return NULL;
+
+	return rena_prepared_statement_new_for_reader (stmt, reader);
 }
 
 void
+rena_database_reader_release_statement (RenaDatabaseReader *reader, RenaPreparedStatement *statement)
+{
+	rena_database_stats_execution (reader->database, statement);
+
+	rena_prepared_statement_reset (statement);
+	rena_database_statement_cache_put (reader->statements_cache, statement);
+}
+
+static void
+rena_database_intern_clear (RenaDatabase *database);
+
+/* The transactions take the write lock when they begin. With the writer
+ * connections, a deferred one that reads first could not write later if
+ * another connection committed meanwhile, and that is not retried. */
+
+gboolean
 rena_database_begin_transaction (RenaDatabase *database)
 {
-	rena_database_exec_query (database, "BEGIN TRANSACTION");
+	return rena_database_exec_query (database, "BEGIN IMMEDIATE TRANSACTION");
 }
 
-void
+gboolean
 rena_database_commit_transaction (RenaDatabase *database)
 {
-	rena_database_exec_query (database, "END TRANSACTION");
+	return rena_database_exec_query (database, "END TRANSACTION");
 }
 
-gint
-rena_database_find_location (RenaDatabase *database, const gchar *location)
+/* The ids cached meanwhile could be of rows rolled back, so forget them. */
+
+gboolean
+rena_database_rollback_transaction (RenaDatabase *database)
 {
-	gint location_id = 0;
-	const gchar *sql = "SELECT id FROM LOCATION WHERE name = ?";
-	RenaPreparedStatement *statement = rena_database_create_statement (database, sql);
-	rena_prepared_statement_bind_string (statement, 1, location);
+	rena_database_intern_clear (database);
+
+	return rena_database_exec_query (database, "ROLLBACK TRANSACTION");
+}
+
+/*
+ * Intern caches.
+ *
+ * Only ids known to exist are cached, so a miss always falls back to SQLite.
+ * Every path that deletes rows of these tables must invalidate them.
+ */
+
+static void
+rena_database_intern_init (RenaDatabaseIntern *intern, gboolean by_value)
+{
+	intern->by_value = by_value;
+	intern->entries = by_value ?
+		g_hash_table_new (g_direct_hash, g_direct_equal) :
+		g_hash_table_new (g_str_hash, g_str_equal);
+	g_queue_init (&intern->lru);
+}
+
+static void
+rena_database_intern_entry_free (RenaDatabaseIntern *intern, RenaDatabaseInternEntry *entry)
+{
+	if (!intern->by_value)
+		g_free (entry->key);
+	g_slice_free (RenaDatabaseInternEntry, entry);
+}
+
+static void
+rena_database_intern_unlink (RenaDatabaseIntern *intern, GList *link)
+{
+	RenaDatabaseInternEntry *entry = link->data;
+
+	g_hash_table_remove (intern->entries, entry->key);
+	g_queue_delete_link (&intern->lru, link);
+	rena_database_intern_entry_free (intern, entry);
+}
+
+static void
+rena_database_intern_reset (RenaDatabaseIntern *intern)
+{
+	while (intern->lru.head)
+		rena_database_intern_unlink (intern, intern->lru.head);
+}
+
+static gint
+rena_database_intern_lookup (RenaDatabase *database, guint intern, gconstpointer key)
+{
+	RenaDatabaseIntern *cache = &database->priv->intern[intern];
+	RenaDatabaseInternEntry *entry;
+	GList *link;
+
+	if (intern != INTERN_YEAR && key == NULL)
+		return 0;
+
+	link = g_hash_table_lookup (cache->entries, key);
+	if (link == NULL)
+		return 0;
+
+	/* Move it to the head, the most recently used. */
+	g_queue_unlink (&cache->lru, link);
+	g_queue_push_head_link (&cache->lru, link);
+
+	entry = link->data;
+	return entry->id;
+}
+
+static void
+rena_database_intern_insert (RenaDatabase *database, guint intern, gconstpointer key, gint id)
+{
+	RenaDatabaseIntern *cache = &database->priv->intern[intern];
+	RenaDatabaseInternEntry *entry;
+	GList *link;
+
+	if (id == 0 || (intern != INTERN_YEAR && key == NULL))
+		return;
+
+	link = g_hash_table_lookup (cache->entries, key);
+	if (link) {
+		entry = link->data;
+		entry->id = id;
+		g_queue_unlink (&cache->lru, link);
+		g_queue_push_head_link (&cache->lru, link);
+		return;
+	}
+
+	entry = g_slice_new (RenaDatabaseInternEntry);
+	entry->key = cache->by_value ? (gpointer) key : g_strdup (key);
+	entry->id = id;
+	g_queue_push_head (&cache->lru, entry);
+	g_hash_table_insert (cache->entries, entry->key, cache->lru.head);
+
+	while (cache->lru.length > RENA_DATABASE_INTERN_MAX)
+		rena_database_intern_unlink (cache, cache->lru.tail);
+}
+
+static void
+rena_database_intern_remove_id (RenaDatabase *database, guint intern, gint id)
+{
+	RenaDatabaseIntern *cache = &database->priv->intern[intern];
+	RenaDatabaseInternEntry *entry;
+	GList *link, *next;
+
+	for (link = cache->lru.head; link != NULL; link = next) {
+		next = link->next;
+		entry = link->data;
+		if (entry->id == id)
+			rena_database_intern_unlink (cache, link);
+	}
+}
+
+static void
+rena_database_intern_clear (RenaDatabase *database)
+{
+	guint i;
+
+	for (i = 0; i < INTERN_LAST; i++)
+		rena_database_intern_reset (&database->priv->intern[i]);
+}
+
+static gint
+rena_database_find_interned (RenaDatabase *database, guint intern, const gchar *sql, const gchar *name)
+{
+	RenaPreparedStatement *statement;
+	gint id;
+
+	if ((id = rena_database_intern_lookup (database, intern, name)))
+		return id;
+
+	statement = rena_database_create_statement (database, sql);
+	rena_prepared_statement_bind_string (statement, 1, name);
 	if (rena_prepared_statement_step (statement))
-		location_id = rena_prepared_statement_get_int (statement, 0);
+		id = rena_prepared_statement_get_int (statement, 0);
 	rena_prepared_statement_free (statement);
-	return location_id;
+
+	rena_database_intern_insert (database, intern, name, id);
+
+	return id;
 }
 
-gint
-rena_database_find_provider (RenaDatabase *database, const gchar *provider)
+/* Returns the rowid of the new entry without querying it again. If the INSERT
+ * failed the last rowid is unchanged, and a rowid equal to the previous one is
+ * harmless since it just falls back to the SELECT. */
+
+static gint
+rena_database_insert_interned (RenaDatabase *database, guint intern, const gchar *sql, const gchar *name)
 {
 	RenaPreparedStatement *statement;
-	gint provider_id = 0;
+	sqlite3_int64 last_rowid;
+	gint id = 0;
 
-	const gchar *sql = "SELECT id FROM PROVIDER WHERE name = ?";
+	last_rowid = sqlite3_last_insert_rowid (database->priv->sqlitedb);
 
 	statement = rena_database_create_statement (database, sql);
-	rena_prepared_statement_bind_string (statement, 1, provider);
-	if (rena_prepared_statement_step (statement))
-		provider_id = rena_prepared_statement_get_int (statement, 0);
+	rena_prepared_statement_bind_string (statement, 1, name);
+	rena_prepared_statement_step (statement);
 	rena_prepared_statement_free (statement);
-	return provider_id;
+
+	if (sqlite3_last_insert_rowid (database->priv->sqlitedb) != last_rowid) {
+		id = (gint) sqlite3_last_insert_rowid (database->priv->sqlitedb);
+		rena_database_intern_insert (database, intern, name, id);
+	}
+
+	return id;
+}
+
+gint
+rena_database_find_location (RenaDatabase *database, const gchar *location)
+{
+	return rena_database_find_interned (database, INTERN_LOCATION,
+	                                    "SELECT id FROM LOCATION WHERE name = ?",
+	                                    location);
+}
+
+gint
+rena_database_find_provider (RenaDatabase *database, const gchar *provider)
+{
+	return rena_database_find_interned (database, INTERN_PROVIDER,
+	                                    "SELECT id FROM PROVIDER WHERE name = ?",
+	                                    provider);
 }
 
 gint
@@ -173,78 +762,60 @@ rena_database_find_provider_type (RenaDatabase *database, const gchar *provider_
 gint
 rena_database_find_mime_type (RenaDatabase *database, const gchar *mime_type)
 {
-	gint mime_type_id = 0;
-	const gchar *sql = "SELECT id FROM MIME_TYPE WHERE name = ?";
-	RenaPreparedStatement *statement = rena_database_create_statement (database, sql);
-	rena_prepared_statement_bind_string (statement, 1, mime_type);
-	if (rena_prepared_statement_step (statement))
-		mime_type_id = rena_prepared_statement_get_int (statement, 0);
-	rena_prepared_statement_free (statement);
-	return mime_type_id;
+	return rena_database_find_interned (database, INTERN_MIME_TYPE,
+	                                    "SELECT id FROM MIME_TYPE WHERE name = ?",
+	                                    mime_type);
 }
 
 gint
 rena_database_find_artist (RenaDatabase *database, const gchar *artist)
 {
-	gint artist_id = 0;
-	const gchar *sql = "SELECT id FROM ARTIST WHERE name = ?";
-	RenaPreparedStatement *statement = rena_database_create_statement (database, sql);
-	rena_prepared_statement_bind_string (statement, 1, artist);
-	if (rena_prepared_statement_step (statement))
-		artist_id = rena_prepared_statement_get_int (statement, 0);
-	rena_prepared_statement_free (statement);
-	return artist_id;
+	return rena_database_find_interned (database, INTERN_ARTIST,
+	                                    "SELECT id FROM ARTIST WHERE name = ?",
+	                                    artist);
 }
 
 gint
 rena_database_find_album (RenaDatabase *database, const gchar *album)
 {
-	gint album_id = 0;
-	const gchar *sql = "SELECT id FROM ALBUM WHERE name = ?";
-	RenaPreparedStatement *statement = rena_database_create_statement (database, sql);
-	rena_prepared_statement_bind_string (statement, 1, album);
-	if (rena_prepared_statement_step (statement))
-		album_id = rena_prepared_statement_get_int (statement, 0);
-	rena_prepared_statement_free (statement);
-	return album_id;
+	return rena_database_find_interned (database, INTERN_ALBUM,
+	                                    "SELECT id FROM ALBUM WHERE name = ?",
+	                                    album);
 }
 
 gint
 rena_database_find_genre (RenaDatabase *database, const gchar *genre)
 {
-	gint genre_id = 0;
-	const gchar *sql = "SELECT id FROM GENRE WHERE name = ?";
-	RenaPreparedStatement *statement = rena_database_create_statement (database, sql);
-	rena_prepared_statement_bind_string (statement, 1, genre);
-	if (rena_prepared_statement_step (statement))
-		genre_id = rena_prepared_statement_get_int (statement, 0);
-	rena_prepared_statement_free (statement);
-	return genre_id;
+	return rena_database_find_interned (database, INTERN_GENRE,
+	                                    "SELECT id FROM GENRE WHERE name = ?",
+	                                    genre);
 }
 
 gint
 rena_database_find_comment (RenaDatabase *database, const gchar *comment)
 {
-	gint comment_id = 0;
-	const gchar *sql = "SELECT id FROM COMMENT WHERE name = ?";
-	RenaPreparedStatement *statement = rena_database_create_statement (database, sql);
-	rena_prepared_statement_bind_string (statement, 1, comment);
-	if (rena_prepared_statement_step (statement))
-		comment_id = rena_prepared_statement_get_int (statement, 0);
-	rena_prepared_statement_free (statement);
-	return comment_id;
+	return rena_database_find_interned (database, INTERN_COMMENT,
+	                                    "SELECT id FROM COMMENT WHERE name = ?",
+	                                    comment);
 }
 
 gint
 rena_database_find_year (RenaDatabase *database, gint year)
 {
 	gint year_id = 0;
+
+	if ((year_id = rena_database_intern_lookup (database, INTERN_YEAR, GINT_TO_POINTER (year))))
+		return year_id;
+
 	const gchar *sql = "SELECT id FROM YEAR WHERE year = ?";
 	RenaPreparedStatement *statement = rena_database_create_statement (database, sql);
 	rena_prepared_statement_bind_int (statement, 1, year);
 	if (rena_prepared_statement_step (statement))
 		year_id = rena_prepared_statement_get_int (statement, 0);
 	rena_prepared_statement_free (statement);
+
+	rena_database_intern_insert (database, INTERN_YEAR, GINT_TO_POINTER (year), year_id);
+
 	return year_id;
 }
 
@@ -274,16 +845,120 @@ rena_database_find_radio (RenaDatabase *database, const gchar *radio)
 	return radio_id;
 }
 
+/* Returns the id of a directory, adding it and its missing parents. Paths
+ * are stored without trailing separator, and the roots have no parent. */
+
+static gint
+rena_database_add_directory (RenaDatabase *database, const gchar *path)
+{
+	RenaPreparedStatement *statement;
+	sqlite3_int64 last_rowid;
+	gchar *parent_path, *name;
+	gint directory_id, parent_id = 0;
+
+	directory_id = rena_database_find_interned (database, INTERN_DIRECTORY,
+	                                            "SELECT id FROM DIRECTORY WHERE path = ?",
+	                                            path);
+	if (directory_id)
+		return directory_id;
+
+	parent_path = g_path_get_dirname (path);
+	if (g_strcmp0 (parent_path, ".") != 0 && g_strcmp0 (parent_path, path) != 0)
+		parent_id = rena_database_add_directory (database, parent_path);
+	g_free (parent_path);
+
+	name = g_path_get_basename (path);
+
+	last_rowid = sqlite3_last_insert_rowid (database->priv->sqlitedb);
+
+	const gchar *sql = "INSERT INTO DIRECTORY (parent, name, path) VALUES (?, ?, ?)";
+	statement = rena_database_create_statement (database, sql);
+	rena_prepared_statement_bind_int (statement, 1, parent_id);
+	rena_prepared_statement_bind_string (statement, 2, name);
+	rena_prepared_statement_bind_string (statement, 3, path);
+	rena_prepared_statement_step (statement);
+	rena_prepared_statement_free (statement);
+
+	if (sqlite3_last_insert_rowid (database->priv->sqlitedb) != last_rowid)
+		directory_id = (gint) sqlite3_last_insert_rowid (database->priv->sqlitedb);
+
+	g_free (name);
+
+	rena_database_intern_insert (database, INTERN_DIRECTORY, path, directory_id);
+
+	return directory_id;
+}
+
+static gint
+rena_database_add_location_directory (RenaDatabase *database, const gchar *location)
+{
+	gchar *path;
+	gint directory_id = 0;
+
+	path = g_path_get_dirname (location);
+	if (g_strcmp0 (path, ".") != 0)
+		directory_id = rena_database_add_directory (database, path);
+	g_free (path);
+
+	return directory_id;
+}
+
 gint
 rena_database_add_new_location (RenaDatabase *database, const gchar *location)
 {
-	const gchar *sql = "INSERT INTO LOCATION (name) VALUES (?)";
-	RenaPreparedStatement *statement = rena_database_create_statement (database, sql);
+	RenaPreparedStatement *statement;
+	sqlite3_int64 last_rowid;
+	gint location_id = 0, directory_id;
+
+	directory_id = rena_database_add_location_directory (database, location);
+
+	last_rowid = sqlite3_last_insert_rowid (database->priv->sqlitedb);
+
+	const gchar *sql = "INSERT INTO LOCATION (name, directory) VALUES (?, ?)";
+	statement = rena_database_create_statement (database, sql);
 	rena_prepared_statement_bind_string (statement, 1, location);
+	rena_prepared_statement_bind_int (statement, 2, directory_id);
 	rena_prepared_statement_step (statement);
 	rena_prepared_statement_free (statement);
 
-	return rena_database_find_location (database, location);
+	if (sqlite3_last_insert_rowid (database->priv->sqlitedb) != last_rowid) {
+		location_id = (gint) sqlite3_last_insert_rowid (database->priv->sqlitedb);
+		rena_database_intern_insert (database, INTERN_LOCATION, location, location_id);
+	}
+
+	if (!location_id)
+		location_id = rena_database_find_location (database, location);
+
+	return location_id;
+}
+
+/**
+ * rena_database_get_location_fingerprint:
+ *
+ * Return value: %TRUE if the file is in the library with a fingerprint.
+ */
+gboolean
+rena_database_get_location_fingerprint (RenaDatabase *database,
+                                        const gchar  *location,
+                                        gint64       *mtime,
+                                        gint64       *size,
+                                        gint64       *inode)
+{
+	RenaPreparedStatement *statement;
+	gboolean found = FALSE;
+
+	const gchar *sql = "SELECT mtime, size, inode FROM LOCATION WHERE name = ? AND mtime IS NOT NULL";
+	statement = rena_database_create_statement (database, sql);
+	rena_prepared_statement_bind_string (statement, 1, location);
+	if (rena_prepared_statement_step (statement)) {
+		*mtime = rena_prepared_statement_get_int64 (statement, 0);
+		*size = rena_prepared_statement_get_int64 (statement, 1);
+		*inode = rena_prepared_statement_get_int64 (statement, 2);
+		found = TRUE;
+	}
+	rena_prepared_statement_free (statement);
+
+	return found;
 }
 
 gint
@@ -304,73 +979,94 @@ rena_database_add_new_provider_type (RenaDatabase *database, const gchar *provid
 gint
 rena_database_add_new_mime_type (RenaDatabase *database, const gchar *mime_type)
 {
-	const gchar *sql = "INSERT INTO MIME_TYPE (name) VALUES (?)";
-	RenaPreparedStatement *statement = rena_database_create_statement (database, sql);
-	rena_prepared_statement_bind_string (statement, 1, mime_type);
-	rena_prepared_statement_step (statement);
-	rena_prepared_statement_free (statement);
+	gint mime_type_id;
 
-	return rena_database_find_mime_type (database, mime_type);
+	mime_type_id = rena_database_insert_interned (database, INTERN_MIME_TYPE,
+	                                         "INSERT INTO MIME_TYPE (name) VALUES (?)",
+	                                         mime_type);
+	if (!mime_type_id)
+		mime_type_id = rena_database_find_mime_type (database, mime_type);
+
+	return mime_type_id;
 }
 
 gint
 rena_database_add_new_artist (RenaDatabase *database, const gchar *artist)
 {
-	const gchar *sql = "INSERT INTO ARTIST (name) VALUES (?)";
-	RenaPreparedStatement *statement = rena_database_create_statement (database, sql);
-	rena_prepared_statement_bind_string (statement, 1, artist);
-	rena_prepared_statement_step (statement);
-	rena_prepared_statement_free (statement);
+	gint artist_id;
+
+	artist_id = rena_database_insert_interned (database, INTERN_ARTIST,
+	                                         "INSERT INTO ARTIST (name, sort_key) VALUES (?1, rena_sort_key(?1))",
+	                                         artist);
+	if (!artist_id)
+		artist_id = rena_database_find_artist (database, artist);
 
-	return rena_database_find_artist (database, artist);
+	return artist_id;
 }
 
 gint
 rena_database_add_new_album (RenaDatabase *database, const gchar *album)
 {
-	const gchar *sql = "INSERT INTO ALBUM (name) VALUES (?)";
-	RenaPreparedStatement *statement = rena_database_create_statement (database, sql);
-	rena_prepared_statement_bind_string (statement, 1, album);
-	rena_prepared_statement_step (statement);
-	rena_prepared_statement_free (statement);
+	gint album_id;
+
+	album_id = rena_database_insert_interned (database, INTERN_ALBUM,
+	                                         "INSERT INTO ALBUM (name, sort_key) VALUES (?1, rena_sort_key(?1))",
+	                                         album);
+	if (!album_id)
+		album_id = rena_database_find_album (database, album);
 
-	return rena_database_find_album (database, album);
+	return album_id;
 }
 
 gint
 rena_database_add_new_genre (RenaDatabase *database, const gchar *genre)
 {
-	const gchar *sql = "INSERT INTO GENRE (name) VALUES (?)";
-	RenaPreparedStatement *statement = rena_database_create_statement (database, sql);
-	rena_prepared_statement_bind_string (statement, 1, genre);
-	rena_prepared_statement_step (statement);
-	rena_prepared_statement_free (statement);
+	gint genre_id;
 
-	return rena_database_find_genre (database, genre);
+	genre_id = rena_database_insert_interned (database, INTERN_GENRE,
+	                                         "INSERT INTO GENRE (name, sort_key) VALUES (?1, rena_sort_key(?1))",
+	                                         genre);
+	if (!genre_id)
+		genre_id = rena_database_find_genre (database, genre);
+
+	return genre_id;
 }
 
 gint
 rena_database_add_new_comment (RenaDatabase *database, const gchar *comment)
 {
-	const gchar *sql = "INSERT INTO COMMENT (name) VALUES (?)";
-	RenaPreparedStatement *statement = rena_database_create_statement (database, sql);
-	rena_prepared_statement_bind_string (statement, 1, comment);
-	rena_prepared_statement_step (statement);
-	rena_prepared_statement_free (statement);
+	gint comment_id;
 
-	return rena_database_find_comment (database, comment);
+	comment_id = rena_database_insert_interned (database, INTERN_COMMENT,
+	                                         "INSERT INTO COMMENT (name) VALUES (?)",
+	                                         comment);
+	if (!comment_id)
+		comment_id = rena_database_find_comment (database, comment);
+
+	return comment_id;
 }
 
 gint
 rena_database_add_new_year (RenaDatabase *database, guint year)
 {
+	sqlite3_int64 last_rowid;
+	gint year_id;
+
+	last_rowid = sqlite3_last_insert_rowid (database->priv->sqlitedb);
+
 	const gchar *sql = "INSERT INTO YEAR (year) VALUES (?)";
 	RenaPreparedStatement *statement = rena_database_create_statement (database, sql);
 	rena_prepared_statement_bind_int (statement, 1, year);
 	rena_prepared_statement_step (statement);
 	rena_prepared_statement_free (statement);
 
-	return rena_database_find_year (database, year);
+	if (sqlite3_last_insert_rowid (database->priv->sqlitedb) == last_rowid)
+		return rena_database_find_year (database, year);
+
+	year_id = (gint) sqlite3_last_insert_rowid (database->priv->sqlitedb);
+	rena_database_intern_insert (database, INTERN_YEAR, GINT_TO_POINTER (year), year_id);
+
+	return year_id;
 }
 
 void
@@ -390,64 +1086,192 @@ rena_database_forget_location (RenaDatabase *database, gint location_id)
 	rena_prepared_statement_bind_int (statement, 1, location_id);
 	rena_prepared_statement_step (statement);
 	rena_prepared_statement_free (statement);
+
+	rena_database_intern_remove_id (database, INTERN_LOCATION, location_id);
+}
+
+void
+rena_database_forget_track (RenaDatabase *database, const gchar *file)
+{
+	gint location_id = rena_database_find_location (database, file);
+
+	if (!location_id) {
+		g_warning ("File not present in DB: %s", file);
+		return;
+	}
+
+	rena_database_forget_location(database, location_id);
+}
+
+gint
+rena_database_add_new_playlist (RenaDatabase *database, const gchar *playlist)
+{
+	const gchar *sql = "INSERT INTO PLAYLIST (name) VALUES (?)";
+	RenaPreparedStatement *statement = rena_database_create_statement (database, sql);
+	rena_prepared_statement_bind_string (statement, 1, playlist);
+	rena_prepared_statement_step (statement);
+	rena_prepared_statement_free (statement);
+
+	return rena_database_find_playlist (database, playlist);
+}
+
+/*
+ * Playlist entries.
+ *
+ * Entries of the library refer to their location, and the others keep the
+ * uri. Positions only grow, so edits never reorder the rest of entries.
+ */
+
+/* 2 parameters per entry, after the playlist id. */
+#define RENA_DATABASE_PLAYLIST_ENTRIES_PER_INSERT 256
+
+static gchar *
+rena_database_build_playlist_insert_sql (guint n_entries)
+{
+	GString *sql;
+	guint i;
+
+	sql = g_string_new ("INSERT INTO PLAYLIST_ENTRIES (playlist, position, location, uri) "
+	                    "SELECT ?1, ENTRIES.column1, LOCATION.id, CASE WHEN LOCATION.id IS NULL THEN ENTRIES.column2 END "
+	                    "FROM (VALUES ");
+
+	for (i = 0; i < n_entries; i++)
+		g_string_append_printf (sql, "%s(?%u, ?%u)", i ? ", " : "", 2 * i + 2, 2 * i + 3);
+
+	g_string_append (sql, ") AS ENTRIES LEFT JOIN LOCATION ON LOCATION.name = ENTRIES.column2");
+
+	return g_string_free (sql, FALSE);
+}
+
+static gint
+rena_database_get_playlist_last_position (RenaDatabase *database, gint playlist_id)
+{
+	gint position = 0;
+
+	const gchar *sql = "SELECT MAX(position) FROM PLAYLIST_ENTRIES WHERE playlist = ?";
+	RenaPreparedStatement *statement = rena_database_create_statement (database, sql);
+	rena_prepared_statement_bind_int (statement, 1, playlist_id);
+	if (rena_prepared_statement_step (statement))
+		position = rena_prepared_statement_get_int (statement, 0);
+	rena_prepared_statement_free (statement);
+
+	return position;
+}
+
+static void
+rena_database_insert_playlist_entries (RenaDatabase *database, gint playlist_id, gint position,
+                                       const gchar **files, guint n_files, gboolean dynamic)
+{
+	RenaPreparedStatement *statement;
+	gchar *sql;
+	guint i;
+
+	sql = rena_database_build_playlist_insert_sql (n_files);
+	if (dynamic)
+		statement = rena_database_create_dynamic_statement (database, sql);
+	else
+		statement = rena_database_create_statement (database, sql);
+	g_free (sql);
+
+	rena_prepared_statement_bind_int (statement, 1, playlist_id);
+	for (i = 0; i < n_files; i++) {
+		rena_prepared_statement_bind_int (statement, 2 * i + 2, position + i);
+		rena_prepared_statement_bind_string (statement, 2 * i + 3, files[i]);
+	}
+	rena_prepared_statement_step (statement);
+	rena_prepared_statement_free (statement);
 }
 
+/**
+ * rena_database_add_playlist_tracks:
+ *
+ * Appends the @files to a playlist in a single savepoint. Each statement
+ * inserts RENA_DATABASE_PLAYLIST_ENTRIES_PER_INSERT entries and resolves
+ * their locations in the same pass, so a playlist of 50000 files takes
+ * about 200 steps of one prepared statement, and one more for the rest.
+ */
 void
-rena_database_forget_track (RenaDatabase *database, const gchar *file)
+rena_database_add_playlist_tracks (RenaDatabase *database, gint playlist_id, GPtrArray *files)
 {
-	gint location_id = rena_database_find_location (database, file);
+	gint position;
+	guint i = 0;
 
-	if (!location_id) {
-		g_warning ("File not present in DB: %s", file);
+	if (!files || files->len == 0)
 		return;
-	}
 
-	rena_database_forget_location(database, location_id);
-}
+	rena_database_exec_query (database, "SAVEPOINT add_playlist_tracks");
 
-gint
-rena_database_add_new_playlist (RenaDatabase *database, const gchar *playlist)
-{
-	const gchar *sql = "INSERT INTO PLAYLIST (name) VALUES (?)";
-	RenaPreparedStatement *statement = rena_database_create_statement (database, sql);
-	rena_prepared_statement_bind_string (statement, 1, playlist);
-	rena_prepared_statement_step (statement);
-	rena_prepared_statement_free (statement);
+	position = rena_database_get_playlist_last_position (database, playlist_id) + 1;
 
-	return rena_database_find_playlist (database, playlist);
+	/* The full chunks share one cached statement. */
+	for (; i + RENA_DATABASE_PLAYLIST_ENTRIES_PER_INSERT <= files->len; i += RENA_DATABASE_PLAYLIST_ENTRIES_PER_INSERT) {
+		rena_database_insert_playlist_entries (database, playlist_id, position + i,
+		                                       (const gchar **) files->pdata + i,
+		                                       RENA_DATABASE_PLAYLIST_ENTRIES_PER_INSERT,
+		                                       FALSE);
+	}
+
+	if (i < files->len) {
+		rena_database_insert_playlist_entries (database, playlist_id, position + i,
+		                                       (const gchar **) files->pdata + i,
+		                                       files->len - i,
+		                                       files->len - i > 1);
+	}
+
+	rena_database_exec_query (database, "RELEASE add_playlist_tracks");
 }
 
 gboolean
 rena_database_playlist_has_track (RenaDatabase *database, gint playlist_id, const gchar *file)
 {
-	gint count = 0;
-	const gchar *sql = "SELECT COUNT() FROM PLAYLIST_TRACKS WHERE playlist = ? AND file = ?";
-	RenaPreparedStatement *statement = rena_database_create_statement (database, sql);
-	rena_prepared_statement_bind_int (statement, 1, playlist_id);
-	rena_prepared_statement_bind_string (statement, 2, file);
+	RenaPreparedStatement *statement;
+	gint location_id, count = 0;
+	const gchar *sql;
+
+	if ((location_id = rena_database_find_location (database, file))) {
+		sql = "SELECT COUNT() FROM PLAYLIST_ENTRIES WHERE location = ? AND playlist = ?";
+		statement = rena_database_create_statement (database, sql);
+		rena_prepared_statement_bind_int (statement, 1, location_id);
+	}
+	else {
+		sql = "SELECT COUNT() FROM PLAYLIST_ENTRIES WHERE uri = ? AND playlist = ?";
+		statement = rena_database_create_statement (database, sql);
+		rena_prepared_statement_bind_string (statement, 1, file);
+	}
+	rena_prepared_statement_bind_int (statement, 2, playlist_id);
 	if (rena_prepared_statement_step (statement))
 		count = rena_prepared_statement_get_int (statement, 0);
 	rena_prepared_statement_free (statement);
+
 	return count > 0;
 }
 
 void
 rena_database_add_playlist_track (RenaDatabase *database, gint playlist_id, const gchar *file)
 {
-	const gchar *sql = "INSERT INTO PLAYLIST_TRACKS (file, playlist) VALUES (?, ?)";
-	RenaPreparedStatement *statement = rena_database_create_statement (database, sql);
-	rena_prepared_statement_bind_string (statement, 1, file);
-	rena_prepared_statement_bind_int (statement, 2, playlist_id);
-	rena_prepared_statement_step (statement);
-	rena_prepared_statement_free (statement);
+	gint position;
+
+	position = rena_database_get_playlist_last_position (database, playlist_id) + 1;
+	rena_database_insert_playlist_entries (database, playlist_id, position, &file, 1, FALSE);
 }
 
 void
 rena_database_delete_playlist_track (RenaDatabase *database, gint playlist_id, const gchar *file)
 {
-	const gchar *sql = "DELETE FROM PLAYLIST_TRACKS WHERE file = ? AND playlist = ?";
-	RenaPreparedStatement *statement = rena_database_create_statement (database, sql);
-	rena_prepared_statement_bind_string (statement, 1, file);
+	RenaPreparedStatement *statement;
+	gint location_id;
+	const gchar *sql;
+
+	if ((location_id = rena_database_find_location (database, file))) {
+		sql = "DELETE FROM PLAYLIST_ENTRIES WHERE location = ? AND playlist = ?";
+		statement = rena_database_create_statement (database, sql);
+		rena_prepared_statement_bind_int (statement, 1, location_id);
+	}
+	else {
+		sql = "DELETE FROM PLAYLIST_ENTRIES WHERE uri = ? AND playlist = ?";
+		statement = rena_database_create_statement (database, sql);
+		rena_prepared_statement_bind_string (statement, 1, file);
+	}
 	rena_prepared_statement_bind_int (statement, 2, playlist_id);
 	rena_prepared_statement_step (statement);
 	rena_prepared_statement_free (statement);
@@ -508,34 +1332,82 @@ rena_database_update_radio_name (RenaDatabase *database, const gchar *old_name,
 	rena_prepared_statement_free (statement);
 }
 
+/* Bounds of the paths below a directory. Since the separator is the only
+ * character between them, the subtree is a range of the UNIQUE(path) index,
+ * and siblings that share a prefix are left out. */
+
+static void
+rena_database_get_subtree_range (const gchar *dir_name, gchar **lower, gchar **upper)
+{
+	if (g_str_has_suffix (dir_name, G_DIR_SEPARATOR_S))
+		*lower = g_strdup (dir_name);
+	else
+		*lower = g_strconcat (dir_name, G_DIR_SEPARATOR_S, NULL);
+
+	*upper = g_strdup (*lower);
+	(*upper)[strlen (*upper) - 1] = G_DIR_SEPARATOR + 1;
+}
+
 void
 rena_database_delete_dir (RenaDatabase *database, const gchar *dir_name)
 {
 	const gchar *sql;
 	RenaPreparedStatement *statement;
-	gchar *mask = g_strconcat (dir_name, "%", NULL);
+	gchar *path, *lower = NULL, *upper = NULL;
+	gsize len;
+
+	/* Directories are stored without trailing separator. */
+
+	path = g_strdup (dir_name);
+	len = strlen (path);
+	while (len > 1 && path[len - 1] == G_DIR_SEPARATOR)
+		path[--len] = '\0';
+
+	rena_database_get_subtree_range (path, &lower, &upper);
 
 	/* Delete all tracks under the given dir */
 
-	sql = "DELETE FROM TRACK WHERE location IN (SELECT id FROM LOCATION WHERE NAME LIKE ?)";
+	sql = "DELETE FROM TRACK WHERE location IN "
+		"(SELECT LOCATION.id FROM DIRECTORY CROSS JOIN LOCATION "
+		"WHERE (DIRECTORY.path = ? OR (DIRECTORY.path >= ? AND DIRECTORY.path < ?)) "
+		"AND LOCATION.directory = DIRECTORY.id)";
+	statement = rena_database_create_statement (database, sql);
+	rena_prepared_statement_bind_string (statement, 1, path);
+	rena_prepared_statement_bind_string (statement, 2, lower);
+	rena_prepared_statement_bind_string (statement, 3, upper);
+	rena_prepared_statement_step (statement);
+	rena_prepared_statement_free (statement);
+
+	/* Delete their location entries, that have no track now */
+
+	sql = "DELETE FROM LOCATION WHERE id IN "
+		"(SELECT LOCATION.id FROM DIRECTORY CROSS JOIN LOCATION "
+		"WHERE (DIRECTORY.path = ? OR (DIRECTORY.path >= ? AND DIRECTORY.path < ?)) "
+		"AND LOCATION.directory = DIRECTORY.id AND LOCATION.refs = 0)";
 	statement = rena_database_create_statement (database, sql);
-	rena_prepared_statement_bind_string (statement, 1, mask);
+	rena_prepared_statement_bind_string (statement, 1, path);
+	rena_prepared_statement_bind_string (statement, 2, lower);
+	rena_prepared_statement_bind_string (statement, 3, upper);
 	rena_prepared_statement_step (statement);
 	rena_prepared_statement_free (statement);
 
-	/* Delete the location entries */
+	/* And the directories */
 
-	sql = "DELETE FROM LOCATION WHERE name LIKE ?";
+	sql = "DELETE FROM DIRECTORY WHERE path = ? OR (path >= ? AND path < ?)";
 	statement = rena_database_create_statement (database, sql);
-	rena_prepared_statement_bind_string (statement, 1, mask);
+	rena_prepared_statement_bind_string (statement, 1, path);
+	rena_prepared_statement_bind_string (statement, 2, lower);
+	rena_prepared_statement_bind_string (statement, 3, upper);
 	rena_prepared_statement_step (statement);
 	rena_prepared_statement_free (statement);
 
-	/* Delete all entries from PLAYLIST_TRACKS which match given dir */
+	/* Delete all playlist entries under the given dir. Deleting the
+	 * locations left their uri on the entries. */
 
-	sql = "DELETE FROM PLAYLIST_TRACKS WHERE file LIKE ?";
+	sql = "DELETE FROM PLAYLIST_ENTRIES WHERE uri >= ? AND uri < ?";
 	statement = rena_database_create_statement (database, sql);
-	rena_prepared_statement_bind_string (statement, 1, mask);
+	rena_prepared_statement_bind_string (statement, 1, lower);
+	rena_prepared_statement_bind_string (statement, 2, upper);
 	rena_prepared_statement_step (statement);
 	rena_prepared_statement_free (statement);
 
@@ -543,7 +1415,9 @@ rena_database_delete_dir (RenaDatabase *database, const gchar *dir_name)
 
 	rena_database_flush_stale_entries (database);
 
-	g_free (mask);
+	g_free (path);
+	g_free (lower);
+	g_free (upper);
 }
 
 gint
@@ -564,7 +1438,7 @@ rena_database_get_playlist_count (RenaDatabase *database)
 void
 rena_database_flush_playlist (RenaDatabase *database, gint playlist_id)
 {
-	const gchar *sql = "DELETE FROM PLAYLIST_TRACKS WHERE playlist = ?";
+	const gchar *sql = "DELETE FROM PLAYLIST_ENTRIES WHERE playlist = ?";
 	RenaPreparedStatement *statement = rena_database_create_statement (database, sql);
 	rena_prepared_statement_bind_int (statement, 1, playlist_id);
 	rena_prepared_statement_step (statement);
@@ -664,9 +1538,10 @@ rena_database_add_new_track (RenaDatabase *database,
 				"samplerate, "
 				"length, "
 				"channels, "
-				"title) "
+				"title, "
+				"sort_key) "
 				"VALUES "
-				"(?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?)";
+				"(?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, rena_sort_key(?14))";
 
 	RenaPreparedStatement *statement = rena_database_create_statement (database, sql);
 	rena_prepared_statement_bind_int (statement, 1, location_id);
@@ -762,92 +1637,565 @@ rena_database_add_new_musicobject (RenaDatabase *database, RenaMusicobject *mobj
 	}
 }
 
-gchar *
-rena_database_get_filename_from_location_id (RenaDatabase *database, gint location_id)
+/*
+ * Bulk insertion.
+ */
+
+/* 14 columns per track keeps it under the default SQLITE_MAX_VARIABLE_NUMBER (999). */
+#define RENA_DATABASE_TRACKS_PER_INSERT 64
+
+/* Locations take at most 5 columns per row. */
+#define RENA_DATABASE_LOCATIONS_PER_STATEMENT 128
+
+typedef struct {
+	RenaMusicobject *mobj;
+	const gchar *file;
+	const RenaDatabaseFingerprint *fingerprint;
+	gint directory_id;
+	gint location_id;
+	gint provider_id;
+	gint mime_type_id;
+	gint artist_id;
+	gint album_id;
+	gint genre_id;
+	gint year_id;
+	gint comment_id;
+} RenaDatabaseTrackRow;
+
+typedef void (*RenaDatabaseBindRowFunc) (RenaPreparedStatement *statement, gint base, RenaDatabaseTrackRow *row);
+typedef void (*RenaDatabaseReadRowFunc) (RenaDatabase *database, RenaPreparedStatement *statement, gpointer user_data);
+
+static gint
+rena_database_resolve_name (RenaDatabase *database,
+                            GHashTable   *resolved,
+                            const gchar  *name,
+                            gint        (*find) (RenaDatabase *, const gchar *),
+                            gint        (*add)  (RenaDatabase *, const gchar *))
 {
-	RenaPreparedStatement *statement;
-	const gchar *sql;
-	gchar *file = NULL;
+	gint id = 0;
 
-	sql = "SELECT name FROM LOCATION WHERE id = ?";
-	statement = rena_database_create_statement (database, sql);
-	rena_prepared_statement_bind_int (statement, 1, location_id);
+	if (name && (id = GPOINTER_TO_INT (g_hash_table_lookup (resolved, name))))
+		return id;
 
-	if (rena_prepared_statement_step (statement))
-		file = g_strdup (rena_prepared_statement_get_string (statement, 0));
-	else
-		g_warning ("Unable to find filename for location id: %d", location_id);
+	if ((id = find (database, name)) == 0)
+		id = add (database, name);
 
-	rena_prepared_statement_free (statement);
+	if (name && id)
+		g_hash_table_insert (resolved, (gpointer) name, GINT_TO_POINTER (id));
 
-	return file;
+	return id;
 }
 
-static void
-rena_database_update_track (RenaDatabase *database,
-                              gint location_id, gint changed,
-                              gint track_no, const gchar *title,
-                              gint artist_id, gint album_id, gint genre_id, gint year_id, gint comment_id)
+static gint
+rena_database_resolve_year (RenaDatabase *database, GHashTable *resolved, gint year)
+{
+	gint id = 0;
+
+	if ((id = GPOINTER_TO_INT (g_hash_table_lookup (resolved, GINT_TO_POINTER (year)))))
+		return id;
+
+	if ((id = rena_database_find_year (database, year)) == 0)
+		id = rena_database_add_new_year (database, year);
+
+	if (id)
+		g_hash_table_insert (resolved, GINT_TO_POINTER (year), GINT_TO_POINTER (id));
+
+	return id;
+}
+
+static gchar *
+rena_database_build_rows_sql (const gchar *head, const gchar *values, const gchar *tail, guint n_rows)
+{
+	GString *sql;
+	guint i;
+
+	sql = g_string_new (head);
+	for (i = 0; i < n_rows; i++)
+		g_string_append_printf (sql, "%s%s", i ? ", " : "", values);
+	g_string_append (sql, tail);
+
+	return g_string_free (sql, FALSE);
+}
+
+/* Runs head, values and tail for all the rows, binding n_params of each
+ * row on each repetition of values, RENA_DATABASE_LOCATIONS_PER_STATEMENT
+ * rows on each statement. Returns FALSE at the first statement failed. */
+
+static gboolean
+rena_database_run_rows (RenaDatabase            *database,
+                        const gchar             *head,
+                        const gchar             *values,
+                        const gchar             *tail,
+                        gint                     n_params,
+                        RenaDatabaseTrackRow    *rows,
+                        guint                    n_rows,
+                        RenaDatabaseBindRowFunc  bind_row,
+                        RenaDatabaseReadRowFunc  read_row,
+                        gpointer                 user_data)
 {
-	const gchar *sql;
 	RenaPreparedStatement *statement;
+	gchar *sql = NULL;
+	gboolean success = TRUE;
+	guint i, j, n;
 
-	if (changed & TAG_TNO_CHANGED) {
-		sql = "UPDATE TRACK SET track_no = ? WHERE LOCATION = ?";
-		statement = rena_database_create_statement (database, sql);
-		rena_prepared_statement_bind_int (statement, 1, track_no);
-		rena_prepared_statement_bind_int (statement, 2, location_id);
-		rena_prepared_statement_step (statement);
+	for (i = 0; success && i < n_rows; i += n) {
+		n = MIN (n_rows - i, RENA_DATABASE_LOCATIONS_PER_STATEMENT);
+
+		if (n == RENA_DATABASE_LOCATIONS_PER_STATEMENT) {
+			if (sql == NULL)
+				sql = rena_database_build_rows_sql (head, values, tail, n);
+			statement = rena_database_create_statement (database, sql);
+		}
+		else {
+			g_free (sql);
+			sql = rena_database_build_rows_sql (head, values, tail, n);
+			statement = rena_database_create_dynamic_statement (database, sql);
+		}
+
+		for (j = 0; j < n; j++)
+			bind_row (statement, j * n_params, &rows[i + j]);
+
+		if (read_row) {
+			while (rena_prepared_statement_step (statement))
+				read_row (database, statement, user_data);
+		}
+		else {
+			success = rena_prepared_statement_run (statement);
+		}
 		rena_prepared_statement_free (statement);
 	}
-	if (changed & TAG_TITLE_CHANGED) {
-		sql = "UPDATE TRACK SET title = ? WHERE LOCATION = ?";
-		statement = rena_database_create_statement (database, sql);
-		rena_prepared_statement_bind_string (statement, 1, title);
-		rena_prepared_statement_bind_int (statement, 2, location_id);
-		rena_prepared_statement_step (statement);
-		rena_prepared_statement_free (statement);
+
+	g_free (sql);
+
+	return success;
+}
+
+/* The fingerprint is left NULL when unknown. */
+
+static void
+rena_database_bind_location_row (RenaPreparedStatement *statement, gint base, RenaDatabaseTrackRow *row)
+{
+	rena_prepared_statement_bind_string (statement, base + 1, row->file);
+	rena_prepared_statement_bind_int (statement, base + 2, row->directory_id);
+	if (row->fingerprint) {
+		rena_prepared_statement_bind_int64 (statement, base + 3, row->fingerprint->mtime);
+		rena_prepared_statement_bind_int64 (statement, base + 4, row->fingerprint->size);
+		rena_prepared_statement_bind_int64 (statement, base + 5, row->fingerprint->inode);
 	}
-	if (changed & TAG_ARTIST_CHANGED) {
-		sql = "UPDATE TRACK SET artist = ? WHERE LOCATION = ?";
-		statement = rena_database_create_statement (database, sql);
-		rena_prepared_statement_bind_int (statement, 1, artist_id);
-		rena_prepared_statement_bind_int (statement, 2, location_id);
-		rena_prepared_statement_step (statement);
-		rena_prepared_statement_free (statement);
+}
+
+/* The rows without fingerprint leave their name NULL, so match nothing. */
+
+static void
+rena_database_bind_fingerprint_row (RenaPreparedStatement *statement, gint base, RenaDatabaseTrackRow *row)
+{
+	if (row->fingerprint == NULL)
+		return;
+
+	rena_prepared_statement_bind_string (statement, base + 1, row->file);
+	rena_prepared_statement_bind_int64 (statement, base + 2, row->fingerprint->mtime);
+	rena_prepared_statement_bind_int64 (statement, base + 3, row->fingerprint->size);
+	rena_prepared_statement_bind_int64 (statement, base + 4, row->fingerprint->inode);
+}
+
+static void
+rena_database_bind_name_row (RenaPreparedStatement *statement, gint base, RenaDatabaseTrackRow *row)
+{
+	rena_prepared_statement_bind_string (statement, base + 1, row->file);
+}
+
+static void
+rena_database_bind_location_id_row (RenaPreparedStatement *statement, gint base, RenaDatabaseTrackRow *row)
+{
+	rena_prepared_statement_bind_int (statement, base + 1, row->location_id);
+}
+
+static void
+rena_database_read_location_id (RenaDatabase *database, RenaPreparedStatement *statement, gpointer user_data)
+{
+	const gchar *name;
+	gint location_id;
+
+	location_id = rena_prepared_statement_get_int (statement, 0);
+	name = rena_prepared_statement_get_string (statement, 1);
+
+	g_hash_table_insert (user_data, g_strdup (name), GINT_TO_POINTER (location_id));
+	rena_database_intern_insert (database, INTERN_LOCATION, name, location_id);
+}
+
+/* Adds the locations of the rows that are missing, saves the fingerprints
+ * of all of them, and fills their ids. */
+
+static gboolean
+rena_database_add_row_locations (RenaDatabase *database, RenaDatabaseTrackRow *rows, guint n_rows)
+{
+	GHashTable *location_ids;
+	guint i;
+
+	if (!rena_database_run_rows (database,
+		"INSERT OR IGNORE INTO LOCATION (name, directory, mtime, size, inode) VALUES ",
+		"(?, ?, ?, ?, ?)", "", 5,
+		rows, n_rows, rena_database_bind_location_row, NULL, NULL))
+		return FALSE;
+
+	/* The locations already there keep their id, and only the fingerprint
+	 * changes. Without UPSERT on older sqlite, update them all at once. */
+
+	if (!rena_database_run_rows (database,
+		"WITH FINGERPRINT (name, mtime, size, inode) AS (VALUES ",
+		"(?, ?, ?, ?)",
+		") UPDATE LOCATION SET "
+		"mtime = (SELECT mtime FROM FINGERPRINT WHERE FINGERPRINT.name = LOCATION.name), "
+		"size = (SELECT size FROM FINGERPRINT WHERE FINGERPRINT.name = LOCATION.name), "
+		"inode = (SELECT inode FROM FINGERPRINT WHERE FINGERPRINT.name = LOCATION.name) "
+		"WHERE name IN (SELECT name FROM FINGERPRINT)", 4,
+		rows, n_rows, rena_database_bind_fingerprint_row, NULL, NULL))
+		return FALSE;
+
+	location_ids = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+
+	rena_database_run_rows (database,
+		"SELECT id, name FROM LOCATION WHERE name IN (", "?", ")", 1,
+		rows, n_rows, rena_database_bind_name_row,
+		rena_database_read_location_id, location_ids);
+
+	for (i = 0; i < n_rows; i++)
+		rows[i].location_id = GPOINTER_TO_INT (g_hash_table_lookup (location_ids, rows[i].file));
+
+	g_hash_table_destroy (location_ids);
+
+	/* Every location must be there now, or the tracks would be lost. */
+
+	for (i = 0; i < n_rows; i++) {
+		if (rows[i].location_id == 0)
+			return FALSE;
 	}
-	if (changed & TAG_ALBUM_CHANGED) {
-		sql = "UPDATE TRACK SET album = ? WHERE LOCATION = ?";
-		statement = rena_database_create_statement (database, sql);
-		rena_prepared_statement_bind_int (statement, 1, album_id);
-		rena_prepared_statement_bind_int (statement, 2, location_id);
-		rena_prepared_statement_step (statement);
-		rena_prepared_statement_free (statement);
+
+	return TRUE;
+}
+
+static gchar *
+rena_database_build_tracks_insert_sql (guint n_tracks)
+{
+	GString *sql;
+	guint i;
+
+	sql = g_string_new ("INSERT OR IGNORE INTO TRACK ("
+	                    "location, provider, file_type, track_no, artist, album, genre, year, comment, "
+	                    "bitrate, samplerate, length, channels, title, sort_key) VALUES ");
+
+	/* The sort key reuses the title parameter of the row. */
+	for (i = 0; i < n_tracks; i++)
+		g_string_append_printf (sql, "%s(?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, rena_sort_key(?%u))",
+		                        i ? ", " : "", (i + 1) * 14);
+
+	return g_string_free (sql, FALSE);
+}
+
+static void
+rena_database_bind_track_row (RenaPreparedStatement *statement, gint base, RenaDatabaseTrackRow *row)
+{
+	rena_prepared_statement_bind_int (statement, base + 1, row->location_id);
+	rena_prepared_statement_bind_int (statement, base + 2, row->provider_id);
+	rena_prepared_statement_bind_int (statement, base + 3, row->mime_type_id);
+	rena_prepared_statement_bind_int (statement, base + 4, rena_musicobject_get_track_no (row->mobj));
+	rena_prepared_statement_bind_int (statement, base + 5, row->artist_id);
+	rena_prepared_statement_bind_int (statement, base + 6, row->album_id);
+	rena_prepared_statement_bind_int (statement, base + 7, row->genre_id);
+	rena_prepared_statement_bind_int (statement, base + 8, row->year_id);
+	rena_prepared_statement_bind_int (statement, base + 9, row->comment_id);
+	rena_prepared_statement_bind_int (statement, base + 10, rena_musicobject_get_bitrate (row->mobj));
+	rena_prepared_statement_bind_int (statement, base + 11, rena_musicobject_get_samplerate (row->mobj));
+	rena_prepared_statement_bind_int (statement, base + 12, rena_musicobject_get_length (row->mobj));
+	rena_prepared_statement_bind_int (statement, base + 13, rena_musicobject_get_channels (row->mobj));
+	rena_prepared_statement_bind_string (statement, base + 14, rena_musicobject_get_title (row->mobj));
+}
+
+static gboolean
+rena_database_save_musicobjects (RenaDatabase *database,
+                                 GPtrArray    *mobjs,
+                                 GPtrArray    *fingerprints,
+                                 GArray       *location_ids,
+                                 gboolean      replace)
+{
+	GHashTable *providers, *mime_types, *artists, *albums, *genres, *years, *comments;
+	RenaPreparedStatement *statement;
+	RenaDatabaseTrackRow *rows, *row;
+	RenaMusicobject *mobj;
+	const gchar *provider;
+	gchar *sql = NULL;
+	gboolean success;
+	guint i, j, n_rows = 0;
+	gint64 begin_time;
+
+	begin_time = g_get_monotonic_time ();
+
+	providers  = g_hash_table_new (g_str_hash, g_str_equal);
+	mime_types = g_hash_table_new (g_str_hash, g_str_equal);
+	artists    = g_hash_table_new (g_str_hash, g_str_equal);
+	albums     = g_hash_table_new (g_str_hash, g_str_equal);
+	genres     = g_hash_table_new (g_str_hash, g_str_equal);
+	years      = g_hash_table_new (g_direct_hash, g_direct_equal);
+	comments   = g_hash_table_new (g_str_hash, g_str_equal);
+
+	rows = g_new0 (RenaDatabaseTrackRow, mobjs->len);
+
+	success = rena_database_exec_query (database, "SAVEPOINT add_musicobjects");
+	if (!success)
+		goto out;
+
+	/* Resolve every name once */
+
+	for (i = 0; i < mobjs->len; i++) {
+		mobj = g_ptr_array_index (mobjs, i);
+		if (G_UNLIKELY(mobj == NULL))
+			continue;
+
+		row = &rows[n_rows];
+		row->mobj = mobj;
+
+		/* If not have an associated provider not be stored in the database. */
+
+		provider = rena_musicobject_get_provider (mobj);
+		if (provider == NULL)
+			continue;
+
+		row->provider_id = GPOINTER_TO_INT (g_hash_table_lookup (providers, provider));
+		if (row->provider_id == 0) {
+			row->provider_id = rena_database_find_provider (database, provider);
+			if (row->provider_id == 0)
+				continue;
+			g_hash_table_insert (providers, (gpointer) provider, GINT_TO_POINTER (row->provider_id));
+		}
+
+		row->file = rena_musicobject_get_file (mobj);
+		row->directory_id = rena_database_add_location_directory (database, row->file);
+		if (fingerprints)
+			row->fingerprint = g_ptr_array_index (fingerprints, i);
+
+		row->mime_type_id = rena_database_resolve_name (database, mime_types,
+			rena_musicobject_get_mime_type (mobj),
+			rena_database_find_mime_type, rena_database_add_new_mime_type);
+		row->artist_id = rena_database_resolve_name (database, artists,
+			rena_musicobject_get_artist (mobj),
+			rena_database_find_artist, rena_database_add_new_artist);
+		row->album_id = rena_database_resolve_name (database, albums,
+			rena_musicobject_get_album (mobj),
+			rena_database_find_album, rena_database_add_new_album);
+		row->genre_id = rena_database_resolve_name (database, genres,
+			rena_musicobject_get_genre (mobj),
+			rena_database_find_genre, rena_database_add_new_genre);
+		row->year_id = rena_database_resolve_year (database, years,
+			rena_musicobject_get_year (mobj));
+		row->comment_id = rena_database_resolve_name (database, comments,
+			rena_musicobject_get_comment (mobj),
+			rena_database_find_comment, rena_database_add_new_comment);
+
+		n_rows++;
 	}
-	if (changed & TAG_GENRE_CHANGED) {
-		sql = "UPDATE TRACK SET genre = ? WHERE LOCATION = ?";
+
+	/* Write the locations with their fingerprints */
+
+	success = rena_database_add_row_locations (database, rows, n_rows);
+
+	/* Drop the tracks being replaced, keeping their locations */
+
+	if (success && replace)
+		success = rena_database_run_rows (database,
+			"DELETE FROM TRACK WHERE location IN (", "?", ")", 1,
+			rows, n_rows, rena_database_bind_location_id_row, NULL, NULL);
+
+	/* Write tracks, RENA_DATABASE_TRACKS_PER_INSERT on each statement */
+
+	for (i = 0; success && i + RENA_DATABASE_TRACKS_PER_INSERT <= n_rows; i += RENA_DATABASE_TRACKS_PER_INSERT) {
+		if (sql == NULL)
+			sql = rena_database_build_tracks_insert_sql (RENA_DATABASE_TRACKS_PER_INSERT);
+
 		statement = rena_database_create_statement (database, sql);
-		rena_prepared_statement_bind_int (statement, 1, genre_id);
-		rena_prepared_statement_bind_int (statement, 2, location_id);
-		rena_prepared_statement_step (statement);
+		for (j = 0; j < RENA_DATABASE_TRACKS_PER_INSERT; j++)
+			rena_database_bind_track_row (statement, j * 14, &rows[i + j]);
+		success = rena_prepared_statement_run (statement);
 		rena_prepared_statement_free (statement);
 	}
-	if (changed & TAG_YEAR_CHANGED) {
-		sql = "UPDATE TRACK SET year = ? WHERE LOCATION = ?";
-		statement = rena_database_create_statement (database, sql);
-		rena_prepared_statement_bind_int (statement, 1, year_id);
-		rena_prepared_statement_bind_int (statement, 2, location_id);
-		rena_prepared_statement_step (statement);
+
+	/* And the remaining ones with a statement of their size */
+
+	if (success && i < n_rows) {
+		g_free (sql);
+		sql = rena_database_build_tracks_insert_sql (n_rows - i);
+
+		statement = rena_database_create_dynamic_statement (database, sql);
+		for (j = 0; i + j < n_rows; j++)
+			rena_database_bind_track_row (statement, j * 14, &rows[i + j]);
+		success = rena_prepared_statement_run (statement);
 		rena_prepared_statement_free (statement);
 	}
-	if (changed & TAG_COMMENT_CHANGED) {
-		sql = "UPDATE TRACK SET comment = ? WHERE LOCATION = ?";
-		statement = rena_database_create_statement (database, sql);
-		rena_prepared_statement_bind_int (statement, 1, comment_id);
-		rena_prepared_statement_bind_int (statement, 2, location_id);
-		rena_prepared_statement_step (statement);
-		rena_prepared_statement_free (statement);
+
+	/* All the tracks or none of them, and forget the ids rolled back */
+
+	if (success) {
+		success = rena_database_exec_query (database, "RELEASE add_musicobjects");
+	}
+	else {
+		rena_database_exec_query (database, "ROLLBACK TO add_musicobjects");
+		rena_database_exec_query (database, "RELEASE add_musicobjects");
+		rena_database_intern_clear (database);
 	}
+
+	if (success && location_ids) {
+		for (i = 0; i < n_rows; i++)
+			g_array_append_val (location_ids, rows[i].location_id);
+	}
+
+	CDEBUG(DBG_DB, "%s %u tracks in %.3f seconds", success ? "Added" : "Failed to add", n_rows,
+	       (g_get_monotonic_time () - begin_time) / (gdouble) G_USEC_PER_SEC);
+
+out:
+	g_free (sql);
+	g_free (rows);
+
+	g_hash_table_destroy (providers);
+	g_hash_table_destroy (mime_types);
+	g_hash_table_destroy (artists);
+	g_hash_table_destroy (albums);
+	g_hash_table_destroy (genres);
+	g_hash_table_destroy (years);
+	g_hash_table_destroy (comments);
+
+	return success;
+}
+
+/**
+ * rena_database_add_new_musicobjects:
+ *
+ * Same as rena_database_add_new_musicobject() for an array of
+ * #RenaMusicobject, resolving every distinct name only once and
+ * inserting the locations and tracks with multi-row statements.
+ *
+ * Return value: %TRUE if all the tracks were saved. Otherwise none was.
+ */
+gboolean
+rena_database_add_new_musicobjects (RenaDatabase *database, GPtrArray *mobjs)
+{
+	g_return_val_if_fail (RENA_IS_DATABASE(database), FALSE);
+
+	if (!mobjs || mobjs->len == 0)
+		return TRUE;
+
+	return rena_database_save_musicobjects (database, mobjs, NULL, NULL, FALSE);
+}
+
+/**
+ * rena_database_replace_musicobjects:
+ * @fingerprints: (nullable): the #RenaDatabaseFingerprint of each file
+ * of @mobjs, or %NULL where unknown.
+ * @location_ids: (nullable): where to append the location ids of the
+ * tracks saved.
+ *
+ * Same as rena_database_add_new_musicobjects(), replacing the tracks of the
+ * files already in the library and saving their fingerprints with them.
+ * Their locations are kept, so the playlists that have them still refer
+ * to them.
+ *
+ * Return value: %TRUE if all the tracks were saved. Otherwise none was,
+ * and nothing was appended to @location_ids.
+ */
+gboolean
+rena_database_replace_musicobjects (RenaDatabase *database,
+                                    GPtrArray    *mobjs,
+                                    GPtrArray    *fingerprints,
+                                    GArray       *location_ids)
+{
+	g_return_val_if_fail (RENA_IS_DATABASE(database), FALSE);
+	g_return_val_if_fail (fingerprints == NULL || (mobjs && fingerprints->len == mobjs->len), FALSE);
+
+	if (!mobjs || mobjs->len == 0)
+		return TRUE;
+
+	return rena_database_save_musicobjects (database, mobjs, fingerprints, location_ids, TRUE);
+}
+
+gchar *
+rena_database_get_filename_from_location_id (RenaDatabase *database, gint location_id)
+{
+	RenaPreparedStatement *statement;
+	const gchar *sql;
+	gchar *file = NULL;
+
+	sql = "SELECT name FROM LOCATION WHERE id = ?";
+	statement = rena_database_create_statement (database, sql);
+	rena_prepared_statement_bind_int (statement, 1, location_id);
+
+	if (rena_prepared_statement_step (statement))
+		file = g_strdup (rena_prepared_statement_get_string (statement, 0));
+	else
+		g_warning ("Unable to find filename for location id: %d", location_id);
+
+	rena_prepared_statement_free (statement);
+
+	return file;
+}
+
+static void
+rena_database_update_track (RenaDatabase *database,
+                              gint location_id, gint changed,
+                              gint track_no, const gchar *title,
+                              gint artist_id, gint album_id, gint genre_id, gint year_id, gint comment_id)
+{
+	RenaPreparedStatement *statement;
+	GString *sql;
+	gint column = 1;
+
+	if (!(changed & (TAG_TNO_CHANGED | TAG_TITLE_CHANGED | TAG_ARTIST_CHANGED | TAG_ALBUM_CHANGED |
+	                 TAG_GENRE_CHANGED | TAG_YEAR_CHANGED | TAG_COMMENT_CHANGED)))
+		return;
+
+	/* Set every changed column in a single statement. There are only a few
+	 * combinations, so the statement cache keeps all of them prepared. */
+
+	sql = g_string_new ("UPDATE TRACK SET ");
+	if (changed & TAG_TNO_CHANGED)
+		g_string_append (sql, "track_no = ?, ");
+	if (changed & TAG_TITLE_CHANGED)
+		g_string_append_printf (sql, "title = ?%d, sort_key = rena_sort_key(?%d), ",
+		                        (changed & TAG_TNO_CHANGED) ? 2 : 1,
+		                        (changed & TAG_TNO_CHANGED) ? 2 : 1);
+	if (changed & TAG_ARTIST_CHANGED)
+		g_string_append (sql, "artist = ?, ");
+	if (changed & TAG_ALBUM_CHANGED)
+		g_string_append (sql, "album = ?, ");
+	if (changed & TAG_GENRE_CHANGED)
+		g_string_append (sql, "genre = ?, ");
+	if (changed & TAG_YEAR_CHANGED)
+		g_string_append (sql, "year = ?, ");
+	if (changed & TAG_COMMENT_CHANGED)
+		g_string_append (sql, "comment = ?, ");
+	g_string_truncate (sql, sql->len - 2);
+	g_string_append (sql, " WHERE location = ?");
+
+	statement = rena_database_create_dynamic_statement (database, sql->str);
+	g_string_free (sql, TRUE);
+	if (statement == NULL)
+		return;
+
+	if (changed & TAG_TNO_CHANGED)
+		rena_prepared_statement_bind_int (statement, column++, track_no);
+	if (changed & TAG_TITLE_CHANGED)
+		rena_prepared_statement_bind_string (statement, column++, title);
+	if (changed & TAG_ARTIST_CHANGED)
+		rena_prepared_statement_bind_int (statement, column++, artist_id);
+	if (changed & TAG_ALBUM_CHANGED)
+		rena_prepared_statement_bind_int (statement, column++, album_id);
+	if (changed & TAG_GENRE_CHANGED)
+		rena_prepared_statement_bind_int (statement, column++, genre_id);
+	if (changed & TAG_YEAR_CHANGED)
+		rena_prepared_statement_bind_int (statement, column++, year_id);
+	if (changed & TAG_COMMENT_CHANGED)
+		rena_prepared_statement_bind_int (statement, column++, comment_id);
+	rena_prepared_statement_bind_int (statement, column, location_id);
+
+	rena_prepared_statement_step (statement);
+	rena_prepared_statement_free (statement);
 }
 
 void
@@ -918,6 +2266,8 @@ rena_database_update_local_files_change_tag (RenaDatabase *database, GArray *loc
 		}
 	}
 	rena_database_commit_transaction (database);
+
+	rena_database_change_tracks_done (database, loc_arr, changed);
 }
 
 gchar**
@@ -955,31 +2305,56 @@ rena_database_flush (RenaDatabase *database)
 	rena_database_exec_query (database, "DELETE FROM GENRE");
 	rena_database_exec_query (database, "DELETE FROM YEAR");
 	rena_database_exec_query (database, "DELETE FROM COMMENT");
+	rena_database_exec_query (database, "DELETE FROM DIRECTORY");
+
+	rena_database_intern_clear (database);
 }
 
 void
 rena_database_flush_stale_entries (RenaDatabase *database)
 {
-	rena_database_exec_query (database, "DELETE FROM ARTIST WHERE id NOT IN (SELECT artist FROM TRACK);");
-	rena_database_exec_query (database, "DELETE FROM ALBUM WHERE id NOT IN (SELECT album FROM TRACK);");
-	rena_database_exec_query (database, "DELETE FROM GENRE WHERE id NOT IN (SELECT genre FROM TRACK);");
-	rena_database_exec_query (database, "DELETE FROM YEAR WHERE id NOT IN (SELECT year FROM TRACK);");
-	rena_database_exec_query (database, "DELETE FROM COMMENT WHERE id NOT IN (SELECT comment FROM TRACK);");
-	rena_database_exec_query (database, "DELETE FROM PLAYLIST WHERE id NOT IN (SELECT playlist FROM PLAYLIST_TRACKS)");
+	/* Only the rows without tracks, walking the partial orphan indexes. */
+	rena_database_exec_query (database, "DELETE FROM ARTIST WHERE refs = 0");
+	rena_database_exec_query (database, "DELETE FROM ALBUM WHERE refs = 0");
+	rena_database_exec_query (database, "DELETE FROM GENRE WHERE refs = 0");
+	rena_database_exec_query (database, "DELETE FROM YEAR WHERE refs = 0");
+	rena_database_exec_query (database, "DELETE FROM COMMENT WHERE refs = 0");
+	rena_database_exec_query (database, "DELETE FROM PLAYLIST WHERE id NOT IN (SELECT playlist FROM PLAYLIST_ENTRIES)");
+
+	/* Prune the directories left empty, one level of leaves each time. */
+	while (rena_database_exec_query (database,
+	                                 "DELETE FROM DIRECTORY WHERE "
+	                                 "NOT EXISTS (SELECT 1 FROM LOCATION WHERE LOCATION.directory = DIRECTORY.id) AND "
+	                                 "NOT EXISTS (SELECT 1 FROM DIRECTORY AS CHILD WHERE CHILD.parent = DIRECTORY.id)")) {
+		if (sqlite3_changes (database->priv->sqlitedb) == 0)
+			break;
+	}
+
+	/* Also called after removing providers and their locations. */
+	rena_database_intern_clear (database);
+}
+
+/**
+ * rena_database_invalidate_caches:
+ *
+ * Forgets the ids cached by @database, after another connection changed
+ * the library.
+ */
+void
+rena_database_invalidate_caches (RenaDatabase *database)
+{
+	rena_database_intern_clear (database);
 }
 
 static gint
-rena_database_get_table_count (RenaDatabase *database, const gchar *table)
+rena_database_get_count (RenaDatabase *database, const gchar *sql)
 {
-	gchar *sql;
 	gint count = 0;
 
-	sql = g_strdup_printf ("SELECT COUNT() FROM %s;", table);
 	RenaPreparedStatement *statement = rena_database_create_statement (database, sql);
 	if (rena_prepared_statement_step (statement))
 		count = rena_prepared_statement_get_int (statement, 0);
 	rena_prepared_statement_free (statement);
-	g_free (sql);
 
 	return count;
 }
@@ -987,31 +2362,529 @@ rena_database_get_table_count (RenaDatabase *database, const gchar *table)
 gint
 rena_database_get_artist_count (RenaDatabase *database)
 {
-	return rena_database_get_table_count (database, "ARTIST");
+	return rena_database_get_count (database, "SELECT COUNT() FROM ARTIST");
 }
 
 gint
 rena_database_get_album_count (RenaDatabase *database)
 {
-	return rena_database_get_table_count (database, "ALBUM");
+	return rena_database_get_count (database, "SELECT COUNT() FROM ALBUM");
 }
 
 gint
 rena_database_get_track_count (RenaDatabase *database)
 {
-	return rena_database_get_table_count (database, "TRACK");
+	return rena_database_get_count (database, "SELECT COUNT() FROM TRACK");
 }
 
-gboolean
-rena_database_init_schema (RenaDatabase *database)
+/**
+ * rena_database_search_locations:
+ * @database: a #RenaDatabase
+ * @text: the words to search.
+ *
+ * Finds the tracks that have all the words of @text as prefixes of the words
+ * of their title, artist, album, genre, comment or filename.
+ *
+ * Return value: a #GArray of gint location ids, or %NULL if there is no
+ * search index or nothing to search.
+ */
+GArray *
+rena_database_search_locations (RenaDatabase *database, const gchar *text)
+{
+	RenaPreparedStatement *statement;
+	GArray *locations = NULL;
+	GString *query;
+	gchar **words, *p;
+	gint location_id, i;
+
+	if (!database->priv->has_search_index || text == NULL)
+		return NULL;
+
+	/* Quote each word as a prefix phrase, so the user text is never
+	 * parsed as FTS5 syntax. */
+
+	query = g_string_new (NULL);
+	words = g_strsplit_set (text, " \t", -1);
+	for (i = 0; words[i] != NULL; i++) {
+		if (*words[i] == '\0')
+			continue;
+		if (query->len)
+			g_string_append_c (query, ' ');
+		g_string_append_c (query, '"');
+		for (p = words[i]; *p != '\0'; p++) {
+			if (*p == '"')
+				g_string_append_c (query, '"');
+			g_string_append_c (query, *p);
+		}
+		g_string_append (query, "\"*");
+	}
+	g_strfreev (words);
+
+	if (query->len) {
+		locations = g_array_new (FALSE, FALSE, sizeof(gint));
+
+		const gchar *sql = "SELECT rowid FROM TRACK_SEARCH WHERE TRACK_SEARCH MATCH ?";
+		statement = rena_database_create_statement (database, sql);
+		rena_prepared_statement_bind_string (statement, 1, query->str);
+		while (rena_prepared_statement_step (statement)) {
+			location_id = rena_prepared_statement_get_int (statement, 0);
+			g_array_append_val (locations, location_id);
+		}
+		rena_prepared_statement_free (statement);
+	}
+
+	g_string_free (query, TRUE);
+
+	return locations;
+}
+
+/*
+ * rena_sort_key(text): the key that orders the names on library views.
+ * Compatibility decomposition and case folding, so "Émile" sorts along
+ * "emile" and the keys can be compared as plain bytes by the indexes.
+ */
+static void
+rena_database_sort_key_func (sqlite3_context *context, int argc, sqlite3_value **argv)
+{
+	const gchar *text;
+	gchar *normalized;
+
+	text = (const gchar *) sqlite3_value_text (argv[0]);
+	if (text == NULL) {
+		sqlite3_result_null (context);
+		return;
+	}
+
+	normalized = g_utf8_normalize (text, -1, G_NORMALIZE_ALL);
+	if (normalized == NULL) {
+		/* Not valid UTF-8. Just keep it. */
+		sqlite3_result_text (context, text, -1, SQLITE_TRANSIENT);
+		return;
+	}
+
+	sqlite3_result_text (context, g_utf8_casefold (normalized, -1), -1, g_free);
+	g_free (normalized);
+}
+
+/*
+ * Schema migrations.
+ *
+ * Each migration upgrades the schema from the previous version to its own
+ * one, and runs in its own transaction. They must be idempotent, since
+ * rena_database_compatibilize_version() recreates the tables and replays
+ * them from the base version.
+ */
+
+static const gchar *migration_141[] = {
+	/* Case-insensitive lookups by name (rena_database_get_artist_and_title_song).
+	 * The exact ones already use the UNIQUE(name) automatic indexes. */
+	"CREATE INDEX IF NOT EXISTS ARTIST_name_nocase_idx ON ARTIST (name COLLATE NOCASE)",
+	"CREATE INDEX IF NOT EXISTS TRACK_title_nocase_idx ON TRACK (title COLLATE NOCASE)",
+	"CREATE INDEX IF NOT EXISTS PROVIDER_type_idx ON PROVIDER (type, ignore)"
+};
+
+static const gchar *migration_142[] = {
+	/* Library views filter by provider and join every dimension. */
+	"CREATE INDEX IF NOT EXISTS TRACK_provider_idx ON TRACK (provider)",
+	"CREATE INDEX IF NOT EXISTS TRACK_artist_idx ON TRACK (artist)",
+	"CREATE INDEX IF NOT EXISTS TRACK_album_idx ON TRACK (album)",
+	"CREATE INDEX IF NOT EXISTS TRACK_genre_idx ON TRACK (genre)",
+	"CREATE INDEX IF NOT EXISTS TRACK_year_idx ON TRACK (year)",
+	"CREATE INDEX IF NOT EXISTS TRACK_comment_idx ON TRACK (comment)",
+	/* Playlists and radios are always read by their parent id. */
+	"CREATE INDEX IF NOT EXISTS PLAYLIST_TRACKS_playlist_idx ON PLAYLIST_TRACKS (playlist, file)",
+	"CREATE INDEX IF NOT EXISTS RADIO_TRACKS_radio_idx ON RADIO_TRACKS (radio)"
+};
+
+/* Full text index of the library, kept in sync with TRACK by triggers.
+ * Its rowid is the location id of the track. */
+
+static const gchar *search_index_queries[] = {
+	"CREATE TRIGGER IF NOT EXISTS TRACK_search_insert AFTER INSERT ON TRACK BEGIN "
+		"INSERT INTO TRACK_SEARCH (rowid, title, artist, album, genre, comment, file) VALUES (new.location, new.title, "
+		"(SELECT name FROM ARTIST WHERE id = new.artist), "
+		"(SELECT name FROM ALBUM WHERE id = new.album), "
+		"(SELECT name FROM GENRE WHERE id = new.genre), "
+		"(SELECT name FROM COMMENT WHERE id = new.comment), "
+		"(SELECT name FROM LOCATION WHERE id = new.location)); "
+	"END",
+	"CREATE TRIGGER IF NOT EXISTS TRACK_search_update AFTER UPDATE ON TRACK BEGIN "
+		"DELETE FROM TRACK_SEARCH WHERE rowid = old.location; "
+		"INSERT INTO TRACK_SEARCH (rowid, title, artist, album, genre, comment, file) VALUES (new.location, new.title, "
+		"(SELECT name FROM ARTIST WHERE id = new.artist), "
+		"(SELECT name FROM ALBUM WHERE id = new.album), "
+		"(SELECT name FROM GENRE WHERE id = new.genre), "
+		"(SELECT name FROM COMMENT WHERE id = new.comment), "
+		"(SELECT name FROM LOCATION WHERE id = new.location)); "
+	"END",
+	"CREATE TRIGGER IF NOT EXISTS TRACK_search_delete AFTER DELETE ON TRACK BEGIN "
+		"DELETE FROM TRACK_SEARCH WHERE rowid = old.location; "
+	"END",
+	"DELETE FROM TRACK_SEARCH",
+	"INSERT INTO TRACK_SEARCH (rowid, title, artist, album, genre, comment, file) "
+		"SELECT TRACK.location, TRACK.title, ARTIST.name, ALBUM.name, GENRE.name, COMMENT.name, LOCATION.name "
+		"FROM TRACK, ARTIST, ALBUM, GENRE, COMMENT, LOCATION "
+		"WHERE ARTIST.id = TRACK.artist AND ALBUM.id = TRACK.album AND GENRE.id = TRACK.genre "
+		"AND COMMENT.id = TRACK.comment AND LOCATION.id = TRACK.location"
+};
+
+static gboolean
+rena_database_create_search_index (RenaDatabase *database)
 {
+	gchar *err = NULL;
 	gint i;
 
-	const gchar *queries[] = {
-		"PRAGMA user_version=140",
+	/* SQLite may be built without FTS5. Then the library search keeps
+	 * walking the tree, so it is not an error. */
+
+	sqlite3_exec (database->priv->sqlitedb,
+	              "CREATE VIRTUAL TABLE IF NOT EXISTS TRACK_SEARCH USING fts5 "
+	              "(title, artist, album, genre, comment, file, tokenize = 'unicode61 remove_diacritics 2')",
+	              NULL, NULL, &err);
+	if (err) {
+		g_warning ("Unable to create the library search index: %s", err);
+		sqlite3_free (err);
+		return TRUE;
+	}
+
+	for (i = 0; i < G_N_ELEMENTS(search_index_queries); i++) {
+		if (!rena_database_exec_query (database, search_index_queries[i]))
+			return FALSE;
+	}
+
+	return TRUE;
+}
+
+static gboolean
+rena_database_has_table (RenaDatabase *database, const gchar *table)
+{
+	RenaPreparedStatement *statement;
+	gboolean has_table;
+
+	const gchar *sql = "SELECT 1 FROM sqlite_master WHERE type = 'table' AND name = ?";
+	statement = rena_database_create_statement (database, sql);
+	rena_prepared_statement_bind_string (statement, 1, table);
+	has_table = rena_prepared_statement_step (statement);
+	rena_prepared_statement_free (statement);
+
+	return has_table;
+}
+
+/* Migration 143 is done even if SQLite had no FTS5, so the index is
+ * created again on startup once the library runs with one that has it. */
+
+static void
+rena_database_check_search_index (RenaDatabase *database)
+{
+	if (!rena_database_has_table (database, "TRACK_SEARCH") &&
+	    sqlite3_compileoption_used ("ENABLE_FTS5")) {
+		rena_database_begin_transaction (database);
+		if (rena_database_create_search_index (database))
+			rena_database_commit_transaction (database);
+		else
+			rena_database_rollback_transaction (database);
+	}
+
+	database->priv->has_search_index = rena_database_has_table (database, "TRACK_SEARCH");
+}
+
+static const gchar *migration_144[] = {
+	/* Casefolded sort keys, so the library views are ordered walking an index
+	 * of the first level and the tracks of each node. See rena_sort_key(). */
+	"ALTER TABLE ARTIST ADD COLUMN sort_key TEXT",
+	"ALTER TABLE ALBUM ADD COLUMN sort_key TEXT",
+	"ALTER TABLE GENRE ADD COLUMN sort_key TEXT",
+	"ALTER TABLE TRACK ADD COLUMN sort_key TEXT",
+	"UPDATE ARTIST SET sort_key = rena_sort_key(name)",
+	"UPDATE ALBUM SET sort_key = rena_sort_key(name)",
+	"UPDATE GENRE SET sort_key = rena_sort_key(name)",
+	"UPDATE TRACK SET sort_key = rena_sort_key(title)",
+	"CREATE INDEX IF NOT EXISTS ARTIST_sort_key_idx ON ARTIST (sort_key)",
+	"CREATE INDEX IF NOT EXISTS ALBUM_sort_key_idx ON ALBUM (sort_key)",
+	"CREATE INDEX IF NOT EXISTS GENRE_sort_key_idx ON GENRE (sort_key)",
+	/* Replace the single column indexes of version 142. */
+	"DROP INDEX IF EXISTS TRACK_artist_idx",
+	"DROP INDEX IF EXISTS TRACK_album_idx",
+	"DROP INDEX IF EXISTS TRACK_genre_idx",
+	"CREATE INDEX IF NOT EXISTS TRACK_artist_sort_key_idx ON TRACK (artist, sort_key)",
+	"CREATE INDEX IF NOT EXISTS TRACK_album_sort_key_idx ON TRACK (album, sort_key)",
+	"CREATE INDEX IF NOT EXISTS TRACK_genre_sort_key_idx ON TRACK (genre, sort_key)"
+};
+
+static const gchar *migration_145[] = {
+	/* Counter bumped on every change of the tracks, that tells when the
+	 * library snapshots written by the library pane are stale. */
+	"CREATE TABLE IF NOT EXISTS LIBRARY_STATE "
+		"(id INTEGER PRIMARY KEY CHECK (id = 0), "
+		"generation INTEGER NOT NULL)",
+	"INSERT OR IGNORE INTO LIBRARY_STATE (id, generation) VALUES (0, 0)",
+	"CREATE TRIGGER IF NOT EXISTS TRACK_generation_insert AFTER INSERT ON TRACK BEGIN "
+		"UPDATE LIBRARY_STATE SET generation = generation + 1; "
+	"END",
+	"CREATE TRIGGER IF NOT EXISTS TRACK_generation_update AFTER UPDATE ON TRACK BEGIN "
+		"UPDATE LIBRARY_STATE SET generation = generation + 1; "
+	"END",
+	"CREATE TRIGGER IF NOT EXISTS TRACK_generation_delete AFTER DELETE ON TRACK BEGIN "
+		"UPDATE LIBRARY_STATE SET generation = generation + 1; "
+	"END"
+};
+
+static const gchar *migration_146[] = {
+	/* Number of tracks that use each row, kept by triggers on TRACK, so the
+	 * orphans are found by the partial indexes on refs = 0 instead of
+	 * checking every row against TRACK. See rena_database_flush_stale_entries(). */
+	"ALTER TABLE ARTIST ADD COLUMN refs INTEGER NOT NULL DEFAULT 0",
+	"ALTER TABLE ALBUM ADD COLUMN refs INTEGER NOT NULL DEFAULT 0",
+	"ALTER TABLE GENRE ADD COLUMN refs INTEGER NOT NULL DEFAULT 0",
+	"ALTER TABLE YEAR ADD COLUMN refs INTEGER NOT NULL DEFAULT 0",
+	"ALTER TABLE COMMENT ADD COLUMN refs INTEGER NOT NULL DEFAULT 0",
+	"ALTER TABLE LOCATION ADD COLUMN refs INTEGER NOT NULL DEFAULT 0",
+	"UPDATE ARTIST SET refs = (SELECT COUNT() FROM TRACK WHERE artist = ARTIST.id)",
+	"UPDATE ALBUM SET refs = (SELECT COUNT() FROM TRACK WHERE album = ALBUM.id)",
+	"UPDATE GENRE SET refs = (SELECT COUNT() FROM TRACK WHERE genre = GENRE.id)",
+	"UPDATE YEAR SET refs = (SELECT COUNT() FROM TRACK WHERE year = YEAR.id)",
+	"UPDATE COMMENT SET refs = (SELECT COUNT() FROM TRACK WHERE comment = COMMENT.id)",
+	"UPDATE LOCATION SET refs = (SELECT COUNT() FROM TRACK WHERE location = LOCATION.id)",
+	"CREATE INDEX IF NOT EXISTS ARTIST_orphan_idx ON ARTIST (id) WHERE refs = 0",
+	"CREATE INDEX IF NOT EXISTS ALBUM_orphan_idx ON ALBUM (id) WHERE refs = 0",
+	"CREATE INDEX IF NOT EXISTS GENRE_orphan_idx ON GENRE (id) WHERE refs = 0",
+	"CREATE INDEX IF NOT EXISTS YEAR_orphan_idx ON YEAR (id) WHERE refs = 0",
+	"CREATE INDEX IF NOT EXISTS COMMENT_orphan_idx ON COMMENT (id) WHERE refs = 0",
+	"CREATE INDEX IF NOT EXISTS LOCATION_orphan_idx ON LOCATION (id) WHERE refs = 0",
+	"CREATE TRIGGER IF NOT EXISTS TRACK_refs_insert AFTER INSERT ON TRACK BEGIN "
+		"UPDATE ARTIST SET refs = refs + 1 WHERE id = new.artist; "
+		"UPDATE ALBUM SET refs = refs + 1 WHERE id = new.album; "
+		"UPDATE GENRE SET refs = refs + 1 WHERE id = new.genre; "
+		"UPDATE YEAR SET refs = refs + 1 WHERE id = new.year; "
+		"UPDATE COMMENT SET refs = refs + 1 WHERE id = new.comment; "
+		"UPDATE LOCATION SET refs = refs + 1 WHERE id = new.location; "
+	"END",
+	"CREATE TRIGGER IF NOT EXISTS TRACK_refs_delete AFTER DELETE ON TRACK BEGIN "
+		"UPDATE ARTIST SET refs = refs - 1 WHERE id = old.artist; "
+		"UPDATE ALBUM SET refs = refs - 1 WHERE id = old.album; "
+		"UPDATE GENRE SET refs = refs - 1 WHERE id = old.genre; "
+		"UPDATE YEAR SET refs = refs - 1 WHERE id = old.year; "
+		"UPDATE COMMENT SET refs = refs - 1 WHERE id = old.comment; "
+		"UPDATE LOCATION SET refs = refs - 1 WHERE id = old.location; "
+	"END",
+	"CREATE TRIGGER IF NOT EXISTS TRACK_refs_update_artist AFTER UPDATE OF artist ON TRACK WHEN old.artist IS NOT new.artist BEGIN "
+		"UPDATE ARTIST SET refs = refs - 1 WHERE id = old.artist; "
+		"UPDATE ARTIST SET refs = refs + 1 WHERE id = new.artist; "
+	"END",
+	"CREATE TRIGGER IF NOT EXISTS TRACK_refs_update_album AFTER UPDATE OF album ON TRACK WHEN old.album IS NOT new.album BEGIN "
+		"UPDATE ALBUM SET refs = refs - 1 WHERE id = old.album; "
+		"UPDATE ALBUM SET refs = refs + 1 WHERE id = new.album; "
+	"END",
+	"CREATE TRIGGER IF NOT EXISTS TRACK_refs_update_genre AFTER UPDATE OF genre ON TRACK WHEN old.genre IS NOT new.genre BEGIN "
+		"UPDATE GENRE SET refs = refs - 1 WHERE id = old.genre; "
+		"UPDATE GENRE SET refs = refs + 1 WHERE id = new.genre; "
+	"END",
+	"CREATE TRIGGER IF NOT EXISTS TRACK_refs_update_year AFTER UPDATE OF year ON TRACK WHEN old.year IS NOT new.year BEGIN "
+		"UPDATE YEAR SET refs = refs - 1 WHERE id = old.year; "
+		"UPDATE YEAR SET refs = refs + 1 WHERE id = new.year; "
+	"END",
+	"CREATE TRIGGER IF NOT EXISTS TRACK_refs_update_comment AFTER UPDATE OF comment ON TRACK WHEN old.comment IS NOT new.comment BEGIN "
+		"UPDATE COMMENT SET refs = refs - 1 WHERE id = old.comment; "
+		"UPDATE COMMENT SET refs = refs + 1 WHERE id = new.comment; "
+	"END"
+};
+
+static const gchar *migration_147[] = {
+	/* Folders of the locations, so a folder is removed or listed by a range
+	 * of paths, and the folder view is built without splitting every path. */
+	"CREATE TABLE IF NOT EXISTS DIRECTORY "
+		"(id INTEGER PRIMARY KEY,"
+		"parent INT,"
+		"name TEXT,"
+		"path TEXT,"
+		"UNIQUE(path))",
+	"CREATE INDEX IF NOT EXISTS DIRECTORY_parent_idx ON DIRECTORY (parent)",
+	"ALTER TABLE LOCATION ADD COLUMN directory INT",
+	"CREATE INDEX IF NOT EXISTS LOCATION_directory_idx ON LOCATION (directory)"
+};
+
+static gboolean
+rena_database_fill_directories (RenaDatabase *database)
+{
+	RenaPreparedStatement *statement;
+	GArray *ids, *directories;
+	GPtrArray *names;
+	gint location_id, directory_id;
+	guint i;
+
+	ids = g_array_new (FALSE, FALSE, sizeof(gint));
+	names = g_ptr_array_new_with_free_func (g_free);
+
+	const gchar *sql = "SELECT id, name FROM LOCATION WHERE directory IS NULL";
+	statement = rena_database_create_statement (database, sql);
+	while (rena_prepared_statement_step (statement)) {
+		location_id = rena_prepared_statement_get_int (statement, 0);
+		g_array_append_val (ids, location_id);
+		g_ptr_array_add (names, g_strdup (rena_prepared_statement_get_string (statement, 1)));
+	}
+	rena_prepared_statement_free (statement);
+
+	directories = g_array_sized_new (FALSE, FALSE, sizeof(gint), ids->len);
+	for (i = 0; i < ids->len; i++) {
+		directory_id = rena_database_add_location_directory (database, g_ptr_array_index (names, i));
+		g_array_append_val (directories, directory_id);
+	}
+
+	sql = "UPDATE LOCATION SET directory = ? WHERE id = ?";
+	for (i = 0; i < ids->len; i++) {
+		statement = rena_database_create_statement (database, sql);
+		rena_prepared_statement_bind_int (statement, 1, g_array_index (directories, gint, i));
+		rena_prepared_statement_bind_int (statement, 2, g_array_index (ids, gint, i));
+		rena_prepared_statement_step (statement);
+		rena_prepared_statement_free (statement);
+	}
+
+	g_array_free (directories, TRUE);
+	g_ptr_array_free (names, TRUE);
+	g_array_free (ids, TRUE);
+
+	return TRUE;
+}
+
+static const gchar *migration_148[] = {
+	/* Playlists as ordered entries of the library, or external uris. */
+	"CREATE TABLE IF NOT EXISTS PLAYLIST_ENTRIES "
+		"(playlist INT NOT NULL,"
+		"position INT NOT NULL,"
+		"location INT,"
+		"uri TEXT,"
+		"PRIMARY KEY (playlist, position)) WITHOUT ROWID",
+	"INSERT OR IGNORE INTO PLAYLIST_ENTRIES (playlist, position, location, uri) "
+		"SELECT PLAYLIST_TRACKS.playlist, PLAYLIST_TRACKS.rowid, LOCATION.id, "
+		"CASE WHEN LOCATION.id IS NULL THEN PLAYLIST_TRACKS.file END "
+		"FROM PLAYLIST_TRACKS LEFT JOIN LOCATION ON LOCATION.name = PLAYLIST_TRACKS.file "
+		"WHERE PLAYLIST_TRACKS.playlist IS NOT NULL",
+	"DROP TABLE IF EXISTS PLAYLIST_TRACKS",
+	"CREATE INDEX IF NOT EXISTS PLAYLIST_ENTRIES_location_idx ON PLAYLIST_ENTRIES (location, playlist)",
+	"CREATE INDEX IF NOT EXISTS PLAYLIST_ENTRIES_uri_idx ON PLAYLIST_ENTRIES (uri) WHERE uri IS NOT NULL",
+	/* Entries of a track removed from the library keep playing it from its file. */
+	"CREATE TRIGGER IF NOT EXISTS LOCATION_playlist_delete AFTER DELETE ON LOCATION BEGIN "
+		"UPDATE PLAYLIST_ENTRIES SET location = NULL, uri = old.name WHERE location = old.id; "
+	"END"
+};
+
+static const gchar *migration_149[] = {
+	/* Jobs done by the maintenance, see rena-database-maintenance.c */
+	"CREATE TABLE IF NOT EXISTS MAINTENANCE_LOG "
+		"(time INT,"
+		"job TEXT,"
+		"steps INT,"
+		"duration INT,"
+		"longest INT,"
+		"result TEXT)",
+	"CREATE INDEX IF NOT EXISTS MAINTENANCE_LOG_job_idx ON MAINTENANCE_LOG (job, time)"
+};
+
+static const gchar *migration_150[] = {
+	/* Fingerprint of the files, so an update scan only reads the tags of
+	 * the files that changed. See rena_database_replace_musicobjects(). */
+	"ALTER TABLE LOCATION ADD COLUMN mtime INT",
+	"ALTER TABLE LOCATION ADD COLUMN size INT",
+	"ALTER TABLE LOCATION ADD COLUMN inode INT"
+};
+
+static const gchar *migration_151[] = {
+	/* Progress of a library scan, kept until it ends so an interrupted
+	 * one resumes where it stopped. See rena-scanner.c */
+	"CREATE TABLE IF NOT EXISTS SCAN_PENDING "
+		"(id INTEGER PRIMARY KEY CHECK (id = 1),"
+		"incremental INT)",
+	"CREATE TABLE IF NOT EXISTS SCAN_DIRECTORY (path TEXT PRIMARY KEY) WITHOUT ROWID",
+	"CREATE TABLE IF NOT EXISTS SCAN_SEEN (location INTEGER PRIMARY KEY)",
+	"CREATE TABLE IF NOT EXISTS SCAN_PLAYLISTS (file TEXT PRIMARY KEY)"
+};
+
+static const RenaDatabaseMigration migrations[] = {
+	{ 141, migration_141, G_N_ELEMENTS(migration_141), NULL },
+	{ 142, migration_142, G_N_ELEMENTS(migration_142), NULL },
+	{ 143, NULL, 0, rena_database_create_search_index },
+	{ 144, migration_144, G_N_ELEMENTS(migration_144), NULL },
+	{ 145, migration_145, G_N_ELEMENTS(migration_145), NULL },
+	{ 146, migration_146, G_N_ELEMENTS(migration_146), NULL },
+	{ 147, migration_147, G_N_ELEMENTS(migration_147), rena_database_fill_directories },
+	{ 148, migration_148, G_N_ELEMENTS(migration_148), NULL },
+	{ 149, migration_149, G_N_ELEMENTS(migration_149), NULL },
+	{ 150, migration_150, G_N_ELEMENTS(migration_150), NULL },
+	{ 151, migration_151, G_N_ELEMENTS(migration_151), NULL }
+};
+
+static gboolean
+rena_database_set_version (RenaDatabase *database, gint version)
+{
+	gchar *query;
+	gboolean ret;
+
+	query = g_strdup_printf ("PRAGMA user_version=%d", version);
+	ret = rena_database_exec_query (database, query);
+	g_free (query);
+
+	return ret;
+}
+
+static gboolean
+rena_database_apply_migration (RenaDatabase *database, const RenaDatabaseMigration *migration)
+{
+	gint i;
+
+	for (i = 0; i < migration->n_queries; i++) {
+		if (!rena_database_exec_query (database, migration->queries[i]))
+			return FALSE;
+	}
+	if (migration->upgrade && !migration->upgrade (database))
+		return FALSE;
+
+	return rena_database_set_version (database, migration->version);
+}
+
+static gboolean
+rena_database_upgrade_schema (RenaDatabase *database)
+{
+	gint version, i;
+
+	version = rena_database_get_version (database);
+
+	/* A new database, or one from before the versioned schema. */
+	if (version < RENA_DATABASE_BASE_VERSION) {
+		if (!rena_database_set_version (database, RENA_DATABASE_BASE_VERSION))
+			return FALSE;
+		version = RENA_DATABASE_BASE_VERSION;
+	}
+
+	for (i = 0; i < G_N_ELEMENTS(migrations); i++) {
+		if (migrations[i].version <= version)
+			continue;
+
+		CDEBUG(DBG_INFO, "Upgrading database schema from version %d to %d",
+		       version, migrations[i].version);
+
+		rena_database_begin_transaction (database);
+		if (!rena_database_apply_migration (database, &migrations[i])) {
+			rena_database_rollback_transaction (database);
+			g_critical ("Unable to upgrade database schema to version %d",
+			            migrations[i].version);
+			return FALSE;
+		}
+		rena_database_commit_transaction (database);
+
+		version = migrations[i].version;
+	}
+
+	rena_database_check_search_index (database);
+
+	return TRUE;
+}
 
-		"PRAGMA synchronous=OFF",
+gboolean
+rena_database_init_schema (RenaDatabase *database)
+{
+	gint version, i;
 
+	const gchar *queries[] = {
 		"CREATE TABLE IF NOT EXISTS TRACK "
 			"(location INT PRIMARY KEY,"
 			"provider INT,"
@@ -1105,12 +2978,28 @@ rena_database_init_schema (RenaDatabase *database)
 			"UNIQUE(name));"
 	};
 
-	for (i = 0; i < G_N_ELEMENTS(queries); i++) {
-		if (!rena_database_exec_query (database, queries[i]))
+	version = rena_database_get_version (database);
+
+	/* New databases give back their free pages in the idle maintenance.
+	 * It only applies before the first table, so just once. The older
+	 * ones are converted by the maintenance with a VACUUM. */
+
+	if (version == 0 && !rena_database_has_table (database, "TRACK")) {
+		if (!rena_database_exec_query (database, "PRAGMA auto_vacuum=INCREMENTAL"))
 			return FALSE;
 	}
 
-	return TRUE;
+	/* The tables of the base version, that later migrations change or
+	 * drop, so only for new databases or the ones from before it. */
+
+	if (version <= RENA_DATABASE_BASE_VERSION) {
+		for (i = 0; i < G_N_ELEMENTS(queries); i++) {
+			if (!rena_database_exec_query (database, queries[i]))
+				return FALSE;
+		}
+	}
+
+	return rena_database_upgrade_schema (database);
 }
 
 /**
@@ -1125,6 +3014,22 @@ rena_database_change_playlists_done(RenaDatabase *database)
 	g_signal_emit (database, signals[SIGNAL_PLAYLISTS_CHANGED], 0);
 }
 
+/**
+ * rena_database_change_tracks_done:
+ * @database: a #RenaDatabase
+ * @loc_arr: a #GArray with the gint location ids of the changed tracks.
+ * @changed: the TAG_*_CHANGED mask of the columns that changed.
+ *
+ * Emits TracksChanged, so listeners can update only these tracks.
+ */
+void
+rena_database_change_tracks_done (RenaDatabase *database, GArray *loc_arr, gint changed)
+{
+	g_return_if_fail(RENA_IS_DATABASE(database));
+
+	g_signal_emit (database, signals[SIGNAL_TRACKS_CHANGED], 0, loc_arr, changed);
+}
+
 /**
  * rena_database_compatibilize_version:
  *
@@ -1143,16 +3048,36 @@ rena_database_compatibilize_version (RenaDatabase *database)
 		"DROP TABLE GENRE",
 		"DROP TABLE YEAR",
 		"DROP TABLE COMMENT",
-		"DROP TABLE MIME_TYPE"
+		"DROP TABLE MIME_TYPE",
+		"DROP TABLE IF EXISTS TRACK_SEARCH",
+		"DROP TABLE IF EXISTS DIRECTORY"
 	};
 
+	/* Dropping LOCATION does not fire its triggers. Keep the files of the
+	 * playlists before their location ids are reused. */
+	if (rena_database_has_table (database, "PLAYLIST_ENTRIES"))
+		rena_database_exec_query (database,
+			"UPDATE PLAYLIST_ENTRIES SET uri = (SELECT name FROM LOCATION WHERE id = location), location = NULL "
+			"WHERE location IS NOT NULL");
+
 	for (i = 0; i < G_N_ELEMENTS(queries); i++) {
 		if (!rena_database_exec_query (database, queries[i]))
 			success = FALSE;
 	}
+
+	/* Replay every migration on the new tables. */
+
+	rena_database_intern_clear (database);
+
+	if (success && !rena_database_set_version (database, RENA_DATABASE_BASE_VERSION))
+		success = FALSE;
 	if (success && !rena_database_init_schema (database))
 		success = FALSE;
 
+	/* Dropping the tables does not fire the triggers. */
+	if (success && !rena_database_exec_query (database, "UPDATE LIBRARY_STATE SET generation = generation + 1"))
+		success = FALSE;
+
 	database->priv->successfully = success;
 }
 
@@ -1170,6 +3095,26 @@ rena_database_get_version (RenaDatabase *database)
 	return version;
 }
 
+/**
+ * rena_database_get_library_generation:
+ *
+ * Return value: a counter that changes each time a track is added, edited
+ * or removed from the library.
+ */
+gint64
+rena_database_get_library_generation (RenaDatabase *database)
+{
+	gint64 generation = -1;
+
+	const gchar *sql = "SELECT generation FROM LIBRARY_STATE";
+	RenaPreparedStatement *statement = rena_database_create_statement (database, sql);
+	if (rena_prepared_statement_step (statement))
+		generation = rena_prepared_statement_get_int64 (statement, 0);
+	rena_prepared_statement_free (statement);
+
+	return generation;
+}
+
 /**
  * rena_database_start_successfully:
  *
@@ -1188,18 +3133,69 @@ rena_database_get_last_error (RenaDatabase *database)
 	return sqlite3_errmsg (database->priv->sqlitedb);
 }
 
-static void
+/**
+ * rena_database_print_stats:
+ *
+ * Logs the memory used by the statements. With the DBG_DB debug level,
+ * also a table with the stats of every SQL and the last slow queries.
+ */
+void
 rena_database_print_stats (RenaDatabase *database)
 {
 	RenaDatabasePrivate *priv = database->priv;
+	RenaDatabaseStatementStats *stats;
+	RenaDatabaseSlowQuery *query;
+	GPtrArray *stats_arr;
+	GList *stats_list, *l;
 	int current = 0, high = 0;
+	guint i;
 
 	sqlite3_db_status (priv->sqlitedb, SQLITE_DBSTATUS_STMT_USED, &current, &high, 0);
 	gchar *formatted = g_format_size_full (current, G_FORMAT_SIZE_IEC_UNITS);
-	CDEBUG (DBG_DB, "statements in cache: %i, mem used: %s",
-			g_hash_table_size (priv->statements_cache),
+	CDEBUG (DBG_DB, "statements in cache: %u, hits: %u, misses: %u, evictions: %u, mem used: %s",
+			priv->statements_cache->lru.length,
+			priv->statements_cache->hits,
+			priv->statements_cache->misses,
+			priv->statements_cache->evictions,
 			formatted);
 	g_free (formatted);
+
+	if (G_LIKELY(DBG_DB > debug_level))
+		return;
+
+	g_mutex_lock (&priv->stats_mutex);
+
+	/* Statements, slowest first. */
+	stats_list = g_hash_table_get_values (priv->statement_stats);
+	stats_arr = g_ptr_array_sized_new (g_hash_table_size (priv->statement_stats));
+	for (l = stats_list; l != NULL; l = l->next)
+		g_ptr_array_add (stats_arr, l->data);
+	g_list_free (stats_list);
+	g_ptr_array_sort (stats_arr, rena_database_compare_statement_stats);
+
+	CDEBUG (DBG_DB, "%8s %10s %10s %9s %6s %6s  %s",
+	        "calls", "rows", "total ms", "max ms", "hits", "misses", "sql");
+	for (i = 0; i < stats_arr->len; i++) {
+		stats = g_ptr_array_index (stats_arr, i);
+		CDEBUG (DBG_DB, "%8u %10u %10.1f %9.1f %6u %6u  %s",
+		        stats->executions, stats->rows,
+		        stats->total_time / 1000.0, stats->max_time / 1000.0,
+		        stats->cache_hits, stats->cache_misses,
+		        stats->sql);
+	}
+	g_ptr_array_free (stats_arr, TRUE);
+
+	/* Last slow queries, oldest first. */
+	CDEBUG (DBG_DB, "%u slow queries over %.1f ms:",
+	        g_queue_get_length (priv->slow_queries),
+	        RENA_DATABASE_SLOW_QUERY_TIME / 1000.0);
+	for (l = priv->slow_queries->head; l != NULL; l = l->next) {
+		query = l->data;
+		CDEBUG (DBG_DB, "%10.1f ms %10u rows  %s",
+		        query->time / 1000.0, query->rows, query->sql);
+	}
+
+	g_mutex_unlock (&priv->stats_mutex);
 }
 
 static void
@@ -1207,10 +3203,26 @@ rena_database_finalize (GObject *object)
 {
 	RenaDatabase *database = RENA_DATABASE(object);
 	RenaDatabasePrivate *priv = database->priv;
+	RenaDatabaseReader *reader;
+	guint i;
 
 	rena_database_print_stats (database);
 
-	g_hash_table_destroy (priv->statements_cache);
+	rena_database_statement_cache_free (priv->statements_cache);
+	for (i = 0; i < INTERN_LAST; i++) {
+		rena_database_intern_reset (&priv->intern[i]);
+		g_hash_table_destroy (priv->intern[i].entries);
+	}
+
+	while ((reader = g_async_queue_try_pop (priv->readers)))
+		rena_database_reader_free (reader);
+	g_async_queue_unref (priv->readers);
+	g_mutex_clear (&priv->readers_mutex);
+
+	g_hash_table_destroy (priv->statement_stats);
+	g_queue_free_full (priv->slow_queries, (GDestroyNotify) rena_database_slow_query_free);
+	g_mutex_clear (&priv->stats_mutex);
+	g_free (priv->database_file);
 
 	sqlite3_close(priv->sqlitedb);
 
@@ -1232,13 +3244,20 @@ rena_database_class_init (RenaDatabaseClass *klass)
 	                                                  NULL, NULL,
 	                                                  g_cclosure_marshal_VOID__VOID,
 	                                                  G_TYPE_NONE, 0);
+
+	signals[SIGNAL_TRACKS_CHANGED] = g_signal_new ("TracksChanged",
+	                                               G_TYPE_FROM_CLASS (object_class),
+	                                               G_SIGNAL_RUN_LAST,
+	                                               G_STRUCT_OFFSET (RenaDatabaseClass, tracks_change),
+	                                               NULL, NULL,
+	                                               g_cclosure_marshal_generic,
+	                                               G_TYPE_NONE, 2, G_TYPE_POINTER, G_TYPE_INT);
 }
 
 static void
 rena_database_init (RenaDatabase *database)
 {
-	gint ret;
-	gchar *database_file;
+	guint i;
 	const gchar *home;
 
 	database->priv = G_TYPE_INSTANCE_GET_PRIVATE(database,
@@ -1247,28 +3266,52 @@ rena_database_init (RenaDatabase *database)
 
 	RenaDatabasePrivate *priv = database->priv;
 
-	priv->statements_cache = g_hash_table_new_full (g_str_hash, g_str_equal, NULL,
-	                                       (GDestroyNotify) rena_prepared_statement_finalize);
+	priv->statements_cache = rena_database_statement_cache_new (RENA_DATABASE_STATEMENTS_CACHE_SIZE);
+
+	for (i = 0; i < INTERN_LAST; i++)
+		rena_database_intern_init (&priv->intern[i], i == INTERN_YEAR);
+
+	priv->readers = g_async_queue_new ();
+	g_mutex_init (&priv->readers_mutex);
+
+	priv->statement_stats = g_hash_table_new_full (g_str_hash, g_str_equal, NULL,
+	                                               (GDestroyNotify) rena_database_statement_stats_free);
+	priv->slow_queries = g_queue_new ();
+	g_mutex_init (&priv->stats_mutex);
 
 	home = g_get_user_config_dir();
-	database_file = g_build_path(G_DIR_SEPARATOR_S, home, "/rena/rena.db", NULL);
+	priv->database_file = g_build_path(G_DIR_SEPARATOR_S, home, "/rena/rena.db", NULL);
 
 	priv->successfully = FALSE;
+}
+
+/* Opens the connection, with what each connection needs and nothing
+ * of the schema, which only the global instance checks. */
+
+static gboolean
+rena_database_open (RenaDatabase *database)
+{
+	RenaDatabasePrivate *priv = database->priv;
 
 	/* Create the database file */
 
-	ret = sqlite3_open(database_file, &priv->sqlitedb);
-	if (ret) {
-		g_critical("Unable to open/create DATABASE file : %s", database_file);
-		g_free(database_file);
-		return;
+	if (sqlite3_open(priv->database_file, &priv->sqlitedb)) {
+		g_critical("Unable to open/create DATABASE file : %s", priv->database_file);
+		return FALSE;
 	}
-	g_free(database_file);
 
-	if (!rena_database_init_schema (database))
-		return;
+	sqlite3_create_function (priv->sqlitedb, "rena_sort_key", 1,
+	                         SQLITE_UTF8 | SQLITE_DETERMINISTIC, NULL,
+	                         rena_database_sort_key_func, NULL, NULL);
+
+	/* WAL lets the reader connections work alongside the writer, and with
+	 * it synchronous=NORMAL is still safe against crashes. */
 
-	priv->successfully = TRUE;
+	rena_database_exec_query (database, "PRAGMA journal_mode=WAL");
+	rena_database_exec_query (database, "PRAGMA synchronous=NORMAL");
+	sqlite3_busy_timeout (priv->sqlitedb, 5000);
+
+	return TRUE;
 }
 
 /**
@@ -1290,6 +3333,9 @@ rena_database_get (void)
       database = g_object_new(RENA_TYPE_DATABASE, NULL);
       g_object_add_weak_pointer(G_OBJECT (database),
                                 (gpointer) &database);
+
+      if (rena_database_open (database) && rena_database_init_schema (database))
+         database->priv->successfully = TRUE;
    }
    else {
       g_object_ref (G_OBJECT (database));
@@ -1297,3 +3343,25 @@ rena_database_get (void)
 
    return database;
 }
+
+/**
+ * rena_database_new_writer:
+ *
+ * Opens another connection on the library, with caches of its own, to
+ * write from a thread without blocking the main one. It must be used by
+ * a single thread, and writes are serialized with the global instance
+ * by SQLite, so keep its transactions short. The schema is left to the
+ * global instance, which must have been created before.
+ *
+ * Return value: a new #RenaDatabase. Call g_object_unref() when done.
+ **/
+RenaDatabase *
+rena_database_new_writer (void)
+{
+	RenaDatabase *database;
+
+	database = g_object_new (RENA_TYPE_DATABASE, NULL);
+	database->priv->successfully = rena_database_open (database);
+
+	return database;
+}
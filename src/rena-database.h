@@ -35,6 +35,14 @@ G_BEGIN_DECLS
 typedef struct _RenaDatabase RenaDatabase;
 typedef struct _RenaDatabaseClass RenaDatabaseClass;
 typedef struct _RenaDatabasePrivate RenaDatabasePrivate;
+typedef struct _RenaDatabaseReader RenaDatabaseReader;
+
+/* What tells whether a file of the library changed since it was read. */
+typedef struct {
+	gint64 mtime;
+	gint64 size;
+	gint64 inode;
+} RenaDatabaseFingerprint;
 
 struct _RenaDatabase
 {
@@ -48,7 +56,7 @@ struct _RenaDatabaseClass
 {
 	GObjectClass parent_class;
 	void (*playlists_change) (RenaDatabase *database);
-	void (*tracks_change)    (RenaDatabase *database);
+	void (*tracks_change)    (RenaDatabase *database, GArray *loc_arr, gint changed);
 };
 
 gboolean
@@ -58,15 +66,33 @@ rena_database_exec_query (RenaDatabase *database,
 RenaPreparedStatement *
 rena_database_create_statement (RenaDatabase *database, const gchar *sql);
 
+RenaPreparedStatement *
+rena_database_create_dynamic_statement (RenaDatabase *database, const gchar *sql);
+
 void
 rena_database_release_statement (RenaDatabase *database, RenaPreparedStatement *statement);
 
+RenaDatabaseReader *
+rena_database_reader_acquire (RenaDatabase *database);
+
 void
-rena_database_begin_transaction (RenaDatabase *database);
+rena_database_reader_release (RenaDatabase *database, RenaDatabaseReader *reader);
+
+RenaPreparedStatement *
+rena_database_reader_create_statement (RenaDatabaseReader *reader, const gchar *sql);
 
 void
+rena_database_reader_release_statement (RenaDatabaseReader *reader, RenaPreparedStatement *statement);
+
+gboolean
+rena_database_begin_transaction (RenaDatabase *database);
+
+gboolean
 rena_database_commit_transaction (RenaDatabase *database);
 
+gboolean
+rena_database_rollback_transaction (RenaDatabase *database);
+
 gint
 rena_database_find_location (RenaDatabase *database, const gchar *location);
 
@@ -103,6 +129,9 @@ rena_database_find_radio (RenaDatabase *database, const gchar *radio);
 gint
 rena_database_add_new_location (RenaDatabase *database, const gchar *location);
 
+gboolean
+rena_database_get_location_fingerprint (RenaDatabase *database, const gchar *location, gint64 *mtime, gint64 *size, gint64 *inode);
+
 gint
 rena_database_add_new_provider_type (RenaDatabase *database, const gchar *provider_type);
 
@@ -130,6 +159,9 @@ rena_database_add_new_playlist (RenaDatabase *database, const gchar *playlist);
 void
 rena_database_add_playlist_track (RenaDatabase *database, gint playlist_id, const gchar *file);
 
+void
+rena_database_add_playlist_tracks (RenaDatabase *database, gint playlist_id, GPtrArray *files);
+
 gboolean
 rena_database_playlist_has_track (RenaDatabase *database, gint playlist_id, const gchar *file);
 
@@ -175,6 +207,12 @@ rena_database_delete_radio (RenaDatabase *database, const gchar *radio);
 void
 rena_database_add_new_musicobject (RenaDatabase *database, RenaMusicobject *mobj);
 
+gboolean
+rena_database_add_new_musicobjects (RenaDatabase *database, GPtrArray *mobjs);
+
+gboolean
+rena_database_replace_musicobjects (RenaDatabase *database, GPtrArray *mobjs, GPtrArray *fingerprints, GArray *location_ids);
+
 gchar *
 rena_database_get_filename_from_location_id (RenaDatabase *database, gint location_id);
 
@@ -190,6 +228,9 @@ rena_database_flush (RenaDatabase *database);
 void
 rena_database_flush_stale_entries (RenaDatabase *database);
 
+void
+rena_database_invalidate_caches (RenaDatabase *database);
+
 gint
 rena_database_get_artist_count (RenaDatabase *database);
 
@@ -199,15 +240,27 @@ rena_database_get_album_count (RenaDatabase *database);
 gint
 rena_database_get_track_count (RenaDatabase *database);
 
+GArray *
+rena_database_search_locations (RenaDatabase *database, const gchar *text);
+
 void
 rena_database_change_playlists_done(RenaDatabase *database);
 
+void
+rena_database_change_tracks_done (RenaDatabase *database, GArray *loc_arr, gint changed);
+
 void
 rena_database_compatibilize_version (RenaDatabase *database);
 
 gint
 rena_database_get_version (RenaDatabase *database);
 
+void
+rena_database_print_stats (RenaDatabase *database);
+
+gint64
+rena_database_get_library_generation (RenaDatabase *database);
+
 gboolean
 rena_database_start_successfully (RenaDatabase *database);
 
@@ -216,6 +269,8 @@ rena_database_get_last_error (RenaDatabase *database);
 
 RenaDatabase* rena_database_get (void);
 
+RenaDatabase *rena_database_new_writer (void);
+
 G_END_DECLS
 
 #endif /* RENA_DATABASE_H */
@@ -35,7 +35,7 @@ rena_dnd_library_get_mobj_list (GtkSelectionData *data, RenaDatabase *cdbase)
 {
 	gint n = 0, location_id = 0;
 	gchar *name = NULL, *uri, **uris;
-	RenaMusicobject *mobj = NULL;
+	GArray *loc_arr;
 	GList *list = NULL;
 
 	CDEBUG(DBG_VERBOSE, "Dnd: Library");
@@ -50,30 +50,36 @@ rena_dnd_library_get_mobj_list (GtkSelectionData *data, RenaDatabase *cdbase)
 
 	rena_database_begin_transaction (cdbase);
 
-	/* Get the mobjs from the path of the library. */
+	/* Get the mobjs from the path of the library. Consecutive tracks are
+	 * hydrated together. */
+
+	loc_arr = g_array_new (FALSE, FALSE, sizeof(gint));
 
 	for (n = 0; uris[n] != NULL; n++) {
 		uri = uris[n];
 		if (g_str_has_prefix(uri, "Location:/")) {
 			location_id = atoi(uri + strlen("Location:/"));
-			mobj = new_musicobject_from_db (cdbase, location_id);
-			if (G_LIKELY(mobj))
-				list = g_list_prepend(list, mobj);
+			g_array_append_val (loc_arr, location_id);
 		}
 		else if(g_str_has_prefix(uri, "Playlist:/")) {
+			list = add_location_ids_to_mobj_list (cdbase, loc_arr, list);
 			name = uri + strlen("Playlist:/");
 			list = add_playlist_to_mobj_list (cdbase, name, list);
 		}
 		else if(g_str_has_prefix(uri, "Radio:/")) {
+			list = add_location_ids_to_mobj_list (cdbase, loc_arr, list);
 			name = uri + strlen("Radio:/");
 			list = add_radio_to_mobj_list (cdbase, name, list);
 		}
 	}
+	list = add_location_ids_to_mobj_list (cdbase, loc_arr, list);
+
 	rena_database_commit_transaction (cdbase);
 
+	g_array_free (loc_arr, TRUE);
 	g_strfreev(uris);
 
-	return g_list_reverse (list);
+	return list;
 }
 
 GList *
@@ -24,6 +24,14 @@
 #include <gtk/gtk.h>
 #include <glib.h>
 #include <glib/gstdio.h>
+#include <string.h>
+
+#ifndef G_OS_WIN32
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#endif
 
 #include "rena-utils.h"
 #include "rena-playlists-mgmt.h"
@@ -201,6 +209,162 @@ rena_pl_parser_guess_format_from_extension (const gchar *filename)
 
 /* Determine if the any file is useful to rena. */
 
+static RenaMediaType
+rena_file_get_media_type_from_mime (const gchar *mime, const gchar *filename)
+{
+	if (is_valid_mime(mime, mime_flac) ||
+	    is_valid_mime(mime, mime_mpeg) ||
+	    is_valid_mime(mime, mime_ogg) ||
+	    is_valid_mime(mime, mime_wav) ||
+	    is_valid_mime(mime, mime_asf) ||
+	    is_valid_mime(mime, mime_mp4) ||
+	    is_valid_mime(mime, mime_ape) ||
+	    is_valid_mime(mime, mime_tracker))
+		return MEDIA_TYPE_AUDIO;
+	#ifdef HAVE_PLPARSER
+	else if (is_valid_mime(mime, mime_playlist))
+	#else
+	else if (g_str_has_suffix (filename, ".m3u") || g_str_has_suffix (filename, ".M3U") ||
+	         g_str_has_suffix (filename, ".pls") || g_str_has_suffix (filename, ".PLS") ||
+	         g_str_has_suffix (filename, ".xspf") || g_str_has_suffix (filename, ".XSPF") ||
+	         g_str_has_suffix (filename, ".asx") || g_str_has_suffix (filename, ".ASX") ||
+	         g_str_has_suffix (filename, ".wax") || g_str_has_suffix (filename, ".WAX"))
+	#endif
+		return MEDIA_TYPE_PLAYLIST;
+	else if (is_valid_mime(mime, mime_image))
+		return MEDIA_TYPE_IMAGE;
+
+	return MEDIA_TYPE_UNKNOWN;
+}
+
+/*
+ * Media type by extension.
+ *
+ * The media type of the usual extensions is guessed once from their names,
+ * as the content type would be, so most files are classified by a lookup.
+ * The extensions guessed with uncertainty, or that may be a playlist or
+ * a media file, are left out, and those files are still guessed one by one.
+ */
+
+#define MEDIA_EXTENSION_MAX 8
+
+static const gchar *media_extensions[] = {
+	"flac", "mp3", "mp2", "mpga", "ogg", "oga", "opus", "spx", "wav",
+	"wma", "asf", "m4a", "m4b", "aac", "ape", "mod", "xm", "s3m", "it",
+	"m3u", "m3u8", "pls", "xspf", "asx", "wax",
+	"jpg", "jpeg", "png", "gif", "bmp",
+	"txt", "nfo", "log", "cue", "pdf", "db", "ini", "sfv", "md5", "url",
+	NULL
+};
+
+static GHashTable *media_extensions_table = NULL;
+
+static gint media_type_by_extension = 0;
+static gint media_type_by_content = 0;
+
+static gchar *
+rena_file_guess_mime_from_name (const gchar *filename, gboolean *uncertain)
+{
+	gchar *content_type;
+#ifdef G_OS_WIN32
+	gchar *mime_type;
+#endif
+
+	content_type = g_content_type_guess (filename, NULL, 0, uncertain);
+#ifdef G_OS_WIN32
+	mime_type = g_content_type_get_mime_type (content_type);
+	g_free (content_type);
+	return mime_type;
+#else
+	return content_type;
+#endif
+}
+
+static GHashTable *
+rena_file_get_media_extensions (void)
+{
+	static gsize initialized = 0;
+	GHashTable *table;
+	RenaMediaType media_type;
+	gboolean uncertain;
+	gchar *filename, *mime;
+	gint i;
+
+	if (g_once_init_enter (&initialized)) {
+		table = g_hash_table_new (g_str_hash, g_str_equal);
+		for (i = 0; media_extensions[i] != NULL; i++) {
+			filename = g_strconcat ("file.", media_extensions[i], NULL);
+			mime = rena_file_guess_mime_from_name (filename, &uncertain);
+			if (mime && !uncertain
+#ifdef HAVE_PLPARSER
+			    && !is_valid_mime (mime, mime_dual)
+#endif
+			    ) {
+				media_type = rena_file_get_media_type_from_mime (mime, filename);
+				g_hash_table_insert (table, (gpointer) media_extensions[i],
+				                     GINT_TO_POINTER(media_type + 1));
+			}
+			g_free (mime);
+			g_free (filename);
+		}
+		media_extensions_table = table;
+		g_once_init_leave (&initialized, 1);
+	}
+
+	return media_extensions_table;
+}
+
+/* Initializes the table of extensions, so the first scan does not wait. */
+
+void
+rena_file_media_types_init (void)
+{
+	rena_file_get_media_extensions ();
+}
+
+/**
+ * rena_file_get_media_type_stats:
+ *
+ * Counts of the files classified by their extension and by their content
+ * type since startup.
+ */
+void
+rena_file_get_media_type_stats (guint *by_extension, guint *by_content)
+{
+	*by_extension = g_atomic_int_get (&media_type_by_extension);
+	*by_content = g_atomic_int_get (&media_type_by_content);
+}
+
+static gboolean
+rena_file_lookup_media_type (const gchar *filename, RenaMediaType *media_type)
+{
+	const gchar *extension, *basename;
+	gchar lower[MEDIA_EXTENSION_MAX + 1];
+	gpointer value;
+	gsize i;
+
+	basename = strrchr (filename, G_DIR_SEPARATOR);
+	extension = strrchr (basename ? basename : filename, '.');
+	if (extension == NULL || extension[1] == '\0')
+		return FALSE;
+
+	extension++;
+	for (i = 0; extension[i] != '\0'; i++) {
+		if (i == MEDIA_EXTENSION_MAX)
+			return FALSE;
+		lower[i] = g_ascii_tolower (extension[i]);
+	}
+	lower[i] = '\0';
+
+	value = g_hash_table_lookup (rena_file_get_media_extensions (), lower);
+	if (value == NULL)
+		return FALSE;
+
+	*media_type = GPOINTER_TO_INT(value) - 1;
+
+	return TRUE;
+}
+
 RenaMediaType
 rena_file_get_media_type (const gchar *filename)
 {
@@ -210,35 +374,21 @@ rena_file_get_media_type (const gchar *filename)
 	if (!filename)
 		return ret;
 
+	if (rena_file_lookup_media_type (filename, &ret)) {
+		g_atomic_int_inc (&media_type_by_extension);
+		return ret;
+	}
+
+	g_atomic_int_inc (&media_type_by_content);
+
 #ifdef G_OS_WIN32
 	result = get_mime_type_from_uri (filename, NULL);
 #else
 	result = get_mime_type (filename);
 #endif
 
-	if (result) {
-		if (is_valid_mime(result, mime_flac) ||
-		    is_valid_mime(result, mime_mpeg) ||
-		    is_valid_mime(result, mime_ogg) ||
-		    is_valid_mime(result, mime_wav) ||
-		    is_valid_mime(result, mime_asf) ||
-		    is_valid_mime(result, mime_mp4) ||
-		    is_valid_mime(result, mime_ape) ||
-		    is_valid_mime(result, mime_tracker))
-			ret = MEDIA_TYPE_AUDIO;
-		#ifdef HAVE_PLPARSER
-		else if (is_valid_mime(result, mime_playlist))
-		#else
-		else if (g_str_has_suffix (filename, ".m3u") || g_str_has_suffix (filename, ".M3U") ||
-		         g_str_has_suffix (filename, ".pls") || g_str_has_suffix (filename, ".PLS") ||
-		         g_str_has_suffix (filename, ".xspf") || g_str_has_suffix (filename, ".XSPF") ||
-		         g_str_has_suffix (filename, ".asx") || g_str_has_suffix (filename, ".ASX") ||
-		         g_str_has_suffix (filename, ".wax") || g_str_has_suffix (filename, ".WAX"))
-		#endif
-			ret = MEDIA_TYPE_PLAYLIST;
-		else if (is_valid_mime(result, mime_image))
-			ret = MEDIA_TYPE_IMAGE;
-	}
+	if (result)
+		ret = rena_file_get_media_type_from_mime (result, filename);
 
 	g_free(result);
 
@@ -434,40 +584,125 @@ get_pref_image_path_dir (RenaPreferences *preferences, const gchar *path)
 	return NULL;
 }
 
-/* Count files on a folder. */
+/* Read the entries of a folder with their kind.
+ *
+ * Where readdir gives the type of each entry no stat is needed, and only
+ * links and unknown types are resolved, relative to the folder. */
 
-gint rena_get_dir_count(const gchar *dir_name, GCancellable *cancellable)
+#ifdef G_OS_WIN32
+struct _RenaDir {
+	GDir  *dir;
+	gchar *path;
+};
+#else
+struct _RenaDir {
+	DIR   *dir;
+};
+#endif
+
+RenaDir *
+rena_dir_open (const gchar *path, GError **error)
 {
-	gint file_count = 0;
-	GDir *dir;
-	const gchar *next_file = NULL;
-	gchar *ab_file;
-	GError *error = NULL;
+	RenaDir *dir;
+#ifdef G_OS_WIN32
+	GDir *gdir;
 
-	dir = g_dir_open(dir_name, 0, &error);
-	if (!dir) {
-		g_warning("Unable to open library : %s", dir_name);
-		return file_count;
+	gdir = g_dir_open (path, 0, error);
+	if (gdir == NULL)
+		return NULL;
+
+	dir = g_slice_new0 (RenaDir);
+	dir->dir = gdir;
+	dir->path = g_strdup (path);
+#else
+	DIR *ddir;
+
+	ddir = opendir (path);
+	if (ddir == NULL) {
+		g_set_error (error, G_FILE_ERROR, g_file_error_from_errno (errno),
+		             "Error opening directory '%s': %s", path, g_strerror (errno));
+		return NULL;
 	}
 
-	next_file = g_dir_read_name(dir);
-	while (next_file) {
-		if(g_cancellable_is_cancelled (cancellable))
-			return 0;
+	dir = g_slice_new0 (RenaDir);
+	dir->dir = ddir;
+#endif
 
-		ab_file = g_strconcat(dir_name, G_DIR_SEPARATOR_S, next_file, NULL);
-		if (g_file_test(ab_file, G_FILE_TEST_IS_DIR))
-			file_count += rena_get_dir_count(ab_file, cancellable);
-		else {
-			file_count++;
+	return dir;
+}
+
+const gchar *
+rena_dir_read_entry (RenaDir *dir, RenaDirEntryType *type)
+{
+#ifdef G_OS_WIN32
+	const gchar *name;
+	gchar *file;
+
+	name = g_dir_read_name (dir->dir);
+	if (name == NULL)
+		return NULL;
+
+	file = g_build_filename (dir->path, name, NULL);
+	if (g_file_test (file, G_FILE_TEST_IS_DIR))
+		*type = RENA_DIR_ENTRY_DIRECTORY;
+	else if (g_file_test (file, G_FILE_TEST_IS_REGULAR))
+		*type = RENA_DIR_ENTRY_FILE;
+	else
+		*type = RENA_DIR_ENTRY_OTHER;
+	g_free (file);
+
+	return name;
+#else
+	struct dirent *entry;
+	struct stat sbuf;
+
+	while ((entry = readdir (dir->dir)) != NULL) {
+		if (g_strcmp0 (entry->d_name, ".") == 0 ||
+		    g_strcmp0 (entry->d_name, "..") == 0)
+			continue;
+
+#if defined(_DIRENT_HAVE_D_TYPE) || defined(DT_DIR)
+		switch (entry->d_type) {
+			case DT_DIR:
+				*type = RENA_DIR_ENTRY_DIRECTORY;
+				return entry->d_name;
+			case DT_REG:
+				*type = RENA_DIR_ENTRY_FILE;
+				return entry->d_name;
+			case DT_LNK:
+			case DT_UNKNOWN:
+				break;
+			default:
+				*type = RENA_DIR_ENTRY_OTHER;
+				return entry->d_name;
 		}
-		g_free(ab_file);
-		next_file = g_dir_read_name(dir);
+#endif
+		if (fstatat (dirfd (dir->dir), entry->d_name, &sbuf, 0) != 0)
+			*type = RENA_DIR_ENTRY_OTHER;
+		else if (S_ISDIR (sbuf.st_mode))
+			*type = RENA_DIR_ENTRY_DIRECTORY;
+		else if (S_ISREG (sbuf.st_mode))
+			*type = RENA_DIR_ENTRY_FILE;
+		else
+			*type = RENA_DIR_ENTRY_OTHER;
+
+		return entry->d_name;
 	}
 
-	g_dir_close(dir);
+	return NULL;
+#endif
+}
 
-	return file_count;
+void
+rena_dir_close (RenaDir *dir)
+{
+#ifdef G_OS_WIN32
+	g_dir_close (dir->dir);
+	g_free (dir->path);
+#else
+	closedir (dir->dir);
+#endif
+	g_slice_free (RenaDir, dir);
 }
 
 GList *
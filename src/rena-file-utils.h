@@ -63,6 +63,8 @@ extern const gchar *mime_dual[];
 gboolean is_playable_file(const gchar *file);
 
 RenaMediaType    rena_file_get_media_type                   (const gchar *filename);
+void               rena_file_media_types_init                 (void);
+void               rena_file_get_media_type_stats             (guint *by_extension, guint *by_content);
 gchar             *rena_file_get_music_type                   (const gchar *filename);
 RenaPlaylistType rena_pl_parser_guess_format_from_extension (const gchar *filename);
 
@@ -71,7 +73,17 @@ gboolean is_dir_and_accessible(const gchar *dir);
 gchar    *get_image_path_from_dir (const gchar *path);
 gchar    *get_pref_image_path_dir (RenaPreferences *preferences, const gchar *path);
 
-gint rena_get_dir_count(const gchar *dir_name, GCancellable *cancellable);
+typedef enum {
+	RENA_DIR_ENTRY_FILE,
+	RENA_DIR_ENTRY_DIRECTORY,
+	RENA_DIR_ENTRY_OTHER
+} RenaDirEntryType;
+
+typedef struct _RenaDir RenaDir;
+
+RenaDir     *rena_dir_open       (const gchar *path, GError **error);
+const gchar *rena_dir_read_entry (RenaDir *dir, RenaDirEntryType *type);
+void         rena_dir_close      (RenaDir *dir);
 
 GList *append_mobj_list_from_folder(GList *list, gchar *dir_name);
 GList *append_mobj_list_from_unknown_filename(GList *list, gchar *filename);
@@ -0,0 +1,943 @@
+/*
+ * Copyright (C) 2024 Santelmo Technologies <santelmotechnologies@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#if HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "rena-library-monitor.h"
+
+#include <string.h>
+#include <errno.h>
+#include <gio/gio.h>
+#include <glib/gstdio.h>
+
+#ifdef HAVE_SYS_INOTIFY_H
+#include <sys/inotify.h>
+#include <unistd.h>
+#include <glib-unix.h>
+#endif
+
+#include "rena-database.h"
+#include "rena-database-provider.h"
+#include "rena-file-utils.h"
+#include "rena-musicobject-mgmt.h"
+#include "rena-preferences.h"
+#include "rena-simple-async.h"
+#include "rena-utils.h"
+#include "rena-debug.h"
+
+/*
+ * Library monitor.
+ *
+ * Watches the folders of the local providers already in the library, with
+ * inotify where available or a GFileMonitor for each folder otherwise.
+ *
+ * Events are kept by path, the last one wins, and applied together once the
+ * folders are quiet for a while. The tags of the changed files are read in
+ * a thread, skipping the files whose fingerprint is the one saved, and then
+ * only those tracks are updated or forgotten.
+ *
+ * Folders are watched walking them in low priority slices, the shallowest
+ * first, up to a number of watches. Changes below the deepest folders
+ * watched are only found by the rescans.
+ */
+
+#define RENA_LIBRARY_MONITOR_DELAY        2   /* Seconds quiet before applying the events */
+#define RENA_LIBRARY_MONITOR_MAX_DELAY    (10 * G_TIME_SPAN_SECOND)
+#define RENA_LIBRARY_MONITOR_WALK_BUDGET  (10 * G_TIME_SPAN_MILLISECOND)
+#define RENA_LIBRARY_MONITOR_MAX_WATCHES  8192
+
+/* Tags changed when tracks are added or removed, that move the library tree. */
+#define RENA_LIBRARY_MONITOR_TRACKS_MOVED \
+	(TAG_ARTIST_CHANGED | TAG_ALBUM_CHANGED | TAG_GENRE_CHANGED | TAG_YEAR_CHANGED)
+
+#ifdef HAVE_SYS_INOTIFY_H
+#define RENA_LIBRARY_MONITOR_INOTIFY_MASK \
+	(IN_CLOSE_WRITE | IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF | IN_ONLYDIR)
+#endif
+
+typedef enum {
+	LIBRARY_MONITOR_NONE,
+	LIBRARY_MONITOR_CHANGED,
+	LIBRARY_MONITOR_DELETED,
+	LIBRARY_MONITOR_DELETED_FOLDER
+} RenaLibraryMonitorEventKind;
+
+typedef struct {
+	gchar                       *path;
+	gchar                       *root;
+	RenaLibraryMonitorEventKind  kind;
+
+	/* Fingerprint saved in the library, and the current one. */
+	gboolean                     saved;
+	RenaDatabaseFingerprint      saved_fingerprint;
+	RenaDatabaseFingerprint      fingerprint;
+
+	RenaMusicobject             *mobj;
+} RenaLibraryMonitorEvent;
+
+typedef struct {
+	RenaLibraryMonitor *monitor;
+	gchar              *path;
+	gchar              *root;
+	gint                wd;
+	GFileMonitor       *file_monitor;
+} RenaLibraryMonitorWatch;
+
+typedef struct {
+	gchar              *path;
+	gchar              *root;
+	gboolean            announce;
+} RenaLibraryMonitorFolder;
+
+typedef struct {
+	RenaLibraryMonitor *monitor;
+	GPtrArray          *events;
+} RenaLibraryMonitorBatch;
+
+struct _RenaLibraryMonitor {
+	RenaScanner          *scanner;
+	RenaDatabase         *database;
+	RenaDatabaseProvider *provider;
+	RenaPreferences      *preferences;
+
+	GHashTable           *roots;
+	GHashTable           *watches;
+	guint                 max_watches;
+	gboolean              exhausted;
+#ifdef HAVE_SYS_INOTIFY_H
+	gint                  inotify_fd;
+	guint                 inotify_id;
+	GHashTable           *watches_by_wd;
+#endif
+
+	/* Folders waiting to be watched. */
+	GQueue               *folders;
+	guint                 walk_id;
+
+	/* Events waiting to be applied, by path. */
+	GHashTable           *pending;
+	gint64                pending_since;
+	guint                 flush_id;
+
+	/* A batch of events in a thread. */
+	gboolean              applying;
+	gboolean              disposed;
+
+	/* Rescan asked for while the library was scanned. */
+	gboolean              rescan;
+	guint                 rescan_id;
+};
+
+static void
+rena_library_monitor_handle (RenaLibraryMonitor *monitor,
+                             const gchar        *root,
+                             const gchar        *path,
+                             gboolean            deleted,
+                             gboolean            is_folder);
+
+
+/*
+ * Events.
+ */
+
+static void
+rena_library_monitor_event_free (RenaLibraryMonitorEvent *event)
+{
+	if (event->mobj)
+		g_object_unref (event->mobj);
+	g_free (event->path);
+	g_free (event->root);
+	g_slice_free (RenaLibraryMonitorEvent, event);
+}
+
+static gboolean
+rena_library_monitor_flush (gpointer user_data);
+
+static void
+rena_library_monitor_add_event (RenaLibraryMonitor          *monitor,
+                                const gchar                 *root,
+                                const gchar                 *path,
+                                RenaLibraryMonitorEventKind  kind)
+{
+	RenaLibraryMonitorEvent *event;
+	gint64 now;
+
+	event = g_slice_new0 (RenaLibraryMonitorEvent);
+	event->path = g_strdup (path);
+	event->root = g_strdup (root);
+	event->kind = kind;
+	g_hash_table_replace (monitor->pending, event->path, event);
+
+	/* Wait for the folders to be quiet, but not forever. */
+
+	now = g_get_monotonic_time ();
+	if (monitor->flush_id == 0) {
+		monitor->pending_since = now;
+	}
+	else {
+		if (now - monitor->pending_since >= RENA_LIBRARY_MONITOR_MAX_DELAY)
+			return;
+		g_source_remove (monitor->flush_id);
+	}
+
+	monitor->flush_id = g_timeout_add_seconds (RENA_LIBRARY_MONITOR_DELAY,
+	                                           rena_library_monitor_flush,
+	                                           monitor);
+}
+
+
+/*
+ * Watches.
+ */
+
+static void
+rena_library_monitor_watch_free (RenaLibraryMonitorWatch *watch)
+{
+#ifdef HAVE_SYS_INOTIFY_H
+	if (watch->wd >= 0)
+		inotify_rm_watch (watch->monitor->inotify_fd, watch->wd);
+#endif
+	if (watch->file_monitor) {
+		g_signal_handlers_disconnect_by_data (watch->file_monitor, watch);
+		g_file_monitor_cancel (watch->file_monitor);
+		g_object_unref (watch->file_monitor);
+	}
+	g_free (watch->path);
+	g_free (watch->root);
+	g_slice_free (RenaLibraryMonitorWatch, watch);
+}
+
+static void
+rena_library_monitor_file_changed (GFileMonitor      *file_monitor,
+                                   GFile             *file,
+                                   GFile             *other_file,
+                                   GFileMonitorEvent  event_type,
+                                   gpointer           user_data)
+{
+	RenaLibraryMonitorWatch *watch = user_data;
+	RenaLibraryMonitor *monitor = watch->monitor;
+	gchar *path;
+
+	path = g_file_get_path (file);
+	if (path == NULL)
+		return;
+
+	/* The parent folder reports the folder itself. */
+	if (g_strcmp0 (path, watch->path) == 0) {
+		g_free (path);
+		return;
+	}
+
+	switch (event_type) {
+		case G_FILE_MONITOR_EVENT_CREATED:
+			rena_library_monitor_handle (monitor, watch->root, path, FALSE,
+			                             g_file_test (path, G_FILE_TEST_IS_DIR));
+			break;
+		case G_FILE_MONITOR_EVENT_CHANGES_DONE_HINT:
+			if (!g_file_test (path, G_FILE_TEST_IS_DIR))
+				rena_library_monitor_handle (monitor, watch->root, path, FALSE, FALSE);
+			break;
+		case G_FILE_MONITOR_EVENT_DELETED:
+			rena_library_monitor_handle (monitor, watch->root, path, TRUE,
+			                             g_hash_table_contains (monitor->watches, path));
+			break;
+		default:
+			break;
+	}
+
+	g_free (path);
+}
+
+static gboolean
+rena_library_monitor_add_watch (RenaLibraryMonitor *monitor, const gchar *path, const gchar *root)
+{
+	RenaLibraryMonitorWatch *watch;
+	GFile *file;
+	GError *error = NULL;
+
+	if (g_hash_table_size (monitor->watches) >= monitor->max_watches)
+		goto exhausted;
+
+	watch = g_slice_new0 (RenaLibraryMonitorWatch);
+	watch->monitor = monitor;
+	watch->wd = -1;
+
+#ifdef HAVE_SYS_INOTIFY_H
+	if (monitor->inotify_fd >= 0) {
+		watch->wd = inotify_add_watch (monitor->inotify_fd, path, RENA_LIBRARY_MONITOR_INOTIFY_MASK);
+		if (watch->wd < 0) {
+			g_slice_free (RenaLibraryMonitorWatch, watch);
+			if (errno == ENOSPC)
+				goto exhausted;
+			return FALSE;
+		}
+		g_hash_table_insert (monitor->watches_by_wd, GINT_TO_POINTER(watch->wd), watch);
+	}
+	else
+#endif
+	{
+		file = g_file_new_for_path (path);
+		watch->file_monitor = g_file_monitor_directory (file, G_FILE_MONITOR_NONE, NULL, &error);
+		g_object_unref (file);
+
+		if (watch->file_monitor == NULL) {
+			g_warning ("Unable to watch %s: %s", path, error->message);
+			g_error_free (error);
+			g_slice_free (RenaLibraryMonitorWatch, watch);
+			return FALSE;
+		}
+		g_signal_connect (watch->file_monitor, "changed",
+		                  G_CALLBACK(rena_library_monitor_file_changed), watch);
+	}
+
+	watch->path = g_strdup (path);
+	watch->root = g_strdup (root);
+	g_hash_table_insert (monitor->watches, watch->path, watch);
+
+	return TRUE;
+
+exhausted:
+	if (!monitor->exhausted) {
+		g_warning ("Watching %u library folders, changes in the others are found when rescanning",
+		           g_hash_table_size (monitor->watches));
+		monitor->exhausted = TRUE;
+	}
+	return FALSE;
+}
+
+static void
+rena_library_monitor_remove_watches (RenaLibraryMonitor *monitor, const gchar *path)
+{
+	RenaLibraryMonitorWatch *watch;
+	GHashTableIter iter;
+	gsize len;
+
+	len = strlen (path);
+
+	g_hash_table_iter_init (&iter, monitor->watches);
+	while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &watch)) {
+		if (strncmp (watch->path, path, len) != 0 ||
+		    (watch->path[len] != '\0' && watch->path[len] != G_DIR_SEPARATOR))
+			continue;
+#ifdef HAVE_SYS_INOTIFY_H
+		if (watch->wd >= 0)
+			g_hash_table_remove (monitor->watches_by_wd, GINT_TO_POINTER(watch->wd));
+#endif
+		g_hash_table_iter_remove (&iter);
+	}
+
+	monitor->exhausted = FALSE;
+}
+
+
+/*
+ * Walk of the folders to watch.
+ */
+
+static void
+rena_library_monitor_folder_free (RenaLibraryMonitorFolder *folder)
+{
+	g_free (folder->path);
+	g_free (folder->root);
+	g_slice_free (RenaLibraryMonitorFolder, folder);
+}
+
+static gboolean
+rena_library_monitor_walk (gpointer user_data);
+
+static void
+rena_library_monitor_queue_folder (RenaLibraryMonitor *monitor,
+                                   const gchar        *path,
+                                   const gchar        *root,
+                                   gboolean            announce)
+{
+	RenaLibraryMonitorFolder *folder;
+
+	folder = g_slice_new0 (RenaLibraryMonitorFolder);
+	folder->path = g_strdup (path);
+	folder->root = g_strdup (root);
+	folder->announce = announce;
+	g_queue_push_tail (monitor->folders, folder);
+
+	if (monitor->walk_id == 0)
+		monitor->walk_id = g_idle_add_full (G_PRIORITY_LOW,
+		                                    rena_library_monitor_walk,
+		                                    monitor,
+		                                    NULL);
+}
+
+/* Watches a folder and queues its subfolders. The files of the folders
+ * that appear while watching are announced as changed. */
+
+static void
+rena_library_monitor_walk_folder (RenaLibraryMonitor *monitor, RenaLibraryMonitorFolder *folder)
+{
+	RenaDir *dir;
+	RenaDirEntryType type;
+	const gchar *name;
+	gchar *path;
+
+	if (!g_hash_table_contains (monitor->roots, folder->root))
+		return;
+	if (g_hash_table_contains (monitor->watches, folder->path))
+		return;
+
+	if (!rena_library_monitor_add_watch (monitor, folder->path, folder->root) &&
+	    !folder->announce)
+		return;
+
+	dir = rena_dir_open (folder->path, NULL);
+	if (dir == NULL)
+		return;
+
+	while ((name = rena_dir_read_entry (dir, &type)) != NULL) {
+		path = g_build_filename (folder->path, name, NULL);
+		if (type == RENA_DIR_ENTRY_DIRECTORY)
+			rena_library_monitor_queue_folder (monitor, path, folder->root, folder->announce);
+		else if (type == RENA_DIR_ENTRY_FILE && folder->announce)
+			rena_library_monitor_add_event (monitor, folder->root, path, LIBRARY_MONITOR_CHANGED);
+		g_free (path);
+	}
+	rena_dir_close (dir);
+}
+
+static gboolean
+rena_library_monitor_walk (gpointer user_data)
+{
+	RenaLibraryMonitor *monitor = user_data;
+	RenaLibraryMonitorFolder *folder;
+	gint64 begin_time;
+
+	begin_time = g_get_monotonic_time ();
+
+	while ((folder = g_queue_pop_head (monitor->folders)) != NULL) {
+		rena_library_monitor_walk_folder (monitor, folder);
+		rena_library_monitor_folder_free (folder);
+
+		if (g_get_monotonic_time () - begin_time > RENA_LIBRARY_MONITOR_WALK_BUDGET)
+			return G_SOURCE_CONTINUE;
+	}
+
+	monitor->walk_id = 0;
+
+	return G_SOURCE_REMOVE;
+}
+
+static void
+rena_library_monitor_handle (RenaLibraryMonitor *monitor,
+                             const gchar        *root,
+                             const gchar        *path,
+                             gboolean            deleted,
+                             gboolean            is_folder)
+{
+	if (is_folder) {
+		if (deleted) {
+			rena_library_monitor_remove_watches (monitor, path);
+			rena_library_monitor_add_event (monitor, root, path, LIBRARY_MONITOR_DELETED_FOLDER);
+		}
+		else {
+			rena_library_monitor_queue_folder (monitor, path, root, TRUE);
+		}
+	}
+	else {
+		rena_library_monitor_add_event (monitor, root, path,
+		                                deleted ? LIBRARY_MONITOR_DELETED : LIBRARY_MONITOR_CHANGED);
+	}
+}
+
+/*
+ * Rescans, when events were lost.
+ */
+
+static gboolean
+rena_library_monitor_rescan (gpointer user_data)
+{
+	RenaLibraryMonitor *monitor = user_data;
+
+	monitor->rescan_id = 0;
+
+	/* Another scan started meanwhile, so wait for it too. */
+	if (rena_preferences_get_lock_library (monitor->preferences))
+		return G_SOURCE_REMOVE;
+
+	monitor->rescan = FALSE;
+	rena_scanner_update_library (monitor->scanner);
+
+	return G_SOURCE_REMOVE;
+}
+
+/* The scanner ignores a rescan while it scans, so wait for the library
+ * to be unlocked, and for the scan to return to the main loop. */
+
+static void
+rena_library_monitor_schedule_rescan (RenaLibraryMonitor *monitor)
+{
+	if (!monitor->rescan || monitor->rescan_id)
+		return;
+	if (rena_preferences_get_lock_library (monitor->preferences))
+		return;
+
+	monitor->rescan_id = g_idle_add (rena_library_monitor_rescan, monitor);
+}
+
+static void
+rena_library_monitor_lock_library_changed (RenaPreferences *preferences,
+                                           GParamSpec      *pspec,
+                                           gpointer         user_data)
+{
+	rena_library_monitor_schedule_rescan (user_data);
+}
+
+#ifdef HAVE_SYS_INOTIFY_H
+static void
+rena_library_monitor_inotify_event (RenaLibraryMonitor *monitor, struct inotify_event *event)
+{
+	RenaLibraryMonitorWatch *watch;
+	gboolean is_folder;
+	gchar *path;
+
+	/* Events were lost, so look for the changes rescanning. */
+	if (event->mask & IN_Q_OVERFLOW) {
+		g_warning ("Too many changes in the library folders, rescanning them");
+		monitor->rescan = TRUE;
+		rena_library_monitor_schedule_rescan (monitor);
+		return;
+	}
+
+	watch = g_hash_table_lookup (monitor->watches_by_wd, GINT_TO_POINTER(event->wd));
+	if (watch == NULL)
+		return;
+
+	if (event->mask & IN_IGNORED) {
+		g_hash_table_remove (monitor->watches_by_wd, GINT_TO_POINTER(event->wd));
+		watch->wd = -1;
+		g_hash_table_remove (monitor->watches, watch->path);
+		return;
+	}
+
+	/* The parent folder reports it too. */
+	if (event->len == 0)
+		return;
+
+	is_folder = (event->mask & IN_ISDIR) != 0;
+	path = g_build_filename (watch->path, event->name, NULL);
+
+	if (event->mask & (IN_DELETE | IN_MOVED_FROM))
+		rena_library_monitor_handle (monitor, watch->root, path, TRUE, is_folder);
+	else if (event->mask & IN_MOVED_TO)
+		rena_library_monitor_handle (monitor, watch->root, path, FALSE, is_folder);
+	else if ((event->mask & IN_CREATE) && is_folder)
+		rena_library_monitor_handle (monitor, watch->root, path, FALSE, TRUE);
+	else if ((event->mask & IN_CLOSE_WRITE) && !is_folder)
+		rena_library_monitor_handle (monitor, watch->root, path, FALSE, FALSE);
+
+	g_free (path);
+}
+
+static gboolean
+rena_library_monitor_inotify_read (gint fd, GIOCondition condition, gpointer user_data)
+{
+	RenaLibraryMonitor *monitor = user_data;
+	struct inotify_event *event;
+	gint64 buffer[4096 / sizeof(gint64)];
+	gssize len, offset;
+
+	while ((len = read (fd, buffer, sizeof(buffer))) > 0) {
+		for (offset = 0; offset < len; offset += sizeof(struct inotify_event) + event->len) {
+			event = (struct inotify_event *) ((gchar *) buffer + offset);
+			rena_library_monitor_inotify_event (monitor, event);
+		}
+	}
+
+	return G_SOURCE_CONTINUE;
+}
+
+static guint
+rena_library_monitor_get_max_watches (void)
+{
+	gchar *contents = NULL;
+	guint64 max_user_watches;
+	guint max_watches = RENA_LIBRARY_MONITOR_MAX_WATCHES;
+
+	/* Leave half of the watches of the user to other programs. */
+	if (g_file_get_contents ("/proc/sys/fs/inotify/max_user_watches", &contents, NULL, NULL)) {
+		max_user_watches = g_ascii_strtoull (contents, NULL, 10);
+		if (max_user_watches > 0)
+			max_watches = MIN (max_watches, max_user_watches / 2);
+		g_free (contents);
+	}
+
+	return max_watches;
+}
+#endif
+
+
+/*
+ * Apply the events.
+ */
+
+static gpointer
+rena_library_monitor_read_worker (gpointer data)
+{
+	RenaLibraryMonitorBatch *batch = data;
+	RenaLibraryMonitorEvent *event;
+	struct stat sbuf;
+	guint i;
+
+	for (i = 0; i < batch->events->len; i++) {
+		event = g_ptr_array_index (batch->events, i);
+		if (event->kind != LIBRARY_MONITOR_CHANGED)
+			continue;
+
+		if (g_stat (event->path, &sbuf) != 0 || !S_ISREG (sbuf.st_mode)) {
+			event->kind = LIBRARY_MONITOR_NONE;
+			continue;
+		}
+
+		event->fingerprint.mtime = sbuf.st_mtime;
+		event->fingerprint.size = sbuf.st_size;
+		event->fingerprint.inode = sbuf.st_ino;
+
+		if (event->saved &&
+		    event->saved_fingerprint.mtime == event->fingerprint.mtime &&
+		    event->saved_fingerprint.size == event->fingerprint.size &&
+		    event->saved_fingerprint.inode == event->fingerprint.inode) {
+			event->kind = LIBRARY_MONITOR_NONE;
+			continue;
+		}
+
+		if (rena_file_get_media_type (event->path) == MEDIA_TYPE_AUDIO)
+			event->mobj = new_musicobject_from_file (event->path, event->root);
+		if (event->mobj == NULL)
+			event->kind = LIBRARY_MONITOR_NONE;
+	}
+
+	return batch;
+}
+
+/* Tags of a track that changed, as the library pane expects them. */
+
+static gint
+rena_library_monitor_changed_tags (RenaMusicobject *saved, RenaMusicobject *mobj)
+{
+	gint changed = 0;
+
+	if (rena_musicobject_get_track_no (saved) != rena_musicobject_get_track_no (mobj))
+		changed |= TAG_TNO_CHANGED;
+	if (g_strcmp0 (rena_musicobject_get_title (saved), rena_musicobject_get_title (mobj)))
+		changed |= TAG_TITLE_CHANGED;
+	if (g_strcmp0 (rena_musicobject_get_artist (saved), rena_musicobject_get_artist (mobj)))
+		changed |= TAG_ARTIST_CHANGED;
+	if (g_strcmp0 (rena_musicobject_get_album (saved), rena_musicobject_get_album (mobj)))
+		changed |= TAG_ALBUM_CHANGED;
+	if (g_strcmp0 (rena_musicobject_get_genre (saved), rena_musicobject_get_genre (mobj)))
+		changed |= TAG_GENRE_CHANGED;
+	if (rena_musicobject_get_year (saved) != rena_musicobject_get_year (mobj))
+		changed |= TAG_YEAR_CHANGED;
+	if (g_strcmp0 (rena_musicobject_get_comment (saved), rena_musicobject_get_comment (mobj)))
+		changed |= TAG_COMMENT_CHANGED;
+
+	return changed;
+}
+
+static gboolean
+rena_library_monitor_read_finished (gpointer data)
+{
+	RenaLibraryMonitorBatch *batch = data;
+	RenaLibraryMonitor *monitor = batch->monitor;
+	RenaLibraryMonitorEvent *event;
+	GPtrArray *mobjs, *fingerprints, *saved_mobjs;
+	RenaMusicobject *saved;
+	GArray *saved_ids, *loc_arr;
+	guint i, changes = 0;
+	gint location_id, changed = 0;
+
+	monitor->applying = FALSE;
+
+	if (monitor->disposed) {
+		rena_library_monitor_free (monitor);
+		goto done;
+	}
+
+	mobjs = g_ptr_array_new ();
+	fingerprints = g_ptr_array_new ();
+	saved_ids = g_array_new (FALSE, FALSE, sizeof(gint));
+	loc_arr = g_array_new (FALSE, FALSE, sizeof(gint));
+
+	for (i = 0; i < batch->events->len; i++) {
+		event = g_ptr_array_index (batch->events, i);
+		if (event->kind != LIBRARY_MONITOR_CHANGED)
+			continue;
+		location_id = rena_database_find_location (monitor->database, event->path);
+		g_array_append_val (saved_ids, location_id);
+		g_ptr_array_add (mobjs, event->mobj);
+		g_ptr_array_add (fingerprints, &event->fingerprint);
+	}
+
+	/* The tracks as they were, to tell the listeners which tags changed.
+	 * Tracks added or removed move the tree as a new artist would. */
+
+	saved_mobjs = new_musicobjects_from_db (monitor->database, saved_ids);
+	for (i = 0; i < saved_mobjs->len; i++) {
+		saved = g_ptr_array_index (saved_mobjs, i);
+		if (saved) {
+			changed |= rena_library_monitor_changed_tags (saved, g_ptr_array_index (mobjs, i));
+			g_object_unref (saved);
+		}
+		else {
+			changed |= RENA_LIBRARY_MONITOR_TRACKS_MOVED;
+		}
+	}
+	g_ptr_array_free (saved_mobjs, TRUE);
+
+	rena_database_begin_transaction (monitor->database);
+
+	rena_database_replace_musicobjects (monitor->database, mobjs, fingerprints, loc_arr);
+	changes += mobjs->len;
+
+	for (i = 0; i < batch->events->len; i++) {
+		event = g_ptr_array_index (batch->events, i);
+		switch (event->kind) {
+			case LIBRARY_MONITOR_DELETED:
+				location_id = rena_database_find_location (monitor->database, event->path);
+				if (location_id) {
+					rena_database_forget_location (monitor->database, location_id);
+					g_array_append_val (loc_arr, location_id);
+					changed |= RENA_LIBRARY_MONITOR_TRACKS_MOVED;
+					changes++;
+				}
+				break;
+			case LIBRARY_MONITOR_DELETED_FOLDER:
+				rena_database_delete_dir (monitor->database, event->path);
+				changed |= RENA_LIBRARY_MONITOR_TRACKS_MOVED;
+				changes++;
+				break;
+			case LIBRARY_MONITOR_CHANGED:
+			case LIBRARY_MONITOR_NONE:
+			default:
+				break;
+		}
+	}
+
+	if (changes)
+		rena_database_flush_stale_entries (monitor->database);
+
+	rena_database_commit_transaction (monitor->database);
+
+	CDEBUG(DBG_INFO, "Library monitor applied %u of %u events", changes, batch->events->len);
+
+	/* Only what changed, so the views can skip reloading the library */
+
+	if (changed)
+		rena_database_change_tracks_done (monitor->database, loc_arr, changed);
+
+	g_ptr_array_free (mobjs, TRUE);
+	g_ptr_array_free (fingerprints, TRUE);
+	g_array_free (saved_ids, TRUE);
+	g_array_free (loc_arr, TRUE);
+
+done:
+	g_ptr_array_free (batch->events, TRUE);
+	g_slice_free (RenaLibraryMonitorBatch, batch);
+
+	return FALSE;
+}
+
+static gboolean
+rena_library_monitor_flush (gpointer user_data)
+{
+	RenaLibraryMonitor *monitor = user_data;
+	RenaLibraryMonitorBatch *batch;
+	RenaLibraryMonitorEvent *event;
+	GHashTableIter iter;
+
+	/* Retry later, while a batch is read or the library is scanned. */
+	if (monitor->applying || rena_preferences_get_lock_library (monitor->preferences))
+		return G_SOURCE_CONTINUE;
+
+	monitor->flush_id = 0;
+
+	batch = g_slice_new0 (RenaLibraryMonitorBatch);
+	batch->monitor = monitor;
+	batch->events = g_ptr_array_new_with_free_func ((GDestroyNotify) rena_library_monitor_event_free);
+
+	g_hash_table_iter_init (&iter, monitor->pending);
+	while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &event)) {
+		if (event->kind == LIBRARY_MONITOR_CHANGED)
+			event->saved = rena_database_get_location_fingerprint (monitor->database, event->path,
+			                                                       &event->saved_fingerprint.mtime,
+			                                                       &event->saved_fingerprint.size,
+			                                                       &event->saved_fingerprint.inode);
+		g_ptr_array_add (batch->events, event);
+		g_hash_table_iter_steal (&iter);
+	}
+
+	monitor->applying = TRUE;
+	rena_async_launch (rena_library_monitor_read_worker,
+	                   rena_library_monitor_read_finished,
+	                   batch);
+
+	return G_SOURCE_REMOVE;
+}
+
+
+/*
+ * Library folders.
+ */
+
+static void
+rena_library_monitor_update_roots (RenaLibraryMonitor *monitor)
+{
+	GSList *list, *l;
+	GHashTableIter iter;
+	const gchar *root;
+
+	list = rena_provider_get_handled_list_by_type (monitor->provider, "local");
+
+	g_hash_table_iter_init (&iter, monitor->roots);
+	while (g_hash_table_iter_next (&iter, (gpointer *) &root, NULL)) {
+		if (rena_string_list_is_present (list, root))
+			continue;
+		rena_library_monitor_remove_watches (monitor, root);
+		g_hash_table_iter_remove (&iter);
+	}
+
+	for (l = list; l != NULL; l = l->next) {
+		if (g_hash_table_contains (monitor->roots, l->data))
+			continue;
+		g_hash_table_add (monitor->roots, g_strdup (l->data));
+		rena_library_monitor_queue_folder (monitor, l->data, l->data, FALSE);
+	}
+
+	free_str_list (list);
+}
+
+static void
+rena_library_monitor_provider_changed (RenaDatabaseProvider *provider,
+                                       const gchar          *name,
+                                       gpointer              user_data)
+{
+	rena_library_monitor_update_roots (user_data);
+}
+
+static void
+rena_library_monitor_update_done (RenaDatabaseProvider *provider,
+                                  gpointer              user_data)
+{
+	rena_library_monitor_update_roots (user_data);
+}
+
+RenaLibraryMonitor *
+rena_library_monitor_new (RenaScanner *scanner)
+{
+	RenaLibraryMonitor *monitor;
+
+	monitor = g_slice_new0 (RenaLibraryMonitor);
+	monitor->scanner = scanner;
+	monitor->database = rena_database_get ();
+	monitor->provider = rena_database_provider_get ();
+	monitor->preferences = rena_preferences_get ();
+
+	monitor->roots = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+	monitor->watches = g_hash_table_new_full (g_str_hash, g_str_equal, NULL,
+	                                          (GDestroyNotify) rena_library_monitor_watch_free);
+	monitor->folders = g_queue_new ();
+	monitor->pending = g_hash_table_new_full (g_str_hash, g_str_equal, NULL,
+	                                          (GDestroyNotify) rena_library_monitor_event_free);
+	monitor->max_watches = RENA_LIBRARY_MONITOR_MAX_WATCHES;
+
+#ifdef HAVE_SYS_INOTIFY_H
+	monitor->watches_by_wd = g_hash_table_new (g_direct_hash, g_direct_equal);
+	monitor->inotify_fd = inotify_init1 (IN_NONBLOCK | IN_CLOEXEC);
+	if (monitor->inotify_fd >= 0) {
+		monitor->max_watches = rena_library_monitor_get_max_watches ();
+		monitor->inotify_id = g_unix_fd_add (monitor->inotify_fd, G_IO_IN,
+		                                     rena_library_monitor_inotify_read,
+		                                     monitor);
+	}
+	else {
+		CDEBUG(DBG_INFO, "Unable to use inotify, watching the library with GFileMonitor");
+	}
+#endif
+
+	g_signal_connect (monitor->provider, "provider-added",
+	                  G_CALLBACK(rena_library_monitor_provider_changed), monitor);
+	g_signal_connect (monitor->provider, "provider-removed",
+	                  G_CALLBACK(rena_library_monitor_provider_changed), monitor);
+	g_signal_connect (monitor->provider, "provider-toggled",
+	                  G_CALLBACK(rena_library_monitor_provider_changed), monitor);
+	g_signal_connect (monitor->provider, "update-done",
+	                  G_CALLBACK(rena_library_monitor_update_done), monitor);
+	g_signal_connect (monitor->preferences, "notify::lock-library",
+	                  G_CALLBACK(rena_library_monitor_lock_library_changed), monitor);
+
+	rena_library_monitor_update_roots (monitor);
+
+	return monitor;
+}
+
+void
+rena_library_monitor_free (RenaLibraryMonitor *monitor)
+{
+	if (!monitor->disposed) {
+		g_signal_handlers_disconnect_by_data (monitor->provider, monitor);
+		g_signal_handlers_disconnect_by_data (monitor->preferences, monitor);
+
+		if (monitor->walk_id)
+			g_source_remove (monitor->walk_id);
+		if (monitor->flush_id)
+			g_source_remove (monitor->flush_id);
+		if (monitor->rescan_id)
+			g_source_remove (monitor->rescan_id);
+		monitor->walk_id = 0;
+		monitor->flush_id = 0;
+		monitor->rescan_id = 0;
+
+		g_hash_table_remove_all (monitor->watches);
+#ifdef HAVE_SYS_INOTIFY_H
+		g_hash_table_remove_all (monitor->watches_by_wd);
+		if (monitor->inotify_id)
+			g_source_remove (monitor->inotify_id);
+		if (monitor->inotify_fd >= 0)
+			close (monitor->inotify_fd);
+		monitor->inotify_id = 0;
+		monitor->inotify_fd = -1;
+#endif
+	}
+
+	/* Freed when the batch being read returns. */
+	if (monitor->applying) {
+		monitor->disposed = TRUE;
+		return;
+	}
+
+	g_hash_table_destroy (monitor->roots);
+	g_hash_table_destroy (monitor->watches);
+#ifdef HAVE_SYS_INOTIFY_H
+	g_hash_table_destroy (monitor->watches_by_wd);
+#endif
+	g_queue_free_full (monitor->folders, (GDestroyNotify) rena_library_monitor_folder_free);
+	g_hash_table_destroy (monitor->pending);
+
+	g_object_unref (monitor->database);
+	g_object_unref (monitor->provider);
+	g_object_unref (monitor->preferences);
+
+	g_slice_free (RenaLibraryMonitor, monitor);
+}
@@ -0,0 +1,37 @@
+/*
+ * Copyright (C) 2024 Santelmo Technologies <santelmotechnologies@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef RENA_LIBRARY_MONITOR_H
+#define RENA_LIBRARY_MONITOR_H
+
+#include <glib.h>
+
+#include "rena-scanner.h"
+
+G_BEGIN_DECLS
+
+typedef struct _RenaLibraryMonitor RenaLibraryMonitor;
+
+RenaLibraryMonitor *
+rena_library_monitor_new  (RenaScanner *scanner);
+
+void
+rena_library_monitor_free (RenaLibraryMonitor *monitor);
+
+G_END_DECLS
+
+#endif /* RENA_LIBRARY_MONITOR_H */
@@ -31,6 +31,7 @@
 #include <glib/gstdio.h>
 #include <gdk/gdkkeysyms.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "rena-playback.h"
 
@@ -43,6 +44,8 @@
 #include "rena-musicobject-mgmt.h"
 #include "rena-database.h"
 #include "rena-database-provider.h"
+#include "rena-library-snapshot.h"
+#include "rena-query-result.h"
 #include "rena-dnd.h"
 
 #ifdef G_OS_WIN32
@@ -70,9 +73,13 @@ struct _RenaLibraryPane {
 	/* Useful flags */
 	gboolean           dragging;
 	gboolean           view_change;
+	guint              reload_id;
 
 	/* Filter stuff */
 	gchar             *filter_entry;
+	GHashTable        *filter_matches;
+	GHashTable        *location_rows;
+	GArray            *filter_rows;
 	guint              filter_id;
 	gboolean           filter_active;
 	guint              pulse_id;
@@ -141,6 +148,9 @@ typedef enum {
 #define RENA_BUTTON_SKIP_ALL   _("S_kip All")
 #define RENA_BUTTON_DELETE_ALL _("Delete _All")
 
+/* Rows added to the library tree between two refreshes of the interface. */
+#define LIBRARY_ROWS_PER_REFRESH 1024
+
 /*
  * Some prototypes
  */
@@ -155,6 +165,10 @@ static void rena_library_pane_upgrade_library (RenaLibraryPane *library);
 static void rena_library_pane_update_library  (RenaLibraryPane *library);
 static void rena_library_pane_remove_library  (RenaLibraryPane *library);
 
+static GtkTreeStore *rena_library_pane_store_new        (void);
+static void          rena_library_pane_set_store        (RenaLibraryPane *library, GtkTreeStore *store);
+static GtkTreeModel *rena_library_pane_filter_model_new (GtkTreeStore *store);
+
 /*
  * Order menu callbacks
  */
@@ -460,129 +474,31 @@ library_store_prepend_node(GtkTreeModel *model,
 	                    -1);
 }
 
-static void
-add_child_node_folder(GtkTreeModel *model,
-		      GtkTreeIter *iter,
-		      GtkTreeIter *p_iter,
-		      const gchar *node_data,
-		      RenaLibraryPane *clibrary)
-{
-	GtkTreeIter l_iter;
-	gchar *data = NULL;
-	gint l_node_type;
-	gboolean valid;
-
-	/* Find position of the last directory that is a child of p_iter */
-	valid = gtk_tree_model_iter_children(model, &l_iter, p_iter);
-	while (valid) {
-		gtk_tree_model_get(model, &l_iter, L_NODE_TYPE, &l_node_type, -1);
-		if (l_node_type != NODE_FOLDER)
-			break;
-		gtk_tree_model_get(model, &l_iter, L_NODE_DATA, &data, -1);
-		if (g_ascii_strcasecmp(data, node_data) >= 0) {
-			g_free(data);
-			break;
-		}
-		g_free(data);
-
-		valid = gtk_tree_model_iter_next(model, &l_iter);
-	}
-
-	/* Insert the new folder after the last subdirectory by order */
-	gtk_tree_store_insert_before (GTK_TREE_STORE(model), iter, p_iter, valid ? &l_iter : NULL);
-	gtk_tree_store_set (GTK_TREE_STORE(model), iter, L_PIXBUF, clibrary->pixbuf_dir,
-	                    L_NODE_DATA, node_data,
-	                    L_NODE_BOLD, PANGO_WEIGHT_NORMAL,
-	                    L_NODE_TYPE, NODE_FOLDER,
-	                    L_DATABASE_ID, 0,
-	                    L_MACH, FALSE,
-	                    L_VISIBILE, TRUE,
-	                    -1);
-}
-
-/* Appends a child (iter) to p_iter with given data. NOTE that iter
+/* Append a child (iter) to p_iter with given data. NOTE that iter
  * and p_iter must be created outside this function */
 
 static void
-add_child_node_file(GtkTreeModel *model,
-		    GtkTreeIter *iter,
-		    GtkTreeIter *p_iter,
-		    const gchar *node_data,
-		    int location_id,
-		    RenaLibraryPane *clibrary)
+library_store_append_node(GtkTreeModel *model,
+                          GtkTreeIter *iter,
+                          GtkTreeIter *p_iter,
+                          GdkPixbuf *pixbuf,
+                          const gchar *node_data,
+                          int node_type,
+                          int location_id)
 {
-	GtkTreeIter l_iter;
-	gchar *data = NULL;
-	gint l_node_type;
-	gboolean valid;
-
-	/* Find position of the last file that is a child of p_iter */
-	valid = gtk_tree_model_iter_children(model, &l_iter, p_iter);
-	while (valid) {
-		gtk_tree_model_get(model, &l_iter, L_NODE_TYPE, &l_node_type, -1);
-		gtk_tree_model_get(model, &l_iter, L_NODE_DATA, &data, -1);
-
-		if ((l_node_type == NODE_BASENAME) && (g_ascii_strcasecmp(data, node_data) >= 0)) {
-			g_free(data);
-			break;
-		}
-		g_free(data);
+	gtk_tree_store_append(GTK_TREE_STORE(model), iter, p_iter);
 
-		valid = gtk_tree_model_iter_next(model, &l_iter);
-	}
-
-	/* Insert the new file after the last file by order */
-	gtk_tree_store_insert_before (GTK_TREE_STORE(model), iter, p_iter, valid ? &l_iter : NULL);
 	gtk_tree_store_set (GTK_TREE_STORE(model), iter,
-	                    L_PIXBUF, clibrary->pixbuf_track,
+	                    L_PIXBUF, pixbuf,
 	                    L_NODE_DATA, node_data,
 	                    L_NODE_BOLD, PANGO_WEIGHT_NORMAL,
-	                    L_NODE_TYPE, NODE_BASENAME,
+	                    L_NODE_TYPE, node_type,
 	                    L_DATABASE_ID, location_id,
 	                    L_MACH, FALSE,
 	                    L_VISIBILE, TRUE,
 	                    -1);
 }
 
-/* Adds a file and its parent directories to the library tree */
-
-static void
-add_folder_file(GtkTreeModel *model,
-                const gchar *filepath,
-                int location_id,
-                GtkTreeIter *p_iter,
-                RenaLibraryPane *clibrary)
-{
-	gchar **subpaths = NULL;		/* To be freed */
-
-	GtkTreeIter iter, iter2, search_iter;
-	int i = 0 , len = 0;
-
-	/* Point after library directory prefix */
-
-	subpaths = g_strsplit(filepath, G_DIR_SEPARATOR_S, -1);
-
-	len = g_strv_length (subpaths);
-	len--;
-
-	/* Add all subdirectories and filename to the tree */
-	for (i = 0; subpaths[i]; i++) {
-		if (!find_child_node(subpaths[i], &search_iter, p_iter, model)) {
-			if(i < len)
-				add_child_node_folder(model, &iter, p_iter, subpaths[i], clibrary);
-			else
-				add_child_node_file(model, &iter, p_iter, subpaths[i], location_id, clibrary);
-			p_iter = &iter;
-		}
-		else {
-			iter2 = search_iter;
-			p_iter = &iter2;
-		}
-	}
-
-	g_strfreev(subpaths);
-}
-
 /* Adds an entry to the library tree by tag (genre, artist...) */
 
 static void
@@ -847,18 +763,19 @@ static void get_location_ids(GtkTreePath *path,
 	clibrary->view_change = FALSE;
 }
 
-/* Add all the tracks under the given path to the current playlist */
+/* Add all the tracks under the given path to the current playlist.
+ * Tracks are collected on loc_arr and hydrated together. */
 
-GList *
+static GList *
 append_library_row_to_mobj_list(RenaDatabase *cdbase,
                                 GtkTreePath *path,
                                 GtkTreeModel *row_model,
+                                GArray *loc_arr,
                                 GList *list)
 {
 	GtkTreeIter t_iter, r_iter;
 	LibraryNodeType node_type = 0;
 	gint location_id;
-	RenaMusicobject *mobj = NULL;
 	gchar *data = NULL;
 	gint j = 0;
 
@@ -881,20 +798,20 @@ append_library_row_to_mobj_list(RenaDatabase *cdbase,
 			/* For all other node types do a recursive add */
 			while (gtk_tree_model_iter_nth_child(row_model, &t_iter, &r_iter, j++)) {
 				path = gtk_tree_model_get_path(row_model, &t_iter);
-				list = append_library_row_to_mobj_list(cdbase, path, row_model, list);
+				list = append_library_row_to_mobj_list(cdbase, path, row_model, loc_arr, list);
 				gtk_tree_path_free(path);
 			}
 			break;
 		case NODE_TRACK:
 		case NODE_BASENAME:
-			mobj = new_musicobject_from_db(cdbase, location_id);
-			if (G_LIKELY(mobj))
-				list = g_list_append(list, mobj);
+			g_array_append_val (loc_arr, location_id);
 			break;
 		case NODE_PLAYLIST:
+			list = add_location_ids_to_mobj_list(cdbase, loc_arr, list);
 			list = add_playlist_to_mobj_list(cdbase, data, list);
 			break;
 		case NODE_RADIO:
+			list = add_location_ids_to_mobj_list(cdbase, loc_arr, list);
 			list = add_radio_to_mobj_list(cdbase, data, list);
 			break;
 		default:
@@ -1487,8 +1404,10 @@ rena_libary_pane_filter_tree_func (GtkTreeModel *model,
                                      GtkTreeIter  *iter,
                                      gpointer      data)
 {
-	gchar *node_data = NULL, *u_str;
-	gboolean p_mach;
+	LibraryNodeType node_type;
+	gchar *node_data = NULL, *u_str = NULL;
+	gboolean mach = FALSE, p_mach;
+	gint location_id;
 
 	RenaLibraryPane *library = data;
 
@@ -1503,9 +1422,24 @@ rena_libary_pane_filter_tree_func (GtkTreeModel *model,
 	   If search entry doesn't match, check if _any_ ancestor has
 	   been marked as visible and if so, mark current node as visible too. */
 
-	gtk_tree_model_get(model, iter, L_NODE_DATA, &node_data, -1);
-	u_str = g_utf8_strdown(node_data, -1);
-	if (rena_strstr_lv(u_str, library->filter_entry, library->preferences))
+	gtk_tree_model_get(model, iter, L_NODE_TYPE, &node_type, -1);
+	if (library->filter_matches != NULL &&
+	    node_type != NODE_PLAYLIST && node_type != NODE_RADIO)
+	{
+		/* The search index already matched the tracks by any of their tags. */
+		if (node_type == NODE_TRACK || node_type == NODE_BASENAME) {
+			gtk_tree_model_get(model, iter, L_DATABASE_ID, &location_id, -1);
+			mach = g_hash_table_contains (library->filter_matches, GINT_TO_POINTER(location_id));
+		}
+	}
+	else
+	{
+		gtk_tree_model_get(model, iter, L_NODE_DATA, &node_data, -1);
+		u_str = g_utf8_strdown(node_data, -1);
+		mach = rena_strstr_lv(u_str, library->filter_entry, library->preferences) != NULL;
+	}
+
+	if (mach)
 	{
 		/* Set visible the match row */
 		gtk_tree_store_set (GTK_TREE_STORE(model), iter,
@@ -1528,10 +1462,185 @@ rena_libary_pane_filter_tree_func (GtkTreeModel *model,
 	return FALSE;
 }
 
+/* The search index matches locations, so its results are shown through a
+ * map of the rows of each location, and the next search only hides the
+ * rows shown by the previous one. The iters of a GtkTreeStore persist, and
+ * any row added or removed drops both. */
+
+static void
+rena_library_pane_forget_filter_rows (RenaLibraryPane *library)
+{
+	if (library->filter_rows) {
+		g_array_free (library->filter_rows, TRUE);
+		library->filter_rows = NULL;
+	}
+}
+
+static void
+rena_library_pane_forget_location_rows (RenaLibraryPane *library)
+{
+	if (library->location_rows) {
+		g_hash_table_destroy (library->location_rows);
+		library->location_rows = NULL;
+	}
+	rena_library_pane_forget_filter_rows (library);
+}
+
+static void
+rena_library_pane_store_row_inserted (GtkTreeModel *model,
+                                      GtkTreePath  *path,
+                                      GtkTreeIter  *iter,
+                                      RenaLibraryPane *library)
+{
+	rena_library_pane_forget_location_rows (library);
+}
+
+static void
+rena_library_pane_store_row_deleted (GtkTreeModel *model,
+                                     GtkTreePath  *path,
+                                     RenaLibraryPane *library)
+{
+	rena_library_pane_forget_location_rows (library);
+}
+
+static gboolean
+rena_library_pane_map_location_row (GtkTreeModel *model,
+                                    GtkTreePath  *path,
+                                    GtkTreeIter  *iter,
+                                    gpointer      data)
+{
+	LibraryNodeType node_type;
+	GArray *rows;
+	gint location_id;
+
+	RenaLibraryPane *library = data;
+
+	gtk_tree_model_get (model, iter, L_NODE_TYPE, &node_type, L_DATABASE_ID, &location_id, -1);
+	if (node_type != NODE_TRACK && node_type != NODE_BASENAME)
+		return FALSE;
+
+	rows = g_hash_table_lookup (library->location_rows, GINT_TO_POINTER(location_id));
+	if (rows == NULL) {
+		rows = g_array_sized_new (FALSE, FALSE, sizeof(GtkTreeIter), 1);
+		g_hash_table_insert (library->location_rows, GINT_TO_POINTER(location_id), rows);
+	}
+	g_array_append_val (rows, *iter);
+
+	return FALSE;
+}
+
+static gboolean
+rena_library_pane_hide_func (GtkTreeModel *model,
+                             GtkTreePath  *path,
+                             GtkTreeIter  *iter,
+                             gpointer      data)
+{
+	gtk_tree_store_set (GTK_TREE_STORE(model), iter,
+	                    L_MACH, FALSE, L_VISIBILE, FALSE, -1);
+	return FALSE;
+}
+
+static void
+rena_library_pane_filter_show_row (RenaLibraryPane *library, GtkTreeModel *model, GtkTreeIter *iter)
+{
+	GtkTreeIter t_iter, parent;
+	gboolean visible;
+
+	gtk_tree_store_set (GTK_TREE_STORE(model), iter,
+	                    L_MACH, TRUE, L_VISIBILE, TRUE, -1);
+	g_array_append_val (library->filter_rows, *iter);
+
+	/* Parents already visible were shown with their own ancestors. */
+	t_iter = *iter;
+	while (gtk_tree_model_iter_parent (model, &parent, &t_iter)) {
+		gtk_tree_model_get (model, &parent, L_VISIBILE, &visible, -1);
+		if (visible)
+			break;
+
+		gtk_tree_store_set (GTK_TREE_STORE(model), &parent, L_VISIBILE, TRUE, -1);
+		g_array_append_val (library->filter_rows, parent);
+		t_iter = parent;
+	}
+}
+
+static void
+rena_library_pane_filter_subtree (RenaLibraryPane *library, GtkTreeModel *model, GtkTreeIter *iter)
+{
+	GtkTreeIter child;
+	GtkTreePath *path;
+
+	path = gtk_tree_model_get_path (model, iter);
+	rena_libary_pane_filter_tree_func (model, path, iter, library);
+	gtk_tree_path_free (path);
+
+	if (gtk_tree_model_iter_children (model, &child, iter)) {
+		do {
+			rena_library_pane_filter_subtree (library, model, &child);
+		} while (gtk_tree_model_iter_next (model, &child));
+	}
+}
+
+static void
+rena_library_pane_filter_by_matches (RenaLibraryPane *library)
+{
+	GtkTreeModel *model;
+	GHashTableIter hash_iter;
+	GtkTreeIter iter;
+	LibraryNodeType node_type;
+	GArray *rows;
+	gpointer key;
+	guint i;
+
+	model = GTK_TREE_MODEL(library->library_store);
+
+	if (library->location_rows == NULL) {
+		library->location_rows = g_hash_table_new_full (g_direct_hash, g_direct_equal,
+		                                                NULL, (GDestroyNotify) g_array_unref);
+		gtk_tree_model_foreach (model, rena_library_pane_map_location_row, library);
+	}
+
+	/* Hide the rows of the previous search, or every row if unknown. */
+
+	if (library->filter_rows != NULL) {
+		for (i = 0; i < library->filter_rows->len; i++)
+			gtk_tree_store_set (library->library_store,
+			                    &g_array_index (library->filter_rows, GtkTreeIter, i),
+			                    L_MACH, FALSE, L_VISIBILE, FALSE, -1);
+		g_array_set_size (library->filter_rows, 0);
+	}
+	else {
+		gtk_tree_model_foreach (model, rena_library_pane_hide_func, library);
+		library->filter_rows = g_array_new (FALSE, FALSE, sizeof(GtkTreeIter));
+	}
+
+	/* Show the matched tracks */
+
+	g_hash_table_iter_init (&hash_iter, library->filter_matches);
+	while (g_hash_table_iter_next (&hash_iter, &key, NULL)) {
+		rows = g_hash_table_lookup (library->location_rows, key);
+		if (rows == NULL)
+			continue;
+		for (i = 0; i < rows->len; i++)
+			rena_library_pane_filter_show_row (library, model, &g_array_index (rows, GtkTreeIter, i));
+	}
+
+	/* Playlists and radios are not indexed, and still matched by name. */
+
+	if (gtk_tree_model_get_iter_first (model, &iter)) {
+		do {
+			gtk_tree_model_get (model, &iter, L_NODE_TYPE, &node_type, -1);
+			if (node_type == NODE_CATEGORY_PLAYLIST || node_type == NODE_CATEGORY_RADIO)
+				rena_library_pane_filter_subtree (library, model, &iter);
+		} while (gtk_tree_model_iter_next (model, &iter));
+	}
+}
+
 static void
 rena_library_pane_do_filter (RenaLibraryPane *library)
 {
 	GtkTreeModel *filter_model;
+	GArray *locations;
+	guint i;
 
 	/* Have to give control to GTK periodically ... */
 	rena_process_gtk_events ();
@@ -1544,9 +1653,29 @@ rena_library_pane_do_filter (RenaLibraryPane *library)
 	/* Have to give control to GTK periodically ... */
 	rena_process_gtk_events ();
 
+	/* Use the search index, unless it is an approximate search. */
+	if (!rena_preferences_get_approximate_search (library->preferences)) {
+		locations = rena_database_search_locations (library->cdbase, library->filter_entry);
+		if (locations) {
+			library->filter_matches = g_hash_table_new (g_direct_hash, g_direct_equal);
+			for (i = 0; i < locations->len; i++)
+				g_hash_table_add (library->filter_matches,
+				                  GINT_TO_POINTER(g_array_index (locations, gint, i)));
+			g_array_free (locations, TRUE);
+		}
+	}
+
 	/* Set visibility of rows in the library store. */
-	gtk_tree_model_foreach (GTK_TREE_MODEL(library->library_store),
-	                        rena_libary_pane_filter_tree_func, library);
+	if (library->filter_matches) {
+		rena_library_pane_filter_by_matches (library);
+		g_hash_table_destroy (library->filter_matches);
+		library->filter_matches = NULL;
+	}
+	else {
+		gtk_tree_model_foreach (GTK_TREE_MODEL(library->library_store),
+		                        rena_libary_pane_filter_tree_func, library);
+		rena_library_pane_forget_filter_rows (library);
+	}
 
 	/* Have to give control to GTK periodically ... */
 	rena_process_gtk_events ();
@@ -1587,6 +1716,7 @@ rena_library_pane_show_all (RenaLibraryPane *library)
 	/* Set all nodes visibles. */
 	gtk_tree_model_foreach (GTK_TREE_MODEL(library->library_store),
 	                        rena_library_pane_set_all_visible_func, library);
+	rena_library_pane_forget_filter_rows (library);
 
 	/* Have to give control to GTK periodically ... */
 	rena_process_gtk_events ();
@@ -1965,126 +2095,296 @@ library_view_append_radios(GtkTreeModel *model,
 	rena_prepared_statement_free (statement);
 }
 
+/* The folders of the provider itself and above it, or the scheme of the
+ * uris, are not shown. Their content hangs from the provider node. */
+
+static gboolean
+library_view_folder_is_visible (const gchar *path, const gchar *provider)
+{
+	gsize len = strlen (provider);
+
+	if (strncmp (path, provider, len) == 0)
+		return path[len] == G_DIR_SEPARATOR;
+
+	return strstr (path, "://") != NULL;
+}
+
 static void
 rena_library_view_append_provider_by_folder (RenaLibraryPane *clibrary,
                                                GtkTreeModel      *model,
                                                GtkTreeIter       *p_iter,
-                                               const gchar       *provider)
+                                               const gchar       *provider,
+                                               gint               provider_id)
 
 {
 	RenaPreparedStatement *statement;
+	RenaQueryResult *result;
+	GHashTable *folders;
+	GtkTreeIter iter, *parent_iter;
 	const gchar *sql = NULL, *filepath = NULL, *filename = NULL;
-	gint provider_id = 0;
-
-	sql = "SELECT name, id FROM LOCATION WHERE id IN (SELECT location FROM TRACK WHERE PROVIDER = ?) ORDER BY name DESC";
+	gint folder_id;
+	guint row, n_rows;
+
+	/* Folder id -> iter of its node. GtkTreeStore iters persist. */
+	folders = g_hash_table_new_full (g_direct_hash, g_direct_equal, NULL, (GDestroyNotify) gtk_tree_iter_free);
+
+	/* The folders with tracks of the provider and their parents. Sorted by
+	 * path, every folder comes after its parent and after its previous
+	 * sibling by name, so they are just appended. */
+
+	sql = "WITH RECURSIVE FOLDERS(id) AS ("
+			"SELECT LOCATION.directory FROM TRACK CROSS JOIN LOCATION "
+			"WHERE TRACK.provider = ? AND LOCATION.id = TRACK.location "
+			"UNION "
+			"SELECT DIRECTORY.parent FROM FOLDERS CROSS JOIN DIRECTORY "
+			"WHERE DIRECTORY.id = FOLDERS.id AND DIRECTORY.parent != 0) "
+		"SELECT DIRECTORY.id, DIRECTORY.parent, DIRECTORY.name, DIRECTORY.path "
+		"FROM FOLDERS CROSS JOIN DIRECTORY WHERE DIRECTORY.id = FOLDERS.id "
+		"ORDER BY DIRECTORY.path COLLATE NOCASE";
 
 	statement = rena_database_create_statement (clibrary->cdbase, sql);
-
-	provider_id = rena_database_find_provider (clibrary->cdbase, provider);
 	rena_prepared_statement_bind_int (statement, 1, provider_id);
 
 	while (rena_prepared_statement_step (statement)) {
-		filepath = rena_prepared_statement_get_string(statement, 0);
+		if (!library_view_folder_is_visible (rena_prepared_statement_get_string (statement, 3), provider))
+			continue;
 
-		/* FIXME: Handle uris like cdda:// */
-		filename = g_strrstr (filepath, "://");
-		if (filename) {
-			filename += strlen("://");
-		}
-		else {
-			filename = filepath + strlen(provider) + 1;
-		}
+		folder_id = rena_prepared_statement_get_int (statement, 0);
+		parent_iter = g_hash_table_lookup (folders, GINT_TO_POINTER(rena_prepared_statement_get_int (statement, 1)));
 
-		add_folder_file(model,
-		                filename,
-		                rena_prepared_statement_get_int(statement, 1),
-		                p_iter,
-		                clibrary);
-		rena_process_gtk_events ();
+		library_store_append_node (model,
+		                           &iter,
+		                           parent_iter ? parent_iter : p_iter,
+		                           clibrary->pixbuf_dir,
+		                           rena_prepared_statement_get_string (statement, 2),
+		                           NODE_FOLDER,
+		                           0);
+
+		g_hash_table_insert (folders, GINT_TO_POINTER(folder_id), gtk_tree_iter_copy (&iter));
 	}
+	rena_prepared_statement_free (statement);
+
+	/* Then the files, after the subfolders of each folder. */
 
+	sql = "SELECT LOCATION.id, LOCATION.name, LOCATION.directory FROM TRACK CROSS JOIN LOCATION "
+		"WHERE TRACK.provider = ? AND LOCATION.id = TRACK.location "
+		"ORDER BY LOCATION.name COLLATE NOCASE";
+
+	statement = rena_database_create_statement (clibrary->cdbase, sql);
+	rena_prepared_statement_bind_int (statement, 1, provider_id);
+	result = rena_query_result_new (statement, "isi");
 	rena_prepared_statement_free (statement);
+
+	n_rows = rena_query_result_get_n_rows (result);
+	for (row = 0; row < n_rows; row++) {
+		filepath = rena_query_result_get_string (result, row, 1);
+
+		filename = strrchr (filepath, G_DIR_SEPARATOR);
+		filename = filename ? filename + 1 : filepath;
+
+		parent_iter = g_hash_table_lookup (folders, GINT_TO_POINTER(rena_query_result_get_int (result, row, 2)));
+
+		library_store_append_node (model,
+		                           &iter,
+		                           parent_iter ? parent_iter : p_iter,
+		                           clibrary->pixbuf_track,
+		                           filename,
+		                           NODE_BASENAME,
+		                           rena_query_result_get_int (result, row, 0));
+
+		/* Have to give control to GTK periodically ... */
+		if (row % LIBRARY_ROWS_PER_REFRESH == 0)
+			rena_process_gtk_events ();
+	}
+	rena_query_result_free (result);
+
+	g_hash_table_destroy (folders);
 }
 
-static void
-rena_library_view_append_provider_by_tags (RenaLibraryPane *clibrary,
-                                             GtkTreeModel      *model,
-                                             GtkTreeIter       *p_iter,
-                                             const gchar       *provider)
+/* Query of the tag based library views for the current style. The columns
+ * follow the order of RenaLibrarySnapshotField, and then the location id. */
+
+static gchar *
+rena_library_view_get_tags_query (RenaLibraryPane *clibrary)
 {
-	RenaPreparedStatement *statement;
-	gchar *order_str = NULL, *sql = NULL;
-	gint provider_id = 0;
+	const gchar *first_table = NULL, *other_tables = NULL, *order_str = NULL;
+	gboolean sort_by_year;
 
-	/* Get order needed to sqlite query. */
+	/* Get order needed to sqlite query. The table of the first level is
+	 * walked by its sort_key index, and its tracks by the TRACK index of
+	 * that column, so most of the result comes already ordered. */
+	sort_by_year = rena_preferences_get_sort_by_year(clibrary->preferences);
 	switch(rena_preferences_get_library_style(clibrary->preferences)) {
 		case FOLDERS:
 			break;
 		case ARTIST:
-			order_str = g_strdup("ARTIST.name COLLATE NOCASE DESC, TRACK.title COLLATE NOCASE DESC");
+			first_table = "ARTIST";
+			order_str = "ARTIST.sort_key DESC, ARTIST.id DESC, TRACK.sort_key DESC";
 			break;
 		case ALBUM:
-			if (rena_preferences_get_sort_by_year(clibrary->preferences))
-				order_str = g_strdup("YEAR.year COLLATE NOCASE DESC, ALBUM.name COLLATE NOCASE DESC, TRACK.title COLLATE NOCASE DESC");
-			else
-				order_str = g_strdup("ALBUM.name COLLATE NOCASE DESC, TRACK.title COLLATE NOCASE DESC");
+			if (sort_by_year) {
+				first_table = "YEAR";
+				order_str = "YEAR.year DESC, ALBUM.sort_key DESC, ALBUM.id DESC, TRACK.sort_key DESC";
+			}
+			else {
+				first_table = "ALBUM";
+				order_str = "ALBUM.sort_key DESC, ALBUM.id DESC, TRACK.sort_key DESC";
+			}
 			break;
 		case GENRE:
-			order_str = g_strdup("GENRE.name COLLATE NOCASE DESC, TRACK.title COLLATE NOCASE DESC");
+			first_table = "GENRE";
+			order_str = "GENRE.sort_key DESC, GENRE.id DESC, TRACK.sort_key DESC";
 			break;
 		case ARTIST_ALBUM:
-			if (rena_preferences_get_sort_by_year(clibrary->preferences))
-				order_str = g_strdup("ARTIST.name COLLATE NOCASE DESC, YEAR.year COLLATE NOCASE DESC, ALBUM.name COLLATE NOCASE DESC, TRACK.track_no COLLATE NOCASE DESC");
+			first_table = "ARTIST";
+			if (sort_by_year)
+				order_str = "ARTIST.sort_key DESC, ARTIST.id DESC, YEAR.year DESC, ALBUM.sort_key DESC, TRACK.track_no DESC";
 			else
-				order_str = g_strdup("ARTIST.name COLLATE NOCASE DESC, ALBUM.name COLLATE NOCASE DESC, TRACK.track_no COLLATE NOCASE DESC");
+				order_str = "ARTIST.sort_key DESC, ARTIST.id DESC, ALBUM.sort_key DESC, TRACK.track_no DESC";
 			break;
 		case GENRE_ARTIST:
-			order_str = g_strdup("GENRE.name COLLATE NOCASE DESC, ARTIST.name COLLATE NOCASE DESC, TRACK.title COLLATE NOCASE DESC");
+			first_table = "GENRE";
+			order_str = "GENRE.sort_key DESC, GENRE.id DESC, ARTIST.sort_key DESC, TRACK.sort_key DESC";
 			break;
 		case GENRE_ALBUM:
-			if (rena_preferences_get_sort_by_year(clibrary->preferences))
-				order_str = g_strdup("GENRE.name COLLATE NOCASE DESC, YEAR.year COLLATE NOCASE DESC, ALBUM.name COLLATE NOCASE DESC, TRACK.track_no COLLATE NOCASE DESC");
+			first_table = "GENRE";
+			if (sort_by_year)
+				order_str = "GENRE.sort_key DESC, GENRE.id DESC, YEAR.year DESC, ALBUM.sort_key DESC, TRACK.track_no DESC";
 			else
-				order_str = g_strdup("GENRE.name COLLATE NOCASE DESC, ALBUM.name COLLATE NOCASE DESC, TRACK.track_no COLLATE NOCASE DESC");
+				order_str = "GENRE.sort_key DESC, GENRE.id DESC, ALBUM.sort_key DESC, TRACK.track_no DESC";
 			break;
 		case GENRE_ARTIST_ALBUM:
-			if (rena_preferences_get_sort_by_year(clibrary->preferences))
-				order_str = g_strdup("GENRE.name COLLATE NOCASE DESC, ARTIST.name COLLATE NOCASE DESC, YEAR.year COLLATE NOCASE DESC, ALBUM.name COLLATE NOCASE DESC, TRACK.track_no COLLATE NOCASE DESC");
+			first_table = "GENRE";
+			if (sort_by_year)
+				order_str = "GENRE.sort_key DESC, GENRE.id DESC, ARTIST.sort_key DESC, YEAR.year DESC, ALBUM.sort_key DESC, TRACK.track_no DESC";
 			else
-				order_str = g_strdup("GENRE.name COLLATE NOCASE DESC, ARTIST.name COLLATE NOCASE DESC, ALBUM.name COLLATE NOCASE DESC, TRACK.track_no COLLATE NOCASE DESC");
+				order_str = "GENRE.sort_key DESC, GENRE.id DESC, ARTIST.sort_key DESC, ALBUM.sort_key DESC, TRACK.track_no DESC";
 			break;
 		default:
 			break;
 	}
 
-	/* Common query for all tag based library views */
-	sql = g_strdup_printf("SELECT TRACK.title, ARTIST.name, YEAR.year, ALBUM.name, GENRE.name, LOCATION.name, LOCATION.id "
-	                        "FROM TRACK, ARTIST, YEAR, ALBUM, GENRE, LOCATION "
-	                        "WHERE PROVIDER = ? AND ARTIST.id = TRACK.artist AND TRACK.year = YEAR.id AND ALBUM.id = TRACK.album AND GENRE.id = TRACK.genre AND LOCATION.id = TRACK.location "
-	                        "ORDER BY %s;", order_str);
+	if (order_str == NULL)
+		return NULL;
 
-	statement = rena_database_create_statement (clibrary->cdbase, sql);
-	provider_id = rena_database_find_provider (clibrary->cdbase, provider);
+	if (g_strcmp0(first_table, "ARTIST") == 0)
+		other_tables = "YEAR, ALBUM, GENRE";
+	else if (g_strcmp0(first_table, "ALBUM") == 0)
+		other_tables = "ARTIST, YEAR, GENRE";
+	else if (g_strcmp0(first_table, "GENRE") == 0)
+		other_tables = "ARTIST, YEAR, ALBUM";
+	else
+		other_tables = "ARTIST, ALBUM, GENRE";
+
+	/* Common query for all tag based library views. CROSS JOIN keeps the
+	 * first level table as the outer loop. */
+	return g_strdup_printf("SELECT TRACK.title, ARTIST.name, YEAR.year, ALBUM.name, GENRE.name, LOCATION.name, LOCATION.id "
+	                       "FROM %s CROSS JOIN TRACK, %s, LOCATION "
+	                       "WHERE PROVIDER = ? AND ARTIST.id = TRACK.artist AND TRACK.year = YEAR.id AND ALBUM.id = TRACK.album AND GENRE.id = TRACK.genre AND LOCATION.id = TRACK.location "
+	                       "ORDER BY %s;", first_table, other_tables, order_str);
+}
+
+/* Identifies the view saved in a library snapshot. */
+
+static guint
+rena_library_view_get_snapshot_view (RenaLibraryPane *clibrary)
+{
+	return rena_preferences_get_library_style(clibrary->preferences) |
+	       (rena_preferences_get_sort_by_year(clibrary->preferences) << 8);
+}
+
+static void
+rena_library_view_append_provider_by_tags (RenaLibraryPane *clibrary,
+                                             GtkTreeModel      *model,
+                                             GtkTreeIter       *p_iter,
+                                             gint               provider_id)
+{
+	RenaPreparedStatement *statement;
+	RenaQueryResult *result;
+	RenaLibrarySnapshot *snapshot;
+	RenaLibrarySnapshotBuilder *builder;
+	const gchar *fields[SNAPSHOT_N_FIELDS];
+	gchar *sql = NULL;
+	gint location_id, i;
+	gint64 generation;
+	guint view, row, n_rows;
+
+	sql = rena_library_view_get_tags_query (clibrary);
+	if (sql == NULL)
+		return;
+
+	view = rena_library_view_get_snapshot_view (clibrary);
+
+	/* Read before the tracks, so changes in between only leave a stale
+	 * snapshot. */
+	generation = rena_database_get_library_generation (clibrary->cdbase);
+
+	/* Fill the tree from the snapshot when it is up to date. */
+
+	snapshot = rena_library_snapshot_open (provider_id, view, generation);
+	if (snapshot) {
+		n_rows = rena_library_snapshot_get_n_rows (snapshot);
+		for (row = 0; row < n_rows; row++) {
+			location_id = rena_library_snapshot_get_row (snapshot, row, fields);
+			add_child_node_by_tags(model,
+			                       p_iter,
+			                       location_id,
+			                       fields[SNAPSHOT_LOCATION],
+			                       fields[SNAPSHOT_GENRE],
+			                       fields[SNAPSHOT_ALBUM],
+			                       fields[SNAPSHOT_YEAR],
+			                       fields[SNAPSHOT_ARTIST],
+			                       fields[SNAPSHOT_TITLE],
+			                       clibrary);
+
+			/* Have to give control to GTK periodically ... */
+			if (row % LIBRARY_ROWS_PER_REFRESH == 0)
+				rena_process_gtk_events ();
+		}
+		rena_library_snapshot_free (snapshot);
+		g_free (sql);
+		return;
+	}
+
+	/* Else query the database, and save the rows for the next time. */
+
+	builder = rena_library_snapshot_builder_new (provider_id, view, generation);
+
+	statement = rena_database_create_dynamic_statement (clibrary->cdbase, sql);
 	rena_prepared_statement_bind_int (statement, 1, provider_id);
+	result = rena_query_result_new (statement, "sssssi");
+	rena_prepared_statement_free (statement);
+
+	n_rows = rena_query_result_get_n_rows (result);
+	for (row = 0; row < n_rows; row++) {
+		for (i = 0; i < SNAPSHOT_N_FIELDS; i++)
+			fields[i] = rena_query_result_get_string (result, row, i);
+		location_id = rena_query_result_get_int (result, row, SNAPSHOT_N_FIELDS);
 
-	while (rena_prepared_statement_step (statement)) {
 		add_child_node_by_tags(model,
 		                       p_iter,
-		                       rena_prepared_statement_get_int(statement, 6),
-		                       rena_prepared_statement_get_string(statement, 5),
-		                       rena_prepared_statement_get_string(statement, 4),
-		                       rena_prepared_statement_get_string(statement, 3),
-		                       rena_prepared_statement_get_string(statement, 2),
-		                       rena_prepared_statement_get_string(statement, 1),
-		                       rena_prepared_statement_get_string(statement, 0),
+		                       location_id,
+		                       fields[SNAPSHOT_LOCATION],
+		                       fields[SNAPSHOT_GENRE],
+		                       fields[SNAPSHOT_ALBUM],
+		                       fields[SNAPSHOT_YEAR],
+		                       fields[SNAPSHOT_ARTIST],
+		                       fields[SNAPSHOT_TITLE],
 		                       clibrary);
 
+		rena_library_snapshot_builder_add_row (builder, location_id, fields);
+
 		/* Have to give control to GTK periodically ... */
-		rena_process_gtk_events ();
+		if (row % LIBRARY_ROWS_PER_REFRESH == 0)
+			rena_process_gtk_events ();
 	}
-	rena_prepared_statement_free (statement);
+	rena_query_result_free (result);
+
+	if (generation >= 0)
+		rena_library_snapshot_builder_write_async (builder);
+	else
+		rena_library_snapshot_builder_free (builder);
 
-	g_free(order_str);
 	g_free(sql);
 }
 
@@ -2097,20 +2397,24 @@ library_pane_view_reload(RenaLibraryPane *clibrary)
 	GtkTreeIter iter;
 	GSList *provider_list, *l;
 	gchar *icon_name, *friendly_name = NULL;
+	gint provider_id;
+
+	/* This reload already covers any queued one. */
+	if (clibrary->reload_id) {
+		g_source_remove (clibrary->reload_id);
+		clibrary->reload_id = 0;
+	}
 
 	clibrary->view_change = TRUE;
 
 	set_watch_cursor (GTK_WIDGET(clibrary));
 
-	filter_model = gtk_tree_view_get_model(GTK_TREE_VIEW(clibrary->library_tree));
-	model = gtk_tree_model_filter_get_model(GTK_TREE_MODEL_FILTER(filter_model));
+	/* Fill a new store apart, so the rows are not seen by the filter
+	 * model of the view until all of them are in. */
 
-	g_object_ref(filter_model);
+	model = GTK_TREE_MODEL(rena_library_pane_store_new ());
 
 	gtk_widget_set_sensitive(GTK_WIDGET(GTK_WIDGET(clibrary)), FALSE);
-	gtk_tree_view_set_model(GTK_TREE_VIEW(clibrary->library_tree), NULL);
-
-	gtk_tree_store_clear(GTK_TREE_STORE(model));
 
 	/* Playlists.*/
 
@@ -2150,6 +2454,8 @@ library_pane_view_reload(RenaLibraryPane *clibrary)
 	provider_list = rena_provider_get_visible_list (provider, TRUE);
 
 	for (l = provider_list; l != NULL; l = l->next) {
+		provider_id = rena_database_provider_get_id (provider, l->data);
+
 		gtk_tree_store_append (GTK_TREE_STORE(model),
 		                       &iter,
 		                       NULL);
@@ -2168,7 +2474,7 @@ library_pane_view_reload(RenaLibraryPane *clibrary)
 		                    L_NODE_DATA, friendly_name,
 		                    L_NODE_BOLD, PANGO_WEIGHT_BOLD,
 		                    L_NODE_TYPE, NODE_CATEGORY_PROVIDER,
-		                    L_DATABASE_ID, rena_database_find_provider (clibrary->cdbase, l->data),
+		                    L_DATABASE_ID, provider_id,
 		                    L_MACH, FALSE,
 		                    L_VISIBILE, TRUE,
 		                    -1);
@@ -2187,10 +2493,10 @@ library_pane_view_reload(RenaLibraryPane *clibrary)
 		}
 
 		if (rena_preferences_get_library_style(clibrary->preferences) == FOLDERS) {
-			rena_library_view_append_provider_by_folder (clibrary, model, &iter, l->data);
+			rena_library_view_append_provider_by_folder (clibrary, model, &iter, l->data, provider_id);
 		}
 		else {
-			rena_library_view_append_provider_by_tags (clibrary, model, &iter, l->data);
+			rena_library_view_append_provider_by_tags (clibrary, model, &iter, provider_id);
 		}
 	}
 
@@ -2198,9 +2504,13 @@ library_pane_view_reload(RenaLibraryPane *clibrary)
 
 	gtk_widget_set_sensitive(GTK_WIDGET(GTK_WIDGET(clibrary)), TRUE);
 
+	rena_library_pane_set_store (clibrary, GTK_TREE_STORE(model));
+	g_object_unref (model);
+
+	filter_model = rena_library_pane_filter_model_new (clibrary->library_store);
 	gtk_tree_view_set_model(GTK_TREE_VIEW(clibrary->library_tree), filter_model);
 	g_object_unref(filter_model);
-	
+
 	if(gtk_entry_get_text_length (GTK_ENTRY(clibrary->search_entry)))
 		g_signal_emit_by_name (G_OBJECT (clibrary->search_entry), "activate");
 	else
@@ -2266,15 +2576,150 @@ update_library_playlist_changes (RenaDatabase *database,
 	clibrary->view_change = FALSE;
 }
 
+static gboolean
+library_pane_view_reload_idle (gpointer user_data)
+{
+	RenaLibraryPane *library = user_data;
+
+	/* A reload pumps the main loop. Wait for it to end. */
+	if (library->view_change)
+		return G_SOURCE_CONTINUE;
+
+	library->reload_id = 0;
+	library_pane_view_reload (library);
+
+	return G_SOURCE_REMOVE;
+}
+
+/*
+ * Providers usually change several things at once, e.g. they are shown
+ * and then their update done, so the tree is rebuilt once for all.
+ */
+
+static void
+library_pane_queue_reload (RenaLibraryPane *library)
+{
+	if (library->reload_id == 0)
+		library->reload_id = g_timeout_add (100, library_pane_view_reload_idle, library);
+}
+
 static void
 update_library_tracks_changes(RenaDatabaseProvider *provider, RenaLibraryPane *library)
 {
 	/*
 	 * Rework to olny update library tree!!!.
 	 **/
-	library_pane_view_reload(library);
+	library_pane_queue_reload (library);
+}
+
+static void
+update_library_providers_changes (RenaDatabaseProvider *provider,
+                                  const gchar          *name,
+                                  RenaLibraryPane      *library)
+{
+	/* New providers are hidden until they are shown, which is toggled. */
+	library_pane_queue_reload (library);
+}
+
+static gboolean
+update_library_track_title_func (GtkTreeModel *model,
+                                 GtkTreePath  *path,
+                                 GtkTreeIter  *iter,
+                                 gpointer      data)
+{
+	GHashTable *mobjs = data;
+	RenaMusicobject *mobj;
+	LibraryNodeType node_type;
+	const gchar *title;
+	gchar *node_data;
+	gint location_id;
+
+	gtk_tree_model_get (model, iter, L_NODE_TYPE, &node_type, -1);
+	if (node_type != NODE_TRACK)
+		return FALSE;
+
+	gtk_tree_model_get (model, iter, L_DATABASE_ID, &location_id, -1);
+	mobj = g_hash_table_lookup (mobjs, GINT_TO_POINTER(location_id));
+	if (mobj == NULL)
+		return FALSE;
+
+	title = rena_musicobject_get_title (mobj);
+	if (string_is_not_empty(title))
+		node_data = g_strdup (title);
+	else
+		node_data = get_display_filename (rena_musicobject_get_file (mobj), FALSE);
+
+	gtk_tree_store_set (GTK_TREE_STORE(model), iter, L_NODE_DATA, node_data, -1);
+	g_free (node_data);
+
+	return FALSE;
+}
+
+static void
+rena_library_pane_update_snapshots (RenaLibraryPane *library)
+{
+	RenaDatabaseProvider *provider;
+	GSList *provider_list, *l;
+	gchar *sql;
+	guint view;
+
+	sql = rena_library_view_get_tags_query (library);
+	if (sql == NULL)
+		return;
+
+	view = rena_library_view_get_snapshot_view (library);
+
+	provider = rena_database_provider_get ();
+	provider_list = rena_provider_get_visible_list (provider, TRUE);
+	for (l = provider_list; l != NULL; l = l->next) {
+		rena_library_snapshot_update_async (library->cdbase,
+		                                    rena_database_provider_get_id (provider, l->data),
+		                                    view, sql);
+	}
+	g_slist_free_full (provider_list, g_free);
+	g_object_unref (provider);
+
+	g_free (sql);
 }
 
+static void
+update_library_tracks_tags_changes (RenaDatabase    *database,
+                                    GArray          *loc_arr,
+                                    gint             changed,
+                                    RenaLibraryPane *library)
+{
+	GHashTable *mobjs;
+	GPtrArray *mobj_arr;
+	RenaMusicobject *mobj;
+	guint i;
+
+	/* Any other tag moves the tracks on the tree, so rebuild it. */
+	if (changed & ~(TAG_TNO_CHANGED | TAG_TITLE_CHANGED | TAG_COMMENT_CHANGED)) {
+		library_pane_view_reload (library);
+		return;
+	}
+
+	/* Track number and comment are not shown. Just rename the tracks. */
+	if (!(changed & TAG_TITLE_CHANGED))
+		return;
+
+	mobjs = g_hash_table_new_full (g_direct_hash, g_direct_equal, NULL, g_object_unref);
+	mobj_arr = new_musicobjects_from_db (database, loc_arr);
+	for (i = 0; i < mobj_arr->len; i++) {
+		mobj = g_ptr_array_index (mobj_arr, i);
+		if (mobj)
+			g_hash_table_replace (mobjs, GINT_TO_POINTER(g_array_index (loc_arr, gint, i)), mobj);
+	}
+	g_ptr_array_free (mobj_arr, TRUE);
+
+	gtk_tree_model_foreach (GTK_TREE_MODEL(library->library_store),
+	                        update_library_track_title_func, mobjs);
+
+	g_hash_table_destroy (mobjs);
+
+	/* The tree was not reloaded, so refresh the snapshots apart. */
+	rena_library_pane_update_snapshots (library);
+}
 
 /*
  * library_tree_context_menu calbacks
@@ -2286,6 +2731,7 @@ rena_library_pane_get_mobj_list (RenaLibraryPane *library)
 	GtkTreeSelection *selection;
 	GtkTreePath *path;
 	GList *mlist = NULL, *list, *i;
+	GArray *loc_arr;
 
 	selection = gtk_tree_view_get_selection (GTK_TREE_VIEW(library->library_tree));
 	list = gtk_tree_selection_get_selected_rows (selection, &model);
@@ -2293,14 +2739,19 @@ rena_library_pane_get_mobj_list (RenaLibraryPane *library)
 	if (list) {
 		/* Add all the rows to the current playlist */
 
+		loc_arr = g_array_new (FALSE, FALSE, sizeof(gint));
+
 		for (i = list; i != NULL; i = i->next) {
 			path = i->data;
-			mlist = append_library_row_to_mobj_list (library->cdbase, path, model, mlist);
+			mlist = append_library_row_to_mobj_list (library->cdbase, path, model, loc_arr, mlist);
 			gtk_tree_path_free (path);
 
 			/* Have to give control to GTK periodically ... */
 			rena_process_gtk_events ();
 		}
+		mlist = add_location_ids_to_mobj_list (library->cdbase, loc_arr, mlist);
+
+		g_array_free (loc_arr, TRUE);
 		g_list_free (list);
 	}
 
@@ -2887,7 +3338,7 @@ rena_library_tree_context_menu_new (RenaLibraryPane *library)
 /********************************/
 
 static GtkTreeStore *
-rena_library_pane_store_new()
+rena_library_pane_store_new (void)
 {
 	GtkTreeStore *store;
 	store = gtk_tree_store_new(N_L_COLUMNS,
@@ -2901,6 +3352,39 @@ rena_library_pane_store_new()
 	return store;
 }
 
+/* Replaces the store of the library, that is filled apart on each reload. */
+
+static void
+rena_library_pane_set_store (RenaLibraryPane *library, GtkTreeStore *store)
+{
+	if (library->library_store) {
+		g_signal_handlers_disconnect_by_data (library->library_store, library);
+		g_object_unref (library->library_store);
+	}
+	rena_library_pane_forget_location_rows (library);
+
+	library->library_store = store ? g_object_ref (store) : NULL;
+	if (store == NULL)
+		return;
+
+	g_signal_connect (store, "row-inserted",
+	                  G_CALLBACK(rena_library_pane_store_row_inserted), library);
+	g_signal_connect (store, "row-deleted",
+	                  G_CALLBACK(rena_library_pane_store_row_deleted), library);
+}
+
+static GtkTreeModel *
+rena_library_pane_filter_model_new (GtkTreeStore *store)
+{
+	GtkTreeModel *filter_model;
+
+	filter_model = gtk_tree_model_filter_new (GTK_TREE_MODEL(store), NULL);
+	gtk_tree_model_filter_set_visible_column (GTK_TREE_MODEL_FILTER(filter_model),
+	                                          L_VISIBILE);
+
+	return filter_model;
+}
+
 static GtkWidget*
 rena_library_pane_tree_new(RenaLibraryPane *clibrary)
 {
@@ -2912,9 +3396,7 @@ rena_library_pane_tree_new(RenaLibraryPane *clibrary)
 
 	/* Create the filter model */
 
-	library_filter_tree = gtk_tree_model_filter_new(GTK_TREE_MODEL(clibrary->library_store), NULL);
-	gtk_tree_model_filter_set_visible_column(GTK_TREE_MODEL_FILTER(library_filter_tree),
-	                                         L_VISIBILE);
+	library_filter_tree = rena_library_pane_filter_model_new (clibrary->library_store);
 
 	/* Create the tree view */
 
@@ -3121,6 +3603,7 @@ static void
 rena_library_pane_init (RenaLibraryPane *library)
 {
 	RenaDatabaseProvider *provider;
+	GtkTreeStore *store;
 
 	gtk_orientable_set_orientation (GTK_ORIENTABLE (library), GTK_ORIENTATION_VERTICAL);
 	g_object_set (G_OBJECT(library), "spacing", 2, NULL);
@@ -3132,7 +3615,12 @@ rena_library_pane_init (RenaLibraryPane *library)
 
 	/* Create the store */
 
-	library->library_store = rena_library_pane_store_new();
+	library->library_store = NULL;
+	library->location_rows = NULL;
+	library->filter_rows = NULL;
+	store = rena_library_pane_store_new();
+	rena_library_pane_set_store (library, store);
+	g_object_unref (store);
 
 	/* Create the widgets */
 
@@ -3153,6 +3641,7 @@ rena_library_pane_init (RenaLibraryPane *library)
 	/* Init the rest of flags */
 
 	library->filter_entry = NULL;
+	library->filter_matches = NULL;
 	library->dragging = FALSE;
 	library->view_change = FALSE;
 	library->library_tree_nodes = NULL;
@@ -3178,6 +3667,8 @@ rena_library_pane_init (RenaLibraryPane *library)
 
 	g_signal_connect (library->cdbase, "PlaylistsChanged",
 	                  G_CALLBACK (update_library_playlist_changes), library);
+	g_signal_connect (library->cdbase, "TracksChanged",
+	                  G_CALLBACK (update_library_tracks_tags_changes), library);
 
 	g_signal_connect (library->preferences, "notify::library-style",
 	                  G_CALLBACK (library_pane_change_style), library);
@@ -3185,6 +3676,10 @@ rena_library_pane_init (RenaLibraryPane *library)
 	provider = rena_database_provider_get ();
 	g_signal_connect (provider, "update-done",
 	                  G_CALLBACK (update_library_tracks_changes), library);
+	g_signal_connect (provider, "provider-removed",
+	                  G_CALLBACK (update_library_providers_changes), library);
+	g_signal_connect (provider, "provider-toggled",
+	                  G_CALLBACK (update_library_providers_changes), library);
 	g_object_unref (provider);
 
 	gtk_widget_show_all (GTK_WIDGET(library));
@@ -3194,6 +3689,14 @@ static void
 rena_library_pane_finalize (GObject *object)
 {
 	RenaLibraryPane *library = RENA_LIBRARY_PANE (object);
+	RenaDatabaseProvider *provider;
+
+	provider = rena_database_provider_get ();
+	g_signal_handlers_disconnect_by_data (provider, library);
+	g_object_unref (provider);
+
+	if (library->reload_id)
+		g_source_remove (library->reload_id);
 
 	if (library->pixbuf_dir)
 		g_object_unref (library->pixbuf_dir);
@@ -3211,9 +3714,10 @@ rena_library_pane_finalize (GObject *object)
 		library->filter_entry = NULL;
 	}
 
+	rena_library_pane_set_store (library, NULL);
+
 	g_object_unref (library->cdbase);
 	g_object_unref (library->preferences);
-	g_object_unref (library->library_store);
 
 	g_slist_free (library->library_tree_nodes);
 
@@ -0,0 +1,451 @@
+/*
+ * Copyright (C) 2024 Santelmo Technologies <santelmotechnologies@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "rena-library-snapshot.h"
+
+#include <string.h>
+#include <glib/gstdio.h>
+
+#include "rena-simple-async.h"
+#include "rena-debug.h"
+
+/*
+ * Library snapshots.
+ *
+ * The rows of a library view, as returned by its SQL query, saved in a file
+ * that is mapped on startup to fill the tree without touching the database.
+ *
+ * The file is a header, followed by the rows and a block with all the
+ * strings, each one stored once. Rows refer to the strings by their offset.
+ * It is written in the byte order of the host, what the magic number checks.
+ *
+ * The header keeps the library generation of the database when the rows were
+ * read, so any later change of the tracks makes the snapshot stale.
+ */
+
+#define RENA_LIBRARY_SNAPSHOT_MAGIC   0x53534e52 /* "RNSS" */
+#define RENA_LIBRARY_SNAPSHOT_VERSION 1
+
+typedef struct {
+	guint32 magic;
+	guint32 version;
+	gint64  generation;
+	guint32 view;
+	gint32  provider;
+	guint32 n_rows;
+	guint32 strings_size;
+} RenaLibrarySnapshotHeader;
+
+typedef struct {
+	gint32  location_id;
+	guint32 fields[SNAPSHOT_N_FIELDS];
+} RenaLibrarySnapshotRow;
+
+struct _RenaLibrarySnapshot {
+	GMappedFile                  *file;
+	const RenaLibrarySnapshotRow *rows;
+	const gchar                  *strings;
+	guint                         n_rows;
+};
+
+struct _RenaLibrarySnapshotBuilder {
+	RenaLibrarySnapshotHeader  header;
+	GArray                    *rows;
+	GString                   *strings;
+	GHashTable                *offsets;
+};
+
+static gchar *
+rena_library_snapshot_get_path (gint provider_id)
+{
+	gchar *filename, *path;
+
+	filename = g_strdup_printf ("library-%d.snapshot", provider_id);
+	path = g_build_filename (g_get_user_cache_dir (), "rena", filename, NULL);
+	g_free (filename);
+
+	return path;
+}
+
+static gboolean
+rena_library_snapshot_check (const gchar *contents, gsize length, gint provider_id, guint view, gint64 generation)
+{
+	const RenaLibrarySnapshotHeader *header;
+	const RenaLibrarySnapshotRow *rows;
+	const gchar *strings;
+	guint i, j;
+
+	if (length < sizeof(RenaLibrarySnapshotHeader))
+		return FALSE;
+
+	header = (const RenaLibrarySnapshotHeader *) contents;
+	if (header->magic != RENA_LIBRARY_SNAPSHOT_MAGIC ||
+	    header->version != RENA_LIBRARY_SNAPSHOT_VERSION)
+		return FALSE;
+
+	/* Valid, but of another view or an older library. */
+	if (header->provider != provider_id ||
+	    header->view != view ||
+	    header->generation != generation)
+		return FALSE;
+
+	if ((guint64) sizeof(RenaLibrarySnapshotHeader) +
+	    (guint64) header->n_rows * sizeof(RenaLibrarySnapshotRow) +
+	    (guint64) header->strings_size != length)
+		return FALSE;
+
+	rows = (const RenaLibrarySnapshotRow *) (contents + sizeof(RenaLibrarySnapshotHeader));
+	strings = (const gchar *) (rows + header->n_rows);
+
+	if (header->strings_size == 0 || strings[header->strings_size - 1] != '\0')
+		return FALSE;
+
+	for (i = 0; i < header->n_rows; i++) {
+		for (j = 0; j < SNAPSHOT_N_FIELDS; j++) {
+			if (rows[i].fields[j] >= header->strings_size)
+				return FALSE;
+		}
+	}
+
+	return TRUE;
+}
+
+/**
+ * rena_library_snapshot_open:
+ *
+ * Maps the snapshot of a provider, if it holds the @view of the library
+ * at @generation.
+ *
+ * Return value: a #RenaLibrarySnapshot or %NULL if missing, stale or invalid.
+ */
+RenaLibrarySnapshot *
+rena_library_snapshot_open (gint provider_id, guint view, gint64 generation)
+{
+	RenaLibrarySnapshot *snapshot;
+	const RenaLibrarySnapshotHeader *header;
+	GMappedFile *file;
+	const gchar *contents;
+	gchar *path;
+	gsize length;
+
+	path = rena_library_snapshot_get_path (provider_id);
+	file = g_mapped_file_new (path, FALSE, NULL);
+	g_free (path);
+
+	if (file == NULL)
+		return NULL;
+
+	contents = g_mapped_file_get_contents (file);
+	length = g_mapped_file_get_length (file);
+
+	if (!rena_library_snapshot_check (contents, length, provider_id, view, generation)) {
+		CDEBUG(DBG_DB, "Library snapshot of provider %d is stale or invalid", provider_id);
+		g_mapped_file_unref (file);
+		return NULL;
+	}
+
+	header = (const RenaLibrarySnapshotHeader *) contents;
+
+	snapshot = g_slice_new0 (RenaLibrarySnapshot);
+	snapshot->file = file;
+	snapshot->n_rows = header->n_rows;
+	snapshot->rows = (const RenaLibrarySnapshotRow *) (contents + sizeof(RenaLibrarySnapshotHeader));
+	snapshot->strings = (const gchar *) (snapshot->rows + header->n_rows);
+
+	CDEBUG(DBG_DB, "Library snapshot of provider %d mapped with %u rows", provider_id, snapshot->n_rows);
+
+	return snapshot;
+}
+
+guint
+rena_library_snapshot_get_n_rows (RenaLibrarySnapshot *snapshot)
+{
+	return snapshot->n_rows;
+}
+
+/**
+ * rena_library_snapshot_get_row:
+ *
+ * Fills @fields with the SNAPSHOT_N_FIELDS strings of the @row. They point
+ * into the snapshot, and are valid until it is freed.
+ *
+ * Return value: the location id of the row.
+ */
+gint
+rena_library_snapshot_get_row (RenaLibrarySnapshot *snapshot, guint row, const gchar **fields)
+{
+	const RenaLibrarySnapshotRow *r = &snapshot->rows[row];
+	guint i;
+
+	for (i = 0; i < SNAPSHOT_N_FIELDS; i++)
+		fields[i] = snapshot->strings + r->fields[i];
+
+	return r->location_id;
+}
+
+void
+rena_library_snapshot_free (RenaLibrarySnapshot *snapshot)
+{
+	g_mapped_file_unref (snapshot->file);
+	g_slice_free (RenaLibrarySnapshot, snapshot);
+}
+
+/*
+ * Writing snapshots.
+ */
+
+RenaLibrarySnapshotBuilder *
+rena_library_snapshot_builder_new (gint provider_id, guint view, gint64 generation)
+{
+	RenaLibrarySnapshotBuilder *builder;
+
+	builder = g_slice_new0 (RenaLibrarySnapshotBuilder);
+	builder->header.magic = RENA_LIBRARY_SNAPSHOT_MAGIC;
+	builder->header.version = RENA_LIBRARY_SNAPSHOT_VERSION;
+	builder->header.generation = generation;
+	builder->header.view = view;
+	builder->header.provider = provider_id;
+
+	builder->rows = g_array_new (FALSE, FALSE, sizeof(RenaLibrarySnapshotRow));
+	builder->strings = g_string_new (NULL);
+	builder->offsets = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+
+	/* Offset 0 is the empty string, also used for NULL values. */
+	g_string_append_c (builder->strings, '\0');
+	g_hash_table_insert (builder->offsets, g_strdup (""), GUINT_TO_POINTER(0));
+
+	return builder;
+}
+
+static guint32
+rena_library_snapshot_builder_intern (RenaLibrarySnapshotBuilder *builder, const gchar *string)
+{
+	gpointer offset;
+
+	if (string == NULL)
+		return 0;
+
+	if (g_hash_table_lookup_extended (builder->offsets, string, NULL, &offset))
+		return GPOINTER_TO_UINT(offset);
+
+	offset = GUINT_TO_POINTER(builder->strings->len);
+	g_string_append_len (builder->strings, string, strlen (string) + 1);
+	g_hash_table_insert (builder->offsets, g_strdup (string), offset);
+
+	return GPOINTER_TO_UINT(offset);
+}
+
+void
+rena_library_snapshot_builder_add_row (RenaLibrarySnapshotBuilder *builder, gint location_id, const gchar **fields)
+{
+	RenaLibrarySnapshotRow row;
+	guint i;
+
+	row.location_id = location_id;
+	for (i = 0; i < SNAPSHOT_N_FIELDS; i++)
+		row.fields[i] = rena_library_snapshot_builder_intern (builder, fields[i]);
+
+	g_array_append_val (builder->rows, row);
+}
+
+/**
+ * rena_library_snapshot_builder_write:
+ *
+ * Replaces the snapshot of the provider with the rows added to @builder.
+ * The file is replaced atomically, so readers never see half of it.
+ */
+gboolean
+rena_library_snapshot_builder_write (RenaLibrarySnapshotBuilder *builder)
+{
+	GError *error = NULL;
+	gchar *contents, *path, *dir;
+	gsize rows_size, length;
+	gboolean ret;
+
+	builder->header.n_rows = builder->rows->len;
+	builder->header.strings_size = builder->strings->len;
+
+	rows_size = builder->rows->len * sizeof(RenaLibrarySnapshotRow);
+	length = sizeof(RenaLibrarySnapshotHeader) + rows_size + builder->strings->len;
+
+	contents = g_malloc (length);
+	memcpy (contents, &builder->header, sizeof(RenaLibrarySnapshotHeader));
+	memcpy (contents + sizeof(RenaLibrarySnapshotHeader), builder->rows->data, rows_size);
+	memcpy (contents + sizeof(RenaLibrarySnapshotHeader) + rows_size, builder->strings->str, builder->strings->len);
+
+	path = rena_library_snapshot_get_path (builder->header.provider);
+	dir = g_path_get_dirname (path);
+	g_mkdir_with_parents (dir, S_IRWXU);
+
+	ret = g_file_set_contents (path, contents, length, &error);
+	if (!ret) {
+		g_warning ("Unable to write the library snapshot: %s", error->message);
+		g_error_free (error);
+	}
+	else {
+		CDEBUG(DBG_DB, "Library snapshot of provider %d written with %u rows",
+		       builder->header.provider, builder->header.n_rows);
+	}
+
+	g_free (dir);
+	g_free (path);
+	g_free (contents);
+
+	return ret;
+}
+
+void
+rena_library_snapshot_builder_free (RenaLibrarySnapshotBuilder *builder)
+{
+	g_array_free (builder->rows, TRUE);
+	g_string_free (builder->strings, TRUE);
+	g_hash_table_destroy (builder->offsets);
+	g_slice_free (RenaLibrarySnapshotBuilder, builder);
+}
+
+/*
+ * Update snapshots in background.
+ */
+
+static gpointer
+rena_library_snapshot_builder_write_worker (gpointer data)
+{
+	RenaLibrarySnapshotBuilder *builder = data;
+
+	rena_library_snapshot_builder_write (builder);
+	rena_library_snapshot_builder_free (builder);
+
+	return NULL;
+}
+
+static gboolean
+rena_library_snapshot_builder_write_finished (gpointer data)
+{
+	return FALSE;
+}
+
+/**
+ * rena_library_snapshot_builder_write_async:
+ *
+ * Same as rena_library_snapshot_builder_write() in a thread. It takes
+ * @builder, and frees it when done.
+ */
+void
+rena_library_snapshot_builder_write_async (RenaLibrarySnapshotBuilder *builder)
+{
+	rena_async_launch (rena_library_snapshot_builder_write_worker,
+	                   rena_library_snapshot_builder_write_finished,
+	                   builder);
+}
+
+typedef struct {
+	RenaDatabase *database;
+	gint          provider_id;
+	guint         view;
+	gchar        *sql;
+} RenaLibrarySnapshotJob;
+
+static gpointer
+rena_library_snapshot_update_worker (gpointer data)
+{
+	RenaLibrarySnapshotJob *job = data;
+	RenaLibrarySnapshotBuilder *builder = NULL;
+	RenaDatabaseReader *reader;
+	RenaPreparedStatement *statement;
+	const gchar *fields[SNAPSHOT_N_FIELDS];
+	gint64 generation = -1;
+	guint i;
+
+	reader = rena_database_reader_acquire (job->database);
+	if (reader == NULL)
+		return job;
+
+	/* Read the generation and the rows in the same transaction. */
+
+	statement = rena_database_reader_create_statement (reader, "BEGIN");
+	rena_prepared_statement_step (statement);
+	rena_prepared_statement_free (statement);
+
+	statement = rena_database_reader_create_statement (reader, "SELECT generation FROM LIBRARY_STATE");
+	if (rena_prepared_statement_step (statement))
+		generation = rena_prepared_statement_get_int64 (statement, 0);
+	rena_prepared_statement_free (statement);
+
+	statement = rena_database_reader_create_statement (reader, job->sql);
+	if (generation >= 0 && statement != NULL) {
+		builder = rena_library_snapshot_builder_new (job->provider_id, job->view, generation);
+		rena_prepared_statement_bind_int (statement, 1, job->provider_id);
+		while (rena_prepared_statement_step (statement)) {
+			for (i = 0; i < SNAPSHOT_N_FIELDS; i++)
+				fields[i] = rena_prepared_statement_get_string (statement, i);
+			rena_library_snapshot_builder_add_row (builder,
+				rena_prepared_statement_get_int (statement, SNAPSHOT_N_FIELDS),
+				fields);
+		}
+	}
+	if (statement != NULL)
+		rena_prepared_statement_free (statement);
+
+	statement = rena_database_reader_create_statement (reader, "COMMIT");
+	rena_prepared_statement_step (statement);
+	rena_prepared_statement_free (statement);
+
+	rena_database_reader_release (job->database, reader);
+
+	if (builder) {
+		rena_library_snapshot_builder_write (builder);
+		rena_library_snapshot_builder_free (builder);
+	}
+
+	return job;
+}
+
+static gboolean
+rena_library_snapshot_update_finished (gpointer data)
+{
+	RenaLibrarySnapshotJob *job = data;
+
+	g_object_unref (job->database);
+	g_free (job->sql);
+	g_slice_free (RenaLibrarySnapshotJob, job);
+
+	return FALSE;
+}
+
+/**
+ * rena_library_snapshot_update_async:
+ *
+ * Rewrites the snapshot of a provider in a thread, running @sql on a
+ * reader connection. @sql must return the fields in the order of
+ * #RenaLibrarySnapshotField, followed by the location id, and take the
+ * provider id as its only parameter.
+ */
+void
+rena_library_snapshot_update_async (RenaDatabase *database, gint provider_id, guint view, const gchar *sql)
+{
+	RenaLibrarySnapshotJob *job;
+
+	job = g_slice_new0 (RenaLibrarySnapshotJob);
+	job->database = g_object_ref (database);
+	job->provider_id = provider_id;
+	job->view = view;
+	job->sql = g_strdup (sql);
+
+	rena_async_launch (rena_library_snapshot_update_worker,
+	                   rena_library_snapshot_update_finished,
+	                   job);
+}
@@ -0,0 +1,73 @@
+/*
+ * Copyright (C) 2024 Santelmo Technologies <santelmotechnologies@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef RENA_LIBRARY_SNAPSHOT_H
+#define RENA_LIBRARY_SNAPSHOT_H
+
+#include <glib.h>
+
+#include "rena-database.h"
+
+G_BEGIN_DECLS
+
+/* Columns of each row, in the order of the library view query. */
+typedef enum {
+	SNAPSHOT_TITLE,
+	SNAPSHOT_ARTIST,
+	SNAPSHOT_YEAR,
+	SNAPSHOT_ALBUM,
+	SNAPSHOT_GENRE,
+	SNAPSHOT_LOCATION,
+	SNAPSHOT_N_FIELDS
+} RenaLibrarySnapshotField;
+
+typedef struct _RenaLibrarySnapshot RenaLibrarySnapshot;
+typedef struct _RenaLibrarySnapshotBuilder RenaLibrarySnapshotBuilder;
+
+RenaLibrarySnapshot *
+rena_library_snapshot_open             (gint provider_id, guint view, gint64 generation);
+
+guint
+rena_library_snapshot_get_n_rows       (RenaLibrarySnapshot *snapshot);
+
+gint
+rena_library_snapshot_get_row          (RenaLibrarySnapshot *snapshot, guint row, const gchar **fields);
+
+void
+rena_library_snapshot_free             (RenaLibrarySnapshot *snapshot);
+
+RenaLibrarySnapshotBuilder *
+rena_library_snapshot_builder_new      (gint provider_id, guint view, gint64 generation);
+
+void
+rena_library_snapshot_builder_add_row  (RenaLibrarySnapshotBuilder *builder, gint location_id, const gchar **fields);
+
+gboolean
+rena_library_snapshot_builder_write    (RenaLibrarySnapshotBuilder *builder);
+
+void
+rena_library_snapshot_builder_free     (RenaLibrarySnapshotBuilder *builder);
+
+void
+rena_library_snapshot_builder_write_async (RenaLibrarySnapshotBuilder *builder);
+
+void
+rena_library_snapshot_update_async     (RenaDatabase *database, gint provider_id, guint view, const gchar *sql);
+
+G_END_DECLS
+
+#endif /* RENA_LIBRARY_SNAPSHOT_H */
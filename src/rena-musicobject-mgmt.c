@@ -57,6 +57,45 @@ new_musicobject_from_file(const gchar *file, const gchar *provider)
 	return NULL;
 }
 
+#define MUSICOBJECT_COLUMNS \
+	"LOCATION.name, PROVIDER_TYPE.name, PROVIDER.name, MIME_TYPE.name, TRACK.title, ARTIST.name, ALBUM.name, GENRE.name, COMMENT.name, YEAR.year, TRACK.track_no, TRACK.length, TRACK.bitrate, TRACK.channels, TRACK.samplerate"
+
+#define MUSICOBJECT_JOINS \
+	"PROVIDER.id = TRACK.provider AND PROVIDER_TYPE.id = PROVIDER.type AND MIME_TYPE.id = TRACK.file_type AND ARTIST.id = TRACK.artist AND ALBUM.id = TRACK.album AND GENRE.id = TRACK.genre AND COMMENT.id = TRACK.comment AND YEAR.id = TRACK.year AND LOCATION.id = TRACK.location"
+
+/* Build a musicobject from the MUSICOBJECT_COLUMNS found at the given column. */
+
+static RenaMusicobject *
+new_musicobject_from_statement (RenaPreparedStatement *statement,
+                                RenaMusicEnum         *enum_map,
+                                gint                   column)
+{
+	RenaMusicobject *mobj = NULL;
+
+	mobj = g_object_new (RENA_TYPE_MUSICOBJECT,
+	                     "file", rena_prepared_statement_get_string (statement, column + 0),
+	                     "provider", rena_prepared_statement_get_string (statement, column + 2),
+	                     "mime-type", rena_prepared_statement_get_string (statement, column + 3),
+	                     "title", rena_prepared_statement_get_string (statement, column + 4),
+	                     "artist", rena_prepared_statement_get_string (statement, column + 5),
+	                     "album", rena_prepared_statement_get_string (statement, column + 6),
+	                     "genre", rena_prepared_statement_get_string (statement, column + 7),
+	                     "comment", rena_prepared_statement_get_string (statement, column + 8),
+	                     "year", rena_prepared_statement_get_int (statement, column + 9),
+	                     "track-no", rena_prepared_statement_get_int (statement, column + 10),
+	                     "length", rena_prepared_statement_get_int (statement, column + 11),
+	                     "bitrate", rena_prepared_statement_get_int (statement, column + 12),
+	                     "channels", rena_prepared_statement_get_int (statement, column + 13),
+	                     "samplerate", rena_prepared_statement_get_int (statement, column + 14),
+	                     NULL);
+
+	rena_musicobject_set_source (mobj,
+		rena_music_enum_map_get(enum_map,
+			rena_prepared_statement_get_string (statement, column + 1)));
+
+	return mobj;
+}
+
 RenaMusicobject *
 new_musicobject_from_db(RenaDatabase *cdbase, gint location_id)
 {
@@ -67,38 +106,17 @@ new_musicobject_from_db(RenaDatabase *cdbase, gint location_id)
 	CDEBUG(DBG_MOBJ, "Creating new musicobject with location id: %d", location_id);
 
 	const gchar *sql =
-		"SELECT LOCATION.name, PROVIDER_TYPE.name, PROVIDER.name, MIME_TYPE.name, TRACK.title, ARTIST.name, ALBUM.name, GENRE.name, COMMENT.name, YEAR.year, TRACK.track_no, TRACK.length, TRACK.bitrate, TRACK.channels, TRACK.samplerate \
+		"SELECT " MUSICOBJECT_COLUMNS " \
 		 FROM LOCATION, PROVIDER_TYPE, PROVIDER, MIME_TYPE, TRACK, ARTIST, ALBUM, GENRE, COMMENT, YEAR \
-		 WHERE TRACK.location = ? AND PROVIDER.id = TRACK.provider AND PROVIDER_TYPE.id = PROVIDER.type AND MIME_TYPE.id = TRACK.file_type AND ARTIST.id = TRACK.artist AND ALBUM.id = TRACK.album AND GENRE.id = TRACK.genre AND COMMENT.id = TRACK.comment AND YEAR.id = TRACK.year \
-		 AND LOCATION.id = ?";
+		 WHERE TRACK.location = ? AND " MUSICOBJECT_JOINS;
 
 	statement = rena_database_create_statement (cdbase, sql);
 	rena_prepared_statement_bind_int (statement, 1, location_id);
-	rena_prepared_statement_bind_int (statement, 2, location_id);
 
 	if (rena_prepared_statement_step (statement))
 	{
-		mobj = g_object_new (RENA_TYPE_MUSICOBJECT,
-		                     "file", rena_prepared_statement_get_string (statement, 0),
-		                     "provider", rena_prepared_statement_get_string (statement, 2),
-		                     "mime-type", rena_prepared_statement_get_string (statement, 3),
-		                     "title", rena_prepared_statement_get_string (statement, 4),
-		                     "artist", rena_prepared_statement_get_string (statement, 5),
-		                     "album", rena_prepared_statement_get_string (statement, 6),
-		                     "genre", rena_prepared_statement_get_string (statement, 7),
-		                     "comment", rena_prepared_statement_get_string (statement, 8),
-		                     "year", rena_prepared_statement_get_int (statement, 9),
-		                     "track-no", rena_prepared_statement_get_int (statement, 10),
-		                     "length", rena_prepared_statement_get_int (statement, 11),
-		                     "bitrate", rena_prepared_statement_get_int (statement, 12),
-		                     "channels", rena_prepared_statement_get_int (statement, 13),
-		                     "samplerate", rena_prepared_statement_get_int (statement, 14),
-		                     NULL);
-
 		enum_map = rena_music_enum_get ();
-		rena_musicobject_set_source (mobj,
-			rena_music_enum_map_get(enum_map,
-				rena_prepared_statement_get_string (statement, 1)));
+		mobj = new_musicobject_from_statement (statement, enum_map, 0);
 		g_object_unref (enum_map);
 	}
 	else
@@ -111,6 +129,156 @@ new_musicobject_from_db(RenaDatabase *cdbase, gint location_id)
 	return mobj;
 }
 
+/* 2 parameters per location keeps it under the default
+ * SQLITE_MAX_VARIABLE_NUMBER (999). */
+#define HYDRATE_LOCATIONS_PER_INSERT 256
+
+static gchar *
+hydrate_locations_insert_sql (guint n_locations)
+{
+	GString *sql;
+	guint i;
+
+	sql = g_string_new ("INSERT INTO temp.HYDRATE_LOCATIONS (pos, location) VALUES ");
+	for (i = 0; i < n_locations; i++)
+		g_string_append (sql, i ? ", (?, ?)" : "(?, ?)");
+
+	return g_string_free (sql, FALSE);
+}
+
+/* Fills temp.HYDRATE_LOCATIONS with the non zero ids of location_ids,
+ * HYDRATE_LOCATIONS_PER_INSERT rows on each statement. */
+
+static void
+hydrate_locations_fill (RenaDatabase *cdbase, GArray *location_ids)
+{
+	RenaPreparedStatement *statement;
+	gchar *sql = NULL;
+	guint *pos, i, n_pos = 0, j, n;
+	gint location_id;
+
+	pos = g_new (guint, location_ids->len);
+	for (i = 0; i < location_ids->len; i++) {
+		if (g_array_index (location_ids, gint, i) != 0)
+			pos[n_pos++] = i;
+	}
+
+	for (i = 0; i < n_pos; i += n) {
+		n = MIN (n_pos - i, HYDRATE_LOCATIONS_PER_INSERT);
+
+		/* The full chunks share one cached statement. */
+		if (n == HYDRATE_LOCATIONS_PER_INSERT) {
+			if (sql == NULL)
+				sql = hydrate_locations_insert_sql (n);
+			statement = rena_database_create_statement (cdbase, sql);
+		}
+		else {
+			g_free (sql);
+			sql = hydrate_locations_insert_sql (n);
+			statement = rena_database_create_dynamic_statement (cdbase, sql);
+		}
+
+		for (j = 0; j < n; j++) {
+			location_id = g_array_index (location_ids, gint, pos[i + j]);
+			rena_prepared_statement_bind_int (statement, 2 * j + 1, pos[i + j]);
+			rena_prepared_statement_bind_int (statement, 2 * j + 2, location_id);
+		}
+		rena_prepared_statement_step (statement);
+		rena_prepared_statement_free (statement);
+	}
+
+	g_free (sql);
+	g_free (pos);
+}
+
+/**
+ * new_musicobjects_from_db:
+ * @cdbase: the #RenaDatabase.
+ * @location_ids: a #GArray of gint location ids.
+ *
+ * Hydrates all the tracks of @location_ids in a single query, joining them
+ * through a temporary table instead of running a query per track.
+ *
+ * Return value: a #GPtrArray with the same length and order than
+ * @location_ids, holding a new #RenaMusicobject for each location, or %NULL
+ * when is zero or not found in database. The caller owns the musicobjects
+ * and must free the array with g_ptr_array_free().
+ */
+GPtrArray *
+new_musicobjects_from_db (RenaDatabase *cdbase, GArray *location_ids)
+{
+	RenaPreparedStatement *statement = NULL;
+	RenaMusicEnum *enum_map = NULL;
+	RenaMusicobject *mobj = NULL;
+	GPtrArray *mobjs;
+	gint pos;
+
+	mobjs = g_ptr_array_sized_new (location_ids->len);
+	g_ptr_array_set_size (mobjs, location_ids->len);
+
+	if (location_ids->len == 0)
+		return mobjs;
+
+	CDEBUG(DBG_MOBJ, "Creating %u new musicobjects from database", location_ids->len);
+
+	const gchar *sql =
+		"SELECT HYDRATE_LOCATIONS.pos, " MUSICOBJECT_COLUMNS " \
+		 FROM temp.HYDRATE_LOCATIONS CROSS JOIN TRACK ON TRACK.location = HYDRATE_LOCATIONS.location, \
+		 LOCATION, PROVIDER_TYPE, PROVIDER, MIME_TYPE, ARTIST, ALBUM, GENRE, COMMENT, YEAR \
+		 WHERE " MUSICOBJECT_JOINS;
+
+	/* CROSS JOIN keeps the temporary table as the outer loop, so each
+	 * track is found by its primary key instead of scanning TRACK. */
+
+	rena_database_exec_query (cdbase, "SAVEPOINT hydrate_locations");
+	rena_database_exec_query (cdbase,
+		"CREATE TEMP TABLE IF NOT EXISTS HYDRATE_LOCATIONS (pos INTEGER PRIMARY KEY, location INT)");
+
+	hydrate_locations_fill (cdbase, location_ids);
+
+	enum_map = rena_music_enum_get ();
+
+	statement = rena_database_create_statement (cdbase, sql);
+	while (rena_prepared_statement_step (statement)) {
+		pos = rena_prepared_statement_get_int (statement, 0);
+		mobj = new_musicobject_from_statement (statement, enum_map, 1);
+		g_ptr_array_index (mobjs, pos) = mobj;
+	}
+	rena_prepared_statement_free (statement);
+
+	g_object_unref (enum_map);
+
+	rena_database_exec_query (cdbase, "DELETE FROM temp.HYDRATE_LOCATIONS");
+	rena_database_exec_query (cdbase, "RELEASE hydrate_locations");
+
+	return mobjs;
+}
+
+/* Hydrate the location ids of loc_arr, append them to the mobj list and
+ * empty the array to collect the following ones. */
+
+GList *
+add_location_ids_to_mobj_list (RenaDatabase *cdbase, GArray *loc_arr, GList *list)
+{
+	GPtrArray *mobjs;
+	GList *tracks = NULL;
+	guint i;
+
+	if (loc_arr->len == 0)
+		return list;
+
+	mobjs = new_musicobjects_from_db (cdbase, loc_arr);
+	for (i = mobjs->len; i > 0; i--) {
+		if (G_LIKELY(g_ptr_array_index (mobjs, i - 1)))
+			tracks = g_list_prepend (tracks, g_ptr_array_index (mobjs, i - 1));
+	}
+	g_ptr_array_free (mobjs, TRUE);
+
+	g_array_set_size (loc_arr, 0);
+
+	return g_list_concat (list, tracks);
+}
+
 RenaMusicobject *
 new_musicobject_from_location(const gchar *uri, const gchar *name)
 {
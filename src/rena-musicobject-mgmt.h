@@ -39,6 +39,15 @@ RenaMusicobject *
 new_musicobject_from_db                   (RenaDatabase *cdbase,
                                            gint location_id);
 
+GPtrArray *
+new_musicobjects_from_db                  (RenaDatabase *cdbase,
+                                           GArray       *location_ids);
+
+GList *
+add_location_ids_to_mobj_list             (RenaDatabase *cdbase,
+                                           GArray       *loc_arr,
+                                           GList        *list);
+
 RenaMusicobject *
 new_musicobject_from_location             (const gchar *uri,
                                            const gchar *name);
@@ -3240,9 +3240,12 @@ rena_playlist_restore_tracks (RenaPlaylist *cplaylist)
 	gint playlist_id, location_id;
 	const gchar *filename = NULL;
 	RenaMusicobject *mobj;
+	GPtrArray *files, *mobjs;
+	GArray *loc_arr;
 	GList *list = NULL;
+	guint i;
 
-	const gchar *sql = "SELECT file FROM PLAYLIST_TRACKS WHERE playlist = ?";
+	const gchar *sql = "SELECT COALESCE(LOCATION.name, PLAYLIST_ENTRIES.uri), PLAYLIST_ENTRIES.location FROM PLAYLIST_ENTRIES LEFT JOIN LOCATION ON LOCATION.id = PLAYLIST_ENTRIES.location WHERE PLAYLIST_ENTRIES.playlist = ? ORDER BY PLAYLIST_ENTRIES.position";
 
 	/* Set watch cursor early */
 	set_watch_cursor (GTK_WIDGET(cplaylist));
@@ -3252,31 +3255,46 @@ rena_playlist_restore_tracks (RenaPlaylist *cplaylist)
 
 	playlist_id = rena_database_find_playlist (cplaylist->cdbase, SAVE_PLAYLIST_STATE);
 
+	/* Collect the stored entries and hydrate all the tracks of the library
+	 * in one pass. Entries outside the library keep a zero location id. */
+
+	files = g_ptr_array_new_with_free_func (g_free);
+	loc_arr = g_array_new (FALSE, FALSE, sizeof(gint));
+
 	statement = rena_database_create_statement (cplaylist->cdbase, sql);
 	rena_prepared_statement_bind_int (statement, 1, playlist_id);
 
 	while (rena_prepared_statement_step (statement))
 	{
-		filename = rena_prepared_statement_get_string (statement, 0);
-		if ((location_id = rena_database_find_location (cplaylist->cdbase, filename)))
-		{
-			mobj = new_musicobject_from_db(cplaylist->cdbase, location_id);
-		}
-		else if (g_str_has_prefix(filename, "http:/") ||
-		         g_str_has_prefix(filename, "https:/"))
-		{
-			mobj = new_musicobject_from_location (filename, NULL);
-		}
-		else
+		location_id = rena_prepared_statement_get_int (statement, 1);
+		g_ptr_array_add (files, g_strdup(rena_prepared_statement_get_string (statement, 0)));
+		g_array_append_val (loc_arr, location_id);
+	}
+
+	rena_prepared_statement_free (statement);
+
+	mobjs = new_musicobjects_from_db (cplaylist->cdbase, loc_arr);
+
+	for (i = 0; i < mobjs->len; i++)
+	{
+		filename = g_ptr_array_index (files, i);
+		mobj = g_ptr_array_index (mobjs, i);
+		if (mobj == NULL)
 		{
-			mobj = new_musicobject_from_file(filename, NULL);
+			if (g_str_has_prefix(filename, "http:/") ||
+			    g_str_has_prefix(filename, "https:/"))
+				mobj = new_musicobject_from_location (filename, NULL);
+			else
+				mobj = new_musicobject_from_file(filename, NULL);
 		}
 
 		if (G_LIKELY(mobj))
 			list = g_list_prepend (list, mobj);
 	}
 
-	rena_prepared_statement_free (statement);
+	g_ptr_array_free (mobjs, TRUE);
+	g_array_free (loc_arr, TRUE);
+	g_ptr_array_free (files, TRUE);
 
 	rena_database_commit_transaction (cplaylist->cdbase);
 
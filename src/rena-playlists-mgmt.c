@@ -431,29 +431,40 @@ add_playlist_to_mobj_list(RenaDatabase *cdbase,
 {
 	gint playlist_id, location_id;
 	RenaMusicobject *mobj;
+	GArray *loc_arr;
 
 	playlist_id = rena_database_find_playlist (cdbase, playlist);
 
 	if(playlist_id == 0)
 		goto bad;
 
-	const gchar *sql = "SELECT file FROM PLAYLIST_TRACKS WHERE playlist = ?";
+	/* Consecutive tracks of the library are hydrated together. */
+
+	loc_arr = g_array_new (FALSE, FALSE, sizeof(gint));
+
+	const gchar *sql = "SELECT COALESCE(LOCATION.name, PLAYLIST_ENTRIES.uri), PLAYLIST_ENTRIES.location FROM PLAYLIST_ENTRIES LEFT JOIN LOCATION ON LOCATION.id = PLAYLIST_ENTRIES.location WHERE PLAYLIST_ENTRIES.playlist = ? ORDER BY PLAYLIST_ENTRIES.position";
 	RenaPreparedStatement *statement = rena_database_create_statement (cdbase, sql);
 	rena_prepared_statement_bind_int (statement, 1, playlist_id);
 
 	while (rena_prepared_statement_step (statement)) {
 		const gchar *file = rena_prepared_statement_get_string (statement, 0);
 
-		if ((location_id = rena_database_find_location (cdbase, file)))
-			mobj = new_musicobject_from_db(cdbase, location_id);
-		else
-			mobj = new_musicobject_from_file (file, NULL);
+		if ((location_id = rena_prepared_statement_get_int (statement, 1))) {
+			g_array_append_val (loc_arr, location_id);
+			continue;
+		}
 
+		list = add_location_ids_to_mobj_list (cdbase, loc_arr, list);
+
+		mobj = new_musicobject_from_file (file, NULL);
 		if (G_LIKELY(mobj))
 			list = g_list_append(list, mobj);
 	}
 
 	rena_prepared_statement_free (statement);
+
+	list = add_location_ids_to_mobj_list (cdbase, loc_arr, list);
+	g_array_free (loc_arr, TRUE);
 bad:
 
 	return list;
@@ -1065,14 +1076,46 @@ rena_pl_get_first_playlist_item (const gchar *uri)
 
 /* Save tracks to a playlist using the given type */
 
+/* Files of the list, skipping the ones already in the playlist when a
+ * database is given. */
+
+static GPtrArray *
+playlist_mobj_list_get_files (GList *mlist, RenaDatabase *cdbase, gint playlist_id)
+{
+	GHashTable *seen = NULL;
+	GPtrArray *files;
+	const gchar *filename;
+	GList *i;
+
+	if (cdbase)
+		seen = g_hash_table_new (g_str_hash, g_str_equal);
+
+	files = g_ptr_array_new ();
+	for (i = mlist; i != NULL; i = i->next) {
+		filename = rena_musicobject_get_file (RENA_MUSICOBJECT(i->data));
+		if (seen) {
+			if (!g_hash_table_add (seen, (gpointer) filename))
+				continue;
+			if (rena_database_playlist_has_track (cdbase, playlist_id, filename))
+				continue;
+		}
+		g_ptr_array_add (files, (gpointer) filename);
+	}
+
+	if (seen)
+		g_hash_table_destroy (seen);
+
+	return files;
+}
+
 void
 save_playlist(RenaPlaylist* cplaylist,
               gint playlist_id,
               RenaPlaylistActionRange type)
 {
 	RenaDatabase *cdbase = NULL;
-	GList *mlist = NULL, *i;
-	const gchar *filename = NULL;
+	GList *mlist = NULL;
+	GPtrArray *files;
 
 	switch(type) {
 	case SAVE_COMPLETE:
@@ -1086,17 +1129,13 @@ save_playlist(RenaPlaylist* cplaylist,
 	}
 
 	cdbase = rena_playlist_get_database (cplaylist);
+	files = playlist_mobj_list_get_files (mlist, NULL, 0);
+	g_list_free(mlist);
+
 	rena_database_begin_transaction (cdbase);
-	if (mlist != NULL)
-	{
-		for (i = mlist; i != NULL; i = i->next)
-		{
-			filename = rena_musicobject_get_file (RENA_MUSICOBJECT(i->data));
-			rena_database_add_playlist_track (cdbase, playlist_id, filename);
-		}
-		g_list_free(mlist);
-	}
+	rena_database_add_playlist_tracks (cdbase, playlist_id, files);
 	rena_database_commit_transaction (cdbase);
+	g_ptr_array_free (files, TRUE);
 }
 
 void
@@ -1145,8 +1184,7 @@ void append_playlist(RenaPlaylist* cplaylist, const gchar *playlist, RenaPlaylis
 void
 rena_playlist_database_update_playlist (RenaDatabase *cdbase, const gchar *playlist, GList *mlist)
 {
-	GList *i;
-	const gchar *filename = NULL;
+	GPtrArray *files;
 	gint playlist_id;
 
 	if (string_is_empty(playlist)) {
@@ -1154,28 +1192,24 @@ rena_playlist_database_update_playlist (RenaDatabase *cdbase, const gchar *playl
 		return;
 	}
 
+	files = playlist_mobj_list_get_files (mlist, NULL, 0);
+
+	rena_database_begin_transaction (cdbase);
+
 	//TODO: Update instead replace playlist..
 	if ((playlist_id = rena_database_find_playlist (cdbase, playlist)))
 		rena_database_delete_playlist (cdbase, playlist);
 	playlist_id = rena_database_add_new_playlist (cdbase, playlist);
 
-	rena_database_begin_transaction (cdbase);
-	if (mlist != NULL)
-	{
-		for (i = mlist; i != NULL; i = i->next)
-		{
-			filename = rena_musicobject_get_file (RENA_MUSICOBJECT(i->data));
-			rena_database_add_playlist_track (cdbase, playlist_id, filename);
-		}
-	}
+	rena_database_add_playlist_tracks (cdbase, playlist_id, files);
 	rena_database_commit_transaction (cdbase);
+	g_ptr_array_free (files, TRUE);
 }
 
 void
 rena_playlist_database_insert_playlist (RenaDatabase *cdbase, const gchar *playlist, GList *mlist)
 {
-	GList *i;
-	const gchar *filename = NULL;
+	GPtrArray *files;
 	gint playlist_id;
 
 	if (string_is_empty(playlist)) {
@@ -1188,16 +1222,10 @@ rena_playlist_database_insert_playlist (RenaDatabase *cdbase, const gchar *playl
 		playlist_id = rena_database_add_new_playlist (cdbase, playlist);
 
 	rena_database_begin_transaction (cdbase);
-	if (mlist != NULL)
-	{
-		for (i = mlist; i != NULL; i = i->next)
-		{
-			filename = rena_musicobject_get_file (RENA_MUSICOBJECT(i->data));
-			if (!rena_database_playlist_has_track (cdbase, playlist_id, filename))
-				rena_database_add_playlist_track (cdbase, playlist_id, filename);
-		}
-	}
+	files = playlist_mobj_list_get_files (mlist, cdbase, playlist_id);
+	rena_database_add_playlist_tracks (cdbase, playlist_id, files);
 	rena_database_commit_transaction (cdbase);
+	g_ptr_array_free (files, TRUE);
 }
 
 
@@ -71,6 +71,7 @@ struct _RenaPreferencesDialog {
 	GtkDialog         __parent__;
 
 	RenaPreferences *preferences;
+	RenaDatabaseProvider *dbase_provider;
 
 	GtkWidget         *notebook;
 	PreferencesTab    *audio_tab;
@@ -274,39 +275,124 @@ rena_preferences_dialog_get_library_list (GtkWidget *library_tree)
 	return library_list;
 }
 
+static void
+rena_preferences_dialog_set_library_row (GtkListStore *store, GtkTreeIter *iter, RenaProvider *provider)
+{
+	gchar *markup = NULL;
+
+	markup = g_markup_printf_escaped("%s (%s)",
+		rena_provider_get_friendly_name(provider),
+		rena_provider_get_name(provider));
+
+	gtk_list_store_set (store, iter,
+	                    COLUMN_NAME, rena_provider_get_name(provider),
+	                    COLUMN_KIND, rena_provider_get_kind(provider),
+	                    COLUMN_FRIENDLY, rena_provider_get_friendly_name(provider),
+	                    COLUMN_ICON_NAME, rena_provider_get_icon_name(provider),
+	                    COLUMN_VISIBLE, rena_provider_get_visible(provider),
+	                    COLUMN_IGNORED, rena_provider_get_ignored(provider),
+	                    COLUMN_MARKUP, markup,
+	                    -1);
+
+	g_free (markup);
+}
+
 static void
 rena_preferences_dialog_set_library_list (GtkWidget *library_tree, GSList *library_list)
 {
-	RenaProvider *provider;
 	GtkTreeModel *model;
 	GtkTreeIter iter;
 	GSList *list;
-	gchar *markup = NULL;
 
 	model = gtk_tree_view_get_model(GTK_TREE_VIEW(library_tree));
 	gtk_list_store_clear (GTK_LIST_STORE(model));
 
 	for (list = library_list; list != NULL; list = list->next)
 	{
-		provider = RENA_PROVIDER(list->data);
+		gtk_list_store_append (GTK_LIST_STORE(model), &iter);
+		rena_preferences_dialog_set_library_row (GTK_LIST_STORE(model), &iter,
+		                                         RENA_PROVIDER(list->data));
+	}
+}
+
+static gboolean
+rena_preferences_dialog_find_library_row (GtkTreeModel *model, const gchar *name, GtkTreeIter *iter)
+{
+	gchar *row_name = NULL;
+	gboolean found = FALSE, ret;
+
+	ret = gtk_tree_model_get_iter_first (model, iter);
+	while (ret && !found) {
+		gtk_tree_model_get (model, iter, COLUMN_NAME, &row_name, -1);
+		found = (g_strcmp0 (row_name, name) == 0);
+		g_free (row_name);
+		if (!found)
+			ret = gtk_tree_model_iter_next (model, iter);
+	}
+
+	return found;
+}
+
+/*
+ * Keep the list of libraries in sync with the providers added, removed or
+ * toggled elsewhere, e.g. by the plugins. Otherwise applying the dialog
+ * would undo those changes.
+ */
+
+static void
+rena_preferences_dialog_provider_added (RenaDatabaseProvider  *dbase_provider,
+                                        const gchar           *name,
+                                        RenaPreferencesDialog *dialog)
+{
+	RenaProvider *provider;
+	GtkTreeModel *model;
+	GtkTreeIter iter;
 
-		markup = g_markup_printf_escaped("%s (%s)",
-			rena_provider_get_friendly_name(provider),
-			rena_provider_get_name(provider));
+	provider = rena_database_provider_get_provider (dbase_provider, name);
+	if (provider == NULL)
+		return;
 
+	model = gtk_tree_view_get_model (GTK_TREE_VIEW(dialog->library_view_w));
+	if (!rena_preferences_dialog_find_library_row (model, name, &iter))
 		gtk_list_store_append (GTK_LIST_STORE(model), &iter);
-		gtk_list_store_set (GTK_LIST_STORE(model), &iter,
-		                    COLUMN_NAME, rena_provider_get_name(provider),
-		                    COLUMN_KIND, rena_provider_get_kind(provider),
-		                    COLUMN_FRIENDLY, rena_provider_get_friendly_name(provider),
-		                    COLUMN_ICON_NAME, rena_provider_get_icon_name(provider),
-		                    COLUMN_VISIBLE, rena_provider_get_visible(provider),
-		                    COLUMN_IGNORED, rena_provider_get_ignored(provider),
-		                    COLUMN_MARKUP, markup,
-		                    -1);
 
-		g_free (markup);
-	}
+	rena_preferences_dialog_set_library_row (GTK_LIST_STORE(model), &iter, provider);
+	g_object_unref (provider);
+}
+
+static void
+rena_preferences_dialog_provider_removed (RenaDatabaseProvider  *dbase_provider,
+                                          const gchar           *name,
+                                          RenaPreferencesDialog *dialog)
+{
+	GtkTreeModel *model;
+	GtkTreeIter iter;
+
+	model = gtk_tree_view_get_model (GTK_TREE_VIEW(dialog->library_view_w));
+	if (rena_preferences_dialog_find_library_row (model, name, &iter))
+		gtk_list_store_remove (GTK_LIST_STORE(model), &iter);
+}
+
+static void
+rena_preferences_dialog_provider_toggled (RenaDatabaseProvider  *dbase_provider,
+                                          const gchar           *name,
+                                          RenaPreferencesDialog *dialog)
+{
+	RenaProvider *provider;
+	GtkTreeModel *model;
+	GtkTreeIter iter;
+
+	/* A library removed in the dialog is not brought back. */
+	model = gtk_tree_view_get_model (GTK_TREE_VIEW(dialog->library_view_w));
+	if (!rena_preferences_dialog_find_library_row (model, name, &iter))
+		return;
+
+	provider = rena_database_provider_get_provider (dbase_provider, name);
+	if (provider == NULL)
+		return;
+
+	rena_preferences_dialog_set_library_row (GTK_LIST_STORE(model), &iter, provider);
+	g_object_unref (provider);
 }
 
 /*
@@ -315,18 +401,15 @@ rena_preferences_dialog_set_library_list (GtkWidget *library_tree, GSList *libra
 static void
 rena_preferences_dialog_restore_changes (RenaPreferencesDialog *dialog)
 {
-	RenaDatabaseProvider *provider;
 	GSList *library_list = NULL;
 	const gchar *start_mode = NULL;
 
 	/*
 	 * Collection settings.
 	 */
-	provider = rena_database_provider_get ();
-	library_list = rena_database_provider_get_list (provider);
+	library_list = rena_database_provider_get_list (dialog->dbase_provider);
 	rena_preferences_dialog_set_library_list(dialog->library_view_w, library_list);
 	g_slist_free_full (library_list, g_object_unref);
-	g_object_unref (G_OBJECT (provider));
 
 	gtk_toggle_button_set_active(GTK_TOGGLE_BUTTON(dialog->sort_by_year_w),
 		rena_preferences_get_sort_by_year(dialog->preferences));
@@ -809,7 +892,6 @@ change_audio_sink(GtkComboBox *combo, RenaPreferencesDialog *dialog)
 static void
 rena_preferences_dialog_init_settings(RenaPreferencesDialog *dialog)
 {
-	RenaDatabaseProvider *provider;
 	GSList *library_dir = NULL;
 	const gchar *start_mode = rena_preferences_get_start_mode(dialog->preferences);
 
@@ -897,11 +979,9 @@ rena_preferences_dialog_init_settings(RenaPreferencesDialog *dialog)
 
 	/* Lbrary Options */
 
-	provider = rena_database_provider_get ();
-	library_dir = rena_database_provider_get_list (provider);
+	library_dir = rena_database_provider_get_list (dialog->dbase_provider);
 	rena_preferences_dialog_set_library_list(dialog->library_view_w, library_dir);
 	g_slist_free_full (library_dir, g_object_unref);
-	g_object_unref (G_OBJECT (provider));
 
 	if (rena_preferences_get_sort_by_year(dialog->preferences))
 		gtk_toggle_button_set_active(GTK_TOGGLE_BUTTON(dialog->sort_by_year_w), TRUE);
@@ -1311,13 +1391,10 @@ rena_preferences_dialog_disconnect_handler (RenaPreferencesDialog *dialog,
 void
 rena_preferences_dialog_show (RenaPreferencesDialog *dialog)
 {
-	RenaDatabaseProvider *provider;
 	GSList *library_list = NULL;
 
 	if (string_is_empty (rena_preferences_get_installed_version (dialog->preferences))) {
-		provider = rena_database_provider_get ();
-		library_list = rena_database_provider_get_list (provider);
-		g_object_unref (G_OBJECT (provider));
+		library_list = rena_database_provider_get_list (dialog->dbase_provider);
 
 		rena_preferences_dialog_set_library_list (dialog->library_view_w, library_list);
 		g_slist_free_full (library_list, g_object_unref);
@@ -1340,6 +1417,11 @@ static void
 rena_preferences_dialog_dispose (GObject *object)
 {
 	RenaPreferencesDialog *dialog = RENA_PREFERENCES_DIALOG(object);
+	if (dialog->dbase_provider) {
+		g_signal_handlers_disconnect_by_data (dialog->dbase_provider, dialog);
+		g_object_unref (dialog->dbase_provider);
+		dialog->dbase_provider = NULL;
+	}
 	if (dialog->preferences) {
 		g_object_unref (dialog->preferences);
 		dialog->preferences = NULL;
@@ -1384,6 +1466,7 @@ rena_preferences_dialog_init (RenaPreferencesDialog *dialog)
 	/* Preferences instance */
 
 	dialog->preferences = rena_preferences_get();
+	dialog->dbase_provider = rena_database_provider_get ();
 
 	/* The main preferences dialog */
 
@@ -1475,6 +1558,13 @@ rena_preferences_dialog_init (RenaPreferencesDialog *dialog)
 	g_signal_connect (G_OBJECT(dialog), "delete_event",
 	                  G_CALLBACK(rena_preferences_dialog_delete), dialog);
 
+	g_signal_connect (dialog->dbase_provider, "provider-added",
+	                  G_CALLBACK(rena_preferences_dialog_provider_added), dialog);
+	g_signal_connect (dialog->dbase_provider, "provider-removed",
+	                  G_CALLBACK(rena_preferences_dialog_provider_removed), dialog);
+	g_signal_connect (dialog->dbase_provider, "provider-toggled",
+	                  G_CALLBACK(rena_preferences_dialog_provider_toggled), dialog);
+
 	rena_preferences_dialog_init_settings(dialog);
 
 	toggle_album_art(GTK_TOGGLE_BUTTON(dialog->album_art_w), dialog);
@@ -79,6 +79,7 @@ struct _RenaPreferencesClass
 #define KEY_LIBRARY_SCANNED        "library_scanned"
 #define KEY_LIBRARY_VIEW_ORDER     "library_view_order"
 #define KEY_LIBRARY_LAST_SCANNED   "library_last_scanned"
+#define KEY_LIBRARY_SCAN_WORKERS   "library_scan_workers"
 #define KEY_SORT_BY_YEAR           "library_sort_by_year"
 
 #define GROUP_AUDIO    "Audio"
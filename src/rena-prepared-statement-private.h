@@ -24,6 +24,9 @@
 #include "rena-prepared-statement.h"
 
 RenaPreparedStatement* rena_prepared_statement_new               (sqlite3_stmt *stmt, RenaDatabase *database);
+RenaPreparedStatement* rena_prepared_statement_new_for_reader    (sqlite3_stmt *stmt, RenaDatabaseReader *reader);
 void                     rena_prepared_statement_finalize          (RenaPreparedStatement *statement);
+gboolean                 rena_prepared_statement_take_stats        (RenaPreparedStatement *statement, gint64 *step_time, guint *n_rows);
+gint64                   rena_prepared_statement_get_last_insert_id (RenaPreparedStatement *statement);
 
 #endif /* RENA_PREPARED_STATEMENT_PRIVATE_H */
@@ -21,11 +21,18 @@
 #include <sqlite3.h>
 
 #include "rena-database.h"
+#include "rena-debug.h"
 
 
 struct RenaPreparedStatement {
 	sqlite3_stmt *stmt;
 	RenaDatabase *database;
+	RenaDatabaseReader *reader;
+
+	/* Since the last rena_prepared_statement_take_stats () */
+	guint n_steps;
+	guint n_rows;
+	gint64 step_time;
 };
 
 RenaPreparedStatement *
@@ -34,6 +41,23 @@ rena_prepared_statement_new (sqlite3_stmt *stmt, RenaDatabase *database)
 	RenaPreparedStatement *statement = g_slice_new (RenaPreparedStatement);
 	statement->stmt = stmt;
 	statement->database = database;
+	statement->reader = NULL;
+	statement->n_steps = 0;
+	statement->n_rows = 0;
+	statement->step_time = 0;
+	return statement;
+}
+
+RenaPreparedStatement *
+rena_prepared_statement_new_for_reader (sqlite3_stmt *stmt, RenaDatabaseReader *reader)
+{
+	RenaPreparedStatement *statement = g_slice_new (RenaPreparedStatement);
+	statement->stmt = stmt;
+	statement->database = NULL;
+	statement->reader = reader;
+	statement->n_steps = 0;
+	statement->n_rows = 0;
+	statement->step_time = 0;
 	return statement;
 }
 
@@ -47,13 +71,16 @@ rena_prepared_statement_finalize (RenaPreparedStatement *statement)
 void
 rena_prepared_statement_free (RenaPreparedStatement *statement)
 {
-	rena_database_release_statement (statement->database, statement);
+	if (statement->reader)
+		rena_database_reader_release_statement (statement->reader, statement);
+	else
+		rena_database_release_statement (statement->database, statement);
 }
 
 static void
 on_sqlite_error (RenaPreparedStatement *statement)
 {
-	g_critical ("db: %s", rena_database_get_last_error (statement->database));
+	g_critical ("db: %s", sqlite3_errmsg (sqlite3_db_handle (statement->stmt)));
 }
 
 void
@@ -70,17 +97,80 @@ rena_prepared_statement_bind_int (RenaPreparedStatement *statement, gint n, gint
 		on_sqlite_error (statement);
 }
 
+void
+rena_prepared_statement_bind_int64 (RenaPreparedStatement *statement, gint n, gint64 value)
+{
+	if (sqlite3_bind_int64 (statement->stmt, n, value) != SQLITE_OK)
+		on_sqlite_error (statement);
+}
 
-gboolean
-rena_prepared_statement_step (RenaPreparedStatement *statement)
+
+static int
+rena_prepared_statement_step_internal (RenaPreparedStatement *statement)
 {
-	int error_code = sqlite3_step (statement->stmt);
+	gint64 begin_time = 0;
+	int error_code;
+
+	/* Only time the statements when the database stats are shown. */
+	if (G_UNLIKELY(DBG_DB <= debug_level))
+		begin_time = g_get_monotonic_time ();
+
+	error_code = sqlite3_step (statement->stmt);
+
+	if (G_UNLIKELY(begin_time))
+		statement->step_time += g_get_monotonic_time () - begin_time;
+
+	statement->n_steps++;
+	if (error_code == SQLITE_ROW)
+		statement->n_rows++;
 
 	if (error_code != SQLITE_OK && error_code != SQLITE_ROW && error_code != SQLITE_DONE) {
 		on_sqlite_error (statement);
 	}
 
-	return error_code == SQLITE_ROW;
+	return error_code;
+}
+
+gboolean
+rena_prepared_statement_step (RenaPreparedStatement *statement)
+{
+	return rena_prepared_statement_step_internal (statement) == SQLITE_ROW;
+}
+
+/*
+ * Steps a statement which is not expected to return rows, and tells if it
+ * was executed without errors.
+ */
+
+gboolean
+rena_prepared_statement_run (RenaPreparedStatement *statement)
+{
+	int error_code;
+
+	error_code = rena_prepared_statement_step_internal (statement);
+
+	return error_code == SQLITE_DONE || error_code == SQLITE_ROW;
+}
+
+gint64
+rena_prepared_statement_get_last_insert_id (RenaPreparedStatement *statement)
+{
+	return sqlite3_last_insert_rowid (sqlite3_db_handle (statement->stmt));
+}
+
+gboolean
+rena_prepared_statement_take_stats (RenaPreparedStatement *statement, gint64 *step_time, guint *n_rows)
+{
+	gboolean executed = statement->n_steps > 0;
+
+	*step_time = statement->step_time;
+	*n_rows = statement->n_rows;
+
+	statement->n_steps = 0;
+	statement->n_rows = 0;
+	statement->step_time = 0;
+
+	return executed;
 }
 
 gint
@@ -89,6 +179,12 @@ rena_prepared_statement_get_int (RenaPreparedStatement *statement, gint column)
 	return sqlite3_column_int (statement->stmt, column);
 }
 
+gint64
+rena_prepared_statement_get_int64 (RenaPreparedStatement *statement, gint column)
+{
+	return sqlite3_column_int64 (statement->stmt, column);
+}
+
 const gchar *
 rena_prepared_statement_get_string (RenaPreparedStatement *statement, gint column)
 {
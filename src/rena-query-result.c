@@ -0,0 +1,159 @@
+/*
+ * Copyright (C) 2024 Santelmo Technologies <santelmotechnologies@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "rena-query-result.h"
+
+#include <string.h>
+
+/*
+ * Query results by columns.
+ *
+ * All the rows of a statement are read at once into an array per column.
+ * Integer columns keep their values, and string columns the offsets of
+ * their strings in an arena shared by all of them. Equal strings in
+ * consecutive rows of a column, as on ordered results, are stored once.
+ *
+ * A result is plain memory, so it can be read in a thread and handed to
+ * the main loop.
+ */
+
+#define RENA_QUERY_RESULT_NULL G_MAXUINT32
+
+struct _RenaQueryResult {
+	guint       n_rows;
+	guint       n_columns;
+	gchar      *types;
+	GArray    **columns;
+	GByteArray *strings;
+};
+
+/**
+ * rena_query_result_new:
+ * @statement: a #RenaPreparedStatement ready to step.
+ * @columns: the type of each column, 'i' for integers and 's' for strings.
+ *
+ * Steps @statement until its last row, keeping @columns of each row.
+ * The statement is still owned by the caller.
+ */
+RenaQueryResult *
+rena_query_result_new (RenaPreparedStatement *statement, const gchar *columns)
+{
+	RenaQueryResult *result;
+	const gchar *string;
+	guint32 offset, previous;
+	gint value;
+	guint i;
+
+	result = g_slice_new0 (RenaQueryResult);
+	result->n_columns = strlen (columns);
+	result->types = g_strdup (columns);
+	result->columns = g_new0 (GArray *, result->n_columns);
+	result->strings = g_byte_array_new ();
+
+	for (i = 0; i < result->n_columns; i++) {
+		result->columns[i] = (result->types[i] == 's') ?
+			g_array_new (FALSE, FALSE, sizeof(guint32)) :
+			g_array_new (FALSE, FALSE, sizeof(gint));
+	}
+
+	while (rena_prepared_statement_step (statement)) {
+		for (i = 0; i < result->n_columns; i++) {
+			if (result->types[i] != 's') {
+				value = rena_prepared_statement_get_int (statement, i);
+				g_array_append_val (result->columns[i], value);
+				continue;
+			}
+
+			string = rena_prepared_statement_get_string (statement, i);
+			if (string == NULL) {
+				offset = RENA_QUERY_RESULT_NULL;
+				g_array_append_val (result->columns[i], offset);
+				continue;
+			}
+
+			if (result->n_rows > 0) {
+				previous = g_array_index (result->columns[i], guint32, result->n_rows - 1);
+				if (previous != RENA_QUERY_RESULT_NULL &&
+				    strcmp ((const gchar *) result->strings->data + previous, string) == 0) {
+					g_array_append_val (result->columns[i], previous);
+					continue;
+				}
+			}
+
+			offset = result->strings->len;
+			g_byte_array_append (result->strings, (const guint8 *) string, strlen (string) + 1);
+			g_array_append_val (result->columns[i], offset);
+		}
+		result->n_rows++;
+	}
+
+	return result;
+}
+
+guint
+rena_query_result_get_n_rows (RenaQueryResult *result)
+{
+	return result->n_rows;
+}
+
+gint
+rena_query_result_get_int (RenaQueryResult *result, guint row, guint column)
+{
+	g_return_val_if_fail (row < result->n_rows && column < result->n_columns && result->types[column] == 'i', 0);
+
+	return g_array_index (result->columns[column], gint, row);
+}
+
+/**
+ * rena_query_result_get_ints:
+ *
+ * Return value: the values of an integer column, one per row.
+ */
+const gint *
+rena_query_result_get_ints (RenaQueryResult *result, guint column)
+{
+	g_return_val_if_fail (column < result->n_columns && result->types[column] == 'i', NULL);
+
+	return (const gint *) result->columns[column]->data;
+}
+
+const gchar *
+rena_query_result_get_string (RenaQueryResult *result, guint row, guint column)
+{
+	guint32 offset;
+
+	g_return_val_if_fail (row < result->n_rows && column < result->n_columns && result->types[column] == 's', NULL);
+
+	offset = g_array_index (result->columns[column], guint32, row);
+	if (offset == RENA_QUERY_RESULT_NULL)
+		return NULL;
+
+	return (const gchar *) result->strings->data + offset;
+}
+
+void
+rena_query_result_free (RenaQueryResult *result)
+{
+	guint i;
+
+	for (i = 0; i < result->n_columns; i++)
+		g_array_free (result->columns[i], TRUE);
+	g_free (result->columns);
+	g_free (result->types);
+	g_byte_array_free (result->strings, TRUE);
+	g_slice_free (RenaQueryResult, result);
+}
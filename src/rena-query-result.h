@@ -0,0 +1,49 @@
+/*
+ * Copyright (C) 2024 Santelmo Technologies <santelmotechnologies@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef RENA_QUERY_RESULT_H
+#define RENA_QUERY_RESULT_H
+
+#include <glib.h>
+
+#include "rena-prepared-statement.h"
+
+G_BEGIN_DECLS
+
+typedef struct _RenaQueryResult RenaQueryResult;
+
+RenaQueryResult *
+rena_query_result_new          (RenaPreparedStatement *statement, const gchar *columns);
+
+guint
+rena_query_result_get_n_rows   (RenaQueryResult *result);
+
+gint
+rena_query_result_get_int      (RenaQueryResult *result, guint row, guint column);
+
+const gint *
+rena_query_result_get_ints     (RenaQueryResult *result, guint column);
+
+const gchar *
+rena_query_result_get_string   (RenaQueryResult *result, guint row, guint column);
+
+void
+rena_query_result_free         (RenaQueryResult *result);
+
+G_END_DECLS
+
+#endif /* RENA_QUERY_RESULT_H */
@@ -33,47 +33,88 @@
 #include "rena-background-task-bar.h"
 #include "rena-background-task-widget.h"
 #include "rena-database-provider.h"
+#include "rena-debug.h"
 #include "rena-file-utils.h"
 #include "rena-musicobject-mgmt.h"
 #include "rena-playlists-mgmt.h"
 #include "rena-simple-async.h"
 #include "rena-utils.h"
 
+typedef struct {
+	gchar             *file;
+	gchar             *provider;
+	gboolean           replace;
+	gboolean           has_fingerprint;
+	RenaDatabaseFingerprint fingerprint;
+	RenaMusicobject   *mobj;
+	gboolean           directory;
+	gboolean           done;
+} RenaScannerTagJob;
+
 struct _RenaScanner {
 	/* Widgets */
 	RenaBackgroundTaskWidget *task_widget;
 
 	/* Cache */
-	GHashTable        *tracks_table;
 	GSList            *folder_list;
 	GSList            *folder_scanned;
-	GSList            *playlists;
 	gchar             *curr_provider;
+	/* Connection of the worker, and what waits to be saved */
+	RenaDatabase      *database;
+	GPtrArray         *batch;
+	GArray            *seen;
+	GPtrArray         *completed;
+	guint              peak_pending;
+	gboolean           resumed;
+	gboolean           closing;
 
 	GTimeVal          last_update;
 	/* Threads */
-	GThread           *no_files_thread;
 	GThread           *worker_thread;
+	/* Tag readers */
+	GThreadPool       *tag_pool;
+	GQueue            *tag_jobs;
+	gint               tag_workers;
+	GMutex             tag_queue_mutex;
+	GCond              tag_queue_cond;
 	/* Mutex to protect progress */
 	GMutex             no_files_mutex;
 	GMutex             files_scanned_mutex;
 	/* Progress of threads */
 	guint              no_files;
+	guint              dirs_found;
+	guint              dirs_scanned;
 	guint              files_scanned;
+	guint              tracks_saved;
+	/* Result of an update */
+	gboolean           incremental;
+	guint              n_unchanged;
+	guint              n_changed;
+	guint              n_new;
+	guint              n_removed;
+	/* Media types classified before the scan, and when it started */
+	guint              by_extension;
+	guint              by_content;
+	gint64             begin_time;
 	/* Cancellation safe */
 	GCancellable      *cancellable;
 	/* Timeout of update progress, also used as operating flag*/
 	guint              update_timeout;
 };
 
-/* Update the dialog. */
+/* Update the dialog.
+ *
+ * The files are counted while the library is walked, so the total is
+ * estimated from the files found so far and the folders still pending,
+ * assuming they hold as many files as the average folder read. */
 
 static gboolean
 rena_scanner_update_progress(gpointer user_data)
 {
-	gdouble fraction = 0.0;
+	gdouble fraction = 0.0, estimated;
 	gint files_scanned = 0;
 	gint no_files;
+	guint dirs_found, dirs_scanned;
 	gchar *data = NULL;
 
 	RenaScanner *scanner = user_data;
@@ -83,6 +124,8 @@ rena_scanner_update_progress(gpointer user_data)
 
 	g_mutex_lock (&scanner->no_files_mutex);
 	no_files = scanner->no_files;
+	dirs_found = scanner->dirs_found;
+	dirs_scanned = scanner->dirs_scanned;
 	g_mutex_unlock (&scanner->no_files_mutex);
 
 	g_mutex_lock (&scanner->files_scanned_mutex);
@@ -90,7 +133,11 @@ rena_scanner_update_progress(gpointer user_data)
 	g_mutex_unlock (&scanner->files_scanned_mutex);
 
 	if(no_files > 0) {
-		fraction = (gdouble)files_scanned / (gdouble)no_files;
+		estimated = no_files;
+		if (dirs_found > dirs_scanned)
+			estimated += (gdouble)(dirs_found - dirs_scanned) * no_files / MAX(dirs_scanned, 1);
+
+		fraction = MIN((gdouble)files_scanned / estimated, 1.0);
 		rena_background_task_widget_set_job_progress (scanner->task_widget, fraction*100);
 
 		data = g_strdup_printf(_("%i files analyzed of %i detected"), files_scanned, no_files);
@@ -105,48 +152,38 @@ rena_scanner_update_progress(gpointer user_data)
 	return TRUE;
 }
 
-/* Thread that counts all files in the library */
+/* Fingerprints of the files */
 
-static gpointer
-rena_scanner_count_no_files_worker(gpointer data)
+static void
+rena_scanner_fingerprint_from_stat (RenaDatabaseFingerprint *fingerprint, struct stat *sbuf)
 {
-	GSList *list;
-	gint no_files = 0;
-
-	RenaScanner *scanner = data;
-
-	for(list = scanner->folder_list ; list != NULL ; list = list->next) {
-		if(g_cancellable_is_cancelled (scanner->cancellable))
-			break;
-
-		no_files += rena_get_dir_count(list->data, scanner->cancellable);
-
-		g_mutex_lock (&scanner->no_files_mutex);
-		scanner->no_files = no_files;
-		g_mutex_unlock (&scanner->no_files_mutex);
-	}
-
-	return NULL;
+	fingerprint->mtime = sbuf->st_mtime;
+	fingerprint->size = sbuf->st_size;
+	fingerprint->inode = sbuf->st_ino;
 }
 
-/* Function that is executed at the end of analyze the files,
- * or if the analysis was canceled.
- * This runs on the main thread. So, can show a dialog.
- * Finally, frees all memory. */
+static gboolean
+rena_scanner_fingerprint_equal (const RenaDatabaseFingerprint *a, const RenaDatabaseFingerprint *b)
+{
+	return a->mtime == b->mtime && a->size == b->size && a->inode == b->inode;
+}
 
-static void
-rena_scanner_add_track_db(gpointer key,
-                            gpointer value,
-                            gpointer user_data)
+static gint
+rena_scanner_tag_workers (RenaPreferences *preferences)
 {
-	RenaMusicobject *mobj = value;
-	RenaDatabase *database = user_data;
+	gint workers;
 
-	rena_database_add_new_musicobject (database, mobj);
+	workers = rena_preferences_get_integer (preferences,
+	                                          GROUP_LIBRARY,
+	                                          KEY_LIBRARY_SCAN_WORKERS);
+	if (workers <= 0)
+		workers = g_get_num_processors ();
 
-	rena_process_gtk_events ();
+	return workers;
 }
 
+/* Playlists found in the library */
+
 static GSList *
 rena_scanner_clean_playlist (GSList *list)
 {
@@ -173,6 +210,7 @@ rena_scanner_import_playlist (RenaDatabase *database,
 	gchar *playlist = NULL;
 	gint playlist_id = 0;
 	GSList *list = NULL, *i = NULL;
+	GPtrArray *files;
 
 	playlist = get_display_filename(playlist_file, FALSE);
 
@@ -190,11 +228,12 @@ rena_scanner_import_playlist (RenaDatabase *database,
 	list = rena_scanner_clean_playlist (list);
 	if (list) {
 		playlist_id = rena_database_add_new_playlist (database, playlist);
-		for (i = list; i != NULL; i = i->next) {
-			rena_database_add_playlist_track (database, playlist_id, i->data);
-			g_free(i->data);
-		}
-		g_slist_free(list);
+		files = g_ptr_array_new ();
+		for (i = list; i != NULL; i = i->next)
+			g_ptr_array_add (files, i->data);
+		rena_database_add_playlist_tracks (database, playlist_id, files);
+		g_ptr_array_free (files, TRUE);
+		g_slist_free_full (list, g_free);
 	}
 
 duplicated:
@@ -222,6 +261,481 @@ rena_scanner_finished_dialog_delete (GtkDialog *dialog, GdkEvent  *event, gpoint
 	return FALSE;
 }
 
+/* Save the results of the scan.
+ *
+ * This runs on the worker thread, with a connection of its own, so the
+ * library can still be browsed and played meanwhile. The tracks read are
+ * written in batches as the scan goes, each in a short transaction, and
+ * the locations found are kept in a table with the playlists to import.
+ * Once the walk ends, the tracks of the scanned folders that were not
+ * found are removed in a last one.
+ *
+ * Each batch also saves the folders whose files are all saved, so a scan
+ * interrupted by closing Rena, or a crash, stays pending and resumes on
+ * the next one skipping them. A scan cancelled by the user is dropped. */
+
+static gint
+rena_scanner_get_pending (RenaDatabase *database)
+{
+	RenaPreparedStatement *statement;
+	gint incremental = -1;
+
+	statement = rena_database_create_statement (database, "SELECT incremental FROM SCAN_PENDING");
+	if (rena_prepared_statement_step (statement))
+		incremental = rena_prepared_statement_get_int (statement, 0);
+	rena_prepared_statement_free (statement);
+
+	return incremental;
+}
+
+static void
+rena_scanner_clear_pending (RenaDatabase *database)
+{
+	rena_database_exec_query (database, "DELETE FROM SCAN_PENDING");
+	rena_database_exec_query (database, "DELETE FROM SCAN_DIRECTORY");
+	rena_database_exec_query (database, "DELETE FROM SCAN_SEEN");
+	rena_database_exec_query (database, "DELETE FROM SCAN_PLAYLISTS");
+}
+
+static gboolean
+rena_scanner_save_begin (RenaScanner *scanner)
+{
+	RenaPreparedStatement *statement;
+
+	scanner->database = rena_database_new_writer ();
+	if (!rena_database_start_successfully (scanner->database)) {
+		g_critical ("Unable to save the library scanned");
+		g_object_unref (scanner->database);
+		scanner->database = NULL;
+		return FALSE;
+	}
+
+	/* Only a scan of the same kind is resumed, an update did not read all tags. */
+
+	if (rena_scanner_get_pending (scanner->database) == scanner->incremental) {
+		CDEBUG(DBG_INFO, "Resuming the library scan left pending");
+		scanner->resumed = TRUE;
+		return TRUE;
+	}
+
+	rena_database_begin_transaction (scanner->database);
+	rena_scanner_clear_pending (scanner->database);
+	statement = rena_database_create_statement (scanner->database, "INSERT INTO SCAN_PENDING (id, incremental) VALUES (1, ?)");
+	rena_prepared_statement_bind_int (statement, 1, scanner->incremental);
+	rena_prepared_statement_step (statement);
+	rena_prepared_statement_free (statement);
+	rena_database_commit_transaction (scanner->database);
+
+	return TRUE;
+}
+
+static gboolean
+rena_scanner_directory_completed (RenaScanner *scanner, const gchar *dir_name)
+{
+	RenaPreparedStatement *statement;
+	gboolean completed;
+
+	if (!scanner->resumed)
+		return FALSE;
+
+	statement = rena_database_create_statement (scanner->database, "SELECT 1 FROM SCAN_DIRECTORY WHERE path = ?");
+	rena_prepared_statement_bind_string (statement, 1, dir_name);
+	completed = rena_prepared_statement_step (statement);
+	rena_prepared_statement_free (statement);
+
+	return completed;
+}
+
+/* Times a batch is written before giving up the scan. */
+#define RENA_SCANNER_SAVE_ATTEMPTS 3
+
+/* Ids of the locations marked seen on each statement. */
+#define RENA_SCANNER_SEEN_PER_INSERT 256
+
+static gchar *
+rena_scanner_build_seen_sql (guint n_locations)
+{
+	GString *sql;
+	guint i;
+
+	sql = g_string_new ("INSERT OR IGNORE INTO SCAN_SEEN (location) VALUES ");
+	for (i = 0; i < n_locations; i++)
+		g_string_append (sql, i ? ", (?)" : "(?)");
+
+	return g_string_free (sql, FALSE);
+}
+
+static gboolean
+rena_scanner_mark_seen (RenaDatabase *database, GArray *location_ids)
+{
+	RenaPreparedStatement *statement;
+	gchar *sql = NULL;
+	gboolean success = TRUE;
+	guint i, j, n;
+
+	for (i = 0; success && i < location_ids->len; i += n) {
+		n = MIN (location_ids->len - i, RENA_SCANNER_SEEN_PER_INSERT);
+
+		if (n == RENA_SCANNER_SEEN_PER_INSERT) {
+			if (sql == NULL)
+				sql = rena_scanner_build_seen_sql (n);
+			statement = rena_database_create_statement (database, sql);
+		}
+		else {
+			g_free (sql);
+			sql = rena_scanner_build_seen_sql (n);
+			statement = rena_database_create_dynamic_statement (database, sql);
+		}
+
+		for (j = 0; j < n; j++)
+			rena_prepared_statement_bind_int (statement, j + 1, g_array_index (location_ids, gint, i + j));
+		success = rena_prepared_statement_run (statement);
+		rena_prepared_statement_free (statement);
+	}
+
+	g_free (sql);
+
+	return success;
+}
+
+/* Writes the batch in a transaction, all of it or nothing. */
+
+static gboolean
+rena_scanner_write_batch (RenaScanner *scanner)
+{
+	RenaPreparedStatement *statement;
+	RenaScannerTagJob *job;
+	GPtrArray *mobjs, *fingerprints;
+	gboolean success;
+	guint i;
+
+	if (!rena_database_begin_transaction (scanner->database))
+		return FALSE;
+
+	/* The main connection may have deleted rows whose ids this one still
+	 * caches, flushing the stale entries. Look them up again. */
+
+	rena_database_invalidate_caches (scanner->database);
+
+	/* Save the fingerprints of the files with them for the next update */
+
+	mobjs = g_ptr_array_sized_new (scanner->batch->len);
+	fingerprints = g_ptr_array_sized_new (scanner->batch->len);
+	for (i = 0; i < scanner->batch->len; i++) {
+		job = g_ptr_array_index (scanner->batch, i);
+		g_ptr_array_add (mobjs, job->mobj);
+		g_ptr_array_add (fingerprints, job->has_fingerprint ? &job->fingerprint : NULL);
+	}
+	success = rena_database_replace_musicobjects (scanner->database, mobjs, fingerprints, scanner->seen);
+	g_ptr_array_free (fingerprints, TRUE);
+	g_ptr_array_free (mobjs, TRUE);
+
+	/* Mark as seen the files saved and the unchanged ones, which are kept */
+
+	if (success)
+		success = rena_scanner_mark_seen (scanner->database, scanner->seen);
+
+	/* The folders done are not read again if the scan is resumed */
+
+	for (i = 0; success && i < scanner->completed->len; i++) {
+		statement = rena_database_create_statement (scanner->database, "INSERT OR IGNORE INTO SCAN_DIRECTORY (path) VALUES (?)");
+		rena_prepared_statement_bind_string (statement, 1, g_ptr_array_index (scanner->completed, i));
+		success = rena_prepared_statement_run (statement);
+		rena_prepared_statement_free (statement);
+	}
+
+	if (success)
+		success = rena_database_commit_transaction (scanner->database);
+	if (!success)
+		rena_database_rollback_transaction (scanner->database);
+
+	return success;
+}
+
+static void
+rena_scanner_save_batch (RenaScanner *scanner)
+{
+	guint attempt, n_seen;
+	gboolean saved = FALSE;
+
+	if (scanner->batch->len == 0 && scanner->seen->len == 0 && scanner->completed->len == 0)
+		return;
+
+	if (g_cancellable_is_cancelled (scanner->cancellable))
+		goto done;
+
+	/* The ids of the tracks saved are added to the seen ones */
+
+	n_seen = scanner->seen->len;
+	for (attempt = 0; attempt < RENA_SCANNER_SAVE_ATTEMPTS && !saved; attempt++) {
+		saved = rena_scanner_write_batch (scanner);
+		if (!saved)
+			g_array_set_size (scanner->seen, n_seen);
+	}
+
+	/* Stop rather than forget the tracks of the batch lost at the end */
+
+	if (!saved) {
+		g_warning ("Unable to save the library scanned, stopping the scan");
+		g_cancellable_cancel (scanner->cancellable);
+		goto done;
+	}
+
+	g_mutex_lock (&scanner->files_scanned_mutex);
+	scanner->tracks_saved += scanner->batch->len;
+	g_mutex_unlock (&scanner->files_scanned_mutex);
+
+done:
+	g_ptr_array_set_size (scanner->batch, 0);
+	g_array_set_size (scanner->seen, 0);
+	g_ptr_array_set_size (scanner->completed, 0);
+}
+
+static void
+rena_scanner_forget_unseen (RenaScanner *scanner)
+{
+	RenaPreparedStatement *statement;
+	RenaDatabase *database = scanner->database;
+	const gchar *sql;
+	GSList *list;
+	gint provider_id;
+
+	/* Remove the tracks of the folders scanned that were not found */
+
+	for (list = scanner->folder_list; list != NULL; list = list->next) {
+		provider_id = rena_database_find_provider (database, list->data);
+
+		sql = "SELECT COUNT(*) FROM TRACK WHERE provider = ? AND location NOT IN (SELECT location FROM SCAN_SEEN)";
+		statement = rena_database_create_statement (database, sql);
+		rena_prepared_statement_bind_int (statement, 1, provider_id);
+		if (rena_prepared_statement_step (statement))
+			scanner->n_removed += rena_prepared_statement_get_int (statement, 0);
+		rena_prepared_statement_free (statement);
+
+		sql = "DELETE FROM TRACK WHERE provider = ? AND location NOT IN (SELECT location FROM SCAN_SEEN)";
+		statement = rena_database_create_statement (database, sql);
+		rena_prepared_statement_bind_int (statement, 1, provider_id);
+		rena_prepared_statement_step (statement);
+		rena_prepared_statement_free (statement);
+	}
+
+	/* Delete the playlist entries of the files not found, before deleting
+	 * their locations turns them into uris, and then the locations. */
+
+	rena_database_exec_query (database, "DELETE FROM PLAYLIST_ENTRIES WHERE location IN (SELECT id FROM LOCATION WHERE refs = 0)");
+	rena_database_exec_query (database, "DELETE FROM LOCATION WHERE refs = 0");
+
+	/* Now flush unused artists, albums, genres, years */
+
+	rena_database_flush_stale_entries (database);
+}
+
+static void
+rena_scanner_save_end (RenaScanner *scanner)
+{
+	RenaPreparedStatement *statement;
+
+	/* Remove the songs lost, and import the playlists detected. */
+
+	if (!g_cancellable_is_cancelled (scanner->cancellable)) {
+		rena_database_begin_transaction (scanner->database);
+
+		rena_scanner_forget_unseen (scanner);
+
+		statement = rena_database_create_statement (scanner->database, "SELECT file FROM SCAN_PLAYLISTS ORDER BY rowid");
+		while (rena_prepared_statement_step (statement))
+			rena_scanner_import_playlist (scanner->database,
+			                              rena_prepared_statement_get_string (statement, 0));
+		rena_prepared_statement_free (statement);
+
+		rena_scanner_clear_pending (scanner->database);
+
+		rena_database_commit_transaction (scanner->database);
+	}
+	else if (!scanner->closing) {
+		rena_scanner_clear_pending (scanner->database);
+	}
+
+	g_object_unref (scanner->database);
+	scanner->database = NULL;
+}
+
+/* Tag readers.
+ *
+ * The worker thread only walks the folders, and queues the files to read
+ * to a pool of threads that fill the musicobjects. The jobs are kept in
+ * the order they were found, and are taken to the batch to save in that
+ * order as they are done, so a scan gives the same results regardless of
+ * the number of readers.
+ *
+ * The walk waits for the oldest job when too many are pending, and for
+ * the batch to be saved when it is full, so the tracks kept in memory do
+ * not depend on the size of the library. */
+
+static void
+rena_scanner_tag_job_free (RenaScannerTagJob *job)
+{
+	if (job->mobj)
+		g_object_unref (job->mobj);
+	g_free (job->file);
+	g_free (job->provider);
+	g_slice_free (RenaScannerTagJob, job);
+}
+
+static void
+rena_scanner_tag_reader (gpointer data, gpointer user_data)
+{
+	RenaScannerTagJob *job = data;
+	RenaScanner *scanner = user_data;
+	struct stat sbuf;
+
+	if (!g_cancellable_is_cancelled (scanner->cancellable)) {
+		if (!job->has_fingerprint && g_stat (job->file, &sbuf) == 0) {
+			rena_scanner_fingerprint_from_stat (&job->fingerprint, &sbuf);
+			job->has_fingerprint = TRUE;
+		}
+		job->mobj = new_musicobject_from_file (job->file, job->provider);
+	}
+
+	g_mutex_lock (&scanner->files_scanned_mutex);
+	scanner->files_scanned++;
+	g_mutex_unlock (&scanner->files_scanned_mutex);
+
+	g_mutex_lock (&scanner->tag_queue_mutex);
+	job->done = TRUE;
+	g_cond_signal (&scanner->tag_queue_cond);
+	g_mutex_unlock (&scanner->tag_queue_mutex);
+}
+
+static void
+rena_scanner_tag_readers_start (RenaScanner *scanner)
+{
+	scanner->tag_jobs = g_queue_new ();
+	scanner->batch = g_ptr_array_new_with_free_func ((GDestroyNotify) rena_scanner_tag_job_free);
+	scanner->seen = g_array_new (FALSE, FALSE, sizeof(gint));
+	scanner->completed = g_ptr_array_new_with_free_func (g_free);
+	scanner->peak_pending = 0;
+	scanner->tag_pool = g_thread_pool_new (rena_scanner_tag_reader,
+	                                       scanner,
+	                                       scanner->tag_workers,
+	                                       FALSE,
+	                                       NULL);
+}
+
+/* Take the jobs done at the head of the queue, waiting for the first one
+ * if asked, and save the batch each time it is full. */
+
+static void
+rena_scanner_collect_tag_jobs (RenaScanner *scanner, gboolean wait)
+{
+	RenaScannerTagJob *job;
+	guint pending;
+
+	pending = g_queue_get_length (scanner->tag_jobs) + scanner->batch->len;
+	scanner->peak_pending = MAX(scanner->peak_pending, pending);
+
+	g_mutex_lock (&scanner->tag_queue_mutex);
+	while ((job = g_queue_peek_head (scanner->tag_jobs)) != NULL) {
+		if (!job->done) {
+			if (!wait)
+				break;
+			g_cond_wait (&scanner->tag_queue_cond, &scanner->tag_queue_mutex);
+			continue;
+		}
+		g_queue_pop_head (scanner->tag_jobs);
+		wait = FALSE;
+		g_mutex_unlock (&scanner->tag_queue_mutex);
+
+		if (job->directory) {
+			g_ptr_array_add (scanner->completed, g_strdup (job->file));
+			if (scanner->completed->len >= RENA_SCANNER_SAVE_BATCH_SIZE)
+				rena_scanner_save_batch (scanner);
+			rena_scanner_tag_job_free (job);
+		}
+		else if (G_LIKELY(job->mobj != NULL)) {
+			if (job->replace)
+				scanner->n_changed++;
+			else
+				scanner->n_new++;
+			g_ptr_array_add (scanner->batch, job);
+			if (scanner->batch->len >= RENA_SCANNER_SAVE_BATCH_SIZE)
+				rena_scanner_save_batch (scanner);
+		}
+		else {
+			rena_scanner_tag_job_free (job);
+		}
+
+		g_mutex_lock (&scanner->tag_queue_mutex);
+	}
+	g_mutex_unlock (&scanner->tag_queue_mutex);
+}
+
+static void
+rena_scanner_queue_tag_job (RenaScanner                  *scanner,
+                            const gchar                  *file,
+                            gboolean                      replace,
+                            const RenaDatabaseFingerprint *fingerprint)
+{
+	RenaScannerTagJob *job;
+
+	job = g_slice_new0 (RenaScannerTagJob);
+	job->file = g_strdup (file);
+	job->provider = g_strdup (scanner->curr_provider);
+	job->replace = replace;
+	if (fingerprint) {
+		job->fingerprint = *fingerprint;
+		job->has_fingerprint = TRUE;
+	}
+	g_queue_push_tail (scanner->tag_jobs, job);
+
+	g_thread_pool_push (scanner->tag_pool, job, NULL);
+
+	rena_scanner_collect_tag_jobs (scanner,
+		g_queue_get_length (scanner->tag_jobs) >= RENA_SCANNER_TAG_QUEUE_SIZE);
+}
+
+/* Queued after the files of a folder, so it is saved as completed in the
+ * same batch as the last of them. */
+
+static void
+rena_scanner_queue_directory_done (RenaScanner *scanner, const gchar *dir_name)
+{
+	RenaScannerTagJob *job;
+
+	job = g_slice_new0 (RenaScannerTagJob);
+	job->file = g_strdup (dir_name);
+	job->directory = TRUE;
+	job->done = TRUE;
+	g_queue_push_tail (scanner->tag_jobs, job);
+
+	rena_scanner_collect_tag_jobs (scanner, FALSE);
+}
+
+static void
+rena_scanner_tag_readers_finish (RenaScanner *scanner)
+{
+	g_thread_pool_free (scanner->tag_pool, FALSE, TRUE);
+	scanner->tag_pool = NULL;
+
+	rena_scanner_collect_tag_jobs (scanner, FALSE);
+	rena_scanner_save_batch (scanner);
+
+	g_queue_free (scanner->tag_jobs);
+	scanner->tag_jobs = NULL;
+	g_ptr_array_free (scanner->batch, TRUE);
+	scanner->batch = NULL;
+	g_array_free (scanner->seen, TRUE);
+	scanner->seen = NULL;
+	g_ptr_array_free (scanner->completed, TRUE);
+	scanner->completed = NULL;
+}
+
+/* Function that is executed at the end of analyze the files,
+ * or if the analysis was canceled.
+ * This runs on the main thread. So, can show a dialog.
+ * The library was already saved by the worker, so it only is reloaded.
+ * Finally, frees all memory. */
+
 static gboolean
 rena_scanner_worker_finished (gpointer data)
 {
@@ -232,6 +746,8 @@ rena_scanner_worker_finished (gpointer data)
 	GtkWidget *msg_dialog;
 	gchar *last_scan_time = NULL;
 	GSList *list;
+	guint by_extension, by_content;
+	gdouble elapsed;
 
 	RenaScanner *scanner = data;
 
@@ -239,11 +755,24 @@ rena_scanner_worker_finished (gpointer data)
 
 	g_source_remove(scanner->update_timeout);
 
-	/* Ensure that the other thread has finished */
+	rena_file_get_media_type_stats (&by_extension, &by_content);
+	CDEBUG(DBG_INFO, "Library scan classified %u files by extension and %u by content type",
+	       by_extension - scanner->by_extension, by_content - scanner->by_content);
+	CDEBUG(DBG_INFO, "Library scan kept at most %u tracks in memory", scanner->peak_pending);
+
+	/* Compare runs with different library_scan_workers to measure the readers. */
+	elapsed = (g_get_monotonic_time () - scanner->begin_time) / (gdouble) G_USEC_PER_SEC;
+	CDEBUG(DBG_INFO, "Library scan analyzed %u files with %d tag readers in %.2f s, %.0f files/s",
+	       scanner->files_scanned, scanner->tag_workers, elapsed,
+	       elapsed > 0 ? scanner->files_scanned / elapsed : 0.0);
 
-	g_thread_join (scanner->no_files_thread);
+	/* Forget what the main connection knew of the library, it changed */
 
-	/* If not cancelled, update database and show a dialog */
+	database = rena_database_get ();
+	rena_database_invalidate_caches (database);
+	g_object_unref (database);
+
+	/* If not cancelled, update the library view and show a dialog */
 
 	if(!g_cancellable_is_cancelled (scanner->cancellable))
 	{
@@ -264,50 +793,27 @@ rena_scanner_worker_finished (gpointer data)
 		                 G_CALLBACK(rena_scanner_finished_dialog_delete),
 		                 scanner);
 
+		if (scanner->incremental)
+			gtk_message_dialog_format_secondary_text (GTK_MESSAGE_DIALOG(msg_dialog),
+			                                          _("%u files unchanged, %u changed, %u new and %u removed"),
+			                                          scanner->n_unchanged,
+			                                          scanner->n_changed,
+			                                          scanner->n_new,
+			                                          scanner->n_removed);
+
 		gtk_widget_show_all(msg_dialog);
 
 		taskbar = rena_background_task_bar_get ();
 		rena_background_task_bar_remove_widget (taskbar, GTK_WIDGET(scanner->task_widget));
 		g_object_unref(G_OBJECT(taskbar));
 
-		/* Save new database and update the library view */
+		/* Set local providers as visible and update the library view */
 
-		set_watch_cursor(msg_dialog);
-
-		database = rena_database_get();
 		provider = rena_database_provider_get ();
-
-		rena_database_begin_transaction (database);
-
-		/* Remove songs of local providers */
-
-		for (list = scanner->folder_list; list != NULL; list = list->next)
-			rena_provider_forget_songs (provider, list->data);
-
-		/* Append new songs */
-
-		g_hash_table_foreach (scanner->tracks_table,
-		                      rena_scanner_add_track_db,
-		                      database);
-
-		/* Set local providers as visible */
-
 		for (list = scanner->folder_list; list != NULL; list = list->next)
 			rena_provider_set_visible (provider, list->data, TRUE);
-
-		/* Import playlist detected. */
-
-		for (list = scanner->playlists ; list != NULL; list = list->next)
-			rena_scanner_import_playlist(database, list->data);
-
-		rena_database_commit_transaction (database);
-
 		rena_provider_update_done (provider);
-
 		g_object_unref (provider);
-		g_object_unref(database);
-
-		remove_watch_cursor(msg_dialog);
 
 		/* Save finished time and folders scanned. */
 
@@ -325,6 +831,14 @@ rena_scanner_worker_finished (gpointer data)
 		g_object_unref(G_OBJECT(preferences));
 	}
 	else {
+		/* Some chunks could be saved before cancelling */
+
+		if (scanner->tracks_saved > 0) {
+			provider = rena_database_provider_get ();
+			rena_provider_update_done (provider);
+			g_object_unref (provider);
+		}
+
 		preferences = rena_preferences_get();
 		rena_preferences_set_lock_library (preferences, FALSE);
 		g_object_unref(G_OBJECT(preferences));
@@ -342,17 +856,23 @@ rena_scanner_worker_finished (gpointer data)
 
 	/* Clean memory */
 
-	g_hash_table_remove_all(scanner->tracks_table);
 	free_str_list(scanner->folder_list);
 	scanner->folder_list = NULL;
 	free_str_list(scanner->folder_scanned);
 	scanner->folder_scanned = NULL;
 
-	free_str_list(scanner->playlists);
-	scanner->playlists = NULL;
-
 	scanner->no_files = 0;
+	scanner->dirs_found = 0;
+	scanner->dirs_scanned = 0;
 	scanner->files_scanned = 0;
+	scanner->tracks_saved = 0;
+
+	scanner->incremental = FALSE;
+	scanner->resumed = FALSE;
+	scanner->n_unchanged = 0;
+	scanner->n_changed = 0;
+	scanner->n_new = 0;
+	scanner->n_removed = 0;
 
 	g_cancellable_reset (scanner->cancellable);
 	scanner->update_timeout = 0;
@@ -360,65 +880,116 @@ rena_scanner_worker_finished (gpointer data)
 	return FALSE;
 }
 
-/* Function that analyzes all files of library recursively */
+static void
+rena_scanner_count_file (RenaScanner *scanner)
+{
+	g_mutex_lock (&scanner->files_scanned_mutex);
+	scanner->files_scanned++;
+	g_mutex_unlock (&scanner->files_scanned_mutex);
+}
+
+/* Walk a folder of the library.
+ *
+ * The entries are handled as they are read, descending into each
+ * subfolder as soon as it is found, so no level keeps more than its
+ * open folder and the entry being handled. */
 
 static void
-rena_scanner_scan_handler(RenaScanner *scanner, const gchar *dir_name)
+rena_scanner_walk_folder (RenaScanner *scanner,
+                          const gchar *dir_name,
+                          void (*handle_file) (RenaScanner *scanner, const gchar *file))
 {
-	GDir *dir;
+	RenaDir *dir;
+	RenaDirEntryType type;
 	const gchar *next_file = NULL;
 	gchar *ab_file;
+	gboolean completed;
 	GError *error = NULL;
-	RenaMusicobject *mobj = NULL;
-	RenaMediaType file_type;
 
 	if(g_cancellable_is_cancelled (scanner->cancellable))
 		return;
 
-	dir = g_dir_open(dir_name, 0, &error);
+	completed = rena_scanner_directory_completed (scanner, dir_name);
+
+	dir = rena_dir_open (dir_name, &error);
 	if (!dir) {
 		g_critical("Unable to open library : %s", dir_name);
+		g_error_free (error);
 		return;
 	}
 
-	next_file = g_dir_read_name(dir);
-	while (next_file) {
-		if(g_cancellable_is_cancelled (scanner->cancellable)) {
-			g_dir_close(dir);
-			return;
-		}
+	while ((next_file = rena_dir_read_entry (dir, &type)) != NULL) {
+		if(g_cancellable_is_cancelled (scanner->cancellable))
+			break;
 
 		ab_file = g_strconcat(dir_name, G_DIR_SEPARATOR_S, next_file, NULL);
-		if (g_file_test(ab_file, G_FILE_TEST_IS_DIR))
-			rena_scanner_scan_handler(scanner, ab_file);
-		else {
-			file_type = rena_file_get_media_type (ab_file);
-			switch (file_type) {
-				case MEDIA_TYPE_AUDIO:
-					mobj = new_musicobject_from_file(ab_file, scanner->curr_provider);
-					if (G_LIKELY(mobj))
-						 g_hash_table_insert(scanner->tracks_table,
-							                 g_strdup(rena_musicobject_get_file(mobj)),
-							                 mobj);
-					break;
-				case MEDIA_TYPE_PLAYLIST:
-					scanner->playlists = g_slist_prepend (scanner->playlists, g_strdup(ab_file));
-					break;
-				case MEDIA_TYPE_IMAGE:
-				case MEDIA_TYPE_UNKNOWN:
-				default:
-					break;
-			}
-
-			g_mutex_lock (&scanner->files_scanned_mutex);
-			scanner->files_scanned++;
-			g_mutex_unlock (&scanner->files_scanned_mutex);
+		switch (type) {
+			case RENA_DIR_ENTRY_DIRECTORY:
+				g_mutex_lock (&scanner->no_files_mutex);
+				scanner->dirs_found++;
+				g_mutex_unlock (&scanner->no_files_mutex);
+				rena_scanner_walk_folder (scanner, ab_file, handle_file);
+				break;
+			case RENA_DIR_ENTRY_FILE:
+				g_mutex_lock (&scanner->no_files_mutex);
+				scanner->no_files++;
+				g_mutex_unlock (&scanner->no_files_mutex);
+				if (completed)
+					rena_scanner_count_file (scanner);
+				else
+					handle_file (scanner, ab_file);
+				break;
+			case RENA_DIR_ENTRY_OTHER:
+			default:
+				break;
 		}
+		g_free (ab_file);
+	}
+	rena_dir_close (dir);
+
+	if (!completed && !g_cancellable_is_cancelled (scanner->cancellable))
+		rena_scanner_queue_directory_done (scanner, dir_name);
+
+	g_mutex_lock (&scanner->no_files_mutex);
+	scanner->dirs_scanned++;
+	g_mutex_unlock (&scanner->no_files_mutex);
+}
 
-		g_free(ab_file);
-		next_file = g_dir_read_name(dir);
+/* Queue the audio files and keep the playlists found on a new folder. */
+
+static void
+rena_scanner_add_playlist (RenaScanner *scanner, const gchar *ab_file)
+{
+	RenaPreparedStatement *statement;
+
+	statement = rena_database_create_statement (scanner->database, "INSERT OR IGNORE INTO SCAN_PLAYLISTS (file) VALUES (?)");
+	rena_prepared_statement_bind_string (statement, 1, ab_file);
+	rena_prepared_statement_step (statement);
+	rena_prepared_statement_free (statement);
+}
+
+static void
+rena_scanner_scan_file (RenaScanner *scanner, const gchar *ab_file)
+{
+	switch (rena_file_get_media_type (ab_file)) {
+		case MEDIA_TYPE_AUDIO:
+			rena_scanner_queue_tag_job (scanner, ab_file, FALSE, NULL);
+			break;
+		case MEDIA_TYPE_PLAYLIST:
+			rena_scanner_add_playlist (scanner, ab_file);
+			/* fall through */
+		case MEDIA_TYPE_IMAGE:
+		case MEDIA_TYPE_UNKNOWN:
+		default:
+			rena_scanner_count_file (scanner);
+			break;
 	}
-	g_dir_close(dir);
+}
+
+static void
+rena_scanner_scan_handler(RenaScanner *scanner, const gchar *dir_name)
+{
+	rena_scanner_walk_folder (scanner, dir_name, rena_scanner_scan_file);
 }
 
 /* Thread that analyze all files in the library */
@@ -430,6 +1001,13 @@ rena_scanner_scan_worker(gpointer data)
 
 	RenaScanner *scanner = data;
 
+	if (!rena_scanner_save_begin (scanner)) {
+		g_cancellable_cancel (scanner->cancellable);
+		return scanner;
+	}
+
+	rena_scanner_tag_readers_start (scanner);
+
 	for(list = scanner->folder_list ; list != NULL; list = list->next) {
 		if(g_cancellable_is_cancelled (scanner->cancellable))
 			break;
@@ -441,73 +1019,101 @@ rena_scanner_scan_worker(gpointer data)
 		rena_scanner_scan_handler(scanner, list->data);
 	}
 
+	rena_scanner_tag_readers_finish (scanner);
+
+	rena_scanner_save_end (scanner);
+
 	return scanner;
 }
 
-/* Function that analyzes all files of library recursively */
+/* Queue the files that are new or changed since the last scan.
+ *
+ * The saved track of each file is looked up in the library as it is
+ * found. A file changed when its fingerprint differs from the saved one.
+ * Files saved before the fingerprints were kept are compared with the
+ * time of the last scan instead. */
+
+static gint
+rena_scanner_lookup_track (RenaScanner            *scanner,
+                           const gchar            *ab_file,
+                           RenaDatabaseFingerprint *saved)
+{
+	RenaPreparedStatement *statement;
+	gint location_id = 0;
+
+	const gchar *sql = "SELECT LOCATION.id, LOCATION.mtime, LOCATION.size, LOCATION.inode "
+	                   "FROM LOCATION JOIN TRACK ON TRACK.location = LOCATION.id "
+	                   "WHERE LOCATION.name = ?";
+	statement = rena_database_create_statement (scanner->database, sql);
+	rena_prepared_statement_bind_string (statement, 1, ab_file);
+	if (rena_prepared_statement_step (statement)) {
+		location_id = rena_prepared_statement_get_int (statement, 0);
+		saved->mtime = rena_prepared_statement_get_int64 (statement, 1);
+		saved->size = rena_prepared_statement_get_int64 (statement, 2);
+		saved->inode = rena_prepared_statement_get_int64 (statement, 3);
+	}
+	rena_prepared_statement_free (statement);
+
+	return location_id;
+}
 
 static void
-rena_scanner_update_handler(RenaScanner *scanner, const gchar *dir_name)
+rena_scanner_update_file (RenaScanner *scanner, const gchar *ab_file)
 {
-	GDir *dir;
-	const gchar *next_file = NULL;
-	gchar *ab_file = NULL, *s_ab_file = NULL;
-	GError *error = NULL;
+	RenaDatabaseFingerprint fingerprint, saved;
 	struct stat sbuf;
-	RenaMusicobject *mobj = NULL;
+	gboolean changed;
+	gint location_id;
 
-	if(g_cancellable_is_cancelled (scanner->cancellable))
-		return;
+	/* Only the audio files have tags to read. The playlists are imported
+	 * at the end, as on a new folder. */
 
-	dir = g_dir_open(dir_name, 0, &error);
-	if (!dir) {
-		g_critical("Unable to open library : %s", dir_name);
+	switch (rena_file_get_media_type (ab_file)) {
+		case MEDIA_TYPE_AUDIO:
+			break;
+		case MEDIA_TYPE_PLAYLIST:
+			rena_scanner_add_playlist (scanner, ab_file);
+			/* fall through */
+		case MEDIA_TYPE_IMAGE:
+		case MEDIA_TYPE_UNKNOWN:
+		default:
+			rena_scanner_count_file (scanner);
+			return;
+	}
+
+	if (g_stat (ab_file, &sbuf) != 0) {
+		rena_scanner_count_file (scanner);
 		return;
 	}
+	rena_scanner_fingerprint_from_stat (&fingerprint, &sbuf);
 
-	next_file = g_dir_read_name(dir);
-	while (next_file) {
-		if(g_cancellable_is_cancelled (scanner->cancellable))
-			return;
+	location_id = rena_scanner_lookup_track (scanner, ab_file, &saved);
+	if (location_id == 0) {
+		rena_scanner_queue_tag_job (scanner, ab_file, FALSE, &fingerprint);
+		return;
+	}
 
-		ab_file = g_strconcat(dir_name, G_DIR_SEPARATOR_S, next_file, NULL);
+	if (saved.mtime || saved.size)
+		changed = !rena_scanner_fingerprint_equal (&saved, &fingerprint);
+	else
+		changed = fingerprint.mtime > scanner->last_update.tv_sec;
 
-		if (g_file_test(ab_file, G_FILE_TEST_IS_DIR)) {
-			rena_scanner_update_handler(scanner, ab_file);
-		}
-		else {
-			mobj = g_hash_table_lookup(scanner->tracks_table,
-			                           ab_file);
-			if(!mobj) {
-				mobj = new_musicobject_from_file(ab_file, scanner->curr_provider);
-				if (G_LIKELY(mobj))
-					 g_hash_table_insert(scanner->tracks_table,
-					                     g_strdup(rena_musicobject_get_file(mobj)),
-					                     mobj);
-
-			}
-			else {
-				if ((g_stat(ab_file, &sbuf) == 0) &&
-				    (sbuf.st_mtime > scanner->last_update.tv_sec)) {
-					mobj = new_musicobject_from_file(ab_file, scanner->curr_provider);
-					if (G_LIKELY(mobj)) {
-						g_hash_table_replace(scanner->tracks_table,
-						                     g_strdup(rena_musicobject_get_file(mobj)),
-						                     mobj);
-					}
-				}
-			}
-
-			g_mutex_lock (&scanner->files_scanned_mutex);
-			scanner->files_scanned++;
-			g_mutex_unlock (&scanner->files_scanned_mutex);
-
-			g_free(s_ab_file);
-		}
-		g_free(ab_file);
-		next_file = g_dir_read_name(dir);
+	if (changed) {
+		rena_scanner_queue_tag_job (scanner, ab_file, TRUE, &fingerprint);
+	}
+	else {
+		g_array_append_val (scanner->seen, location_id);
+		if (scanner->seen->len >= RENA_SCANNER_SAVE_BATCH_SIZE)
+			rena_scanner_save_batch (scanner);
+		scanner->n_unchanged++;
+		rena_scanner_count_file (scanner);
 	}
-	g_dir_close(dir);
+}
+
+static void
+rena_scanner_update_handler(RenaScanner *scanner, const gchar *dir_name)
+{
+	rena_scanner_walk_folder (scanner, dir_name, rena_scanner_update_file);
 }
 
 /* Thread that analyze all files in the library */
@@ -516,23 +1122,16 @@ static gpointer
 rena_scanner_update_worker(gpointer data)
 {
 	GSList *list;
-	GHashTableIter iter;
-	gpointer key, value;
-	gchar *file;
 
 	RenaScanner *scanner = data;
 
-	/* Clean removed files */
-
-	g_hash_table_iter_init (&iter, scanner->tracks_table);
-	while (g_hash_table_iter_next (&iter, &key, &value)) {
-		file = key;
-		if(g_cancellable_is_cancelled (scanner->cancellable))
-			break;
-		if(!g_file_test(file, G_FILE_TEST_EXISTS))
-			g_hash_table_iter_remove(&iter);
+	if (!rena_scanner_save_begin (scanner)) {
+		g_cancellable_cancel (scanner->cancellable);
+		return scanner;
 	}
 
+	rena_scanner_tag_readers_start (scanner);
+
 	/* Then update files changed.. */
 	for(list = scanner->folder_list ; list != NULL; list = list->next) {
 		if(g_cancellable_is_cancelled (scanner->cancellable))
@@ -559,6 +1158,12 @@ rena_scanner_update_worker(gpointer data)
 		}
 	}
 
+	rena_scanner_tag_readers_finish (scanner);
+
+	/* Clean the files that were not found */
+
+	rena_scanner_save_end (scanner);
+
 	return scanner;
 }
 
@@ -567,14 +1172,8 @@ rena_scanner_update_library(RenaScanner *scanner)
 {
 	RenaBackgroundTaskBar *taskbar;
 	RenaPreferences *preferences;
-	RenaDatabase *database;
 	RenaDatabaseProvider *provider;
-	RenaPreparedStatement *statement;
-	RenaMusicobject *mobj = NULL;
 	gchar *last_scan_time = NULL;
-	const gchar *sql = NULL;
-	guint location_id;
-	GSList *list;
 
 	if(scanner->update_timeout)
 		return;
@@ -593,6 +1192,7 @@ rena_scanner_update_library(RenaScanner *scanner)
 			g_warning("Unable to convert last rescan time");
 		g_free(last_scan_time);
 	}
+	scanner->tag_workers = rena_scanner_tag_workers (preferences);
 	g_object_unref(G_OBJECT(preferences));
 
 	provider = rena_database_provider_get ();
@@ -600,6 +1200,8 @@ rena_scanner_update_library(RenaScanner *scanner)
 	scanner->folder_scanned = rena_provider_get_handled_list_by_type (provider, "local");
 	g_object_unref (provider);
 
+	scanner->dirs_found = g_slist_length (scanner->folder_list);
+
 	/* Update the gui */
 
 	scanner->update_timeout =
@@ -609,38 +1211,14 @@ rena_scanner_update_library(RenaScanner *scanner)
 	rena_background_task_bar_prepend_widget (taskbar, GTK_WIDGET(scanner->task_widget));
 	g_object_unref(G_OBJECT(taskbar));
 
-	/* Append the files from database that no changed. */
+	/* Only the files changed are read again */
 
-	database = rena_database_get();
-	for (list = scanner->folder_scanned; list != NULL; list = list->next)
-	{
-		if (rena_string_list_is_present (scanner->folder_list, list->data))
-		{
-			sql = "SELECT location FROM TRACK WHERE provider = ?";
-			statement = rena_database_create_statement (database, sql);
-
-			rena_prepared_statement_bind_int (statement, 1,
-				rena_database_find_provider (database, list->data));
-
-			while (rena_prepared_statement_step (statement)) {
-				location_id = rena_prepared_statement_get_int (statement, 0);
-				mobj = new_musicobject_from_db(database, location_id);
-				if (G_LIKELY(mobj)) {
-					g_hash_table_insert(scanner->tracks_table,
-					                    g_strdup(rena_musicobject_get_file(mobj)),
-					                    mobj);
-				}
-
-				rena_process_gtk_events ();
-			}
-			rena_prepared_statement_free (statement);
-		}
-	}
-	g_object_unref(database);
+	scanner->incremental = TRUE;
 
 	/* Launch threads */
 
-	scanner->no_files_thread = g_thread_new("Count no files", rena_scanner_count_no_files_worker, scanner);
+	rena_file_get_media_type_stats (&scanner->by_extension, &scanner->by_content);
+	scanner->begin_time = g_get_monotonic_time ();
 
 	scanner->worker_thread = rena_async_launch_full(rena_scanner_update_worker,
 	                                                  rena_scanner_worker_finished,
@@ -671,6 +1249,7 @@ rena_scanner_scan_library(RenaScanner *scanner)
 			g_warning("Unable to convert last rescan time");
 		g_free(last_scan_time);
 	}
+	scanner->tag_workers = rena_scanner_tag_workers (preferences);
 	g_object_unref(G_OBJECT(preferences));
 
 	provider = rena_database_provider_get ();
@@ -678,6 +1257,8 @@ rena_scanner_scan_library(RenaScanner *scanner)
 	scanner->folder_scanned = rena_provider_get_handled_list_by_type (provider, "local");
 	g_object_unref (provider);
 
+	scanner->dirs_found = g_slist_length (scanner->folder_list);
+
 	/* Update the gui */
 
 	scanner->update_timeout = g_timeout_add_seconds(1, (GSourceFunc)rena_scanner_update_progress, scanner);
@@ -688,27 +1269,64 @@ rena_scanner_scan_library(RenaScanner *scanner)
 
 	/* Launch threads */
 
-	scanner->no_files_thread = g_thread_new("Count no files", rena_scanner_count_no_files_worker, scanner);
+	rena_file_get_media_type_stats (&scanner->by_extension, &scanner->by_content);
+	scanner->begin_time = g_get_monotonic_time ();
 
 	scanner->worker_thread = rena_async_launch_full(rena_scanner_scan_worker,
 	                                                  rena_scanner_worker_finished,
 	                                                  scanner);
 }
 
+/* Resume the scan left pending when Rena was closed, if any. */
+
+void
+rena_scanner_resume_pending (RenaScanner *scanner)
+{
+	RenaDatabase *database;
+	gint incremental;
+
+	database = rena_database_get ();
+	incremental = rena_scanner_get_pending (database);
+	g_object_unref (database);
+
+	if (incremental < 0)
+		return;
+
+	if (incremental)
+		rena_scanner_update_library (scanner);
+	else
+		rena_scanner_scan_library (scanner);
+}
+
+/**
+ * rena_scanner_get_peak_pending:
+ *
+ * Return value: the most tracks that the last scan kept in memory at
+ * once, waiting for their tags or to be saved. It stays under
+ * RENA_SCANNER_TAG_QUEUE_SIZE plus RENA_SCANNER_SAVE_BATCH_SIZE whatever
+ * the size of the library.
+ */
+guint
+rena_scanner_get_peak_pending (RenaScanner *scanner)
+{
+	return scanner->peak_pending;
+}
+
 void
 rena_scanner_free(RenaScanner *scanner)
 {
 	if(scanner->update_timeout) {
+		scanner->closing = TRUE;
 		g_cancellable_cancel (scanner->cancellable);
-		g_thread_join (scanner->no_files_thread);
 		g_thread_join (scanner->worker_thread);
 	}
 
-	g_hash_table_destroy(scanner->tracks_table);
 	free_str_list(scanner->folder_list);
 	free_str_list(scanner->folder_scanned);
 	g_mutex_clear (&scanner->no_files_mutex);
 	g_mutex_clear (&scanner->files_scanned_mutex);
+	g_mutex_clear (&scanner->tag_queue_mutex);
+	g_cond_clear (&scanner->tag_queue_cond);
 	g_object_unref(scanner->cancellable);
 
 	g_slice_free (RenaScanner, scanner);
@@ -736,14 +1354,12 @@ rena_scanner_new()
 	/* Init the rest and save references */
 
 	scanner->task_widget = task_widget;
-	scanner->tracks_table = g_hash_table_new_full (g_str_hash,
-	                                               g_str_equal,
-	                                               g_free,
-	                                               g_object_unref);
 	scanner->files_scanned = 0;
 	g_mutex_init (&scanner->files_scanned_mutex);
 	scanner->no_files = 0;
 	g_mutex_init (&scanner->no_files_mutex);
+	g_mutex_init (&scanner->tag_queue_mutex);
+	g_cond_init (&scanner->tag_queue_cond);
 	scanner->update_timeout = 0;
 
 	return scanner;
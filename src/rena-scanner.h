@@ -18,6 +18,14 @@
 #ifndef RENA_SCANNER_H
 #define RENA_SCANNER_H
 
+#include <glib.h>
+
+/* Files waiting for a tag reader, so discovery does not run far ahead. */
+#define RENA_SCANNER_TAG_QUEUE_SIZE 256
+
+/* Tracks saved per transaction, so the main thread never waits long to write. */
+#define RENA_SCANNER_SAVE_BATCH_SIZE 512
+
 typedef struct _RenaScanner RenaScanner;
 
 void
@@ -26,6 +34,12 @@ rena_scanner_update_library(RenaScanner *scanner);
 void
 rena_scanner_scan_library(RenaScanner *scanner);
 
+void
+rena_scanner_resume_pending (RenaScanner *scanner);
+
+guint
+rena_scanner_get_peak_pending (RenaScanner *scanner);
+
 void
 rena_scanner_free(RenaScanner *scanner);
 
@@ -19,7 +19,6 @@
 
 #include "rena-musicobject.h"
 #include "rena-database.h"
-#include "rena-database-provider.h"
 #include "rena-library-pane.h"
 #include "rena-tags-mgmt.h"
 
@@ -75,20 +74,14 @@ rena_tagger_add_location_id(RenaTagger *tagger, gint location_id)
 void
 rena_tagger_apply_changes(RenaTagger *tagger)
 {
-	RenaDatabaseProvider *provider;
-
 	RenaTaggerPrivate *priv = tagger->priv;
 
 	if(priv->file_arr->len)
 		rena_update_local_files_change_tag(priv->file_arr, priv->changed, priv->mobj);
 
-	if(priv->loc_arr->len) {
+	/* The database emits TracksChanged with the updated locations. */
+	if(priv->loc_arr->len)
 		rena_database_update_local_files_change_tag(priv->cdbase, priv->loc_arr, priv->changed, priv->mobj);
-
-		provider = rena_database_provider_get ();
-		rena_provider_update_done (provider);
-		g_object_unref (provider);
-	}
 }
 
 static void
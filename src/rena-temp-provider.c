@@ -44,16 +44,6 @@ G_DEFINE_TYPE(RenaTempProvider, rena_temp_provider, G_TYPE_OBJECT)
 /*
  * Helpers
  */
-static void
-rena_temp_provider_add_track_db (gpointer key,
-                                   gpointer value,
-                                   gpointer user_data)
-{
-	RenaMusicobject *mobj = value;
-	RenaDatabase *database = user_data;
-	rena_database_add_new_musicobject (database, mobj);
-}
-
 static void
 rena_temp_provider_forget_track_db (gpointer key,
                                       gpointer value,
@@ -116,15 +106,23 @@ rena_temp_provider_merge_database (RenaTempProvider *provider)
 void
 rena_temp_provider_commit_database (RenaTempProvider *provider)
 {
+	GHashTableIter iter;
+	GPtrArray *tracks;
+	gpointer value;
+
 	/* Remove old. */
 	g_hash_table_foreach (provider->rm_table,
 	                      rena_temp_provider_forget_track_db,
 	                      provider->database);
 
 	/* Add song with changes. */
-	g_hash_table_foreach (provider->ins_table,
-	                      rena_temp_provider_add_track_db,
-	                      provider->database);
+	tracks = g_ptr_array_sized_new (g_hash_table_size (provider->ins_table));
+	g_hash_table_iter_init (&iter, provider->ins_table);
+	while (g_hash_table_iter_next (&iter, NULL, &value))
+		g_ptr_array_add (tracks, value);
+
+	rena_database_add_new_musicobjects (provider->database, tracks);
+	g_ptr_array_free (tracks, TRUE);
 
 	/* Songs without changes remain there.. */
 }
@@ -148,7 +146,10 @@ rena_temp_provider_fill_database (RenaTempProvider *provider)
 	RenaDatabase *database;
 	RenaPreparedStatement *statement;
 	RenaMusicobject *mobj = NULL;
+	GPtrArray *mobjs;
+	GArray *loc_arr;
 	gint location_id = 0;
+	guint i;
 
 	database = rena_database_get();
 
@@ -156,18 +157,27 @@ rena_temp_provider_fill_database (RenaTempProvider *provider)
 	statement = rena_database_create_statement (database, sql);
 
 	rena_prepared_statement_bind_int (statement, 1,
-		rena_database_find_provider (database, provider->name));
+		rena_database_provider_get_id (provider->db_provider, provider->name));
 
+	loc_arr = g_array_new (FALSE, FALSE, sizeof(gint));
 	while (rena_prepared_statement_step (statement)) {
 		location_id = rena_prepared_statement_get_int (statement, 0);
-		mobj = new_musicobject_from_db(database, location_id);
+		g_array_append_val (loc_arr, location_id);
+	}
+	rena_prepared_statement_free (statement);
+
+	mobjs = new_musicobjects_from_db (database, loc_arr);
+	for (i = 0; i < mobjs->len; i++) {
+		mobj = g_ptr_array_index (mobjs, i);
 		if (G_LIKELY(mobj)) {
 			g_hash_table_insert(provider->db_table,
 			                    g_strdup(rena_musicobject_get_file(mobj)),
 			                    mobj);
 		}
-		rena_prepared_statement_free (statement);
 	}
+	g_ptr_array_free (mobjs, TRUE);
+	g_array_free (loc_arr, TRUE);
+
 	g_object_unref(database);
 }
 
@@ -348,6 +348,8 @@ void rena_init_gui_state (RenaApplication *rena)
 		rena_playlist_init_playlist_state (playlist);
 	}
 
+	rena_scanner_resume_pending (rena_application_get_scanner (rena));
+
 	if (info_bar_import_music_will_be_useful(rena)) {
 		GtkWidget* info_bar = create_info_bar_import_music(rena);
 		rena_window_add_widget_to_infobox(rena, info_bar);
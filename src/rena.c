@@ -42,6 +42,8 @@
 #include "rena-music-enum.h"
 #include "rena-playlists-mgmt.h"
 #include "rena-database-provider.h"
+#include "rena-database-maintenance.h"
+#include "rena-library-monitor.h"
 
 #ifdef G_OS_WIN32
 #include "win32/win32dep.h"
@@ -60,10 +62,12 @@ struct _RenaApplication {
 	RenaPreferences      *preferences;
 	RenaDatabase         *cdbase;
 	RenaDatabaseProvider *provider;
+	RenaDatabaseMaintenance *maintenance;
 	RenaArtCache         *art_cache;
 	RenaMusicEnum        *enum_map;
 
 	RenaScanner     *scanner;
+	RenaLibraryMonitor *library_monitor;
 
 	RenaPreferencesDialog *setting_dialog;
 
@@ -678,6 +682,19 @@ rena_libary_list_changed_cb (RenaPreferences *preferences, RenaApplication *rena
 	rena_window_add_widget_to_infobox (rena, infobar);
 }
 
+/* Database maintenance only runs while nothing is playing. */
+
+static void
+rena_application_maintenance_playback_state_cb (RenaBackend     *backend,
+                                                GParamSpec      *pspec,
+                                                RenaApplication *rena)
+{
+	RenaBackendState state = rena_backend_get_state (backend);
+
+	rena_database_maintenance_set_idle (rena->maintenance,
+	                                    state == ST_STOPPED || state == ST_PAUSED);
+}
+
 static void
 rena_application_provider_want_update (RenaDatabaseProvider *provider,
                                          gint                    provider_id,
@@ -997,7 +1014,9 @@ rena_application_construct_window (RenaApplication *rena)
 	rena->library = rena_library_pane_new ();
 	rena->playlist = rena_playlist_new ();
 	rena->statusbar = rena_statusbar_get ();
+	rena_file_media_types_init ();
 	rena->scanner = rena_scanner_new();
+	rena->library_monitor = rena_library_monitor_new (rena->scanner);
 
 	rena->status_icon = rena_status_icon_new (rena);
 
@@ -1036,6 +1055,10 @@ rena_application_dispose (GObject *object)
 		g_object_unref (rena->backend);
 		rena->backend = NULL;
 	}
+	if (rena->maintenance) {
+		rena_database_maintenance_free (rena->maintenance);
+		rena->maintenance = NULL;
+	}
 	if (rena->art_cache) {
 		g_object_unref (rena->art_cache);
 		rena->art_cache = NULL;
@@ -1044,6 +1067,10 @@ rena_application_dispose (GObject *object)
 		g_object_unref (rena->enum_map);
 		rena->enum_map = NULL;
 	}
+	if (rena->library_monitor) {
+		rena_library_monitor_free (rena->library_monitor);
+		rena->library_monitor = NULL;
+	}
 	if (rena->scanner) {
 		rena_scanner_free (rena->scanner);
 		rena->scanner = NULL;
@@ -1142,6 +1169,11 @@ rena_application_startup (GApplication *application)
 	g_signal_connect (rena->backend, "notify::state",
 	                  G_CALLBACK (rena_menubar_update_playback_state_cb), rena);
 
+	rena->maintenance = rena_database_maintenance_new (rena->cdbase);
+	g_signal_connect (rena->backend, "notify::state",
+	                  G_CALLBACK (rena_application_maintenance_playback_state_cb), rena);
+	rena_application_maintenance_playback_state_cb (rena->backend, NULL, rena);
+
 	/*
 	 * Collect widgets and construct the window.
 	 */
@@ -0,0 +1,250 @@
+/*****************************************************************************/
+/* Copyright (C) 2024 Santelmo Technologies <santelmotechnologies@gmail.com> */
+/*                                                                           */
+/* This program is free software: you can redistribute it and/or modify      */
+/* it under the terms of the GNU General Public License as published by      */
+/* the Free Software Foundation, either version 3 of the License, or         */
+/* (at your option) any later version.                                       */
+/*                                                                           */
+/* This program is distributed in the hope that it will be useful,           */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of            */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the             */
+/* GNU General Public License for more details.                              */
+/*                                                                           */
+/* You should have received a copy of the GNU General Public License         */
+/* along with this program.  If not, see <http://www.gnu.org/licenses/>.     */
+/*****************************************************************************/
+
+/*
+ * Imports a synthetic library into an empty database twice, once track by
+ * track as the scanner used to, and once with the bulk insert, and fails
+ * if either import loses a track, or if the bulk insert is not the fastest.
+ *
+ * Usage: bench-bulk-insert [n_tracks]
+ *
+ * Built as test-bulk-insert with BENCH_CHECK_ONLY, it imports a few
+ * batches and only checks that every track is saved, since timings are
+ * not reliable on a loaded build machine.
+ */
+
+#if HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdlib.h>
+#include <glib.h>
+#include <glib/gstdio.h>
+
+#include "src/rena-database.h"
+#include "src/rena-database-provider.h"
+#include "src/rena-musicobject.h"
+
+/* The scanner saves its results in batches of this size. */
+#define BENCH_TRACKS_PER_BATCH 512
+
+#ifdef BENCH_CHECK_ONLY
+/* A few full batches and a partial one. */
+#define BENCH_DEFAULT_TRACKS (3 * BENCH_TRACKS_PER_BATCH + 100)
+#else
+#define BENCH_DEFAULT_TRACKS 100000
+#endif
+
+static GPtrArray *
+bench_build_library (const gchar *provider, guint n_tracks)
+{
+	RenaMusicobject *mobj;
+	GPtrArray *mobjs;
+	gchar *text;
+	guint i;
+
+	mobjs = g_ptr_array_new_with_free_func (g_object_unref);
+
+	/* Roughly the shape of a real library: 10 tracks an album,
+	 * 4 albums an artist, and a handful of genres. */
+
+	for (i = 0; i < n_tracks; i++) {
+		mobj = rena_musicobject_new ();
+
+		text = g_strdup_printf ("%s/Artist %u/Album %u/%02u - Track.ogg",
+		                        provider, i / 40, i / 10, i % 10 + 1);
+		rena_musicobject_set_file (mobj, text);
+		g_free (text);
+
+		rena_musicobject_set_provider (mobj, provider);
+		rena_musicobject_set_mime_type (mobj, "audio/x-vorbis+ogg");
+
+		text = g_strdup_printf ("Track %u", i);
+		rena_musicobject_set_title (mobj, text);
+		g_free (text);
+
+		text = g_strdup_printf ("%s Artist %u", provider, i / 40);
+		rena_musicobject_set_artist (mobj, text);
+		g_free (text);
+
+		text = g_strdup_printf ("%s Album %u", provider, i / 10);
+		rena_musicobject_set_album (mobj, text);
+		g_free (text);
+
+		text = g_strdup_printf ("%s Genre %u", provider, i % 23);
+		rena_musicobject_set_genre (mobj, text);
+		g_free (text);
+
+		rena_musicobject_set_year (mobj, 1950 + (i / 10) % 70);
+		rena_musicobject_set_track_no (mobj, i % 10 + 1);
+		rena_musicobject_set_length (mobj, 180 + i % 120);
+		rena_musicobject_set_bitrate (mobj, 192);
+		rena_musicobject_set_channels (mobj, 2);
+		rena_musicobject_set_samplerate (mobj, 44100);
+
+		g_ptr_array_add (mobjs, mobj);
+	}
+
+	return mobjs;
+}
+
+static gdouble
+bench_per_track (RenaDatabase *database, GPtrArray *mobjs)
+{
+	gint64 begin_time;
+	guint i;
+
+	begin_time = g_get_monotonic_time ();
+
+	rena_database_begin_transaction (database);
+	for (i = 0; i < mobjs->len; i++)
+		rena_database_add_new_musicobject (database, g_ptr_array_index (mobjs, i));
+	rena_database_commit_transaction (database);
+
+	return (g_get_monotonic_time () - begin_time) / (gdouble) G_USEC_PER_SEC;
+}
+
+static gdouble
+bench_bulk (RenaDatabase *database, GPtrArray *mobjs)
+{
+	GPtrArray *batch;
+	gint64 begin_time;
+	guint i;
+
+	batch = g_ptr_array_sized_new (BENCH_TRACKS_PER_BATCH);
+
+	begin_time = g_get_monotonic_time ();
+
+	rena_database_begin_transaction (database);
+	for (i = 0; i < mobjs->len; i++) {
+		g_ptr_array_add (batch, g_ptr_array_index (mobjs, i));
+		if (batch->len == BENCH_TRACKS_PER_BATCH || i == mobjs->len - 1) {
+			rena_database_add_new_musicobjects (database, batch);
+			g_ptr_array_set_size (batch, 0);
+		}
+	}
+	rena_database_commit_transaction (database);
+
+	g_ptr_array_free (batch, TRUE);
+
+	return (g_get_monotonic_time () - begin_time) / (gdouble) G_USEC_PER_SEC;
+}
+
+static gint
+bench_count_tracks (RenaDatabase *database, const gchar *provider)
+{
+	RenaPreparedStatement *statement;
+	gint count = 0;
+
+	const gchar *sql = "SELECT COUNT(*) FROM TRACK WHERE provider = ?";
+	statement = rena_database_create_statement (database, sql);
+	rena_prepared_statement_bind_int (statement, 1,
+		rena_database_find_provider (database, provider));
+	if (rena_prepared_statement_step (statement))
+		count = rena_prepared_statement_get_int (statement, 0);
+	rena_prepared_statement_free (statement);
+
+	return count;
+}
+
+static void
+bench_remove_library (const gchar *rena_dir)
+{
+	const gchar *files[] = { "rena.db", "rena.db-wal", "rena.db-shm" };
+	gchar *file;
+	guint i;
+
+	for (i = 0; i < G_N_ELEMENTS (files); i++) {
+		file = g_build_filename (rena_dir, files[i], NULL);
+		g_remove (file);
+		g_free (file);
+	}
+}
+
+gint
+main (gint argc, gchar *argv[])
+{
+	RenaDatabaseProvider *provider;
+	RenaDatabase *database;
+	GPtrArray *per_track_mobjs, *bulk_mobjs;
+	gchar *config_dir, *rena_dir;
+	gdouble per_track_time, bulk_time;
+	guint n_tracks = BENCH_DEFAULT_TRACKS;
+	gint ret = EXIT_SUCCESS;
+
+	if (argc > 1)
+		n_tracks = (guint) g_ascii_strtoull (argv[1], NULL, 10);
+	if (n_tracks == 0)
+		n_tracks = BENCH_DEFAULT_TRACKS;
+
+	/* Work on an empty library of our own */
+
+	config_dir = g_dir_make_tmp ("rena-bench-XXXXXX", NULL);
+	g_return_val_if_fail (config_dir != NULL, EXIT_FAILURE);
+	g_setenv ("XDG_CONFIG_HOME", config_dir, TRUE);
+
+	rena_dir = g_build_filename (config_dir, "rena", NULL);
+	g_mkdir_with_parents (rena_dir, 0700);
+
+	database = rena_database_get ();
+	if (!rena_database_start_successfully (database)) {
+		g_printerr ("Unable to create the database in %s\n", rena_dir);
+		return EXIT_FAILURE;
+	}
+
+	provider = rena_database_provider_get ();
+	rena_provider_add_new (provider, "/per-track", "local", "per-track", "drive-harddisk");
+	rena_provider_add_new (provider, "/bulk", "local", "bulk", "drive-harddisk");
+
+	per_track_mobjs = bench_build_library ("/per-track", n_tracks);
+	bulk_mobjs = bench_build_library ("/bulk", n_tracks);
+
+	per_track_time = bench_per_track (database, per_track_mobjs);
+	bulk_time = bench_bulk (database, bulk_mobjs);
+
+	g_print ("%u tracks: per track %.3f s (%.0f tracks/s), bulk %.3f s (%.0f tracks/s), %.2fx\n",
+	         n_tracks,
+	         per_track_time, n_tracks / per_track_time,
+	         bulk_time, n_tracks / bulk_time,
+	         per_track_time / bulk_time);
+
+	if (bench_count_tracks (database, "/per-track") != (gint) n_tracks ||
+	    bench_count_tracks (database, "/bulk") != (gint) n_tracks) {
+		g_printerr ("Both imports must save every track\n");
+		ret = EXIT_FAILURE;
+	}
+#ifndef BENCH_CHECK_ONLY
+	else if (bulk_time >= per_track_time) {
+		g_printerr ("The bulk insert is not faster than the per track one\n");
+		ret = EXIT_FAILURE;
+	}
+#endif
+
+	g_ptr_array_free (per_track_mobjs, TRUE);
+	g_ptr_array_free (bulk_mobjs, TRUE);
+	g_object_unref (provider);
+	g_object_unref (database);
+
+	bench_remove_library (rena_dir);
+	g_rmdir (rena_dir);
+	g_rmdir (config_dir);
+
+	g_free (rena_dir);
+	g_free (config_dir);
+
+	return ret;
+}
@@ -0,0 +1,381 @@
+/*****************************************************************************/
+/* Copyright (C) 2024 Santelmo Technologies <santelmotechnologies@gmail.com> */
+/*                                                                           */
+/* This program is free software: you can redistribute it and/or modify      */
+/* it under the terms of the GNU General Public License as published by      */
+/* the Free Software Foundation, either version 3 of the License, or         */
+/* (at your option) any later version.                                       */
+/*                                                                           */
+/* This program is distributed in the hope that it will be useful,           */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of            */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the             */
+/* GNU General Public License for more details.                              */
+/*                                                                           */
+/* You should have received a copy of the GNU General Public License         */
+/* along with this program.  If not, see <http://www.gnu.org/licenses/>.     */
+/*****************************************************************************/
+
+/*
+ * Scans two synthetic libraries of tagged files, one several times larger
+ * than the other and both larger than what the scanner may hold at once,
+ * each in a process of its own. Fails if any track is not saved, or if the
+ * peak memory of the large scan grows with the size of the library.
+ *
+ * Usage: test-scanner-pending
+ *        test-scanner-pending --scan n_files
+ *
+ * Skipped without a display, since the scanner reports to the task bar.
+ */
+
+#if HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <gtk/gtk.h>
+
+#include "src/rena-database.h"
+#include "src/rena-database-provider.h"
+#include "src/rena-preferences.h"
+#include "src/rena-scanner.h"
+
+#define TEST_PENDING_LIMIT (RENA_SCANNER_TAG_QUEUE_SIZE + RENA_SCANNER_SAVE_BATCH_SIZE)
+
+#define TEST_SMALL_FILES (2 * TEST_PENDING_LIMIT)
+#define TEST_LARGE_FILES (16 * TEST_PENDING_LIMIT)
+
+/* What a track held in memory costs at least, file name and tags
+ * included. The large scan must grow far less than keeping them all. */
+#define TEST_BYTES_PER_TRACK 1024
+
+/* Files on each folder of the library. */
+#define TEST_FILES_PER_FOLDER 50
+
+/* Automake's exit status for a skipped test. */
+#define TEST_EXIT_SKIP 77
+
+#define TEST_TIMEOUT_SECONDS 300
+
+/* Minimal PCM wave files, tagged with a RIFF INFO list. */
+
+static void
+test_put_le16 (guint8 *data, guint16 value)
+{
+	value = GUINT16_TO_LE (value);
+	memcpy (data, &value, sizeof(value));
+}
+
+static void
+test_put_le32 (guint8 *data, guint32 value)
+{
+	value = GUINT32_TO_LE (value);
+	memcpy (data, &value, sizeof(value));
+}
+
+static void
+test_append_chunk (GByteArray *wav, const gchar *id, gconstpointer data, guint32 len)
+{
+	guint8 size[4];
+
+	test_put_le32 (size, len);
+	g_byte_array_append (wav, (const guint8 *) id, 4);
+	g_byte_array_append (wav, size, 4);
+	g_byte_array_append (wav, data, len);
+	if (len % 2)
+		g_byte_array_append (wav, (const guint8 *) "", 1);
+}
+
+static void
+test_append_info (GByteArray *info, const gchar *id, const gchar *text)
+{
+	test_append_chunk (info, id, text, strlen (text) + 1);
+}
+
+static GByteArray *
+test_build_wav (guint i)
+{
+	GByteArray *wav, *info;
+	guint8 fmt[16], samples[64];
+	gchar *text;
+
+	/* Roughly the shape of a real library: 10 tracks an album,
+	 * 4 albums an artist. */
+
+	info = g_byte_array_new ();
+	g_byte_array_append (info, (const guint8 *) "INFO", 4);
+
+	text = g_strdup_printf ("Track %u", i);
+	test_append_info (info, "INAM", text);
+	g_free (text);
+
+	text = g_strdup_printf ("Artist %u", i / 40);
+	test_append_info (info, "IART", text);
+	g_free (text);
+
+	text = g_strdup_printf ("Album %u", i / 10);
+	test_append_info (info, "IPRD", text);
+	g_free (text);
+
+	/* 8 bits mono at 8 kHz */
+
+	test_put_le16 (fmt + 0, 1);
+	test_put_le16 (fmt + 2, 1);
+	test_put_le32 (fmt + 4, 8000);
+	test_put_le32 (fmt + 8, 8000);
+	test_put_le16 (fmt + 12, 1);
+	test_put_le16 (fmt + 14, 8);
+
+	memset (samples, 0x80, sizeof(samples));
+
+	wav = g_byte_array_new ();
+	g_byte_array_append (wav, (const guint8 *) "RIFF\0\0\0\0WAVE", 12);
+	test_append_chunk (wav, "fmt ", fmt, sizeof(fmt));
+	test_append_chunk (wav, "LIST", info->data, info->len);
+	test_append_chunk (wav, "data", samples, sizeof(samples));
+	test_put_le32 (wav->data + 4, wav->len - 8);
+
+	g_byte_array_free (info, TRUE);
+
+	return wav;
+}
+
+static void
+test_build_library (const gchar *library_dir, guint n_files)
+{
+	GByteArray *wav;
+	gchar *folder, *file;
+	guint i;
+
+	for (i = 0; i < n_files; i++) {
+		folder = g_strdup_printf ("%s/Artist %u/Album %u",
+		                          library_dir,
+		                          i / (4 * TEST_FILES_PER_FOLDER),
+		                          i / TEST_FILES_PER_FOLDER);
+		if (i % TEST_FILES_PER_FOLDER == 0)
+			g_mkdir_with_parents (folder, 0700);
+
+		file = g_strdup_printf ("%s/%02u - Track.wav", folder, i % TEST_FILES_PER_FOLDER + 1);
+		wav = test_build_wav (i);
+		g_file_set_contents (file, (const gchar *) wav->data, wav->len, NULL);
+		g_byte_array_free (wav, TRUE);
+
+		g_free (file);
+		g_free (folder);
+	}
+}
+
+static void
+test_remove_tree (const gchar *path)
+{
+	const gchar *name;
+	gchar *child;
+	GDir *dir;
+
+	dir = g_dir_open (path, 0, NULL);
+	if (dir) {
+		while ((name = g_dir_read_name (dir)) != NULL) {
+			child = g_build_filename (path, name, NULL);
+			test_remove_tree (child);
+			g_free (child);
+		}
+		g_dir_close (dir);
+		g_rmdir (path);
+	}
+	else {
+		g_remove (path);
+	}
+}
+
+static guint
+test_count_tracks (RenaDatabase *database)
+{
+	RenaPreparedStatement *statement;
+	guint count = 0;
+
+	statement = rena_database_create_statement (database, "SELECT COUNT(*) FROM TRACK");
+	if (rena_prepared_statement_step (statement))
+		count = rena_prepared_statement_get_int (statement, 0);
+	rena_prepared_statement_free (statement);
+
+	return count;
+}
+
+static void
+test_lock_library_changed (RenaPreferences *preferences, GParamSpec *pspec, GMainLoop *loop)
+{
+	if (!rena_preferences_get_lock_library (preferences))
+		g_main_loop_quit (loop);
+}
+
+static gboolean
+test_timeout (GMainLoop *loop)
+{
+	g_printerr ("The scan did not finish in %u seconds\n", TEST_TIMEOUT_SECONDS);
+	exit (EXIT_FAILURE);
+
+	return FALSE;
+}
+
+/* Scans a new library of n_files, and prints the tracks saved, the most
+ * pending at once and the peak memory of the process in KiB. */
+
+static gint
+test_scan (guint n_files)
+{
+	RenaDatabaseProvider *provider;
+	RenaPreferences *preferences;
+	RenaDatabase *database;
+	RenaScanner *scanner;
+	GMainLoop *loop;
+	struct rusage usage;
+	gchar *config_dir, *rena_dir, *library_dir;
+	guint n_tracks, peak_pending;
+
+	/* Work on an empty library of our own */
+
+	config_dir = g_dir_make_tmp ("rena-test-XXXXXX", NULL);
+	g_return_val_if_fail (config_dir != NULL, EXIT_FAILURE);
+	g_setenv ("XDG_CONFIG_HOME", config_dir, TRUE);
+
+	rena_dir = g_build_filename (config_dir, "rena", NULL);
+	g_mkdir_with_parents (rena_dir, 0700);
+
+	library_dir = g_build_filename (config_dir, "library", NULL);
+	test_build_library (library_dir, n_files);
+
+	database = rena_database_get ();
+	if (!rena_database_start_successfully (database)) {
+		g_printerr ("Unable to create the database in %s\n", rena_dir);
+		return EXIT_FAILURE;
+	}
+
+	provider = rena_database_provider_get ();
+	rena_provider_add_new (provider, library_dir, "local", "library", "drive-harddisk");
+
+	/* Scan it, until the library is unlocked at the end */
+
+	loop = g_main_loop_new (NULL, FALSE);
+
+	preferences = rena_preferences_get ();
+	g_signal_connect (preferences, "notify::lock-library",
+	                  G_CALLBACK (test_lock_library_changed), loop);
+
+	scanner = rena_scanner_new ();
+	rena_scanner_scan_library (scanner);
+
+	g_timeout_add_seconds (TEST_TIMEOUT_SECONDS, (GSourceFunc) test_timeout, loop);
+	g_main_loop_run (loop);
+
+	n_tracks = test_count_tracks (database);
+	peak_pending = rena_scanner_get_peak_pending (scanner);
+
+	getrusage (RUSAGE_SELF, &usage);
+
+	g_print ("%u %u %ld\n", n_tracks, peak_pending, usage.ru_maxrss);
+
+	/* Tear down the worker and its connection before removing them */
+
+	rena_scanner_free (scanner);
+
+	g_signal_handlers_disconnect_by_func (preferences, test_lock_library_changed, loop);
+	g_object_unref (preferences);
+	g_main_loop_unref (loop);
+	g_object_unref (provider);
+	g_object_unref (database);
+
+	test_remove_tree (config_dir);
+
+	g_free (library_dir);
+	g_free (rena_dir);
+	g_free (config_dir);
+
+	return EXIT_SUCCESS;
+}
+
+/* Runs test_scan() in a child, so its peak memory is only its own. */
+
+static gint
+test_run_scan (const gchar *self, guint n_files, guint *n_tracks, guint *peak_pending, glong *max_rss)
+{
+	gchar *argv[4], *output = NULL;
+	gint status, ret = EXIT_FAILURE;
+	GError *error = NULL;
+
+	argv[0] = (gchar *) self;
+	argv[1] = (gchar *) "--scan";
+	argv[2] = g_strdup_printf ("%u", n_files);
+	argv[3] = NULL;
+
+	if (!g_spawn_sync (NULL, argv, NULL, 0, NULL, NULL, &output, NULL, &status, &error)) {
+		g_printerr ("Unable to run the scan: %s\n", error->message);
+		g_error_free (error);
+	}
+	else if (!WIFEXITED (status)) {
+		g_printerr ("The scan of %u files crashed\n", n_files);
+	}
+	else if (WEXITSTATUS (status) != EXIT_SUCCESS) {
+		ret = WEXITSTATUS (status);
+	}
+	else if (output && sscanf (output, "%u %u %ld", n_tracks, peak_pending, max_rss) == 3) {
+		ret = EXIT_SUCCESS;
+	}
+	else {
+		g_printerr ("The scan of %u files did not finish\n", n_files);
+	}
+
+	g_free (output);
+	g_free (argv[2]);
+
+	return ret;
+}
+
+gint
+main (gint argc, gchar *argv[])
+{
+	guint small_tracks, large_tracks, small_peak, large_peak;
+	glong small_rss, large_rss, budget;
+	gint ret;
+
+	if (!gtk_init_check (&argc, &argv)) {
+		g_print ("No display, skipped\n");
+		return TEST_EXIT_SKIP;
+	}
+
+	if (argc > 2 && g_strcmp0 (argv[1], "--scan") == 0)
+		return test_scan ((guint) g_ascii_strtoull (argv[2], NULL, 10));
+
+	ret = test_run_scan (argv[0], TEST_SMALL_FILES, &small_tracks, &small_peak, &small_rss);
+	if (ret != EXIT_SUCCESS)
+		return ret;
+
+	ret = test_run_scan (argv[0], TEST_LARGE_FILES, &large_tracks, &large_peak, &large_rss);
+	if (ret != EXIT_SUCCESS)
+		return ret;
+
+	budget = (glong) (TEST_LARGE_FILES - TEST_SMALL_FILES) * TEST_BYTES_PER_TRACK / 1024 / 2;
+
+	g_print ("%u files: %u tracks, at most %u pending, peak %ld KiB\n",
+	         TEST_SMALL_FILES, small_tracks, small_peak, small_rss);
+	g_print ("%u files: %u tracks, at most %u pending, peak %ld KiB, %ld KiB more, limit %ld KiB\n",
+	         TEST_LARGE_FILES, large_tracks, large_peak, large_rss, large_rss - small_rss, budget);
+
+	if (small_tracks != TEST_SMALL_FILES || large_tracks != TEST_LARGE_FILES) {
+		g_printerr ("The scans must save every track\n");
+		return EXIT_FAILURE;
+	}
+	if (small_peak > TEST_PENDING_LIMIT || large_peak > TEST_PENDING_LIMIT) {
+		g_printerr ("The scans kept more tracks pending than their queues allow\n");
+		return EXIT_FAILURE;
+	}
+	if (large_rss - small_rss > budget) {
+		g_printerr ("The peak memory of the scan grows with the library\n");
+		return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}